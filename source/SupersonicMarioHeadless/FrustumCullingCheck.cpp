@@ -0,0 +1,421 @@
+// FrustumCullingCheck.cpp
+// Checks and times the plugin's frustum culling without Rocket League or D3D.
+//
+// Builds view-projections the way the renderer does, with a left handed
+// look at and perspective like DirectXMath's, and fails if a sphere any
+// point of which lands inside clip space is culled, if a few hand placed
+// spheres around the camera come out wrong, if CullSpheres and
+// CullSpheresScalar disagree on a single sphere, or if a bounding sphere
+// misses one of its points before or after a transform. Then times both
+// culls on many spheres.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Graphics/FrustumCulling.h"
+
+#define CHECK_NEAR_Z 50.0f // NEAR_Z in Graphics/Render.cpp
+#define CHECK_FAR_Z 20000.0f // FAR_Z in Graphics/Render.cpp
+#define CHECK_SAMPLES 64 // Points tried inside each random sphere
+
+struct CheckOptions
+{
+    int spheres = 4096;
+    int iterations = 2000;
+    unsigned seed = 1;
+};
+
+struct Matrix
+{
+    float m[16];
+};
+
+void printUsage()
+{
+    printf("usage: FrustumCullingCheck [--spheres N] [--iterations N] [--seed N]\n");
+}
+
+bool parseOptions(int argc, char** argv, CheckOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--spheres")
+        {
+            options.spheres = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--iterations")
+        {
+            options.iterations = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+Matrix multiply(const Matrix& a, const Matrix& b)
+{
+    Matrix result;
+    for (int row = 0; row < 4; row++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; k++)
+            {
+                sum += a.m[row * 4 + k] * b.m[k * 4 + column];
+            }
+            result.m[row * 4 + column] = sum;
+        }
+    }
+    return result;
+}
+
+void normalize(float v[3])
+{
+    const float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    for (int k = 0; k < 3; k++)
+    {
+        v[k] /= length;
+    }
+}
+
+void cross(const float a[3], const float b[3], float result[3])
+{
+    result[0] = a[1] * b[2] - a[2] * b[1];
+    result[1] = a[2] * b[0] - a[0] * b[2];
+    result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// XMMatrixLookAtLH(eye, eye + forward, up) * XMMatrixPerspectiveFovLH, as Renderer builds it
+Matrix viewProjection(const float eye[3], const float forward[3], float verticalFov, float aspectRatio)
+{
+    const float up[3] = { 0.0f, 0.0f, 1.0f };
+    float zAxis[3] = { forward[0], forward[1], forward[2] };
+    normalize(zAxis);
+    float xAxis[3];
+    cross(up, zAxis, xAxis);
+    normalize(xAxis);
+    float yAxis[3];
+    cross(zAxis, xAxis, yAxis);
+
+    Matrix view = { {
+        xAxis[0], yAxis[0], zAxis[0], 0.0f,
+        xAxis[1], yAxis[1], zAxis[1], 0.0f,
+        xAxis[2], yAxis[2], zAxis[2], 0.0f,
+        -(xAxis[0] * eye[0] + xAxis[1] * eye[1] + xAxis[2] * eye[2]),
+        -(yAxis[0] * eye[0] + yAxis[1] * eye[1] + yAxis[2] * eye[2]),
+        -(zAxis[0] * eye[0] + zAxis[1] * eye[1] + zAxis[2] * eye[2]), 1.0f,
+    } };
+
+    const float height = 1.0f / std::tan(verticalFov / 2.0f);
+    const float width = height / aspectRatio;
+    const float range = CHECK_FAR_Z / (CHECK_FAR_Z - CHECK_NEAR_Z);
+    Matrix projection = { {
+        width, 0.0f, 0.0f, 0.0f,
+        0.0f, height, 0.0f, 0.0f,
+        0.0f, 0.0f, range, 1.0f,
+        0.0f, 0.0f, -range * CHECK_NEAR_Z, 0.0f,
+    } };
+    return multiply(view, projection);
+}
+
+bool insideClipSpace(const Matrix& viewProjection, const float point[3])
+{
+    float clip[4];
+    for (int k = 0; k < 4; k++)
+    {
+        clip[k] = point[0] * viewProjection.m[k] + point[1] * viewProjection.m[4 + k] +
+            point[2] * viewProjection.m[8 + k] + viewProjection.m[12 + k];
+    }
+    return clip[3] > 0.0f && std::abs(clip[0]) <= clip[3] && std::abs(clip[1]) <= clip[3] && clip[2] >= 0.0f &&
+        clip[2] <= clip[3];
+}
+
+BoundingSphere sphereAt(float x, float y, float z, float radius)
+{
+    BoundingSphere sphere;
+    sphere.center[0] = x;
+    sphere.center[1] = y;
+    sphere.center[2] = z;
+    sphere.radius = radius;
+    return sphere;
+}
+
+// Returns how many of the hand placed spheres come out wrong, for a camera at the origin looking down x
+size_t checkPlacedSpheres()
+{
+    const float eye[3] = { 0.0f, 0.0f, 0.0f };
+    const float forward[3] = { 1.0f, 0.0f, 0.0f };
+    const Matrix matrix = viewProjection(eye, forward, 1.2f, 16.0f / 9.0f);
+    const Frustum frustum = FrustumFromViewProjection(matrix.m);
+
+    struct Placed
+    {
+        const char* name;
+        BoundingSphere sphere;
+        bool visible;
+    };
+    const Placed placed[] = {
+        { "ahead", sphereAt(1000.0f, 0.0f, 0.0f, 50.0f), true },
+        { "behind", sphereAt(-1000.0f, 0.0f, 0.0f, 50.0f), false },
+        { "around the camera", sphereAt(-30.0f, 0.0f, 0.0f, 100.0f), true },
+        { "past the far plane", sphereAt(CHECK_FAR_Z + 500.0f, 0.0f, 0.0f, 100.0f), false },
+        { "on the far plane", sphereAt(CHECK_FAR_Z + 50.0f, 0.0f, 0.0f, 100.0f), true },
+        { "far to the side", sphereAt(1000.0f, 5000.0f, 0.0f, 100.0f), false },
+        { "across the side", sphereAt(1000.0f, 1200.0f, 0.0f, 400.0f), true },
+        { "far above", sphereAt(1000.0f, 0.0f, 4000.0f, 100.0f), false },
+        { "without bounds", BoundingSphere(), true },
+    };
+
+    size_t problems = 0;
+    for (const Placed& test : placed)
+    {
+        if (SphereVisible(frustum, test.sphere) != test.visible)
+        {
+            printf("sphere %s came out %s\n", test.name, test.visible ? "culled" : "visible");
+            problems++;
+        }
+    }
+    return problems;
+}
+
+// Returns how many random spheres are culled although some point of them is inside clip space
+size_t checkConservative(std::mt19937& random, size_t& culled, size_t& tested)
+{
+    std::uniform_real_distribution<float> coordinate(-12000.0f, 12000.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> radius(1.0f, 1500.0f);
+    std::uniform_real_distribution<float> fov(0.5f, 2.0f);
+
+    size_t problems = 0;
+    for (int camera = 0; camera < 64; camera++)
+    {
+        const float eye[3] = { coordinate(random), coordinate(random), coordinate(random) * 0.2f };
+        const float forward[3] = { direction(random), direction(random), direction(random) * 0.5f };
+        const Matrix matrix = viewProjection(eye, forward, fov(random), 16.0f / 9.0f);
+        const Frustum frustum = FrustumFromViewProjection(matrix.m);
+
+        for (int i = 0; i < 256; i++)
+        {
+            const BoundingSphere sphere = sphereAt(coordinate(random), coordinate(random), coordinate(random) * 0.2f,
+                radius(random));
+            tested++;
+            if (SphereVisible(frustum, sphere))
+            {
+                continue;
+            }
+            culled++;
+
+            for (int sample = 0; sample < CHECK_SAMPLES; sample++)
+            {
+                float offset[3] = { direction(random), direction(random), direction(random) };
+                normalize(offset);
+                const float distance = sample == 0 ? 0.0f : sphere.radius * std::cbrt(std::abs(direction(random)));
+                const float point[3] = { sphere.center[0] + offset[0] * distance,
+                    sphere.center[1] + offset[1] * distance, sphere.center[2] + offset[2] * distance };
+                if (insideClipSpace(matrix, point))
+                {
+                    problems++;
+                    break;
+                }
+            }
+        }
+    }
+    return problems;
+}
+
+// Returns how many spheres CullSpheres and CullSpheresScalar disagree on, for every count up to a few blocks
+size_t checkSimd(const Frustum& frustum, const std::vector<BoundingSphere>& spheres)
+{
+    size_t problems = 0;
+    std::vector<uint8_t> expected(spheres.size());
+    std::vector<uint8_t> actual(spheres.size());
+    std::vector<size_t> counts;
+    for (size_t count = 0; count <= 13 && count <= spheres.size(); count++)
+    {
+        counts.push_back(count);
+    }
+    counts.push_back(spheres.size());
+
+    for (size_t count : counts)
+    {
+        // Each count gets its own array of exactly its size
+        const std::vector<BoundingSphere> sized(spheres.begin(), spheres.begin() + count);
+        const size_t expectedCount = CullSpheresScalar(frustum, sized.data(), count, expected.data());
+        const size_t actualCount = CullSpheres(frustum, sized.data(), count, actual.data());
+        problems += expectedCount != actualCount ? 1 : 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            problems += expected[i] != actual[i] ? 1 : 0;
+        }
+    }
+    return problems;
+}
+
+// Returns how many points end up outside their bounding sphere, before or after a transform
+size_t checkBounds(std::mt19937& random)
+{
+    // Laid out like a Vertex, so the stride is checked too
+    struct Point
+    {
+        float pos[3];
+        float rest[9];
+    };
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+    std::uniform_real_distribution<float> scale(0.25f, 4.0f);
+
+    size_t problems = 0;
+    for (int cloud = 0; cloud < 200; cloud++)
+    {
+        std::vector<Point> points(1 + cloud * 7);
+        const float shift[3] = { coordinate(random) * 10.0f, coordinate(random) * 10.0f, coordinate(random) };
+        for (Point& point : points)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                point.pos[k] = shift[k] + coordinate(random) * (k + 1) * 0.5f;
+            }
+        }
+        const BoundingSphere sphere = BoundingSphereOf(points[0].pos, points.size(), sizeof(Point));
+
+        // A rotation about z, then one about x, then a scale, uniform for every other cloud, then a translation
+        const float yaw = angle(random);
+        const float roll = angle(random);
+        const float uniform = scale(random);
+        const float scales[3] = { uniform, cloud % 2 == 0 ? uniform : scale(random), cloud % 2 == 0 ? uniform : scale(random) };
+        const Matrix rotateZ = { {
+            std::cos(yaw), std::sin(yaw), 0.0f, 0.0f,
+            -std::sin(yaw), std::cos(yaw), 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f,
+        } };
+        const Matrix rotateX = { {
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, std::cos(roll), std::sin(roll), 0.0f,
+            0.0f, -std::sin(roll), std::cos(roll), 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f,
+        } };
+        const Matrix scaleAndMove = { {
+            scales[0], 0.0f, 0.0f, 0.0f,
+            0.0f, scales[1], 0.0f, 0.0f,
+            0.0f, 0.0f, scales[2], 0.0f,
+            coordinate(random), coordinate(random), coordinate(random), 1.0f,
+        } };
+        const Matrix world = multiply(multiply(rotateZ, rotateX), scaleAndMove);
+        const BoundingSphere transformed = TransformBoundingSphere(sphere, world.m);
+
+        for (const Point& point : points)
+        {
+            float distanceSquared = 0.0f;
+            float transformedSquared = 0.0f;
+            for (int k = 0; k < 3; k++)
+            {
+                const float moved = point.pos[0] * world.m[k] + point.pos[1] * world.m[4 + k] +
+                    point.pos[2] * world.m[8 + k] + world.m[12 + k];
+                distanceSquared += (point.pos[k] - sphere.center[k]) * (point.pos[k] - sphere.center[k]);
+                transformedSquared += (moved - transformed.center[k]) * (moved - transformed.center[k]);
+            }
+            problems += std::sqrt(distanceSquared) > sphere.radius ? 1 : 0;
+            problems += std::sqrt(transformedSquared) > transformed.radius ? 1 : 0;
+        }
+    }
+    return problems;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    const size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+template <typename Cull>
+std::vector<double> timeCull(const Frustum& frustum, const std::vector<BoundingSphere>& spheres,
+    std::vector<uint8_t>& visible, int iterations, Cull cull)
+{
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> us;
+    us.reserve(iterations);
+    for (int i = 0; i < iterations; i++)
+    {
+        const auto start = Clock::now();
+        cull(frustum, spheres.data(), spheres.size(), visible.data());
+        us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    return us;
+}
+
+int main(int argc, char** argv)
+{
+    CheckOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::mt19937 random(options.seed);
+    const size_t placedProblems = checkPlacedSpheres();
+
+    size_t culled = 0;
+    size_t tested = 0;
+    const size_t conservativeProblems = checkConservative(random, culled, tested);
+    printf("culled %zu of %zu random spheres, %zu of them had a point inside clip space\n", culled, tested,
+        conservativeProblems);
+
+    // Around an arena, some without bounds like the map
+    std::uniform_real_distribution<float> coordinate(-6000.0f, 6000.0f);
+    std::uniform_real_distribution<float> radius(50.0f, 400.0f);
+    std::vector<BoundingSphere> spheres;
+    for (int i = 0; i < options.spheres; i++)
+    {
+        spheres.push_back(i % 61 == 0 ? BoundingSphere() :
+            sphereAt(coordinate(random), coordinate(random), coordinate(random) * 0.2f, radius(random)));
+    }
+    const float eye[3] = { -4000.0f, 0.0f, 800.0f };
+    const float forward[3] = { 1.0f, 0.3f, -0.1f };
+    const Matrix matrix = viewProjection(eye, forward, 1.6f, 16.0f / 9.0f);
+    const Frustum frustum = FrustumFromViewProjection(matrix.m);
+
+    const size_t simdProblems = checkSimd(frustum, spheres);
+    const size_t boundsProblems = checkBounds(random);
+    printf("%zu placed spheres wrong, %zu simd and scalar culls disagree, %zu points outside their bounds\n",
+        placedProblems, simdProblems, boundsProblems);
+
+    std::vector<uint8_t> visible(spheres.size());
+    const size_t visibleCount = CullSpheres(frustum, spheres.data(), spheres.size(), visible.data());
+    const std::vector<double> scalarUs = timeCull(frustum, spheres, visible, options.iterations, CullSpheresScalar);
+    const std::vector<double> simdUs = timeCull(frustum, spheres, visible, options.iterations, CullSpheres);
+    const double scalarP50 = percentile(scalarUs, 0.5);
+    const double simdP50 = percentile(simdUs, 0.5);
+    printf("%zu spheres, %zu visible, %d iterations: scalar p50 %.2f us p99 %.2f us, simd p50 %.2f us p99 %.2f us, "
+        "%.2fx\n", spheres.size(), visibleCount, options.iterations, scalarP50, percentile(scalarUs, 0.99), simdP50,
+        percentile(simdUs, 0.99), simdP50 > 0.0 ? scalarP50 / simdP50 : 0.0);
+
+    return placedProblems == 0 && conservativeProblems == 0 && simdProblems == 0 && boundsProblems == 0 ? 0 : 1;
+}
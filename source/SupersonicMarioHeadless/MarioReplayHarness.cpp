@@ -0,0 +1,1034 @@
+// MarioReplayHarness.cpp
+// Headless SM64 simulation driven by mario replays, runs without Rocket League or BakkesMod.
+//
+// Feeds the cars, cameras, controls and ball of a replay recorded in game
+// with rp_replay_record, or of a seeded synthetic one, through the plugin's
+// MarioLogic and libsm64 on the default level, one 30 Hz step at a time.
+// Writes the body states as a trace in the plugin's body state recording
+// format and prints a hash over them, which only changes when the
+// simulation does, together with how long the ticks took.
+//
+// With --latency the first mario is played by a client that predicts it
+// with the plugin's InputPredictor, while the harness simulates it as the
+// host from the inputs that made it over a link with that latency, jitter
+// and loss. The client reconciles with the host's states as they arrive.
+//
+// With --frame-rates the steps are also run from a render loop at each of
+// those frame rates, through the plugin's FixedStepScheduler, and have to
+// give the same trace as running them one after the other.
+//
+// --tick-scaling times ticking 1 to N marios per frame on worker pools of
+// different sizes, the way SM64::OnRender ticks remote marios.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Modules/FixedStepScheduler.h"
+#include "Modules/MarioLogic.h"
+#include "Modules/MarioReplay.h"
+#include "Modules/MarioInteractions.h"
+#include "Modules/MarioVertices.h"
+#include "Modules/WorkerPool.h"
+#include "Networking/BodyStateRecording.h"
+#include "Networking/InputPrediction.h"
+#include "Graphics/level.h"
+#include "xxHash/xxhash.h"
+
+#define HARNESS_STEP_MS (1000.0 / 30.0)
+#define HARNESS_TEXTURE_SIZE (4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT)
+#define HARNESS_BALL_COOLDOWN_STEPS 10 // BALL_INTERACTION_COOLDOWN_MS in steps
+#define HARNESS_SETTLE_STEPS 60 // Idle steps after the replay, for the predicted mario to come to rest
+#define HARNESS_FRAME_JITTER 0.25 // Simulated frames take up to this much longer or shorter than 1/fps
+#define SYNTHETIC_FIELD_HALF_WIDTH 3500.0f
+#define SYNTHETIC_FIELD_HALF_LENGTH 4500.0f
+
+struct HarnessOptions
+{
+    std::string romPath;
+    std::string replayPath;
+    std::string recordPath; // Synthetic only, saves the generated replay
+    std::string tracePath;
+    int syntheticMarios = 0;
+    int steps = 900;
+    unsigned seed = 1;
+    int runs = 1;
+    uint64_t expectedHash = 0;
+    // One way, prediction is off below 0
+    double latencyMs = -1.0;
+    double jitterMs = 0.0;
+    double lossPercent = 0.0;
+    std::vector<double> frameRates;
+    int tickScalingMarios = 0;
+};
+
+struct HarnessMario
+{
+    int32_t marioId = -1;
+    SM64MarioInputs inputs = {};
+    SM64MarioState state = {};
+    SM64MarioBodyState bodyState = {};
+    SM64MarioGeometryBuffers geometry = {};
+    int lastBallHitStep = -HARNESS_BALL_COOLDOWN_STEPS;
+    // Synthetic controls are held for a while, like a player would
+    CarControls heldControls;
+    int holdSteps = 0;
+};
+
+struct PredictionResult
+{
+    bool enabled = false;
+    bool caughtUp = false;
+    uint32_t inputs = 0;
+    InputPredictor::Stats predictor;
+    InputSequencer::Stats sequencer;
+    double finalError = 0.0;
+    double maxCorrection = 0.0;
+    double maxDrawnStep = 0.0;
+};
+
+struct HarnessResult
+{
+    uint64_t traceHash = 0;
+    uint64_t steps = 0;
+    uint64_t ticks = 0;
+    uint64_t ballHits = 0;
+    uint64_t attacks = 0;
+    uint32_t spawned = 0;
+    std::vector<double> tickUs;
+    PredictionResult prediction;
+    // Only when the steps were run from simulated frames
+    uint64_t frames = 0;
+    uint64_t scheduledSteps = 0;
+    FixedStepScheduler::Stats scheduler;
+    bool alphaInRange = true;
+};
+
+// Replays from a file or generated from a seed, step by step
+class StepSource
+{
+public:
+    virtual ~StepSource() = default;
+    virtual uint32_t MarioCount() const = 0;
+    virtual bool Next(MarioReplayBall& ball, std::vector<MarioReplayMario>& marios,
+        const std::vector<HarnessMario>& simulated) = 0;
+};
+
+class ReplayStepSource : public StepSource
+{
+public:
+    bool Open(const std::string& path) { return reader.Open(path); }
+    uint32_t MarioCount() const override { return reader.MarioCount(); }
+    bool Next(MarioReplayBall& ball, std::vector<MarioReplayMario>& marios, const std::vector<HarnessMario>&) override
+    {
+        return reader.ReadStep(&ball, marios.data());
+    }
+
+private:
+    MarioReplayReader reader;
+};
+
+// Cars follow their marios like moveCarToMario makes them, the camera trails behind and the ball flies around
+class SyntheticStepSource : public StepSource
+{
+public:
+    SyntheticStepSource(uint32_t marioCount, int steps, unsigned seed)
+        : marioCount(marioCount), stepsLeft(steps), rng(seed)
+    {
+        ball.location[2] = 93.0f;
+    }
+
+    uint32_t MarioCount() const override { return marioCount; }
+    bool Next(MarioReplayBall& outBall, std::vector<MarioReplayMario>& marios,
+        const std::vector<HarnessMario>& simulated) override
+    {
+        if (stepsLeft-- <= 0)
+        {
+            return false;
+        }
+
+        std::uniform_real_distribution<float> axis(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+        for (uint32_t i = 0; i < marioCount; i++)
+        {
+            const HarnessMario& mario = simulated[i];
+            MarioReplayMario& step = marios[i];
+            if (mario.marioId < 0)
+            {
+                // Spread out spawns on the field
+                step.carLocation[0] = (i % 4) * 800.0f - 1200.0f;
+                step.carLocation[1] = (i / 4) * 800.0f - 1200.0f;
+                step.carLocation[2] = 20.0f;
+            }
+            else
+            {
+                step.carLocation[0] = mario.state.position[0];
+                step.carLocation[1] = mario.state.position[2];
+                step.carLocation[2] = mario.state.position[1];
+            }
+            step.cameraLocation[0] = step.carLocation[0] - 600.0f;
+            step.cameraLocation[1] = step.carLocation[1];
+            step.cameraLocation[2] = step.carLocation[2] + 300.0f;
+
+            CarControls& held = heldControls(i);
+            if (heldSteps[i]-- <= 0)
+            {
+                heldSteps[i] = 10 + (int)(chance(rng) * 35.0f);
+                held.throttle = axis(rng);
+                held.steer = axis(rng);
+                held.pitch = axis(rng);
+                held.handbrake = chance(rng) < 0.2f;
+                held.holdingBoost = chance(rng) < 0.1f;
+            }
+            held.jump = chance(rng) < 0.15f;
+            step.controls = held;
+            step.canMove = true;
+            step.boostAmount = 0.33f;
+        }
+
+        // Rolls around inside the field and bounces off its walls
+        const float dt = (float)(HARNESS_STEP_MS / 1000.0);
+        const float halfSize[2] = { SYNTHETIC_FIELD_HALF_WIDTH, SYNTHETIC_FIELD_HALF_LENGTH };
+        for (int k = 0; k < 2; k++)
+        {
+            ball.location[k] += ball.velocity[k] * dt;
+            if (std::fabs(ball.location[k]) > halfSize[k])
+            {
+                ball.location[k] = std::clamp(ball.location[k], -halfSize[k], halfSize[k]);
+                ball.velocity[k] = -ball.velocity[k];
+            }
+            ball.velocity[k] *= 0.99f;
+        }
+        outBall = ball;
+        return true;
+    }
+
+    // The harness adds hits to the velocity it was given
+    void SetBallVelocity(const float velocity[3])
+    {
+        std::copy(velocity, velocity + 3, ball.velocity);
+    }
+
+private:
+    CarControls& heldControls(uint32_t i)
+    {
+        if (held.size() <= i)
+        {
+            held.resize(marioCount);
+            heldSteps.resize(marioCount, 0);
+        }
+        return held[i];
+    }
+
+    uint32_t marioCount;
+    int stepsLeft;
+    std::mt19937 rng;
+    MarioReplayBall ball;
+    std::vector<CarControls> held;
+    std::vector<int> heldSteps;
+};
+
+// Ticks a mario with its inputs, or puts it into its body state when it has none, like the plugin shows remote marios
+void tickMario(HarnessMario& mario)
+{
+    sm64_mario_tick(mario.marioId, &mario.inputs, mario.inputs.isInput ? &mario.state : &mario.bodyState.marioState,
+        &mario.geometry, &mario.bodyState);
+}
+
+void createGeometry(HarnessMario& mario)
+{
+    mario.geometry.position = (float*)malloc(sizeof(float) * 9 * SM64_GEO_MAX_TRIANGLES);
+    mario.geometry.color = (float*)malloc(sizeof(float) * 9 * SM64_GEO_MAX_TRIANGLES);
+    mario.geometry.normal = (float*)malloc(sizeof(float) * 9 * SM64_GEO_MAX_TRIANGLES);
+    mario.geometry.uv = (float*)malloc(sizeof(float) * 6 * SM64_GEO_MAX_TRIANGLES);
+    mario.inputs.bljInput.bljState = SM64_BLJ_STATE_DISABLED;
+    mario.inputs.bljInput.bljVel = 0;
+}
+
+void deleteMario(HarnessMario& mario)
+{
+    if (mario.marioId >= 0)
+    {
+        sm64_mario_delete(mario.marioId);
+    }
+    free(mario.geometry.position);
+    free(mario.geometry.color);
+    free(mario.geometry.normal);
+    free(mario.geometry.uv);
+}
+
+// Creates the mario over its car like tickMarioInstance does, and again if libsm64 lost it. Returns whether it did.
+bool spawnIfNeeded(HarnessMario& mario, const MarioReplayMario& step)
+{
+    const bool lost = mario.marioId >= 0 && mario.bodyState.marioState.position[0] == 0.0f &&
+        mario.bodyState.marioState.position[1] == 0.0f && mario.bodyState.marioState.position[2] == 0.0f;
+    if (mario.marioId >= 0 && !lost)
+    {
+        return false;
+    }
+    if (lost)
+    {
+        sm64_mario_delete(mario.marioId);
+    }
+
+    // Unreal swaps coords
+    mario.marioId = sm64_mario_create((int16_t)step.carLocation[0], (int16_t)step.carLocation[2],
+        (int16_t)step.carLocation[1]);
+    return mario.marioId >= 0;
+}
+
+// The client side of the first mario when the host simulates it, over a link with latency, jitter and loss.
+// Mirrors what SM64 does for the local mario and for host simulated ones.
+class PredictedClient
+{
+public:
+    explicit PredictedClient(const HarnessOptions& options)
+        : options(options),
+        predictor(sizeof(struct SM64MarioInputs), sizeof(struct SM64MarioBodyState),
+            offsetof(struct SM64MarioBodyState, marioState.position)),
+        sequencer(sizeof(struct SM64MarioInputs)),
+        rng(options.seed),
+        jitter(0.0, options.jitterMs),
+        loss(0.0, 100.0)
+    {
+        createGeometry(mario);
+        sequencer.Start(0);
+    }
+
+    ~PredictedClient()
+    {
+        deleteMario(mario);
+    }
+
+    // Reconciles with the host's states that arrived, then predicts a step with the player's controls and sends the
+    // inputs the host hasn't acked. Attacks come from where the client sees the other marios, except is its own.
+    void Step(const MarioReplayMario& step, const MarioInteractionBatch& interactions, int except, double nowMs)
+    {
+        std::stable_sort(toClient.begin(), toClient.end(), [](const StateMessage& a, const StateMessage& b) {
+            return a.arrivalMs < b.arrivalMs;
+        });
+        size_t arrived = 0;
+        for (; arrived < toClient.size() && toClient[arrived].arrivalMs <= nowMs; arrived++)
+        {
+            reconcile(toClient[arrived], nowMs);
+        }
+        toClient.erase(toClient.begin(), toClient.begin() + arrived);
+
+        spawnIfNeeded(mario, step);
+        if (mario.marioId < 0)
+        {
+            return;
+        }
+
+        MarioInputsFromCar(step.controls, step.canMove, step.boostAmount, mario.state.position, step.cameraLocation,
+            &mario.inputs);
+        ClearMarioAttack(&mario.inputs);
+        interactions.ApplyAttack(mario.state.position, except, &mario.inputs);
+        mario.inputs.isInput = true;
+        mario.inputs.giveWingcap = true;
+        tickMario(mario);
+        predictor.Record(&mario.inputs, &mario.bodyState);
+
+        // The newest unacked inputs go out every step, so a lost message is covered by the next ones
+        InputMessage message;
+        message.inputs.resize(PREDICTION_MAX_SENT_INPUTS);
+        message.inputs.resize(predictor.UnackedInputs(message.inputs.size(), message.inputs.data(),
+            &message.firstSequence));
+        if (loss(rng) >= options.lossPercent)
+        {
+            message.arrivalMs = nowMs + options.latencyMs + jitter(rng);
+            toHost.push_back(std::move(message));
+        }
+
+        // What is drawn only moves by the simulation's own steps plus a fading share of each correction
+        float offset[3];
+        predictor.SmoothingOffset(nowMs, offset);
+        const float drawn[3] = { mario.state.position[0] + offset[0], mario.state.position[1] + offset[1],
+            mario.state.position[2] + offset[2] };
+        if (predictor.LastSequence() > 1)
+        {
+            maxDrawnStep = std::max(maxDrawnStep, (double)std::hypot(drawn[0] - lastDrawn[0], drawn[1] - lastDrawn[1],
+                drawn[2] - lastDrawn[2]));
+        }
+        std::copy(drawn, drawn + 3, lastDrawn);
+    }
+
+    // Picks the host's next input of this mario and decides its knockback from where the host has everyone, like
+    // SM64::prepareHostSimulatedMario. It holds still while the next input is late. Returns whether it was attacked.
+    bool PrepareHost(HarnessMario& host, const MarioInteractionBatch& interactions, int index, double nowMs)
+    {
+        std::stable_sort(toHost.begin(), toHost.end(), [](const InputMessage& a, const InputMessage& b) {
+            return a.arrivalMs < b.arrivalMs;
+        });
+        size_t arrived = 0;
+        for (; arrived < toHost.size() && toHost[arrived].arrivalMs <= nowMs; arrived++)
+        {
+            sequencer.Push(toHost[arrived].firstSequence, toHost[arrived].inputs.data(), toHost[arrived].inputs.size());
+        }
+        toHost.erase(toHost.begin(), toHost.begin() + arrived);
+
+        hostHasInput = sequencer.Next(&host.inputs);
+        if (!hostHasInput && sequencer.Newest() - sequencer.Processed() > PREDICTION_MAX_SENT_INPUTS)
+        {
+            // The client no longer repeats the input we are waiting for, skipping it costs the client a correction
+            sequencer.Start(sequencer.Processed() + 1);
+            hostHasInput = sequencer.Next(&host.inputs);
+        }
+
+        if (!hostHasInput && sequencer.Processed() == 0)
+        {
+            // Nothing arrived yet, the new mario stands where it was created
+            const float cameraLocation[3] = {};
+            MarioInputsFromCar(CarControls(), false, 0.0f, host.state.position, cameraLocation, &host.inputs);
+            ClearMarioAttack(&host.inputs);
+            host.inputs.isInput = true;
+            host.inputs.giveWingcap = true;
+            return false;
+        }
+
+        bool attacked = false;
+        if (hostHasInput)
+        {
+            ClearMarioAttack(&host.inputs);
+            attacked = interactions.ApplyAttack(host.bodyState.marioState.position, index, &host.inputs);
+        }
+        host.inputs.isInput = hostHasInput;
+        host.inputs.giveWingcap = true;
+        return attacked;
+    }
+
+    // Sends the host's state after the input it just applied
+    void HostTicked(HarnessMario& host, double nowMs)
+    {
+        host.state = host.bodyState.marioState;
+        if (hostHasInput && loss(rng) >= options.lossPercent)
+        {
+            toClient.push_back({ nowMs + options.latencyMs + jitter(rng), sequencer.Processed(), host.bodyState });
+        }
+    }
+
+    // Inputs predicted within this many steps needn't be acked yet
+    int RoundTripSteps() const
+    {
+        return (int)std::ceil(2.0 * (options.latencyMs + options.jitterMs) / HARNESS_STEP_MS) +
+            PREDICTION_MAX_SENT_INPUTS;
+    }
+
+    void Finish(const HarnessMario& host, PredictionResult& result) const
+    {
+        result.enabled = true;
+        result.inputs = predictor.LastSequence();
+        result.predictor = predictor.GetStats();
+        result.sequencer = sequencer.GetStats();
+        result.caughtUp = predictor.AckedSequence() + RoundTripSteps() >= predictor.LastSequence();
+        result.finalError = std::hypot(mario.state.position[0] - host.state.position[0],
+            mario.state.position[1] - host.state.position[1], mario.state.position[2] - host.state.position[2]);
+        result.maxCorrection = maxCorrection;
+        result.maxDrawnStep = maxDrawnStep;
+    }
+
+private:
+    struct InputMessage
+    {
+        double arrivalMs = 0.0;
+        uint32_t firstSequence = 0;
+        std::vector<SM64MarioInputs> inputs;
+    };
+
+    struct StateMessage
+    {
+        double arrivalMs;
+        uint32_t ack;
+        SM64MarioBodyState bodyState;
+    };
+
+    // Like SM64::reconcileLocalMario
+    void reconcile(const StateMessage& message, double nowMs)
+    {
+        if (mario.marioId < 0)
+        {
+            return;
+        }
+
+        const float before[3] = { mario.state.position[0], mario.state.position[1], mario.state.position[2] };
+        const bool corrected = predictor.Reconcile(message.ack, &message.bodyState, nowMs,
+            [this](const void* state) {
+                memcpy(&mario.bodyState, state, sizeof(mario.bodyState));
+                mario.bodyState.marioState.soundMask = 0;
+                mario.inputs.isInput = false;
+                tickMario(mario);
+                mario.state = mario.bodyState.marioState;
+            },
+            [this](const void* input, void* stateOut) {
+                memcpy(&mario.inputs, input, sizeof(mario.inputs));
+                tickMario(mario);
+                memcpy(stateOut, &mario.bodyState, sizeof(mario.bodyState));
+            });
+        if (corrected)
+        {
+            maxCorrection = std::max(maxCorrection, (double)std::hypot(mario.state.position[0] - before[0],
+                mario.state.position[1] - before[1], mario.state.position[2] - before[2]));
+        }
+    }
+
+    const HarnessOptions& options;
+    HarnessMario mario;
+    InputPredictor predictor;
+    InputSequencer sequencer;
+    std::vector<InputMessage> toHost;
+    std::vector<StateMessage> toClient;
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> jitter;
+    std::uniform_real_distribution<double> loss;
+    bool hostHasInput = false;
+    float lastDrawn[3] = {};
+    double maxCorrection = 0.0;
+    double maxDrawnStep = 0.0;
+};
+
+void printUsage()
+{
+    printf("usage: MarioReplayHarness --rom PATH (--replay FILE | --synthetic MARIOS [--steps N] [--seed N] [--record FILE])\n"
+        "                          [--trace FILE] [--runs N] [--expect HASH] [--latency MS [--jitter MS] [--loss PERCENT]]\n"
+        "                          [--frame-rates FPS,FPS,...]\n"
+        "       MarioReplayHarness --rom PATH --tick-scaling MAX_MARIOS [--steps N]\n");
+}
+
+bool parseOptions(int argc, char** argv, HarnessOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--rom")
+        {
+            options.romPath = value;
+        }
+        else if (arg == "--replay")
+        {
+            options.replayPath = value;
+        }
+        else if (arg == "--synthetic")
+        {
+            options.syntheticMarios = std::clamp(atoi(value.c_str()), 1, MARIO_REPLAY_MAX_MARIOS);
+        }
+        else if (arg == "--steps")
+        {
+            options.steps = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--record")
+        {
+            options.recordPath = value;
+        }
+        else if (arg == "--trace")
+        {
+            options.tracePath = value;
+        }
+        else if (arg == "--runs")
+        {
+            options.runs = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--expect")
+        {
+            options.expectedHash = strtoull(value.c_str(), nullptr, 16);
+        }
+        else if (arg == "--latency")
+        {
+            options.latencyMs = std::max(0.0, atof(value.c_str()));
+        }
+        else if (arg == "--jitter")
+        {
+            options.jitterMs = std::max(0.0, atof(value.c_str()));
+        }
+        else if (arg == "--loss")
+        {
+            options.lossPercent = std::clamp(atof(value.c_str()), 0.0, 99.0);
+        }
+        else if (arg == "--tick-scaling")
+        {
+            options.tickScalingMarios = std::clamp(atoi(value.c_str()), 1, MARIO_REPLAY_MAX_MARIOS);
+        }
+        else if (arg == "--frame-rates")
+        {
+            const char* next = value.c_str();
+            char* end;
+            for (double fps = strtod(next, &end); end != next; fps = strtod(next, &end))
+            {
+                if (fps < 1.0)
+                {
+                    return false;
+                }
+                options.frameRates.push_back(fps);
+                next = *end == ',' ? end + 1 : end;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return !options.romPath.empty() &&
+        (options.tickScalingMarios > 0 || options.replayPath.empty() != (options.syntheticMarios == 0));
+}
+
+std::vector<uint8_t> readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Without a frame rate every step runs right after the other, with one they are run from a render loop at that rate
+HarnessResult run(const HarnessOptions& options, const uint8_t* rom, uint8_t* texture, double frameRate = 0.0)
+{
+    HarnessResult result;
+    std::unique_ptr<StepSource> source;
+    SyntheticStepSource* synthetic = nullptr;
+    if (!options.replayPath.empty())
+    {
+        auto replay = std::make_unique<ReplayStepSource>();
+        if (!replay->Open(options.replayPath))
+        {
+            fprintf(stderr, "could not read replay %s\n", options.replayPath.c_str());
+            exit(2);
+        }
+        source = std::move(replay);
+    }
+    else
+    {
+        auto generated = std::make_unique<SyntheticStepSource>(options.syntheticMarios, options.steps, options.seed);
+        synthetic = generated.get();
+        source = std::move(generated);
+    }
+
+    MarioReplayWriter recording;
+    if (synthetic != nullptr && !options.recordPath.empty() &&
+        !recording.Open(options.recordPath, source->MarioCount()))
+    {
+        fprintf(stderr, "could not write replay %s\n", options.recordPath.c_str());
+        exit(2);
+    }
+    std::ofstream trace;
+    if (!options.tracePath.empty())
+    {
+        trace.open(options.tracePath, std::ios::binary | std::ios::trunc);
+        // Laid out like the plugin's recordings, see SM64::MarioBodyStateLayout
+        BodyStateRecordingHeader header;
+        header.layout.size = sizeof(struct SM64MarioBodyState);
+        header.layout.positionOffset = offsetof(struct SM64MarioBodyState, marioState.position);
+        header.layout.velocityOffset = offsetof(struct SM64MarioBodyState, marioState.velocity);
+        header.layout.faceAngleOffset = offsetof(struct SM64MarioBodyState, marioState.faceAngle);
+        trace.write((const char*)&header, sizeof(header));
+    }
+
+    sm64_global_init(rom, texture, NULL, NULL);
+    sm64_set_interpolation_interval(1);
+    sm64_static_surfaces_load(surfaces, surfaces_count);
+
+    const uint32_t marioCount = source->MarioCount();
+    std::vector<HarnessMario> marios(marioCount);
+    for (HarnessMario& mario : marios)
+    {
+        createGeometry(mario);
+    }
+    // The first mario's simulation in marios is the host's, the client predicts its own
+    std::unique_ptr<PredictedClient> client;
+    if (options.latencyMs >= 0.0 && marioCount > 0)
+    {
+        client = std::make_unique<PredictedClient>(options);
+    }
+
+    XXH3_state_t* hashState = XXH3_createState();
+    XXH3_64bits_reset(hashState);
+    std::vector<MarioReplayMario> steps(marioCount);
+    MarioInteractionBatch interactions;
+    std::vector<int> interactionIndex(marioCount);
+    std::vector<uint32_t> ballMarios;
+    std::vector<uint8_t> ballHits;
+    MarioReplayBall ball;
+    using Clock = std::chrono::steady_clock;
+    // Frames take a random time around 1/frameRate, like SM64::OnRender is called
+    FixedStepScheduler scheduler(HARNESS_STEP_MS);
+    std::mt19937 frameRng(options.seed);
+    std::uniform_real_distribution<double> frameJitter(1.0 - HARNESS_FRAME_JITTER, 1.0 + HARNESS_FRAME_JITTER);
+    double frameMs = 0.0;
+    uint32_t dueSteps = 0;
+    scheduler.Advance(frameMs);
+    int stepIndex = 0;
+    for (; source->Next(ball, steps, marios); stepIndex++)
+    {
+        if (frameRate > 0.0)
+        {
+            while (dueSteps == 0)
+            {
+                frameMs += 1000.0 / frameRate * frameJitter(frameRng);
+                dueSteps = scheduler.Advance(frameMs);
+                const float alpha = scheduler.Alpha(frameMs);
+                result.alphaInRange = result.alphaInRange && alpha >= 0.0f && alpha <= 1.0f;
+                result.frames++;
+            }
+            dueSteps--;
+        }
+        const double nowMs = stepIndex * HARNESS_STEP_MS;
+        if (synthetic != nullptr)
+        {
+            // Simulates what the recording plays back, so both give the same trace
+            QuantizeReplayBall(ball);
+            for (MarioReplayMario& step : steps)
+            {
+                QuantizeReplayMario(step);
+            }
+        }
+        if (recording.IsOpen())
+        {
+            recording.WriteStep(ball, steps.data());
+        }
+
+        // Everyone attacks with what they did last step, like remote marios do in game
+        interactions.Clear();
+        for (uint32_t i = 0; i < marioCount; i++)
+        {
+            interactionIndex[i] = marios[i].marioId >= 0 ? interactions.Add(marios[i].bodyState) : -1;
+        }
+        if (client != nullptr)
+        {
+            client->Step(steps[0], interactions, interactionIndex[0], nowMs);
+        }
+
+        for (uint32_t i = 0; i < marioCount; i++)
+        {
+            HarnessMario& mario = marios[i];
+            const MarioReplayMario& step = steps[i];
+            if (spawnIfNeeded(mario, step))
+            {
+                result.spawned++;
+            }
+            if (mario.marioId < 0)
+            {
+                continue;
+            }
+
+            bool attacked;
+            if (client != nullptr && i == 0)
+            {
+                // Only has the inputs that made it over the link
+                attacked = client->PrepareHost(mario, interactions, interactionIndex[i], nowMs);
+            }
+            else
+            {
+                MarioInputsFromCar(step.controls, step.canMove, step.boostAmount, mario.state.position,
+                    step.cameraLocation, &mario.inputs);
+                ClearMarioAttack(&mario.inputs);
+                attacked = interactions.ApplyAttack(mario.state.position, interactionIndex[i], &mario.inputs);
+                mario.inputs.isInput = true;
+                mario.inputs.giveWingcap = true;
+            }
+            if (attacked)
+            {
+                result.attacks++;
+            }
+
+            const auto start = Clock::now();
+            tickMario(mario);
+            result.tickUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+            result.ticks++;
+            if (client != nullptr && i == 0)
+            {
+                client->HostTicked(mario, nowMs);
+            }
+
+            XXH3_64bits_update(hashState, &mario.bodyState, sizeof(mario.bodyState));
+            if (trace.is_open())
+            {
+                const uint64_t timestamp = (uint64_t)std::llround(stepIndex * HARNESS_STEP_MS);
+                const int playerId = (int)i;
+                trace.write((const char*)&timestamp, sizeof(timestamp));
+                trace.write((const char*)&playerId, sizeof(playerId));
+                trace.write((const char*)&mario.bodyState, sizeof(mario.bodyState));
+            }
+        }
+
+        // Everyone's ball hits at once, like the host's game tick
+        interactions.Clear();
+        ballMarios.clear();
+        for (uint32_t i = 0; i < marioCount; i++)
+        {
+            if (marios[i].marioId >= 0)
+            {
+                interactions.Add(marios[i].bodyState, stepIndex - marios[i].lastBallHitStep >= HARNESS_BALL_COOLDOWN_STEPS);
+                ballMarios.push_back(i);
+            }
+        }
+        if (interactions.ResolveBall(ball.location, ball.velocity, BallInteractionTuning(), ballHits) > 0)
+        {
+            for (size_t hit = 0; hit < ballMarios.size(); hit++)
+            {
+                if (ballHits[hit])
+                {
+                    marios[ballMarios[hit]].lastBallHitStep = stepIndex;
+                    result.ballHits++;
+                }
+            }
+            if (synthetic != nullptr)
+            {
+                synthetic->SetBallVelocity(ball.velocity);
+            }
+        }
+    }
+    result.traceHash = XXH3_64bits_digest(hashState);
+    result.steps = stepIndex;
+    XXH3_freeState(hashState);
+    if (frameRate > 0.0)
+    {
+        // Steps the last frame made due but the replay had no more of aren't run
+        result.scheduledSteps = scheduler.Step() - dueSteps;
+        result.scheduler = scheduler.GetStats();
+    }
+
+    if (client != nullptr && marios[0].marioId >= 0)
+    {
+        // The player lets go of the controls until the mario stands still and the host has acked what it can
+        MarioReplayMario idle = steps[0];
+        idle.controls = CarControls();
+        MarioInteractionBatch nobody;
+        const int settleSteps = HARNESS_SETTLE_STEPS + client->RoundTripSteps();
+        for (int settled = 0; settled < settleSteps; settled++, stepIndex++)
+        {
+            const double nowMs = stepIndex * HARNESS_STEP_MS;
+            client->Step(idle, nobody, -1, nowMs);
+            client->PrepareHost(marios[0], nobody, -1, nowMs);
+            tickMario(marios[0]);
+            client->HostTicked(marios[0], nowMs);
+        }
+        client->Finish(marios[0], result.prediction);
+    }
+    client.reset();
+
+    for (HarnessMario& mario : marios)
+    {
+        deleteMario(mario);
+    }
+    sm64_global_terminate();
+    return result;
+}
+
+// Ticks 1, 2, 4 up to tickScalingMarios marios for --steps frames on pools of 0, 1, 3 and 7 workers. Like OnRender,
+// every tick holds one lock, as sm64Sema does in guardedMarioTick, and only the vertex conversion runs outside it.
+void runTickScaling(const HarnessOptions& options, const uint8_t* rom, uint8_t* texture)
+{
+    sm64_global_init(rom, texture, NULL, NULL);
+    sm64_set_interpolation_interval(1);
+    sm64_static_surfaces_load(surfaces, surfaces_count);
+
+    std::vector<HarnessMario> marios(options.tickScalingMarios);
+    std::vector<std::vector<MarioVertex>> vertices(marios.size());
+    size_t created = 0;
+    for (HarnessMario& mario : marios)
+    {
+        createGeometry(mario);
+        // A grid 200 units apart, so they don't land on top of each other
+        mario.marioId = sm64_mario_create((int16_t)((created % 8) * 200.0f - 800.0f), 20,
+            (int16_t)((created / 8) * 200.0f - 800.0f));
+        vertices[created].resize(SM64_GEO_MAX_TRIANGLES * 3);
+        created += mario.marioId >= 0 ? 1 : 0;
+    }
+
+    std::vector<size_t> workerCounts = { 0 };
+    const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t workers : { 1, 3, 7 })
+    {
+        if (workers < hardwareThreads)
+        {
+            workerCounts.push_back(workers);
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::mutex sm64Lock;
+    for (size_t marioCount = 1; marioCount <= created; marioCount *= 2)
+    {
+        double serialMs = 0.0;
+        double serializedShare = 1.0;
+        for (size_t workers : workerCounts)
+        {
+            WorkerPool pool(workers);
+            // Time spent ticking, waiting for the lock included
+            std::atomic<int64_t> tickNs = 0;
+            const auto start = Clock::now();
+            for (int frame = 0; frame < options.steps; frame++)
+            {
+                pool.ParallelFor(marioCount, [&](size_t i) {
+                    HarnessMario& mario = marios[i];
+                    // Turning around every second keeps them running without leaving the level
+                    mario.inputs.isInput = true;
+                    mario.inputs.stickX = (frame / 30) % 2 == 0 ? 1.0f : -1.0f;
+                    const auto tickStart = Clock::now();
+                    {
+                        std::lock_guard<std::mutex> lock(sm64Lock);
+                        tickMario(mario);
+                    }
+                    tickNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - tickStart).count();
+
+                    MarioVertexSource source;
+                    source.position = mario.geometry.position;
+                    source.color = mario.geometry.color;
+                    source.uv = mario.geometry.uv;
+                    source.normal = mario.geometry.normal;
+                    source.vertexCount = (size_t)mario.geometry.numTrianglesUsed * 3;
+                    ConvertMarioVertices(source, vertices[i].data());
+                });
+            }
+            const double frameMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() /
+                options.steps;
+            const double tickMs = tickNs / 1e6 / options.steps;
+            if (workers == 0)
+            {
+                // Nobody else wants the lock, so this is only the time it is held
+                serialMs = frameMs;
+                serializedShare = frameMs > 0.0 ? std::clamp(tickMs / frameMs, 0.0, 1.0) : 1.0;
+                printf("%2zu marios, 0 workers: %.3f ms/frame, %.3f ms of it ticking under the lock (%.0f%% serialized, "
+                    "at most %.2fx with any number of workers)\n", marioCount, frameMs, tickMs, serializedShare * 100.0,
+                    serializedShare > 0.0 ? 1.0 / serializedShare : 0.0);
+                continue;
+            }
+
+            // Amdahl's law for the workers plus the calling thread, with the tick as the serial part
+            const double bound = 1.0 / (serializedShare + (1.0 - serializedShare) / (workers + 1));
+            printf("%2zu marios, %zu workers: %.3f ms/frame, %.2fx (bound %.2fx), %.3f ms/frame ticking or waiting for "
+                "the lock across threads\n", marioCount, workers, frameMs, serialMs / frameMs, bound, tickMs);
+        }
+    }
+
+    for (HarnessMario& mario : marios)
+    {
+        deleteMario(mario);
+    }
+    sm64_global_terminate();
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    const size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, char** argv)
+{
+    HarnessOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<uint8_t> rom = readFile(options.romPath);
+    if (rom.empty())
+    {
+        fprintf(stderr, "could not read rom %s\n", options.romPath.c_str());
+        return 2;
+    }
+    std::vector<uint8_t> texture(HARNESS_TEXTURE_SIZE);
+    if (options.tickScalingMarios > 0)
+    {
+        runTickScaling(options, rom.data(), texture.data());
+        return 0;
+    }
+
+    bool deterministic = true;
+    bool reconciled = true;
+    uint64_t firstHash = 0;
+    for (int runIndex = 0; runIndex < options.runs; runIndex++)
+    {
+        HarnessResult result = run(options, rom.data(), texture.data());
+        const double totalUs = std::accumulate(result.tickUs.begin(), result.tickUs.end(), 0.0);
+        printf("run %d: %llu ticks, %u spawns, %llu ball hits, %llu attacks, trace %016llx, tick p50 %.1f us p99 %.1f us "
+            "max %.1f us, %.0f ticks/s\n", runIndex + 1, (unsigned long long)result.ticks, result.spawned,
+            (unsigned long long)result.ballHits, (unsigned long long)result.attacks,
+            (unsigned long long)result.traceHash, percentile(result.tickUs, 0.5), percentile(result.tickUs, 0.99),
+            percentile(result.tickUs, 1.0), totalUs > 0.0 ? result.ticks / (totalUs / 1e6) : 0.0);
+        if (result.prediction.enabled)
+        {
+            // Standing still at the end, the client must have ended up where the host has its mario
+            const PredictionResult& prediction = result.prediction;
+            const bool passed = prediction.caughtUp && prediction.finalError <= PREDICTION_DEFAULT_TOLERANCE;
+            printf("prediction %s: %u inputs, %llu acks, %llu corrections, %llu replayed, %llu host stalls, largest "
+                "error %.1f, largest correction %.1f, largest drawn step %.1f, final error %.2f%s\n",
+                passed ? "passed" : "FAILED", prediction.inputs, (unsigned long long)prediction.predictor.acks,
+                (unsigned long long)prediction.predictor.corrections,
+                (unsigned long long)prediction.predictor.replayedInputs, (unsigned long long)prediction.sequencer.stalls,
+                prediction.predictor.maxError, prediction.maxCorrection, prediction.maxDrawnStep, prediction.finalError,
+                prediction.caughtUp ? "" : ", host stopped acking");
+            reconciled = reconciled && passed;
+        }
+
+        if (runIndex == 0)
+        {
+            firstHash = result.traceHash;
+        }
+        deterministic = deterministic && result.traceHash == firstHash;
+    }
+
+    // The same steps from a render loop at every frame rate, they have to come out the same as one after the other
+    bool sameAtFrameRates = true;
+    for (double fps : options.frameRates)
+    {
+        HarnessResult result = run(options, rom.data(), texture.data(), fps);
+        const bool passed = result.traceHash == firstHash && result.scheduledSteps == result.steps &&
+            result.scheduler.droppedSteps == 0 && result.alphaInRange;
+        printf("%.0f fps %s: %llu frames, %llu of %llu steps, %llu dropped, at most %u in a frame, trace %016llx%s\n",
+            fps, passed ? "passed" : "FAILED", (unsigned long long)result.frames,
+            (unsigned long long)result.scheduledSteps, (unsigned long long)result.steps,
+            (unsigned long long)result.scheduler.droppedSteps, result.scheduler.mostStepsInAFrame,
+            (unsigned long long)result.traceHash, result.alphaInRange ? "" : ", alpha out of range");
+        sameAtFrameRates = sameAtFrameRates && passed;
+    }
+
+    if (!deterministic)
+    {
+        printf("FAILED: runs of the same replay gave different traces\n");
+        return 1;
+    }
+    if (!sameAtFrameRates)
+    {
+        printf("FAILED: a render loop dropped steps or changed the trace\n");
+        return 1;
+    }
+    if (!reconciled)
+    {
+        printf("FAILED: the predicted mario did not end up where the host has it\n");
+        return 1;
+    }
+    if (options.expectedHash != 0 && firstHash != options.expectedHash)
+    {
+        printf("FAILED: trace %016llx, expected %016llx\n", (unsigned long long)firstHash,
+            (unsigned long long)options.expectedHash);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+// MarioVertexBench.cpp
+// Checks and times the plugin's mario vertex conversion without Rocket League or BakkesMod.
+//
+// Converts random geometry the size of a mario with ConvertMarioVertices
+// and ConvertMarioVerticesScalar, with and without blending from a
+// previous step and for every vertex count around the wingcap, and fails
+// if the two differ in a single bit. Then times both on a whole mario.
+//
+// Also packs a converted mario into PackedVertex, decodes it again like
+// the vertex shader does and fails if any attribute is off by more than
+// its format can hold, or if a cap or shirt color doesn't come back exact.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Modules/MarioVertices.h"
+#include "Modules/PackedVertices.h"
+
+#define BENCH_MAX_VERTICES (1024 * 3) // SM64_GEO_MAX_TRIANGLES * 3
+#define BENCH_WINGCAP_VERTEX (750 * 3) // WINGCAP_VERTEX_INDEX * 3
+
+struct BenchOptions
+{
+    int vertices = BENCH_MAX_VERTICES;
+    int iterations = 20000;
+    unsigned seed = 1;
+};
+
+// libsm64's arrays, sized exactly so reading past them shows up under a sanitizer
+struct BenchGeometry
+{
+    std::vector<float> position;
+    std::vector<float> previousPosition;
+    std::vector<float> color;
+    std::vector<float> uv;
+    std::vector<float> normal;
+
+    BenchGeometry(size_t vertexCount, std::mt19937& random)
+    {
+        std::uniform_real_distribution<float> coordinate(-3000.0f, 3000.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+        for (size_t i = 0; i < vertexCount * 3; i++)
+        {
+            position.push_back(coordinate(random));
+            previousPosition.push_back(coordinate(random));
+            color.push_back(unit(random));
+            normal.push_back(direction(random));
+        }
+        for (size_t i = 0; i < vertexCount * 2; i++)
+        {
+            uv.push_back(unit(random));
+        }
+    }
+
+    MarioVertexSource Source(size_t vertexCount, bool blend, float alpha) const
+    {
+        MarioVertexSource source;
+        source.position = position.data();
+        source.previousPosition = blend ? previousPosition.data() : nullptr;
+        source.color = color.data();
+        source.uv = uv.data();
+        source.normal = normal.data();
+        source.vertexCount = vertexCount;
+        source.firstTransparentVertex = BENCH_WINGCAP_VERTEX;
+        source.alpha = alpha;
+        source.offset[0] = 12.5f;
+        source.offset[1] = -3.25f;
+        source.offset[2] = 0.75f;
+        return source;
+    }
+};
+
+void printUsage()
+{
+    printf("usage: MarioVertexBench [--vertices N] [--iterations N] [--seed N]\n");
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--vertices")
+        {
+            options.vertices = std::clamp(atoi(value.c_str()), 1, BENCH_MAX_VERTICES);
+        }
+        else if (arg == "--iterations")
+        {
+            options.iterations = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns how many of the converted vertices differ between the two conversions
+size_t compare(const BenchGeometry& geometry, size_t vertexCount, bool blend, float alpha)
+{
+    const MarioVertexSource source = geometry.Source(vertexCount, blend, alpha);
+    std::vector<MarioVertex> expected(vertexCount);
+    std::vector<MarioVertex> actual(vertexCount);
+    ConvertMarioVerticesScalar(source, expected.data());
+    ConvertMarioVertices(source, actual.data());
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        if (memcmp(&expected[i], &actual[i], sizeof(MarioVertex)) != 0)
+        {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    const size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+template <typename Convert>
+std::vector<double> timeConversion(const MarioVertexSource& source, MarioVertex* vertices, int iterations, Convert convert)
+{
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> us;
+    us.reserve(iterations);
+    for (int i = 0; i < iterations; i++)
+    {
+        const auto start = Clock::now();
+        convert(source, vertices);
+        us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    return us;
+}
+
+// Returns how many packed vertices decode further from the float vertex than the packed formats allow
+size_t checkPacking(const BenchGeometry& geometry, const BenchOptions& options)
+{
+    std::vector<MarioVertex> vertices(options.vertices);
+    ConvertMarioVerticesScalar(geometry.Source((size_t)options.vertices, true, 0.5f), vertices.data());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        MarioVertex& vertex = vertices[i];
+        // libsm64's normals are unit length, the cap and shirt colors pure red and blue
+        const float length = std::sqrt(vertex.normal[0] * vertex.normal[0] + vertex.normal[1] * vertex.normal[1] +
+            vertex.normal[2] * vertex.normal[2]);
+        for (int k = 0; k < 3; k++)
+        {
+            vertex.normal[k] = length > 0.0f ? vertex.normal[k] / length : (k == 2 ? 1.0f : 0.0f);
+        }
+        if (i % 3 == 0)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                vertex.color[k] = vertex.color[k] < 0.5f ? 0.0f : 1.0f;
+            }
+        }
+    }
+
+    const PackedVertexBounds bounds = PackedVertexBoundsOf(vertices.data(), vertices.size());
+    std::vector<PackedVertex> packed(vertices.size());
+    PackVertices(vertices.data(), vertices.size(), bounds, packed.data());
+
+    float maxPositionError = 0.0f;
+    float maxColorError = 0.0f;
+    float maxUvError = 0.0f;
+    float maxNormalError = 0.0f; // Radians
+    size_t failures = 0;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const MarioVertex& expected = vertices[i];
+        MarioVertex actual;
+        UnpackVertex(packed[i], bounds, actual);
+
+        bool failed = false;
+        for (int k = 0; k < 3; k++)
+        {
+            const float error = std::abs(actual.pos[k] - expected.pos[k]);
+            maxPositionError = std::max(maxPositionError, error);
+            failed |= error > bounds.scale[k] / 32767.0f;
+        }
+        for (int k = 0; k < 4; k++)
+        {
+            const float error = std::abs(actual.color[k] - expected.color[k]);
+            maxColorError = std::max(maxColorError, error);
+            failed |= error > 0.5f / 255.0f + 1e-6f;
+            failed |= (expected.color[k] == 0.0f || expected.color[k] == 1.0f) && error != 0.0f;
+        }
+        for (int k = 0; k < 2; k++)
+        {
+            const float error = std::abs(actual.texCoord[k] - expected.texCoord[k]);
+            maxUvError = std::max(maxUvError, error);
+            failed |= error > 0.5f / 65535.0f + 1e-6f;
+        }
+        const float dot = actual.normal[0] * expected.normal[0] + actual.normal[1] * expected.normal[1] +
+            actual.normal[2] * expected.normal[2];
+        const float angle = std::acos(std::clamp(dot, -1.0f, 1.0f));
+        maxNormalError = std::max(maxNormalError, angle);
+        failed |= angle > 0.001f;
+
+        if (failed)
+        {
+            failures++;
+        }
+    }
+
+    const std::vector<double> packUs = timeConversion(MarioVertexSource(), nullptr, options.iterations,
+        [&](const MarioVertexSource&, MarioVertex*) {
+            PackVertices(vertices.data(), vertices.size(), PackedVertexBoundsOf(vertices.data(), vertices.size()),
+                packed.data());
+        });
+    printf("packed %zu vertices into %zu bytes instead of %zu, %zu off by more than the format holds, max error "
+        "position %.4f color %.5f uv %.7f normal %.5f rad, pack p50 %.2f us\n", vertices.size(),
+        vertices.size() * sizeof(PackedVertex), vertices.size() * sizeof(MarioVertex), failures, maxPositionError,
+        maxColorError, maxUvError, maxNormalError, percentile(packUs, 0.5));
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::mt19937 random(options.seed);
+    const BenchGeometry geometry(BENCH_MAX_VERTICES, random);
+
+    // Every count up to a few triangles, around the wingcap and the end of the arrays, blended or not
+    std::vector<size_t> counts;
+    for (size_t count = 0; count <= 12; count++)
+    {
+        counts.push_back(count);
+    }
+    for (size_t count = BENCH_WINGCAP_VERTEX - 4; count <= BENCH_WINGCAP_VERTEX + 4; count++)
+    {
+        counts.push_back(count);
+    }
+    counts.push_back(BENCH_MAX_VERTICES - 1);
+    counts.push_back(BENCH_MAX_VERTICES);
+
+    size_t mismatches = 0;
+    size_t checked = 0;
+    for (size_t count : counts)
+    {
+        for (float alpha : { 0.0f, 0.37f, 1.0f })
+        {
+            // Each count gets its own arrays of exactly its size
+            std::mt19937 countRandom(options.seed + (unsigned)count);
+            const BenchGeometry sized(count, countRandom);
+            mismatches += compare(sized, count, true, alpha);
+            mismatches += compare(sized, count, false, alpha);
+            checked += 2 * count;
+        }
+    }
+    printf("checked %zu vertices in %zu conversions, %zu differ from the scalar conversion\n", checked,
+        counts.size() * 6, mismatches);
+
+    const MarioVertexSource source = geometry.Source((size_t)options.vertices, true, 0.5f);
+    std::vector<MarioVertex> vertices(options.vertices);
+    const std::vector<double> scalarUs = timeConversion(source, vertices.data(), options.iterations,
+        ConvertMarioVerticesScalar);
+    const std::vector<double> simdUs = timeConversion(source, vertices.data(), options.iterations,
+        ConvertMarioVertices);
+    const double scalarP50 = percentile(scalarUs, 0.5);
+    const double simdP50 = percentile(simdUs, 0.5);
+    printf("%d vertices, %d iterations: scalar p50 %.2f us p99 %.2f us, simd p50 %.2f us p99 %.2f us, %.2fx\n",
+        options.vertices, options.iterations, scalarP50, percentile(scalarUs, 0.99), simdP50,
+        percentile(simdUs, 0.99), simdP50 > 0.0 ? scalarP50 / simdP50 : 0.0);
+
+    const size_t packingFailures = checkPacking(geometry, options);
+
+    return mismatches == 0 && packingFailures == 0 ? 0 : 1;
+}
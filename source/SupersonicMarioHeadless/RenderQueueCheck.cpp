@@ -0,0 +1,245 @@
+// RenderQueueCheck.cpp
+// Checks the plugin's render queue and counts the state changes it saves, without D3D.
+//
+// Queues a frame like the plugin draws it, the map, the ball, the car
+// ghosts and the marios, and submits it to a NullRenderBackend. Fails if
+// any draw is missing, drawn twice, drawn with another item's state or
+// constants, or drawn in the wrong pass. Then prints how many constant
+// buffer maps, state changes and draws the queue needed, next to what
+// drawing mesh by mesh needed for the same frame.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Graphics/RenderQueue.h"
+
+#define CHECK_CAR_MESHES 4 // Meshes of a car ghost model
+
+struct CheckOptions
+{
+    int marios = 8;
+    int cars = 6;
+    int iterations = 10000;
+};
+
+// Stand ins for the plugin's meshes and textures, only their addresses matter
+struct FakeMesh
+{
+    int id;
+};
+
+struct Scene
+{
+    FakeMesh map{ 0 };
+    FakeMesh ball{ 1 };
+    std::vector<FakeMesh> carMeshes; // CHECK_CAR_MESHES per car model, three models
+    std::vector<FakeMesh> marioMeshes;
+    int transparentTexture = 0;
+    int marioTexture = 0;
+};
+
+struct QueuedItem
+{
+    DrawState state;
+    DrawConstants constants;
+};
+
+void printUsage()
+{
+    printf("usage: RenderQueueCheck [--marios N] [--cars N] [--iterations N]\n");
+}
+
+bool parseOptions(int argc, char** argv, CheckOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--marios")
+        {
+            options.marios = std::clamp(atoi(value.c_str()), 0, 64);
+        }
+        else if (arg == "--cars")
+        {
+            options.cars = std::clamp(atoi(value.c_str()), 0, 64);
+        }
+        else if (arg == "--iterations")
+        {
+            options.iterations = std::max(1, atoi(value.c_str()));
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+DrawConstants constantsFor(uint32_t id)
+{
+    DrawConstants constants = {};
+    for (int k = 0; k < 16; k++)
+    {
+        constants.wvp[k] = (float)(id * 16 + k);
+        constants.world[k] = (float)(id * 16 + k) * 0.5f;
+    }
+    // The unused w of the cap color tells the items apart
+    constants.capColor[3] = (float)id;
+    return constants;
+}
+
+// In the order the plugin's models are added: ball, car ghosts, map, marios
+std::vector<QueuedItem> buildFrame(const Scene& scene, const CheckOptions& options)
+{
+    std::vector<QueuedItem> items;
+    auto add = [&](const FakeMesh* mesh, DrawPass pass, const void* texture, bool packed, bool noCull, uint32_t indices) {
+        DrawState state;
+        state.pass = pass;
+        state.packedVertices = packed;
+        state.noCull = noCull;
+        state.texture = texture;
+        state.mesh = mesh;
+        state.indexCount = indices;
+        items.push_back({ state, constantsFor((uint32_t)items.size()) });
+    };
+
+    add(&scene.ball, DrawPass::Occluder, &scene.transparentTexture, false, false, 2880);
+    // Every car of a model is one frame of it, the frames draw all of the model's meshes
+    for (int model = 0; model < 3; model++)
+    {
+        for (int car = model; car < options.cars; car += 3)
+        {
+            for (int mesh = 0; mesh < CHECK_CAR_MESHES; mesh++)
+            {
+                add(&scene.carMeshes[model * CHECK_CAR_MESHES + mesh], DrawPass::Occluder, &scene.transparentTexture,
+                    false, false, 1200);
+            }
+        }
+    }
+    add(&scene.map, DrawPass::Occluder, &scene.transparentTexture, false, false, 600000);
+    for (int mario = 0; mario < options.marios; mario++)
+    {
+        add(&scene.marioMeshes[mario], DrawPass::Textured, &scene.marioTexture, true, true, 2250);
+    }
+    return items;
+}
+
+// Returns how many problems the submitted frame had
+size_t check(const std::vector<QueuedItem>& items, const NullRenderBackend& backend)
+{
+    size_t problems = 0;
+    if (backend.drawn.size() != items.size())
+    {
+        printf("drew %zu instances for %zu items\n", backend.drawn.size(), items.size());
+        problems++;
+    }
+
+    std::vector<int> drawnTimes(items.size(), 0);
+    DrawPass lastPass = DrawPass::Occluder;
+    for (const NullRenderBackend::DrawnInstance& drawn : backend.drawn)
+    {
+        const uint32_t id = (uint32_t)drawn.constants.capColor[3];
+        if (id >= items.size())
+        {
+            problems++;
+            continue;
+        }
+
+        drawnTimes[id]++;
+        const QueuedItem& item = items[id];
+        if (memcmp(&drawn.constants, &item.constants, sizeof(DrawConstants)) != 0 ||
+            drawn.state.mesh != item.state.mesh || drawn.state.texture != item.state.texture ||
+            drawn.state.pass != item.state.pass || drawn.state.packedVertices != item.state.packedVertices ||
+            drawn.state.noCull != item.state.noCull || drawn.state.indexCount != item.state.indexCount)
+        {
+            printf("item %u drawn with another item's state or constants\n", id);
+            problems++;
+        }
+        if (drawn.state.pass < lastPass)
+        {
+            printf("item %u drawn after a later pass\n", id);
+            problems++;
+        }
+        lastPass = drawn.state.pass;
+    }
+    for (size_t id = 0; id < items.size(); id++)
+    {
+        if (drawnTimes[id] != 1)
+        {
+            printf("item %zu drawn %d times\n", id, drawnTimes[id]);
+            problems++;
+        }
+    }
+    return problems;
+}
+
+int main(int argc, char** argv)
+{
+    CheckOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    Scene scene;
+    for (int i = 0; i < 3 * CHECK_CAR_MESHES; i++)
+    {
+        scene.carMeshes.push_back({ 2 + i });
+    }
+    for (int i = 0; i < options.marios; i++)
+    {
+        scene.marioMeshes.push_back({ 100 + i });
+    }
+
+    const std::vector<QueuedItem> items = buildFrame(scene, options);
+    RenderQueue queue;
+    NullRenderBackend backend;
+    for (const QueuedItem& item : items)
+    {
+        queue.Add(item.state, item.constants);
+    }
+    queue.Submit(backend);
+    const size_t problems = check(items, backend);
+
+    // Mesh by mesh, every draw mapped the pixel and the vertex constants and bound its own shader, texture and mesh
+    const NullRenderBackend::Counts& counts = backend.counts;
+    size_t textured = 0;
+    for (const QueuedItem& item : items)
+    {
+        textured += item.state.texture != nullptr ? 1 : 0;
+    }
+    printf("%zu items: mesh by mesh %zu constant maps, %zu shader binds, %zu texture binds, %zu mesh binds, %zu draws\n",
+        items.size(), 2 * items.size(), items.size(), textured, items.size(), items.size());
+    printf("%zu items: queued     %llu constant maps, %llu pipeline changes, %llu texture changes, %llu mesh changes, "
+        "%llu draws of %llu instances\n", items.size(), (unsigned long long)counts.constantMaps,
+        (unsigned long long)counts.pipelineChanges, (unsigned long long)counts.textureChanges,
+        (unsigned long long)counts.meshChanges, (unsigned long long)counts.draws, (unsigned long long)counts.instances);
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    for (int i = 0; i < options.iterations; i++)
+    {
+        NullRenderBackend timed;
+        queue.Clear();
+        for (const QueuedItem& item : items)
+        {
+            queue.Add(item.state, item.constants);
+        }
+        queue.Submit(timed);
+    }
+    const double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / options.iterations;
+    printf("queueing and submitting a frame took %.2f us, %zu problems\n", us, problems);
+
+    return problems == 0 ? 0 : 1;
+}
@@ -0,0 +1,365 @@
+// SnapshotInterpolationCheck.cpp
+// Checks the plugin's snapshot interpolator on synthetic streams, without Rocket League or libsm64.
+//
+// A mario runs in a circle at about full run speed and its snapshots are
+// sent with jitter, at a varying rate, reordered and with an outage, over
+// a 16-bit sender clock that wraps during the run. Rendering at 144 Hz,
+// the interpolated position has to stay close to where the mario really
+// was a delay behind the fastest snapshot so far, extrapolation has to
+// stop in time and snapshots must only be dropped once the jitter is
+// larger than the delay. Also checks that UnwrapTime counts on across a
+// wrap and counts back for a snapshot sent before the first one, and that
+// one-shot fields like a hit only come out of the first sample showing
+// their snapshot. Any failure exits with code 1.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Networking/SnapshotInterpolator.h"
+
+#define CHECK_RADIUS 1000.0
+#define CHECK_RADIANS_PER_MS 0.001
+#define CHECK_VELOCITY_TICK_MS (1000.0 / 30.0) // SM64's velocity is per 30 Hz frame
+#define CHECK_LATENCY_MS 40.0
+#define CHECK_MAX_INTERPOLATION_ERROR 10.0
+#define CHECK_START_MS 65000.0 // Wraps the 16-bit sender time during the run
+#define CHECK_RUN_MS 8000.0
+
+struct CheckOptions
+{
+    unsigned seed = 1234;
+};
+
+// Laid out like the front of libsm64's body state, the interpolator only knows the offsets
+struct CheckBodyState
+{
+    float position[3];
+    float velocity[3];
+    float faceAngle;
+    uint32_t action;
+    uint32_t soundMask;
+    uint8_t isAttacked;
+    uint8_t isUpdateFrame;
+};
+
+struct Scenario
+{
+    std::string name;
+    double minIntervalMs;
+    double maxIntervalMs;
+    double jitterMs;
+    double gapStartMs; // Nothing is sent from here for gapMs
+    double gapMs;
+    bool swapPairs; // Holds back every other snapshot until just after the next one, the first one included
+};
+
+struct Packet
+{
+    double arrivalMs;
+    uint16_t senderTime;
+    double sentMs;
+    CheckBodyState state;
+};
+
+void printUsage()
+{
+    printf("usage: SnapshotInterpolationCheck [--seed N]\n");
+}
+
+bool parseOptions(int argc, char** argv, CheckOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+SnapshotKinematics kinematics()
+{
+    return {
+        offsetof(CheckBodyState, position),
+        offsetof(CheckBodyState, velocity),
+        offsetof(CheckBodyState, faceAngle),
+    };
+}
+
+CheckBodyState truth(double senderMs)
+{
+    const double angle = senderMs * CHECK_RADIANS_PER_MS;
+    const double speed = CHECK_RADIUS * CHECK_RADIANS_PER_MS * CHECK_VELOCITY_TICK_MS;
+    CheckBodyState state = {};
+    state.position[0] = (float)(CHECK_RADIUS * cos(angle));
+    state.position[2] = (float)(CHECK_RADIUS * sin(angle));
+    state.velocity[0] = (float)(-speed * sin(angle));
+    state.velocity[2] = (float)(speed * cos(angle));
+    state.faceAngle = (float)(fmod(angle + 1.5707963, 6.2831853) - 3.1415927);
+    return state;
+}
+
+// Returns how many problems the one-shot fields had. Each snapshot carries a hit, and a hit has to be seen
+// exactly once however many frames show that snapshot, also while extrapolating and after a reset.
+size_t checkOneShot()
+{
+    size_t problems = 0;
+    SnapshotInterpolator interpolator(sizeof(CheckBodyState), kinematics());
+    interpolator.AddOneShotField(offsetof(CheckBodyState, soundMask), sizeof(CheckBodyState::soundMask));
+    interpolator.AddOneShotField(offsetof(CheckBodyState, isAttacked), sizeof(CheckBodyState::isAttacked));
+    interpolator.AddOneShotField(offsetof(CheckBodyState, isUpdateFrame), sizeof(CheckBodyState::isUpdateFrame));
+
+    auto pushHit = [&interpolator](uint32_t senderMs, double arrivalMs) {
+        CheckBodyState state = truth(senderMs);
+        state.action = senderMs;
+        state.soundMask = 0x10;
+        state.isAttacked = 1;
+        state.isUpdateFrame = 1;
+        interpolator.Push(senderMs, arrivalMs, &state);
+    };
+    // Counts the frames a hit comes out in while rendering at 144 Hz from fromMs to toMs
+    auto countHits = [&interpolator](double fromMs, double toMs, uint32_t& lastAction) {
+        size_t hits = 0;
+        for (double nowMs = fromMs; nowMs < toMs; nowMs += 1000.0 / 144.0)
+        {
+            CheckBodyState out;
+            interpolator.Sample(nowMs, &out);
+            if (out.isAttacked != 0 || out.isUpdateFrame != 0 || out.soundMask != 0)
+            {
+                hits++;
+                // Everything else about the snapshot stays as it was sent
+                if (!(out.isAttacked != 0 && out.isUpdateFrame != 0 && out.soundMask == 0x10) || out.action == lastAction)
+                {
+                    return (size_t)1000;
+                }
+                lastAction = out.action;
+            }
+        }
+        return hits;
+    };
+
+    // A single snapshot, sampled while the buffer fills and then for half a second of extrapolation
+    uint32_t lastAction = 0;
+    pushHit(1000, 0.0);
+    size_t hits = countHits(0.0, 600.0, lastAction);
+    if (hits != 1)
+    {
+        printf("one snapshot, sampled for 600 ms, came out with a hit in %zu frames instead of 1\n", hits);
+        problems++;
+    }
+
+    // A 10 Hz stream is shown for about 14 frames per snapshot, each hit has to come out once
+    for (uint32_t i = 1; i <= 20; i++)
+    {
+        pushHit(1600 + i * 100, 600.0 + i * 100.0);
+    }
+    hits = countHits(600.0, 2800.0, lastAction);
+    if (hits != 20)
+    {
+        printf("20 snapshots at 10 Hz came out with a hit in %zu frames instead of 20\n", hits);
+        problems++;
+    }
+
+    // After a reset the same sender time is a new snapshot again
+    interpolator.Reset();
+    lastAction = 0;
+    pushHit(1000, 5000.0);
+    hits = countHits(5000.0, 5200.0, lastAction);
+    if (hits != 1)
+    {
+        printf("a snapshot after a reset came out with a hit in %zu frames instead of 1\n", hits);
+        problems++;
+    }
+
+    printf("one-shot fields: %s\n", problems == 0 ? "passed" : "FAILED");
+    return problems;
+}
+
+// Returns how many problems UnwrapTime had
+size_t checkUnwrap()
+{
+    size_t problems = 0;
+    SnapshotInterpolator interpolator(sizeof(CheckBodyState), kinematics());
+    const uint32_t first = interpolator.UnwrapTime(1000);
+    // Sent before the first one, it has to come out earlier and not wrap to the top of the range
+    const uint32_t earlier = interpolator.UnwrapTime(967);
+    if (earlier != first - 33)
+    {
+        printf("a snapshot from before the first one unwrapped to %u, the first to %u\n", earlier, first);
+        problems++;
+    }
+
+    interpolator.Reset();
+    uint32_t last = interpolator.UnwrapTime(65500);
+    const uint32_t start = last;
+    for (uint32_t senderMs = 65500 + 33; senderMs < 65500 + 33 * 100; senderMs += 33)
+    {
+        const uint32_t unwrapped = interpolator.UnwrapTime((uint16_t)senderMs);
+        if (unwrapped != last + 33)
+        {
+            problems++;
+        }
+        last = unwrapped;
+    }
+    // Reordered across the wrap
+    const uint32_t reordered = interpolator.UnwrapTime((uint16_t)(65500 + 33 * 50));
+    if (reordered != start + 33 * 50)
+    {
+        problems++;
+    }
+    printf("unwrap: %s\n", problems == 0 ? "passed" : "FAILED");
+    return problems;
+}
+
+// Returns whether the interpolator kept to the scenario's expectations
+bool run(const Scenario& scenario, std::mt19937& random)
+{
+    SnapshotInterpolator::Config interpolatorConfig;
+    interpolatorConfig.velocityTickMs = CHECK_VELOCITY_TICK_MS;
+    SnapshotInterpolator interpolator(sizeof(CheckBodyState), kinematics(), interpolatorConfig);
+    const SnapshotInterpolator::Config& config = interpolator.GetConfig();
+
+    // Build the stream up front, arrival order is whatever the jitter makes it
+    std::vector<Packet> packets;
+    std::uniform_real_distribution<double> interval(scenario.minIntervalMs, scenario.maxIntervalMs);
+    std::uniform_real_distribution<double> jitter(0.0, scenario.jitterMs);
+    for (double senderMs = CHECK_START_MS; senderMs < CHECK_START_MS + CHECK_RUN_MS; senderMs += interval(random))
+    {
+        const double sinceStart = senderMs - CHECK_START_MS;
+        if (sinceStart >= scenario.gapStartMs && sinceStart < scenario.gapStartMs + scenario.gapMs)
+        {
+            continue;
+        }
+        const double whole = floor(senderMs);
+        packets.push_back({ whole + CHECK_LATENCY_MS + jitter(random), (uint16_t)(uint64_t)whole, whole, truth(whole) });
+    }
+    if (scenario.swapPairs)
+    {
+        for (size_t i = 0; i + 1 < packets.size(); i += 4)
+        {
+            packets[i].arrivalMs = packets[i + 1].arrivalMs + 1.0;
+        }
+    }
+    std::stable_sort(packets.begin(), packets.end(), [](const Packet& a, const Packet& b) {
+        return a.arrivalMs < b.arrivalMs;
+    });
+
+    // Render at 144 Hz, skipping the first second while the clock offset settles
+    double maxError = 0.0;
+    double maxExtrapolationMs = 0.0;
+    double maxOvershoot = 0.0;
+    size_t maxDepth = 0;
+    size_t depthTotal = 0;
+    size_t samples = 0;
+    size_t next = 0;
+    double fastestMs = CHECK_RUN_MS; // Quickest one way trip so far, the best the clock offset can know
+    float newestPosition[3] = {};
+    uint32_t newestSenderMs = 0;
+    bool senderTimeInRange = true;
+    for (double nowMs = CHECK_START_MS; nowMs < CHECK_START_MS + CHECK_RUN_MS + CHECK_LATENCY_MS; nowMs += 1000.0 / 144.0)
+    {
+        while (next < packets.size() && packets[next].arrivalMs <= nowMs)
+        {
+            const Packet& packet = packets[next++];
+            fastestMs = std::min(fastestMs, packet.arrivalMs - packet.sentMs);
+            const uint32_t senderMs = interpolator.UnwrapTime(packet.senderTime);
+            // Nothing in the stream is more than its length apart
+            senderTimeInRange &= next == 1 || (senderMs + CHECK_RUN_MS > newestSenderMs &&
+                senderMs < newestSenderMs + CHECK_RUN_MS);
+            interpolator.Push(senderMs, packet.arrivalMs, &packet.state);
+            if (next == 1 || senderMs > newestSenderMs)
+            {
+                newestSenderMs = senderMs;
+                memcpy(newestPosition, packet.state.position, sizeof(newestPosition));
+            }
+        }
+
+        CheckBodyState sampled;
+        SnapshotInterpolator::SampleInfo info;
+        if (!interpolator.Sample(nowMs, &sampled, &info) || nowMs < CHECK_START_MS + 1000.0)
+        {
+            continue;
+        }
+
+        const SnapshotInterpolator::Stats& stats = interpolator.GetStats();
+        maxDepth = std::max(maxDepth, stats.depth);
+        depthTotal += stats.depth;
+        samples++;
+        if (info.extrapolated)
+        {
+            // Extrapolation must stop at maxExtrapolationMs past the newest snapshot, wherever the truth went
+            maxExtrapolationMs = std::max(maxExtrapolationMs, stats.extrapolationMs);
+            const double speed = CHECK_RADIUS * CHECK_RADIANS_PER_MS;
+            const double moved = hypot(sampled.position[0] - newestPosition[0], sampled.position[2] - newestPosition[2]);
+            maxOvershoot = std::max(maxOvershoot, moved - speed * config.maxExtrapolationMs);
+            continue;
+        }
+
+        const CheckBodyState expected = truth(nowMs - fastestMs - config.delayMs);
+        maxError = std::max(maxError, (double)hypot(sampled.position[0] - expected.position[0],
+            sampled.position[2] - expected.position[2]));
+    }
+
+    const SnapshotInterpolator::Stats& stats = interpolator.GetStats();
+    const bool expectExtrapolation = scenario.gapMs > config.delayMs || scenario.jitterMs > config.delayMs;
+    // Late snapshots are expected to be dropped, and to cost accuracy, once the jitter is larger than the delay
+    const bool passed = samples > 0 && senderTimeInRange && maxOvershoot < 1.0 &&
+        maxError < (expectExtrapolation ? 2.0 : 1.0) * CHECK_MAX_INTERPOLATION_ERROR &&
+        (expectExtrapolation || stats.droppedSnapshots == 0) &&
+        expectExtrapolation == (stats.extrapolatedSamples > 0) &&
+        (scenario.gapMs <= config.delayMs + config.maxExtrapolationMs || stats.frozenSamples > 0);
+    printf("%-30s %s: max error %.2f, depth avg %.1f max %zu, %llu interpolated, %llu extrapolated (max %.0f ms), "
+        "%llu frozen, %llu late, %llu dropped%s\n", scenario.name.c_str(), passed ? "passed" : "FAILED", maxError,
+        samples > 0 ? (double)depthTotal / samples : 0.0, maxDepth, (unsigned long long)stats.interpolatedSamples,
+        (unsigned long long)stats.extrapolatedSamples, maxExtrapolationMs, (unsigned long long)stats.frozenSamples,
+        (unsigned long long)stats.lateSnapshots, (unsigned long long)stats.droppedSnapshots,
+        senderTimeInRange ? "" : ", sender times out of range");
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    CheckOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    const std::vector<Scenario> scenarios = {
+        { "steady 30 Hz, 40 ms jitter", 33.3, 33.3, 40.0, 0.0, 0.0, false },
+        { "20-60 Hz sender, 40 ms jitter", 16.7, 50.0, 40.0, 0.0, 0.0, false },
+        { "reordered pairs", 33.3, 33.3, 10.0, 0.0, 0.0, true },
+        { "500 ms outage", 33.3, 33.3, 20.0, 3000.0, 500.0, false },
+        { "jitter beyond the delay", 33.3, 33.3, 250.0, 0.0, 0.0, false },
+    };
+
+    size_t problems = checkUnwrap();
+    problems += checkOneShot();
+    std::mt19937 random(options.seed);
+    for (const Scenario& scenario : scenarios)
+    {
+        problems += run(scenario, random) ? 0 : 1;
+    }
+    printf("%zu problems\n", problems);
+    return problems == 0 ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include "SupersonicMarioPlugin.h"
 
 #include "ExternalModules.h"
+#include "GameModes/SM64.h"
 
 
 /*
@@ -35,3 +36,607 @@ RP_EXTERNAL_DEBUG_NOTIFIER("rp_crash", [](const std::vector<std::string>&) {
 RP_EXTERNAL_DEBUG_NOTIFIER("rp_throw", [](const std::vector<std::string>&) {
     throw std::runtime_error("NotifierInterrupt");
 }, "Throws exception", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_netcode_impair", [](const std::vector<std::string>& arguments) {
+    // Run one game as host and another joined on 127.0.0.1, then impair either side
+    if (arguments.size() >= 2) {
+        const int lossPercent = std::stoi(arguments[1]);
+        const int latencyMs = arguments.size() >= 3 ? std::stoi(arguments[2]) : 0;
+        const int jitterMs = arguments.size() >= 4 ? std::stoi(arguments[3]) : 0;
+        UdpTransport::getInstance().SetImpairment(lossPercent, latencyMs, jitterMs);
+        BM_INFO_LOG("UDP impairment set to {}% loss, {}ms latency, {}ms jitter", lossPercent, latencyMs, jitterMs);
+    }
+
+    const UdpTransport::Stats stats = UdpTransport::getInstance().GetStats();
+    BM_INFO_LOG("UDP connected: {}, sent: {}, received: {}, impaired dropped: {}, impaired delayed: {}",
+        UdpTransport::getInstance().IsConnected(), stats.sent, stats.received, stats.impairedDropped, stats.impairedDelayed);
+}, "Sets UDP loss/latency/jitter injection and logs UDP stats, usage: rp_netcode_impair [loss %] [latency ms] [jitter ms]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_test_netcode_udp", [](const std::vector<std::string>&) {
+    constexpr int frameCount = 2000;
+    constexpr int lossPercent = 10;
+
+    SOCKET receiver = GetBoundSocket(0, "127.0.0.1");
+    SOCKET sender = GetBoundSocket(0, "127.0.0.1");
+    sockaddr_in receiverAddr = {};
+    int addrLen = sizeof(receiverAddr);
+    if (receiver == INVALID_SOCKET || sender == INVALID_SOCKET ||
+        getsockname(receiver, reinterpret_cast<sockaddr*>(&receiverAddr), &addrLen) == SOCKET_ERROR) {
+        BM_ERROR_LOG("could not bind loopback sockets, {}", WSAGetLastError());
+        closesocket(receiver);
+        closesocket(sender);
+        return;
+    }
+    DWORD timeout = 200;
+    setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+    // Drop, duplicate and locally reorder frames the way a lossy link would, before they hit the socket
+    std::mt19937 rng(64);
+    std::vector<uint32_t> order;
+    for (uint32_t sequence = 0; sequence < frameCount; sequence++) {
+        if (static_cast<int>(rng() % 100) >= lossPercent) {
+            order.push_back(sequence);
+        }
+        if (rng() % 20 == 0) {
+            order.push_back(sequence);
+        }
+    }
+    for (size_t i = 0; i + 1 < order.size(); i++) {
+        if (rng() % 8 == 0) {
+            std::swap(order[i], order[i + 1]);
+        }
+    }
+
+    int playerId = 1;
+    char payload[sizeof(int) + sizeof(SM64MarioBodyState)] = {};
+    char frameBuf[sizeof(NetcodeFrameHeader) + sizeof(payload)];
+    memcpy(payload, &playerId, sizeof(int));
+    for (const uint32_t sequence : order) {
+        NetcodeFraming::WriteFrame(frameBuf, sizeof(frameBuf), NetcodeMessageType::MARIO_BODY_STATE, sequence,
+            payload, sizeof(payload));
+        sendto(sender, frameBuf, sizeof(frameBuf), 0, reinterpret_cast<const sockaddr*>(&receiverAddr), sizeof(receiverAddr));
+    }
+
+    NetcodeSequenceFilter filter;
+    std::vector<char> buf(UDP_BUF_SIZE);
+    int received = 0;
+    int accepted = 0;
+    uint32_t latest = 0;
+    bool monotonic = true;
+    int bytesIn;
+    while ((bytesIn = recvfrom(receiver, buf.data(), UDP_BUF_SIZE, 0, nullptr, nullptr)) > 0) {
+        NetcodeFrame frame;
+        if (!NetcodeFraming::ReadFrame(buf.data(), bytesIn, frame)) {
+            continue;
+        }
+        received++;
+        if (filter.Accept(*reinterpret_cast<int*>(frame.payload), frame.header.sequence)) {
+            monotonic &= accepted == 0 || frame.header.sequence > latest;
+            latest = frame.header.sequence;
+            accepted++;
+        }
+    }
+    closesocket(receiver);
+    closesocket(sender);
+
+    const std::string result = fmt::format("sent {}, received {}, accepted {}, stale {}, newest {}",
+        order.size(), received, accepted, filter.Stale(), latest);
+    if (monotonic && received > 0 && accepted + static_cast<int>(filter.Stale()) == received) {
+        BM_INFO_LOG("UDP sequencing passed: {}", result);
+    }
+    else {
+        BM_ERROR_LOG("UDP sequencing failed: {}", result);
+    }
+}, "Sends lossy, duplicated and reordered body state over loopback UDP and checks stale frames are dropped", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_netcode_record", [](const std::vector<std::string>& arguments) {
+    if (arguments.size() >= 2 && arguments[1] == "stop") {
+        SM64::StopBodyStateRecording();
+        BM_INFO_LOG("stopped recording body states");
+        return;
+    }
+
+    const std::filesystem::path path = SupersonicMarioPluginDataFolder / "bodystate_recording.bin";
+    if (SM64::StartBodyStateRecording(path)) {
+        BM_INFO_LOG("recording local and remote body states to {}", path.string());
+    }
+    else {
+        BM_ERROR_LOG("could not open {}", path.string());
+    }
+}, "Records body state streams for SnapshotCodecBench, usage: rp_netcode_record [stop]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_replay_record", [](const std::vector<std::string>& arguments) {
+    if (arguments.size() >= 2 && arguments[1] == "stop") {
+        SM64::StopReplayRecording();
+        BM_INFO_LOG("stopped recording the mario replay");
+        return;
+    }
+
+    const std::filesystem::path path = SupersonicMarioPluginDataFolder / "mario_replay.rpl";
+    if (SM64::StartReplayRecording(path)) {
+        BM_INFO_LOG("recording the local mario's replay to {}", path.string());
+    }
+    else {
+        BM_ERROR_LOG("could not open {}", path.string());
+    }
+}, "Records a replay for SupersonicMarioHeadless, usage: rp_replay_record [stop]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_netcode_relay_stats", [](const std::vector<std::string>& arguments) {
+    const auto logStats = [](const std::string& name, RelayStats& stats) {
+        const uint64_t ticks = stats.ticks;
+        if (ticks == 0) {
+            BM_INFO_LOG("{} relay: no ticks yet", name);
+            return;
+        }
+        BM_INFO_LOG("{} relay: {} ticks, {:.2f} frames/tick, {:.2f} syscalls/tick, {:.1f} bytes/tick",
+            name, ticks, static_cast<double>(stats.framesRelayed) / ticks,
+            static_cast<double>(stats.sendCalls) / ticks, static_cast<double>(stats.bytesSent) / ticks);
+    };
+
+    const bool reset = arguments.size() >= 2 && arguments[1] == "reset";
+    TcpServer& server = TcpServer::getInstance();
+    server.relaySema.acquire();
+    if (server.relay != nullptr) {
+        logStats("TCP", server.relay->Stats());
+        BM_INFO_LOG("TCP interest: {} body states relayed, {} held back from far away clients",
+            server.relay->InterestStats().relevant.load(), server.relay->InterestStats().skipped.load());
+        const RelayBackendStats& backendStats = server.relay->BackendStats();
+        BM_INFO_LOG("TCP backend: {} connections, {} send calls, {} bytes, {} dropped sends, {} slow clients closed",
+            server.relay->Connections(), backendStats.sendCalls.load(), backendStats.bytesSent.load(), backendStats.droppedSends.load(),
+            backendStats.slowClientsClosed.load());
+        if (reset) {
+            server.relay->Stats().Reset();
+            server.relay->InterestStats().Reset();
+        }
+    }
+    server.relaySema.release();
+
+    logStats("UDP", UdpTransport::getInstance().relayStats);
+    RelayInterest::Stats& interestStats = UdpTransport::getInstance().InterestStats();
+    BM_INFO_LOG("UDP interest: {} body states relayed, {} held back from far away peers",
+        interestStats.relevant.load(), interestStats.skipped.load());
+    if (reset) {
+        UdpTransport::getInstance().relayStats.Reset();
+        interestStats.Reset();
+    }
+}, "Logs host relay syscalls and bytes per tick, usage: rp_netcode_relay_stats [reset]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_netcode_interpolation_stats", [](const std::vector<std::string>&) {
+    const std::shared_ptr<SM64> sm64 = SupersonicMarioPluginModule::Outer()->GetCustomGameMode<SM64>();
+    if (sm64 == nullptr) {
+        BM_INFO_LOG("SM64 is not loaded");
+        return;
+    }
+
+    sm64->remoteMariosSema.acquire();
+    for (auto const& [playerId, marioInstance] : sm64->remoteMarios) {
+        marioInstance->sema.acquire();
+        const SnapshotInterpolator::Stats stats = marioInstance->interpolator.GetStats();
+        const double delayMs = marioInstance->interpolator.GetConfig().delayMs;
+        const uint64_t inboxDropped = marioInstance->inbox.Dropped();
+        marioInstance->sema.release();
+
+        BM_INFO_LOG("player {}: {:.0f} ms delay, depth {}, extrapolating {:.1f} ms, {} interpolated, {} extrapolated, "
+            "{} frozen, {} late, {} dropped, {} dropped by a full inbox", playerId, delayMs, stats.depth,
+            std::max(0.0, stats.extrapolationMs), stats.interpolatedSamples, stats.extrapolatedSamples, stats.frozenSamples,
+            stats.lateSnapshots, stats.droppedSnapshots, inboxDropped);
+    }
+    if (sm64->remoteMarios.empty()) {
+        BM_INFO_LOG("no remote marios");
+    }
+    sm64->remoteMariosSema.release();
+}, "Logs interpolation buffer depth and extrapolation time for every remote mario", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_netcode_prediction_stats", [](const std::vector<std::string>&) {
+    const std::shared_ptr<SM64> sm64 = SupersonicMarioPluginModule::Outer()->GetCustomGameMode<SM64>();
+    if (sm64 == nullptr) {
+        BM_INFO_LOG("SM64 is not loaded");
+        return;
+    }
+
+    sm64->localMario.sema.acquire();
+    const InputPredictor::Stats predictorStats = sm64->localMario.predictor.GetStats();
+    const bool hostAuthoritative = sm64->localMario.hostAuthoritative;
+    const uint32_t unacked = sm64->localMario.predictor.LastSequence() - sm64->localMario.predictor.AckedSequence();
+    sm64->localMario.sema.release();
+    BM_INFO_LOG("local mario: {}, {} predicted, {} unacked, {} acks, {} corrections, {} replayed, {} lost history, "
+        "last error {:.1f}, max error {:.1f}", hostAuthoritative ? "host simulated" : "owner simulated",
+        predictorStats.predictedInputs, unacked, predictorStats.acks, predictorStats.corrections, predictorStats.replayedInputs,
+        predictorStats.lostHistory, predictorStats.lastError, predictorStats.maxError);
+
+    sm64->remoteMariosSema.acquire();
+    for (auto const& [playerId, marioInstance] : sm64->remoteMarios) {
+        marioInstance->sema.acquire();
+        const InputSequencer::Stats stats = marioInstance->inputSequencer.GetStats();
+        const bool simulated = marioInstance->inputSequencer.Started();
+        const size_t queued = marioInstance->inputSequencer.Queued();
+        marioInstance->sema.release();
+
+        BM_INFO_LOG("player {}: {}, {} queued, {} received, {} duplicates, {} stalls, {} overflows", playerId,
+            simulated ? "simulated here" : "not simulated here", queued, stats.received, stats.duplicates, stats.stalls,
+            stats.overflows);
+    }
+    sm64->remoteMariosSema.release();
+}, "Logs client prediction corrections for the local mario and queued inputs for every remote mario", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_bench_mario_tick", [](const std::vector<std::string>& arguments) {
+    // Ticks and converts the vertices of up to maxMarios marios on worker pools of different sizes, the way OnRender
+    // does for remote marios. Run it outside of a game, the marios are created on the loaded map surfaces.
+    // libsm64 is not thread safe, every sm64_mario_tick holds sm64Sema, so only the vertex conversion runs in
+    // parallel. The share of a frame spent in the tick bounds the speedup any number of workers can give.
+    const int maxMarios = arguments.size() >= 2 ? std::clamp(std::stoi(arguments[1]), 1, 64) : 32;
+    const int frames = arguments.size() >= 3 ? std::max(1, std::stoi(arguments[2])) : 300;
+    const std::shared_ptr<SM64> sm64 = SupersonicMarioPluginModule::Outer()->GetCustomGameMode<SM64>();
+    if (sm64 == nullptr || !sm64->Sm64Initialized) {
+        BM_INFO_LOG("SM64 is not initialized");
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<std::unique_ptr<SM64MarioInstance>> marios;
+    std::vector<std::vector<Vertex>> vertices;
+    for (int i = 0; i < maxMarios; i++) {
+        auto marioInstance = std::make_unique<SM64MarioInstance>();
+        // A grid 200 units apart, so they don't land on top of each other
+        marioInstance->marioId = guardedMarioCreate((int16_t)((i % 8 - 4) * 200), 100, (int16_t)((i / 8 - 4) * 200));
+        if (marioInstance->marioId < 0) {
+            BM_INFO_LOG("could only create {} marios", i);
+            break;
+        }
+        marios.push_back(std::move(marioInstance));
+        vertices.emplace_back(SM64_GEO_MAX_TRIANGLES * 3);
+    }
+
+    std::vector<size_t> workerCounts = { 0 };
+    const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t workers : { 1, 3, 7 }) {
+        if (workers < hardwareThreads) {
+            workerCounts.push_back(workers);
+        }
+    }
+
+    for (size_t marioCount = 1; marioCount <= marios.size(); marioCount *= 2) {
+        double serialMs = 0.0;
+        double serializedShare = 1.0;
+        double serialTickMs = 0.0;
+        for (size_t workers : workerCounts) {
+            WorkerPool pool(workers);
+            // Time spent in guardedMarioTick, waiting for sm64Sema included
+            std::atomic<int64_t> tickNs = 0;
+            const auto start = Clock::now();
+            for (int frame = 0; frame < frames; frame++) {
+                pool.ParallelFor(marioCount, [&](size_t i) {
+                    SM64MarioInstance* marioInstance = marios[i].get();
+                    marioInstance->sema.acquire();
+                    // Turning around every second keeps them running without leaving the map
+                    marioInstance->marioInputs.isInput = true;
+                    marioInstance->marioInputs.stickX = (frame / 30) % 2 == 0 ? 1.0f : -1.0f;
+                    const auto tickStart = Clock::now();
+                    guardedMarioTick(marioInstance, &marioInstance->marioState);
+                    tickNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - tickStart).count();
+                    updateMarioVertices(marioInstance, vertices[i], 1.0f);
+                    marioInstance->sema.release();
+                });
+            }
+            const double frameMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+            const double tickMs = tickNs / 1e6 / frames;
+            if (workers == 0) {
+                // Nobody else wants sm64Sema, so this is only the time it is held
+                serialMs = frameMs;
+                serialTickMs = tickMs;
+                serializedShare = std::clamp(tickMs / frameMs, 0.0, 1.0);
+                BM_INFO_LOG("{:>2} marios, 0 workers: {:.3f} ms/frame, {:.3f} ms of it ticking under sm64Sema ({:.0f}% "
+                    "serialized, at most {:.2f}x with any number of workers)", marioCount, frameMs, tickMs,
+                    serializedShare * 100.0, serializedShare > 0.0 ? 1.0 / serializedShare : 0.0);
+                continue;
+            }
+
+            // Amdahl's law for the workers plus the render thread, with the tick as the serial part
+            const double bound = 1.0 / (serializedShare + (1.0 - serializedShare) / (workers + 1));
+            BM_INFO_LOG("{:>2} marios, {} workers: {:.3f} ms/frame, {:.2f}x (bound {:.2f}x), {:.3f} ms/frame spent "
+                "waiting for sm64Sema across threads", marioCount, workers, frameMs, serialMs / frameMs, bound,
+                std::max(0.0, tickMs - serialTickMs));
+        }
+    }
+
+    for (const auto& marioInstance : marios) {
+        guardedMarioDelete(marioInstance->marioId);
+        marioInstance->marioId = -2;
+    }
+}, "Times ticking remote marios on worker pools of different sizes and the share sm64Sema serializes, usage: rp_bench_mario_tick [max marios] [frames]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_sim_step_stats", [](const std::vector<std::string>&) {
+    const std::shared_ptr<SM64> sm64 = SupersonicMarioPluginModule::Outer()->GetCustomGameMode<SM64>();
+    if (sm64 == nullptr) {
+        BM_INFO_LOG("SM64 is not loaded");
+        return;
+    }
+
+    sm64->remoteMariosSema.acquire();
+    for (FixedStepScheduler* scheduler : { &sm64->localMarioSteps, &sm64->remoteMarioSteps }) {
+        const FixedStepScheduler::Stats stats = scheduler->GetStats();
+        BM_INFO_LOG("{} marios: {} steps, {} dropped, at most {} in a frame",
+            scheduler == &sm64->localMarioSteps ? "local" : "remote", stats.steps, stats.droppedSteps,
+            stats.mostStepsInAFrame);
+        scheduler->ResetStats();
+    }
+    sm64->remoteMariosSema.release();
+}, "Logs and resets how many 30 Hz steps the marios ran and dropped", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_bench_surface_grid", [](const std::vector<std::string>& arguments) {
+    // Random floor and wall queries against the default level and whatever map is loaded, e.g. LethSM64, once by
+    // testing every surface and once through the grid. Both have to find the same surfaces.
+    const int queries = arguments.size() >= 2 ? std::max(1000, std::stoi(arguments[1])) : 200000;
+    const std::shared_ptr<SM64> sm64 = SupersonicMarioPluginModule::Outer()->GetCustomGameMode<SM64>();
+
+    using Clock = std::chrono::steady_clock;
+    const auto bench = [queries](const std::string& name, const SurfaceGrid& grid) {
+        float low[3], high[3];
+        grid.Bounds(low, high);
+        std::mt19937 rng(1234);
+        std::vector<float> points(queries * 3);
+        for (int i = 0; i < queries; i++) {
+            for (int k = 0; k < 3; k++) {
+                points[i * 3 + k] = std::uniform_real_distribution<float>(low[k], high[k])(rng);
+            }
+        }
+
+        constexpr float wallRadius = 50.0f;
+        int mismatches = 0;
+        for (int i = 0; i < queries; i++) {
+            const float* p = &points[i * 3];
+            int32_t gridWalls[4], scanWalls[4];
+            const int gridCount = grid.FindWalls(p[0], p[1], p[2], wallRadius, gridWalls, 4);
+            const int scanCount = grid.FindWallsScan(p[0], p[1], p[2], wallRadius, scanWalls, 4);
+            if (grid.FindFloor(p[0], p[1], p[2], nullptr) != grid.FindFloorScan(p[0], p[1], p[2], nullptr) ||
+                gridCount != scanCount || !std::equal(gridWalls, gridWalls + gridCount, scanWalls)) {
+                mismatches++;
+            }
+        }
+
+        const auto queriesPerSecond = [&](const std::function<int(const float*)>& query) {
+            int found = 0;
+            const auto start = Clock::now();
+            for (int i = 0; i < queries; i++) {
+                found += query(&points[i * 3]) >= 0;
+            }
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            return std::make_pair(queries / seconds, found);
+        };
+        const auto floorScan = queriesPerSecond([&](const float* p) { return grid.FindFloorScan(p[0], p[1], p[2], nullptr); });
+        const auto floorGrid = queriesPerSecond([&](const float* p) { return grid.FindFloor(p[0], p[1], p[2], nullptr); });
+        const auto wallScan = queriesPerSecond([&](const float* p) {
+            int32_t walls[4];
+            return grid.FindWallsScan(p[0], p[1], p[2], wallRadius, walls, 4) - 1;
+        });
+        const auto wallGrid = queriesPerSecond([&](const float* p) {
+            int32_t walls[4];
+            return grid.FindWalls(p[0], p[1], p[2], wallRadius, walls, 4) - 1;
+        });
+
+        const std::string result = fmt::format("{}: {} surfaces in {} cells, floors {:.0f} -> {:.0f} queries/s ({:.1f}x), "
+            "walls {:.0f} -> {:.0f} queries/s ({:.1f}x), {} mismatches", name, grid.Surfaces(), grid.Cells(),
+            floorScan.first, floorGrid.first, floorGrid.first / floorScan.first, wallScan.first, wallGrid.first,
+            wallGrid.first / wallScan.first, mismatches);
+        if (mismatches == 0) {
+            BM_INFO_LOG(result);
+        }
+        else {
+            BM_ERROR_LOG(result);
+        }
+    };
+
+    SurfaceGrid defaultLevel;
+    defaultLevel.Build(surfaces, surfaces_count);
+    bench("default level", defaultLevel);
+
+    if (sm64 != nullptr && !sm64->surfaceGrid.Empty() && sm64->surfaceGrid.Surfaces() != surfaces_count) {
+        // Don't load a map while this runs
+        bench("loaded map", sm64->surfaceGrid);
+    }
+    else {
+        BM_INFO_LOG("no custom map loaded, load e.g. LethSM64 to bench it too");
+    }
+}, "Times random floor and wall queries through the surface grid against testing every surface, usage: rp_bench_surface_grid [queries]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_bench_interactions", [](const std::vector<std::string>& arguments) {
+    // Random marios around the ball, some of them attacking, once checked pair by pair like tickMarioInstance used to
+    // and once through a MarioInteractionBatch. Both have to decide the same knockbacks and ball velocity.
+    const int iterations = arguments.size() >= 2 ? std::max(100, std::stoi(arguments[1])) : 20000;
+    constexpr uint32_t actions[] = { 0, ACT_JUMP_KICK, ACT_MOVE_PUNCHING, ACT_DIVE, ACT_FLYING, ACT_GROUND_POUND_LAND };
+    const BallInteractionTuning tuning;
+    const float ballLocation[3] = { 0.0f, 0.0f, 93.0f };
+
+    using Clock = std::chrono::steady_clock;
+    for (const int marios : { 8, 16, 32, 64 }) {
+        std::mt19937 rng(marios);
+        // Close enough together that some of them reach each other and the ball
+        std::uniform_real_distribution<float> spread(-600.0f, 600.0f);
+        std::vector<SM64MarioBodyState> bodyStates(marios);
+        for (SM64MarioBodyState& bodyState : bodyStates) {
+            bodyState.marioState.position[0] = spread(rng);
+            bodyState.marioState.position[1] = 93.0f + spread(rng) * 0.25f;
+            bodyState.marioState.position[2] = spread(rng);
+            bodyState.action = actions[rng() % std::size(actions)];
+        }
+
+        std::vector<SM64MarioInputs> pairInputs(marios);
+        std::vector<SM64MarioInputs> batchInputs(marios);
+        float pairVelocity[3] = {};
+        float batchVelocity[3] = {};
+        const auto byPairs = [&]() {
+            std::fill(pairVelocity, pairVelocity + 3, 0.0f);
+            for (int i = 0; i < marios; i++) {
+                ClearMarioAttack(&pairInputs[i]);
+                for (int other = 0; other < marios && !pairInputs[i].attackInput.isAttacked; other++) {
+                    if (other != i) {
+                        ApplyMarioAttack(bodyStates[i].marioState.position, bodyStates[other], &pairInputs[i]);
+                    }
+                }
+                ApplyBallInteraction(bodyStates[i], ballLocation, pairVelocity, tuning);
+            }
+        };
+        MarioInteractionBatch batch;
+        std::vector<uint8_t> hits;
+        const auto batched = [&]() {
+            std::fill(batchVelocity, batchVelocity + 3, 0.0f);
+            batch.Clear();
+            for (const SM64MarioBodyState& bodyState : bodyStates) {
+                batch.Add(bodyState);
+            }
+            for (int i = 0; i < marios; i++) {
+                ClearMarioAttack(&batchInputs[i]);
+                batch.ApplyAttack(bodyStates[i].marioState.position, i, &batchInputs[i]);
+            }
+            batch.ResolveBall(ballLocation, batchVelocity, tuning, hits);
+        };
+        const auto nsPerTick = [iterations](const std::function<void()>& tick) {
+            const auto start = Clock::now();
+            for (int i = 0; i < iterations; i++) {
+                tick();
+            }
+            return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+        };
+        const double pairNs = nsPerTick(byPairs);
+        const double batchNs = nsPerTick(batched);
+
+        int attacked = 0;
+        int mismatches = 0;
+        for (int i = 0; i < marios; i++) {
+            const auto& a = pairInputs[i].attackInput;
+            const auto& b = batchInputs[i].attackInput;
+            attacked += a.isAttacked;
+            if (a.isAttacked != b.isAttacked || a.attackedPosX != b.attackedPosX || a.attackedPosY != b.attackedPosY ||
+                a.attackedPosZ != b.attackedPosZ) {
+                mismatches++;
+            }
+        }
+        if (!std::equal(pairVelocity, pairVelocity + 3, batchVelocity)) {
+            mismatches++;
+        }
+
+        const std::string result = fmt::format("{} marios: {} attacked, ball hit to {:.0f} {:.0f} {:.0f}, pair by pair {:.0f} ns -> "
+            "batched {:.0f} ns a step ({:.1f}x), {} mismatches", marios, attacked, batchVelocity[0], batchVelocity[1],
+            batchVelocity[2], pairNs, batchNs, pairNs / batchNs, mismatches);
+        if (mismatches == 0) {
+            BM_INFO_LOG(result);
+        }
+        else {
+            BM_ERROR_LOG(result);
+        }
+    }
+}, "Times knockbacks and ball hits of 8 to 64 marios checked pair by pair against a batch, usage: rp_bench_interactions [iterations]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_bench_map_cache", [](const std::vector<std::string>& arguments) {
+    // Loads a supported map once through Assimp, which also rewrites its cache file, and once from the cache file.
+    // Both have to give the same surfaces and vertices.
+    const std::string map = arguments.size() >= 2 ? arguments[1] : "LethSM64";
+    const std::shared_ptr<SM64> sm64 = SupersonicMarioPluginModule::Outer()->GetCustomGameMode<SM64>();
+    if (sm64 == nullptr) {
+        BM_INFO_LOG("SM64 is not loaded");
+        return;
+    }
+
+    // The loader logs every stage's time as well
+    using Clock = std::chrono::steady_clock;
+    const auto timed = [&](bool useCache) {
+        const auto start = Clock::now();
+        std::shared_ptr<MapSurfaces> surfaces = sm64->mapLoader.Load(map, useCache).get();
+        return std::make_pair(surfaces, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    };
+    const auto [cold, coldMs] = timed(false);
+    if (cold == nullptr) {
+        BM_ERROR_LOG("rp_bench_map_cache: {} is not a supported map", quote(map));
+        return;
+    }
+    const auto [warm, warmMs] = timed(true);
+
+    const bool same = warm != nullptr && warm->Mapped() &&
+        warm->SurfaceCount() == cold->SurfaceCount() && warm->VertexCount() == cold->VertexCount() &&
+        memcmp(warm->Surfaces(), cold->Surfaces(), cold->SurfaceCount() * sizeof(struct SM64Surface)) == 0 &&
+        memcmp(warm->Vertices(), cold->Vertices(), cold->VertexCount() * sizeof(Vertex)) == 0;
+    const std::string result = fmt::format("rp_bench_map_cache: {}, {} surfaces, cold {:.1f}ms, warm {:.1f}ms ({:.1f}x)",
+        map, cold->SurfaceCount(), coldMs, warmMs, coldMs / warmMs);
+    if (same) {
+        BM_INFO_LOG(result + ": passed");
+    }
+    else {
+        BM_ERROR_LOG(result + ": failed, the cache does not match the converted map");
+    }
+}, "Times loading a custom map through Assimp against loading it from the map cache, usage: rp_bench_map_cache [map]", PERMISSION_ALL); }
+
+
+RP_EXTERNAL_DEBUG_NOTIFIER("rp_bench_file_hash", [](const std::vector<std::string>& arguments) {
+    // Hashes a synthetic file the size of a large map package by reading it whole, by streaming it in chunks, through
+    // a mapped view and through the hash cache. All have to give the same hash.
+    const size_t megabytes = arguments.size() >= 2 ? std::max(1, std::stoi(arguments[1])) : 512;
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "rp_bench_file_hash.bin";
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::mt19937_64 rng(1234);
+        std::vector<uint64_t> block((1 << 20) / sizeof(uint64_t));
+        for (size_t i = 0; i < megabytes; i++) {
+            std::generate(block.begin(), block.end(), std::ref(rng));
+            out.write((const char*)block.data(), block.size() * sizeof(uint64_t));
+        }
+        if (!out) {
+            BM_ERROR_LOG("rp_bench_file_hash: could not write {}", path.string());
+            return;
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<std::string> results;
+    std::vector<XXH128_hash_t> hashes;
+    const auto timed = [&](const std::string& name, size_t bufferBytes, const std::function<bool(XXH128_hash_t*)>& hash) {
+        XXH128_hash_t result = {};
+        const auto start = Clock::now();
+        const bool ok = hash(&result);
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        hashes.push_back(ok ? result : XXH128_hash_t{});
+        results.push_back(fmt::format("{} {:.0f} MB/s holding {} KB", name, megabytes / seconds, bufferBytes / 1024));
+    };
+
+    timed("whole", megabytes << 20, [&](XXH128_hash_t* hash) {
+        size_t length;
+        uint8_t* data = Utils::readFileAlloc(path.string(), &length);
+        if (data == nullptr) return false;
+        *hash = XXH3_128bits(data, length);
+        free(data);
+        return true;
+    });
+    timed("streamed", FILE_HASH_CHUNK_SIZE, [&](XXH128_hash_t* hash) { return HashFileStreamed(path, hash); });
+    timed("mapped", 0, [&](XXH128_hash_t* hash) { return HashFileMapped(path, hash); });
+    FileHashCache& cache = FileHashCache::getInstance();
+    cache.Forget(path);
+    timed("first cached", FILE_HASH_CHUNK_SIZE, [&](XXH128_hash_t* hash) { return cache.Hash(path, hash); });
+    timed("cache hit", 0, [&](XXH128_hash_t* hash) { return cache.Hash(path, hash); });
+    cache.Forget(path);
+
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    bool same = !XXH128_isEqual(hashes[0], XXH128_hash_t{});
+    for (const XXH128_hash_t& hash : hashes) {
+        same = same && XXH128_isEqual(hash, hashes[0]);
+    }
+    const std::string result = fmt::format("rp_bench_file_hash: {} MB, {}", megabytes, fmt::join(results, ", "));
+    if (same) {
+        BM_INFO_LOG(result + ": passed");
+    }
+    else {
+        BM_ERROR_LOG(result + ": failed, the hashes differ");
+    }
+}, "Times hashing a synthetic map sized file read whole, streamed, mapped and through the hash cache, usage: rp_bench_file_hash [MB]", PERMISSION_ALL); }
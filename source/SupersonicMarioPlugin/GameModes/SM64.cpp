@@ -10,17 +10,7 @@
 #define CAR_OFFSET_Z 45.0f
 #define SM64_TEXTURE_SIZE (4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT)
 #define WINGCAP_VERTEX_INDEX 750
-#define ATTACK_BOOST_DAMAGE 0.20f
-#define GROUND_POUND_BALL_RADIUS 200.0f
-#define GROUND_POUND_PINCH_VELOCITY 2708.0f
-#define ATTACK_BALL_RADIUS 261.0f
-#define KICK_BALL_VEL_HORIZ 583.0f
-#define KICK_BALL_VEL_VERT 305.0f
-#define PUNCH_BALL_VEL_HORIZ 1388.0f
-#define PUNCH_BALL_VEL_VERT 250.0f
-#define DIVE_BALL_VEL_HORIZ 639.0f
-#define DIVE_BALL_VEL_VERT 166.6f
-#define FLY_BALL_VEL 500.0f
+#define MAP_MAX_TRIANGLES 10000000
 #define IM_COL32_ERROR_BANNER (ImColor(211,  47,  47, 255))
 
 #define OCTANE_ID 23
@@ -32,10 +22,73 @@ inline void tickMarioInstance(SM64MarioInstance* marioInstance,
 	CarWrapper car,
 	SM64* instance);
 
-void MessageReceived(char* buf, int len);
+void MessageReceived(const NetcodeFrame& frame);
 
 SM64* self = nullptr;
 
+std::ofstream bodyStateRecording;
+std::counting_semaphore<1> bodyStateRecordingSema{ 1 };
+std::atomic<bool> isRecordingBodyState = false;
+
+uint64_t netcodeNowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void recordBodyState(int playerId, const SM64MarioBodyState& bodyState)
+{
+	if (!isRecordingBodyState) return;
+
+	uint64_t timestamp = netcodeNowMs();
+	bodyStateRecordingSema.acquire();
+	bodyStateRecording.write((const char*)&timestamp, sizeof(timestamp));
+	bodyStateRecording.write((const char*)&playerId, sizeof(playerId));
+	bodyStateRecording.write((const char*)&bodyState, sizeof(bodyState));
+	bodyStateRecordingSema.release();
+}
+
+MarioReplayWriter replayRecording;
+std::counting_semaphore<1> replayRecordingSema{ 1 };
+std::atomic<bool> isRecordingReplay = false;
+
+void recordReplayStep(const MarioReplayBall& ball, const MarioReplayMario& mario)
+{
+	replayRecordingSema.acquire();
+	replayRecording.WriteStep(ball, &mario);
+	replayRecordingSema.release();
+}
+
+// libsm64 binds the mario it works on into its globals for the length of a call, so calls from the game thread,
+// the render thread and the tick workers have to take turns
+std::counting_semaphore<1> sm64Sema{ 1 };
+
+int32_t guardedMarioCreate(int16_t x, int16_t y, int16_t z)
+{
+	sm64Sema.acquire();
+	int32_t marioId = sm64_mario_create(x, y, z);
+	sm64Sema.release();
+	return marioId;
+}
+
+void guardedMarioDelete(int32_t marioId)
+{
+	sm64Sema.acquire();
+	sm64_mario_delete(marioId);
+	sm64Sema.release();
+}
+
+void guardedMarioTick(SM64MarioInstance* marioInstance, struct SM64MarioState* marioState)
+{
+	sm64Sema.acquire();
+	sm64_mario_tick(marioInstance->marioId,
+		&marioInstance->marioInputs,
+		marioState,
+		&marioInstance->marioGeometry,
+		&marioInstance->marioBodyState);
+	sm64Sema.release();
+}
+
 SM64::SM64(std::shared_ptr<GameWrapper> gw, std::shared_ptr<CVarManagerWrapper> cm, BakkesMod::Plugin::PluginInfo exports)
 {
 	using namespace std::placeholders;
@@ -49,17 +102,7 @@ SM64::SM64(std::shared_ptr<GameWrapper> gw, std::shared_ptr<CVarManagerWrapper>
 	gameWrapper->HookEventPost("Function GameEvent_Soccar_TA.PostGoalScored.Tick", bind(&SM64::onGoalScored, this, _1));
 	gameWrapper->HookEventPost("Function TAGame.GameEvent_Soccar_TA.EventMatchWinnerSet", bind(&SM64::onMatchWinnerSet, this, _1));
 
-	attackBoostDamage = ATTACK_BOOST_DAMAGE;
-
-	groundPoundPinchVel = GROUND_POUND_PINCH_VELOCITY;
-	attackBallRadius = ATTACK_BALL_RADIUS;
-	kickBallVelHoriz = KICK_BALL_VEL_HORIZ;
-	kickBallVelVert = KICK_BALL_VEL_VERT;
-	punchBallVelHoriz = PUNCH_BALL_VEL_HORIZ;
-	punchBallVelVert = PUNCH_BALL_VEL_VERT;
-	diveBallVelHoriz = DIVE_BALL_VEL_HORIZ;
-	diveBallVelVert = DIVE_BALL_VEL_VERT;
-	flyBallVel = FLY_BALL_VEL;
+	tuning.Watch(Utils::GetBakkesmodFolderPath() + MARIO_TUNING_FILE_NAME);
 
 	matchSettings.bljSetup.bljState = SM64_BLJ_STATE_DISABLED;
 	matchSettings.bljSetup.bljVel = 0;
@@ -136,7 +179,7 @@ SM64::SM64(std::shared_ptr<GameWrapper> gw, std::shared_ptr<CVarManagerWrapper>
 
 	self = this;
 
-	// Register callback to receiving TCP data from server/clients
+	// Register callback to receiving framed TCP data from server/clients
 	Networking::RegisterCallback(MessageReceived);
 }
 
@@ -165,16 +208,49 @@ void SM64::OnGameLeft(bool deleteMario)
 	matchSettingsSema.acquire();
 	matchSettings.isInSm64Game = false;
 	matchSettingsSema.release();
+	tuning.ReleaseOverride();
 	if (localMario.model != nullptr)
 	{
 		localMario.model->RenderUpdateVertices(0, nullptr);
 	}
 
+	// Respawned marios start over with their owners simulating them, the host takes over again from their first state
+	receiveSema.acquire();
+	for (int playerId : hostAuthoritativeStreams)
+	{
+		bodyStateFilter.Forget(playerId);
+		bodyStateDecoders.erase(playerId);
+	}
+	hostAuthoritativeStreams.clear();
+	if (deleteMario)
+	{
+		// Control messages still on their way are dropped by the render thread
+		receivingMarios.clear();
+		bodyStateFilter.Reset();
+		bodyStateDecoders.clear();
+		receiveGeneration++;
+	}
+	publishAcks();
+	receiveSema.release();
+
+	remoteMariosSema.acquire();
+	localMario.sema.acquire();
+	if (localMario.hostAuthoritative)
+	{
+		bodyStateEncoder.Reset();
+	}
+	localMario.ResetPrediction();
+	localMario.sema.release();
+	// The next game starts its own clock instead of catching up on the time in between
+	localMarioSteps.Reset();
+	remoteMarioSteps.Reset();
+	remoteMariosSema.release();
+
 	if (localMario.marioId >= 0)
 	{
 		if (deleteMario)
 		{
-			sm64_mario_delete(localMario.marioId);
+			guardedMarioDelete(localMario.marioId);
 			localMario.marioId = -2;
 		}
 		else
@@ -218,7 +294,7 @@ void SM64::OnGameLeft(bool deleteMario)
 		}
 		if (deleteMario && marioInstance->marioId >= 0)
 		{
-			sm64_mario_delete(marioInstance->marioId);
+			guardedMarioDelete(marioInstance->marioId);
 			marioInstance->marioId = -2;
 		}
 		if (isHost && deleteMario && marioInstance->colorIndex >= 0)
@@ -232,11 +308,14 @@ void SM64::OnGameLeft(bool deleteMario)
 			marioInstance->marioBodyState.marioState.position[1] = 0.0f;
 			marioInstance->marioBodyState.marioState.position[2] = 0.0f;
 		}
+		marioInstance->interpolator.Reset();
+		marioInstance->ResetPrediction();
 		marioInstance->sema.release();
 	}
 	if (deleteMario)
 	{
 		remoteMarios.clear();
+		bodyStateEncoder.Reset();
 		Activate(false);
 	}
 
@@ -386,117 +465,684 @@ void SM64::menuPopped(ServerWrapper server)
 		menuStackCount--;
 }
 
-void SM64::MarioMessageReceived(char* buf, int len)
+void SM64::MarioMessageReceived(char* buf, int len, uint32_t sequence, bool authoritative)
 {
-	auto marioMsgLen = sizeof(struct SM64MarioBodyState) + sizeof(int);
-	uint8_t* targetData = (uint8_t*)buf;
-	if (len != marioMsgLen) return;
-
+	// NetcodeRelevance (int playerId, int16 position[3]), uint16 sender time, varint last input sequence applied,
+	// uint8 ack count, acks for other players' streams, delta encoded body state. Authoritative states come from
+	// the host once it simulates playerId's mario from its inputs.
+	// Runs on the network threads, which only hand the result to the render thread and never wait for it.
+	if (len < sizeof(NetcodeRelevance) + sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t)) return;
+	if (self->isHost && authoritative) return;
+	const uint8_t* data = (const uint8_t*)buf;
 	int playerId = *((int*)buf);
+	size_t offset = sizeof(NetcodeRelevance);
+	ReceivedBodyState received;
+	received.arrivalMs = netcodeNowMs();
+	received.authoritative = authoritative;
+	memcpy(&received.senderTime, data + offset, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+	size_t read = SnapshotVarint::Read(data + offset, len - offset, &received.inputSequence);
+	if (read == 0) return;
+	offset += read;
+
+	// Only the host gets to tell us where our own mario is
+	bool isLocalMario = playerId == self->localPlayerId;
+	if (isLocalMario && !authoritative) return;
+
+	self->receiveSema.acquire();
+	uint32_t generation = self->receiveGeneration;
+	bool wasAuthoritative = self->hostAuthoritativeStreams.count(playerId) > 0;
+	if (wasAuthoritative && !authoritative)
+	{
+		// Sent by the owner before the host took over, its inputs carry its acks from then on
+		self->receiveSema.release();
+		return;
+	}
+	if (authoritative && !wasAuthoritative)
+	{
+		// The host's stream replaces the owner's, with its own sequences and snapshot ids
+		self->bodyStateFilter.Forget(playerId);
+		self->bodyStateDecoders.erase(playerId);
+	}
+
+	// Body state can arrive over UDP out of order, never let an older snapshot overwrite a newer one
+	MarioControlMessage ackMessage;
+	if (!self->bodyStateFilter.Accept(playerId, sequence) || !self->readAcks(data, len, offset, ackMessage.acks))
+	{
+		self->receiveSema.release();
+		return;
+	}
+	if (ackMessage.acks.count > 0)
+	{
+		ackMessage.type = MarioControlType::ACKS;
+		ackMessage.generation = generation;
+		ackMessage.playerId = playerId;
+		self->controlInbox.TryPush(ackMessage);
+	}
+
+	uint16_t snapshotId;
+	auto& decoder = self->bodyStateDecoders.try_emplace(playerId, BodyStateCodec()).first->second;
+	auto result = decoder.Decode(data + offset, len - offset, &received.bodyState, &snapshotId);
+	// A missing baseline gets a keyframe requested through our next ack
+	self->publishAcks();
+	if (result != SnapshotStreamDecoder::Result::OK)
+	{
+		self->receiveSema.release();
+		return;
+	}
+	if (authoritative)
+	{
+		self->hostAuthoritativeStreams.insert(playerId);
+	}
+
+	if (isLocalMario)
+	{
+		// Reconciled on our next tick, only the newest correction matters
+		MarioCorrection& correction = self->localMario.corrections.Back();
+		correction.sequence = received.inputSequence;
+		correction.bodyState = received.bodyState;
+		self->localMario.corrections.Publish();
+		self->receiveSema.release();
+		return;
+	}
 
 	SM64MarioInstance* marioInstance = nullptr;
-	self->remoteMariosSema.acquire();
-	if (self->remoteMarios.count(playerId) == 0)
+	if (self->receivingMarios.count(playerId) > 0)
 	{
-		// Initialize mario for this player
-		marioInstance = new SM64MarioInstance();
-		self->remoteMarios[playerId] = marioInstance;
+		marioInstance = self->receivingMarios[playerId];
 	}
 	else
 	{
-		marioInstance = self->remoteMarios[playerId];
+		// Initialize mario for this player, the render thread adds it to remoteMarios
+		marioInstance = new SM64MarioInstance();
+		marioInstance->playerId = playerId;
+		self->receivingMarios[playerId] = marioInstance;
+
+		MarioControlMessage newMario;
+		newMario.type = MarioControlType::NEW_MARIO;
+		newMario.generation = generation;
+		newMario.playerId = playerId;
+		newMario.marioInstance = marioInstance;
+		if (!self->controlInbox.TryPush(newMario))
+		{
+			// Try again with the next snapshot
+			self->receivingMarios.erase(playerId);
+			delete marioInstance;
+			self->receiveSema.release();
+			return;
+		}
 	}
-	self->remoteMariosSema.release();
 
-	marioInstance->sema.acquire();
-	memcpy(&marioInstance->marioBodyState, targetData + sizeof(int), marioMsgLen - sizeof(int));
-	marioInstance->sema.release();
+	// Played back from the interpolator when rendering, so arrival jitter doesn't show
+	marioInstance->inbox.TryPush(received);
+	self->receiveSema.release();
+	recordBodyState(playerId, received.bodyState);
+	self->marioStateReceived = true;
+}
 
-	self->matchSettingsSema.acquire();
-	self->matchSettings.isInSm64Game = true;
-	self->matchSettingsSema.release();
+void SM64::MarioInputMessageReceived(char* buf, int len)
+{
+	// int playerId, varint first input sequence, uint8 input count, inputs, uint8 ack count, acks for other players' streams
+	if (!self->isHost) return;
+	if (len < sizeof(int) + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint8_t)) return;
+	const uint8_t* data = (const uint8_t*)buf;
+	MarioControlMessage message;
+	message.type = MarioControlType::INPUTS;
+	message.generation = self->receiveGeneration;
+	message.playerId = *((int*)buf);
+	size_t offset = sizeof(int);
+	size_t read = SnapshotVarint::Read(data + offset, len - offset, &message.firstSequence);
+	if (read == 0 || len - offset - read < sizeof(uint8_t)) return;
+	offset += read;
+	message.inputCount = data[offset++];
+	size_t inputsLen = message.inputCount * sizeof(struct SM64MarioInputs);
+	if (message.inputCount > PREDICTION_MAX_SENT_INPUTS || len - offset < inputsLen) return;
+	memcpy(message.inputs, data + offset, inputsLen);
+	offset += inputsLen;
+	if (!self->readAcks(data, len, offset, message.acks)) return;
+
+	// Inputs from before the owner's first body state are dropped, it keeps repeating the unacked ones
+	self->controlInbox.TryPush(message);
 }
 
-void SM64::MatchSettingsMessageReceived(char* buf, int len)
+bool SM64::readAcks(const uint8_t* data, size_t len, size_t& offset, BodyStateAcks& acks)
 {
-	auto settingsMsgLen = sizeof(MatchSettings) + sizeof(int);
-	if (len != settingsMsgLen) return;
+	if (len - offset < sizeof(uint8_t)) return false;
+	uint8_t ackCount = data[offset++];
+
+	acks.count = 0;
+	for (int i = 0; i < ackCount; i++)
+	{
+		uint32_t streamPlayerId = 0;
+		size_t read = SnapshotVarint::Read(data + offset, len - offset, &streamPlayerId);
+		if (read == 0 || len - offset - read < sizeof(uint8_t)) return false;
+		offset += read;
+		uint8_t ackId = data[offset++];
+
+		if (acks.count < MAX_NUM_PLAYERS)
+		{
+			acks.playerIds[acks.count] = (int)streamPlayerId;
+			acks.ackIds[acks.count] = ackId;
+			acks.count++;
+		}
+	}
+	return true;
+}
+
+// Assumes receiveSema is already acquired. Don't acquire here!
+void SM64::publishAcks()
+{
+	BodyStateAcks& acks = bodyStateAcks.Back();
+	acks.count = 0;
+	for (auto const& [playerId, decoder] : bodyStateDecoders)
+	{
+		if (acks.count == MAX_NUM_PLAYERS) break;
+
+		acks.playerIds[acks.count] = playerId;
+		acks.ackIds[acks.count] = decoder.AckId();
+		acks.count++;
+	}
+	bodyStateAcks.Publish();
+}
 
-	self->matchSettingsSema.acquire();
-	memcpy(&self->matchSettings, buf + sizeof(int), settingsMsgLen - sizeof(int));
-	self->matchSettingsSema.release();
+// Assumes remoteMariosSema is already acquired. Don't acquire here!
+size_t SM64::writeAcks(uint8_t* data, size_t offset, size_t maxLen, size_t reserve)
+{
+	// Piggyback acks for every stream we decode, so senders know which baselines we have
+	bodyStateAcks.Update();
+	const BodyStateAcks& acks = bodyStateAcks.Front();
+	size_t ackCountOffset = offset++;
+	uint8_t ackCount = 0;
+	size_t ackSize = SNAPSHOT_VARINT_MAX_SIZE + sizeof(uint8_t);
+	for (int i = 0; i < acks.count; i++)
+	{
+		if (maxLen - offset < ackSize + reserve) break;
+
+		offset += SnapshotVarint::Write((uint32_t)acks.playerIds[i], data + offset, maxLen - offset);
+		data[offset++] = acks.ackIds[i];
+		ackCount++;
+	}
+	data[ackCountOffset] = ackCount;
+	return offset;
+}
+
+// Assumes remoteMariosSema is already acquired. Don't acquire here!
+void SM64::applyAcks(int senderId, const BodyStateAcks& acks)
+{
+	uint64_t now = netcodeNowMs();
+	for (int i = 0; i < acks.count; i++)
+	{
+		int streamPlayerId = acks.playerIds[i];
+		if (streamPlayerId == localMario.playerId)
+		{
+			bodyStateEncoder.Ack(senderId, acks.ackIds[i], now);
+		}
+		else if (isHost && remoteMarios.count(streamPlayerId) > 0)
+		{
+			// Acks for a mario we simulate are for our stream of it
+			auto& authorityEncoder = remoteMarios[streamPlayerId]->authorityEncoder;
+			if (authorityEncoder != nullptr)
+			{
+				authorityEncoder->Ack(senderId, acks.ackIds[i], now);
+			}
+		}
+	}
+}
+
+// Assumes remoteMariosSema is already acquired. Don't acquire here!
+// Returns whether the host's match settings asked us to join its game.
+bool SM64::drainControlInbox()
+{
+	uint32_t generation = receiveGeneration;
+	bool joinRequested = false;
+	MarioControlMessage message;
+	while (controlInbox.TryPop(message))
+	{
+		// Settings aren't part of a stream, they still count after leaving a game
+		if (message.type == MarioControlType::MATCH_SETTINGS)
+		{
+			joinRequested = applyMatchSettings(message.matchSettings) || joinRequested;
+			continue;
+		}
+		if (message.generation != generation)
+		{
+			// Its stream was forgotten when we left the game, nothing else points to it
+			if (message.type == MarioControlType::NEW_MARIO)
+			{
+				delete message.marioInstance;
+			}
+			continue;
+		}
+
+		switch (message.type)
+		{
+		case MarioControlType::NEW_MARIO:
+			remoteMarios[message.playerId] = message.marioInstance;
+			break;
+		case MarioControlType::INPUTS:
+			if (remoteMarios.count(message.playerId) > 0)
+			{
+				SM64MarioInstance* marioInstance = remoteMarios[message.playerId];
+				marioInstance->sema.acquire();
+				marioInstance->inputSequencer.Push(message.firstSequence, message.inputs, message.inputCount);
+				marioInstance->sema.release();
+			}
+			applyAcks(message.playerId, message.acks);
+			break;
+		case MarioControlType::ACKS:
+			applyAcks(message.playerId, message.acks);
+			break;
+		default:
+			break;
+		}
+	}
+	return joinRequested;
+}
+
+// Assumes remoteMariosSema is already acquired. Don't acquire here!
+// Returns whether the settings ask us to join the host's game.
+bool SM64::applyMatchSettings(const MatchSettings& settings)
+{
+	matchSettingsSema.acquire();
+	matchSettings = settings;
+	matchSettingsSema.release();
+
+	if (!isHost && settings.tuning.version == MARIO_TUNING_VERSION)
+	{
+		tuning.Override(settings.tuning);
+	}
 
 	// Sync player colors
-	self->remoteMariosSema.acquire();
-	self->localMario.sema.acquire();
-	int localMarioPlayerId = self->localMario.playerId;
-	self->localMario.sema.release();
-	for (int i = 0; i < self->matchSettings.playerCount; i++)
-	{
-		int playerId = self->matchSettings.playerIds[i];
-		int colorIndex = self->matchSettings.playerColorIndices[i];
-		bool isCar = self->matchSettings.playerIsCarFlags[i];
+	localMario.sema.acquire();
+	int localMarioPlayerId = localMario.playerId;
+	localMario.sema.release();
+	int playerCount = std::clamp(settings.playerCount, 0, MAX_NUM_PLAYERS);
+	for (int i = 0; i < playerCount; i++)
+	{
+		int playerId = settings.playerIds[i];
 		SM64MarioInstance* marioInstance = nullptr;
-		if (self->remoteMarios.count(playerId) > 0)
+		if (remoteMarios.count(playerId) > 0)
 		{
-			marioInstance = self->remoteMarios[playerId];
+			marioInstance = remoteMarios[playerId];
 		}
 		else if (playerId == localMarioPlayerId)
 		{
-			marioInstance = &self->localMario;
+			marioInstance = &localMario;
 		}
 
 		if (marioInstance != nullptr)
 		{
 			marioInstance->sema.acquire();
-			marioInstance->colorIndex = colorIndex;
-			marioInstance->isCar = isCar;
+			marioInstance->colorIndex = settings.playerColorIndices[i];
+			marioInstance->isCar = settings.playerIsCarFlags[i];
 			marioInstance->sema.release();
 		}
 	}
 
-	self->remoteMariosSema.release();
+	return settings.joinGame;
+}
 
-	if( self->matchSettings.joinGame )
-	{
-		OnGameLeft(true);
+// Leaves our game and joins the host's once it answers pings, which is waited for off the render thread
+void SM64::joinHostGame()
+{
+	OnGameLeft(true);
 
-		static const char pswdBuf[64] = "";
-		static const int MAX_WAIT_CYCLES = 4;
-        static Networking::HostStatus hostOnline = Networking::HostStatus::HOST_UNKNOWN;
-		static std::shared_ptr<std::string> joinIP = std::make_shared<std::string>();
-		static std::shared_ptr<int> joinPort = std::make_shared<int>(DEFAULT_PORT);
+	static const char pswdBuf[64] = "";
+	static const int MAX_WAIT_CYCLES = 4;
+	static Networking::HostStatus hostOnline = Networking::HostStatus::HOST_UNKNOWN;
+	static std::shared_ptr<std::string> joinIP = std::make_shared<std::string>();
+	static std::shared_ptr<int> joinPort = std::make_shared<int>(DEFAULT_PORT);
 
-		hostOnline = Networking::HostStatus::HOST_UNKNOWN;
-		*joinIP = cvarManager->getCvar("mp_ip").getStringValue();
-		*joinPort = cvarManager->getCvar("mp_port").getIntValue();
+	hostOnline = Networking::HostStatus::HOST_UNKNOWN;
+	*joinIP = cvarManager->getCvar("mp_ip").getStringValue();
+	*joinPort = cvarManager->getCvar("mp_port").getIntValue();
 
+	std::thread([this]() {
 		int waits = 0;
-		while( hostOnline != Networking::HostStatus::HOST_ONLINE && waits <= MAX_WAIT_CYCLES)
+		while (hostOnline != Networking::HostStatus::HOST_ONLINE && waits <= MAX_WAIT_CYCLES)
 		{
-		std::this_thread::sleep_for(std::chrono::milliseconds(250));
-		waits++;
-		Networking::PingHost(*joinIP, static_cast<unsigned short>(*joinPort), &hostOnline, true);
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+			waits++;
+			Networking::PingHost(*joinIP, static_cast<unsigned short>(*joinPort), &hostOnline, true);
 		}
 
 		Execute([this](GameWrapper*) {
 			SupersonicMarioPluginModule::Outer()->JoinGame(pswdBuf);
-        });
+		});
+	}).detach();
+}
+
+// Assumes the mario's sema is already acquired. Don't acquire here!
+void SM64::drainMarioInbox(SM64MarioInstance* marioInstance)
+{
+	ReceivedBodyState received;
+	while (marioInstance->inbox.TryPop(received))
+	{
+		if (received.authoritative && !marioInstance->hostAuthoritative)
+		{
+			// Different sender clock, start playback over
+			marioInstance->hostAuthoritative = true;
+			marioInstance->interpolator.Reset();
+		}
+		if (isHost && !received.authoritative)
+		{
+			// The owner's newest state and the last of its inputs in it, taken over from once its inputs arrive
+			marioInstance->ownerBodyState = received.bodyState;
+			marioInstance->ownerInputSequence = received.inputSequence;
+		}
+		if (isHost && marioInstance->hostAuthoritative)
+		{
+			continue;
+		}
 
+		uint32_t senderMs = marioInstance->interpolator.UnwrapTime(received.senderTime);
+		marioInstance->interpolator.Push(senderMs, (double)received.arrivalMs, &received.bodyState);
 	}
 }
 
-void MessageReceived(char* buf, int len)
+int SM64::encodeBodyState(SM64MarioInstance* marioInstance, SnapshotStreamEncoder& encoder, uint32_t inputSequence,
+	char* out, int outLen)
 {
-	if (len < sizeof(int)) return;
-	int messageId = *((int*)buf);
-	if (messageId == -1)
+	uint8_t* data = (uint8_t*)out;
+	size_t maxLen = (size_t)outLen;
+	if (maxLen < sizeof(NetcodeRelevance) + sizeof(uint16_t) + SNAPSHOT_VARINT_MAX_SIZE + sizeof(uint8_t) + encoder.MaxEncodedSize()) return 0;
+
+	// Relays thin out our state for players far away from this position
+	NetcodeRelevance relevance;
+	relevance.playerId = marioInstance->playerId;
+	for (int i = 0; i < 3; i++)
 	{
-		self->MatchSettingsMessageReceived(buf, len);
+		relevance.position[i] = (int16_t)std::clamp(marioInstance->marioBodyState.marioState.position[i], (float)INT16_MIN, (float)INT16_MAX);
+	}
+	memcpy(data, &relevance, sizeof(NetcodeRelevance));
+	size_t offset = sizeof(NetcodeRelevance);
+	// Lets receivers play snapshots back at the rate they were taken, which follows our frame rate
+	uint64_t now = netcodeNowMs();
+	uint16_t senderTime = (uint16_t)now;
+	memcpy(data + offset, &senderTime, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+	offset += SnapshotVarint::Write(inputSequence, data + offset, maxLen - offset);
+
+	if (&encoder == &bodyStateEncoder)
+	{
+		offset = writeAcks(data, offset, maxLen, encoder.MaxEncodedSize());
 	}
 	else
 	{
-		self->MarioMessageReceived(buf, len);
+		// Receivers take acks as the sender's, not ours, in the host's states of other players' marios
+		data[offset++] = 0;
+	}
+
+	size_t encoded = encoder.Encode(&marioInstance->marioBodyState, now, data + offset, maxLen - offset);
+	if (encoded == 0) return 0;
+
+	return (int)(offset + encoded);
+}
+
+// Assumes remoteMariosSema is already acquired. Don't acquire here!
+void SM64::sendMarioInputs(SM64MarioInstance* marioInstance)
+{
+	if (isHost) return;
+
+	// int playerId, varint first input sequence, uint8 input count, inputs, uint8 ack count, acks for other players' streams
+	uint8_t* data = (uint8_t*)netcodeOutBuf;
+	size_t maxLen = SM64_NETCODE_BUF_LEN;
+	struct SM64MarioInputs inputs[PREDICTION_MAX_SENT_INPUTS];
+	uint32_t firstSequence = 0;
+	// The newest unacked inputs go out every time, so a lost message is covered by the next ones
+	size_t inputCount = marioInstance->predictor.UnackedInputs(PREDICTION_MAX_SENT_INPUTS, inputs, &firstSequence);
+	if (inputCount == 0) return;
+
+	memcpy(data, &marioInstance->playerId, sizeof(int));
+	size_t offset = sizeof(int);
+	offset += SnapshotVarint::Write(firstSequence, data + offset, maxLen - offset);
+	data[offset++] = (uint8_t)inputCount;
+	memcpy(data + offset, inputs, inputCount * sizeof(struct SM64MarioInputs));
+	offset += inputCount * sizeof(struct SM64MarioInputs);
+	// We stop sending body states once the host simulates us, acks for everyone else's have to go out with the inputs
+	offset = writeAcks(data, offset, maxLen, 0);
+
+	Networking::SendBytes(NetcodeMessageType::MARIO_INPUT, netcodeOutBuf, (int)offset);
+}
+
+void SM64::reconcileLocalMario(SM64MarioInstance* marioInstance)
+{
+	// Sequences restart when prediction is reset, a correction past our last input is from before that
+	if (marioInstance->corrections.Update())
+	{
+		const MarioCorrection& correction = marioInstance->corrections.Front();
+		if (correction.sequence <= marioInstance->predictor.LastSequence())
+		{
+			marioInstance->hostAuthoritative = true;
+			marioInstance->hasCorrection = true;
+			marioInstance->correctionSequence = correction.sequence;
+			marioInstance->correctionState = correction.bodyState;
+		}
+	}
+
+	// Only called right before a step, every replayed tick is a whole step too
+	if (isHost || !marioInstance->hasCorrection || marioInstance->marioId < 0) return;
+	marioInstance->hasCorrection = false;
+
+	// Held for the whole rewind
+	sm64Sema.acquire();
+	marioInstance->predictor.Reconcile(marioInstance->correctionSequence,
+		&marioInstance->correctionState,
+		(double)netcodeNowMs(),
+		[marioInstance](const void* state) {
+			// Same as showing a remote mario's body state
+			memcpy(&marioInstance->marioBodyState, state, sizeof(struct SM64MarioBodyState));
+			marioInstance->marioBodyState.marioState.soundMask = 0;
+			marioInstance->marioInputs.isInput = false;
+			sm64_mario_tick(marioInstance->marioId,
+				&marioInstance->marioInputs,
+				&marioInstance->marioBodyState.marioState,
+				&marioInstance->marioGeometry,
+				&marioInstance->marioBodyState);
+			marioInstance->marioState = marioInstance->marioBodyState.marioState;
+		},
+		[marioInstance](const void* input, void* stateOut) {
+			memcpy(&marioInstance->marioInputs, input, sizeof(struct SM64MarioInputs));
+			sm64_mario_tick(marioInstance->marioId,
+				&marioInstance->marioInputs,
+				&marioInstance->marioState,
+				&marioInstance->marioGeometry,
+				&marioInstance->marioBodyState);
+			memcpy(stateOut, &marioInstance->marioBodyState, sizeof(struct SM64MarioBodyState));
+		});
+	sm64Sema.release();
+}
+
+// Gathers where every mario is once a step, for the host simulated marios' knockbacks.
+// Assumes remoteMariosSema is already acquired and tickJobs is filled. Don't acquire here!
+void SM64::gatherHostInteractions()
+{
+	hostInteractions.Clear();
+	if (localMario.marioId >= 0)
+	{
+		localMario.sema.acquire();
+		hostInteractions.Add(localMario.marioBodyState);
+		localMario.sema.release();
+	}
+
+	// The jobs are in the same order as remoteMarios, only some of them are left out
+	size_t job = 0;
+	for (auto const& [playerId, marioInstance] : remoteMarios)
+	{
+		const bool hasJob = job < tickJobs.size() && tickJobs[job].marioInstance == marioInstance;
+		int index = -1;
+		if (marioInstance->marioId >= 0)
+		{
+			marioInstance->sema.acquire();
+			index = hostInteractions.Add(marioInstance->marioBodyState);
+			marioInstance->sema.release();
+		}
+		if (hasJob)
+		{
+			tickJobs[job++].interactionIndex = index;
+		}
+	}
+}
+
+// Picks the next input and decides knockbacks from hostInteractions, so it can't run on the tick workers.
+// Assumes remoteMariosSema and the mario's sema are already acquired. Don't acquire here!
+bool SM64::prepareHostSimulatedMario(SM64MarioInstance* marioInstance, int interactionIndex)
+{
+	// One of the owner's inputs per step
+	InputSequencer& sequencer = marioInstance->inputSequencer;
+	bool hasInput = sequencer.Next(&marioInstance->marioInputs);
+	if (!hasInput && sequencer.Newest() - sequencer.Processed() > PREDICTION_MAX_SENT_INPUTS)
+	{
+		// The owner no longer repeats the input we are waiting for, skipping it costs the owner a correction
+		sequencer.Start(sequencer.Processed() + 1);
+		hasInput = sequencer.Next(&marioInstance->marioInputs);
+	}
+
+	if (hasInput)
+	{
+		// Knockbacks are decided by where everyone is on the host, not by where the owner saw them
+		ClearMarioAttack(&marioInstance->marioInputs);
+		hostInteractions.ApplyAttack(marioInstance->marioBodyState.marioState.position, interactionIndex,
+			&marioInstance->marioInputs);
+	}
+
+	// Holds still while the owner's next input is late
+	marioInstance->marioInputs.isInput = hasInput;
+	marioInstance->marioInputs.giveWingcap = true;
+	return hasInput;
+}
+
+// Runs on the tick workers, only touches this mario.
+// Assumes the mario's sema is already acquired. Don't acquire here!
+void SM64::tickHostSimulatedMario(SM64MarioInstance* marioInstance, bool hasInput)
+{
+	guardedMarioTick(marioInstance, &marioInstance->marioBodyState.marioState);
+
+	if (hasInput && marioInstance->authorityEncoder != nullptr)
+	{
+		// netcodeOutBuf is shared with the game thread
+		thread_local char authorityOutBuf[SM64_NETCODE_BUF_LEN];
+		int bodyStateLen = encodeBodyState(marioInstance,
+			*marioInstance->authorityEncoder,
+			marioInstance->inputSequencer.Processed(),
+			authorityOutBuf,
+			SM64_NETCODE_BUF_LEN);
+		if (bodyStateLen > 0)
+		{
+			Networking::SendBytes(NetcodeMessageType::MARIO_BODY_STATE, authorityOutBuf, bodyStateLen,
+				NETCODE_FLAG_AUTHORITATIVE | NETCODE_FLAG_RELEVANCE);
+		}
+		recordBodyState(marioInstance->playerId, marioInstance->marioBodyState);
+	}
+}
+
+BodyStateLayout SM64::MarioBodyStateLayout()
+{
+	BodyStateLayout layout;
+	layout.size = sizeof(struct SM64MarioBodyState);
+	layout.positionOffset = offsetof(struct SM64MarioBodyState, marioState.position);
+	layout.velocityOffset = offsetof(struct SM64MarioBodyState, marioState.velocity);
+	layout.faceAngleOffset = offsetof(struct SM64MarioBodyState, marioState.faceAngle);
+	return layout;
+}
+
+const SnapshotCodec& SM64::BodyStateCodec()
+{
+	static const SnapshotCodec codec(sizeof(struct SM64MarioBodyState), BodyStateQuantizedFields(MarioBodyStateLayout()));
+	return codec;
+}
+
+SnapshotKinematics SM64::BodyStateKinematics()
+{
+	// Mario's velocity is in units per 30 Hz game frame, which is the interpolator's default velocity tick
+	return {
+		offsetof(struct SM64MarioBodyState, marioState.position),
+		offsetof(struct SM64MarioBodyState, marioState.velocity),
+		offsetof(struct SM64MarioBodyState, marioState.faceAngle),
+	};
+}
+
+bool SM64::StartBodyStateRecording(const std::filesystem::path& path)
+{
+	StopBodyStateRecording();
+
+	bodyStateRecordingSema.acquire();
+	bodyStateRecording.open(path, std::ios::binary | std::ios::trunc);
+	bool opened = bodyStateRecording.is_open();
+	if (opened)
+	{
+		BodyStateRecordingHeader header;
+		header.layout = MarioBodyStateLayout();
+		bodyStateRecording.write((const char*)&header, sizeof(header));
+	}
+	bodyStateRecordingSema.release();
+
+	isRecordingBodyState = opened;
+	return opened;
+}
+
+void SM64::StopBodyStateRecording()
+{
+	isRecordingBodyState = false;
+	bodyStateRecordingSema.acquire();
+	if (bodyStateRecording.is_open())
+	{
+		bodyStateRecording.close();
+	}
+	bodyStateRecordingSema.release();
+}
+
+bool SM64::StartReplayRecording(const std::filesystem::path& path)
+{
+	StopReplayRecording();
+
+	replayRecordingSema.acquire();
+	bool opened = replayRecording.Open(path, 1);
+	replayRecordingSema.release();
+
+	isRecordingReplay = opened;
+	return opened;
+}
+
+void SM64::StopReplayRecording()
+{
+	isRecordingReplay = false;
+	replayRecordingSema.acquire();
+	replayRecording.Close();
+	replayRecordingSema.release();
+}
+
+void SM64::MatchSettingsMessageReceived(char* buf, int len)
+{
+	auto settingsMsgLen = sizeof(MatchSettings) + sizeof(int);
+	if (len != settingsMsgLen) return;
+
+	// Applied by the render thread like the other control messages, so this network thread takes none of its locks
+	MarioControlMessage message;
+	message.type = MarioControlType::MATCH_SETTINGS;
+	memcpy(&message.matchSettings, buf + sizeof(int), sizeof(MatchSettings));
+	self->controlInbox.TryPush(message);
+}
+
+void MessageReceived(const NetcodeFrame& frame)
+{
+	if (frame.payloadLen < sizeof(int)) return;
+	switch (frame.Type())
+	{
+	case NetcodeMessageType::MATCH_SETTINGS:
+		self->MatchSettingsMessageReceived(frame.payload, frame.payloadLen);
+		break;
+	case NetcodeMessageType::MARIO_BODY_STATE:
+		self->MarioMessageReceived(frame.payload,
+			frame.payloadLen,
+			frame.header.sequence,
+			(frame.header.flags & NETCODE_FLAG_AUTHORITATIVE) != 0);
+		break;
+	case NetcodeMessageType::MARIO_INPUT:
+		self->MarioInputMessageReceived(frame.payload, frame.payloadLen);
+		break;
+	default:
+		break;
 	}
 }
 
@@ -534,9 +1180,12 @@ void SM64::SendSettingsToClients()
 		remoteMariosSema.release();
 	}
 
+	sentTuningRevision = tuning.Revision();
+	matchSettings.tuning = tuning.Current();
+
 	memcpy(self->netcodeOutBuf, &messageId, sizeof(int));
 	memcpy(self->netcodeOutBuf + sizeof(int), &matchSettings, sizeof(MatchSettings));
-	Networking::SendBytes(self->netcodeOutBuf, sizeof(MatchSettings) + sizeof(int));
+	Networking::SendBytes(NetcodeMessageType::MATCH_SETTINGS, self->netcodeOutBuf, sizeof(MatchSettings) + sizeof(int));
 }
 
 void SM64::sendSettingsIfHost(ServerWrapper server)
@@ -558,71 +1207,58 @@ void SM64::SendJoinCommandToClients()
 	matchSettingsSema.release();
 }
 
-void SM64::LoadStaticSurfaces(Model* model)
+bool SM64::hasFloorBelow(int16_t x, int16_t y, int16_t z)
+{
+	sm64Sema.acquire();
+	bool hasFloor = surfaceGrid.Empty() || surfaceGrid.FindFloor(x, y, z, nullptr) >= 0;
+	sm64Sema.release();
+	return hasFloor;
+}
+
+void SM64::LoadMap(const std::string& arena)
 {
-	if (model == nullptr)
+	std::lock_guard<std::mutex> lock(mapSwapMutex);
+	const uint64_t generation = ++mapGeneration;
+	if (arena.empty())
 	{
-		// Load default map surfaces
-		sm64_static_surfaces_load(surfaces, surfaces_count);
+		LoadStaticSurfaces();
+		mapLoading = false;
+		return;
 	}
-	else
-	{
-		std::vector<Vertex> vertices;
-		for (int i = 0; i < model->modelIndicesArr.size(); i++)
-		{
-			auto indices = model->modelIndicesArr[i];
-			auto modelVertices = model->modelVerticesArr[i];
-			for (int k = 0; k < indices.size(); k++)
-			{
-				vertices.push_back(modelVertices[indices[k]]);
-			}
-		}
 
-		if (mapModel != nullptr)
+	// Marios wait for the new surfaces, see tickMarioInstance
+	mapLoading = true;
+	mapLoader.Load(arena, true, [this, generation](const std::shared_ptr<MapSurfaces>& map) {
+		std::lock_guard<std::mutex> lock(mapSwapMutex);
+		if (generation != mapGeneration)
 		{
-			mapModel->Disabled = true;
-		}
-
-		int numSurfaces = vertices.size() / 3;
-		struct SM64Surface* staticSurfaces = (SM64Surface*)malloc(sizeof(struct SM64Surface) * numSurfaces);
-		mapVertices.clear();
-
-		for (int i = 0; i < vertices.size(); i++)
-		{
-			Vertex v;
-
-			v.pos.x = vertices[i].pos.x;
-			v.pos.y = -vertices[i].pos.y;
-			v.pos.z = -vertices[i].pos.z;
-
-			v.normal.x = vertices[i].pos.x;
-			v.normal.y = -vertices[i].pos.y;
-			v.normal.z = -vertices[i].pos.z;
-
-			mapVertices.push_back(v);
+			// Hosted or joined something else while this loaded
+			return;
 		}
+		LoadStaticSurfaces(map);
+		mapLoading = false;
+	});
+}
 
-		for (int i = 0; i < vertices.size() / 3; i++)
-		{
-			struct SM64Surface* surface = &staticSurfaces[i];
-			Vertex* surfaceVertices = &vertices[i * 3];
-			surface->type = SURFACE_DEFAULT;
-			surface->force = 0;
-			surface->terrain = TERRAIN_GRASS;
-
-			surface->vertices[2][0] = (int16_t)surfaceVertices[0].pos.x;
-			surface->vertices[2][1] = -(int16_t)surfaceVertices[0].pos.z;
-			surface->vertices[2][2] = -(int16_t)surfaceVertices[0].pos.y;
-
-			surface->vertices[1][0] = (int16_t)surfaceVertices[1].pos.x;
-			surface->vertices[1][1] = -(int16_t)surfaceVertices[1].pos.z;
-			surface->vertices[1][2] = -(int16_t)surfaceVertices[1].pos.y;
-
-			surface->vertices[0][0] = (int16_t)surfaceVertices[2].pos.x;
-			surface->vertices[0][1] = -(int16_t)surfaceVertices[2].pos.z;
-			surface->vertices[0][2] = -(int16_t)surfaceVertices[2].pos.y;
-		}
-		sm64_static_surfaces_load(staticSurfaces, numSurfaces);
+void SM64::LoadStaticSurfaces(std::shared_ptr<MapSurfaces> map)
+{
+	if (map == nullptr)
+	{
+		// Load default map surfaces
+		sm64Sema.acquire();
+		sm64_static_surfaces_load(surfaces, surfaces_count);
+		surfaceGrid.Build(surfaces, surfaces_count);
+		sm64Sema.release();
+	}
+	else
+	{
+		sm64Sema.acquire();
+		sm64_static_surfaces_load(map->Surfaces(), map->SurfaceCount());
+		surfaceGrid.Build(map->Surfaces(), map->SurfaceCount());
+		// Keeps a mapped cache file open until the next map replaces it
+		loadedMap = map;
+		sm64Sema.release();
+		// The render thread swaps the drawn map when it sees this, the model is only touched there
 		mapInitialized = false;
 	}
 }
@@ -630,21 +1266,45 @@ void SM64::LoadStaticSurfaces(Model* model)
 /// <summary>Renders the available options for the game mode.</summary>
 void SM64::RenderOptions()
 {
-	ImGui::SliderFloat("Attack Boost Damage", &attackBoostDamage, 0.0f, 1.0f);
+	// The sliders edit a copy, the table only takes a new tuning once a slider is let go
+	if (!ImGui::IsAnyItemActive())
+	{
+		editedTuning = tuning.Current();
+	}
+	bool published = false;
+	ImGui::SliderFloat("Attack Boost Damage", &editedTuning.attackBoostDamage, 0.0f, 1.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
 
-	ImGui::SliderFloat("Ground Pound Pinch Velocity", &groundPoundPinchVel, 0.0f, 15000.0f);
-	ImGui::SliderFloat("Attack Ball Radius", &attackBallRadius, 0.0f, 600.0f);
+	ImGui::SliderFloat("Ground Pound Pinch Velocity", &editedTuning.ball.groundPoundPinchVel, 0.0f, 15000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
+	ImGui::SliderFloat("Attack Ball Radius", &editedTuning.ball.attackBallRadius, 0.0f, 600.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
 
-	ImGui::SliderFloat("Kick Ball Vel Horiz", &kickBallVelHoriz, 0.0f, 10000.0f);
-	ImGui::SliderFloat("Kick Ball Vel Vert", &kickBallVelVert, 0.0f, 10000.0f);
+	ImGui::SliderFloat("Kick Ball Vel Horiz", &editedTuning.ball.kickBallVelHoriz, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
+	ImGui::SliderFloat("Kick Ball Vel Vert", &editedTuning.ball.kickBallVelVert, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
 
-	ImGui::SliderFloat("Punch Ball Vel Horiz", &punchBallVelHoriz, 0.0f, 10000.0f);
-	ImGui::SliderFloat("Punch Ball Vel Vert", &punchBallVelVert, 0.0f, 10000.0f);
+	ImGui::SliderFloat("Punch Ball Vel Horiz", &editedTuning.ball.punchBallVelHoriz, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
+	ImGui::SliderFloat("Punch Ball Vel Vert", &editedTuning.ball.punchBallVelVert, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
 
-	ImGui::SliderFloat("Dive Ball Vel Horiz", &diveBallVelHoriz, 0.0f, 10000.0f);
-	ImGui::SliderFloat("Dive Ball Vel Vert", &diveBallVelVert, 0.0f, 10000.0f);
+	ImGui::SliderFloat("Dive Ball Vel Horiz", &editedTuning.ball.diveBallVelHoriz, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
+	ImGui::SliderFloat("Dive Ball Vel Vert", &editedTuning.ball.diveBallVelVert, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
 
-	ImGui::SliderFloat("Aerial Ball Vel", &flyBallVel, 0.0f, 10000.0f);
+	ImGui::SliderFloat("Aerial Ball Vel", &editedTuning.ball.flyBallVel, 0.0f, 10000.0f);
+	published |= ImGui::IsItemDeactivatedAfterEdit();
+	if (published)
+	{
+		tuning.Publish(editedTuning);
+	}
+	if (ImGui::Button("Save Tuning"))
+	{
+		tuning.Save();
+	}
 
 	ImGui::NewLine();
 
@@ -748,6 +1408,25 @@ void SM64::RenderPreferences()
 	{
 		MarioConfig::getInstance().SetVolume(marioAudio->MasterVolume);
 	}
+
+	static int interpolationDelay = marioConfig->GetInterpolationDelay();
+	ImGui::SliderInt("Remote Mario Delay (ms)", &interpolationDelay, 0, 250);
+	if (ImGui::IsItemHovered())
+	{
+		ImGui::SetTooltip("How far behind other players are shown, more hides more network jitter");
+	}
+	if (ImGui::IsItemDeactivatedAfterChange())
+	{
+		marioConfig->SetInterpolationDelay(interpolationDelay);
+		remoteMariosSema.acquire();
+		for (auto const& [playerId, marioInstance] : remoteMarios)
+		{
+			marioInstance->sema.acquire();
+			marioInstance->interpolator.GetConfig().delayMs = interpolationDelay;
+			marioInstance->sema.release();
+		}
+		remoteMariosSema.release();
+	}
 	matchSettingsSema.acquire();
 	bool inSm64Game = matchSettings.isInSm64Game;
 	matchSettingsSema.release();
@@ -825,16 +1504,9 @@ void SM64::Activate(const bool active)
 constexpr XXH128_hash_t ROM_HASH = { 0x8a90daa33e09a265, 0xc2d257a56ce0d963 };
 void SM64::InitSM64()
 {
-	size_t romSize;
 	std::string romPath = MarioConfig::getInstance().GetRomPath();
-	uint8_t* rom = Utils::readFileAlloc(romPath, &romSize);
-	if (rom == NULL)
-	{
-		return;
-	}
-
-	const auto romHash = XXH3_128bits(rom, romSize);
-	if (!XXH128_isEqual(romHash, ROM_HASH))
+	XXH128_hash_t romHash;
+	if (!FileHashCache::getInstance().Hash(romPath, &romHash) || !XXH128_isEqual(romHash, ROM_HASH))
 	{
 		return;
 	}
@@ -845,7 +1517,21 @@ void SM64::InitSM64()
 
 	if (!Sm64Initialized)
 	{
-		sm64_global_init(rom, texture, NULL, NULL);
+		// libsm64 reads the ROM straight from the mapping, it stays mapped until the next init. Hashing the
+		// mapped 8 MB again is cheap and catches a ROM replaced without its write time changing.
+		if (!romFile.Open(romPath) || !XXH128_isEqual(XXH3_128bits(romFile.Data(), romFile.Size()), ROM_HASH))
+		{
+			romFile.Close();
+			free(texture);
+			texture = nullptr;
+			return;
+		}
+		sm64Sema.acquire();
+		sm64_global_init(romFile.Data(), texture, NULL, NULL);
+		// Every tick is a whole 30 Hz step, the schedulers decide when one is due and frames in between are drawn
+		// from the last two steps' geometry
+		sm64_set_interpolation_interval(1);
+		sm64Sema.release();
 		LoadStaticSurfaces();
 	}
 
@@ -863,12 +1549,23 @@ void SM64::InitSM64()
 
 void SM64::DestroySM64()
 {
+	{
+		// Loads still in flight call back into a libsm64 that is gone, this makes their callbacks do nothing
+		std::lock_guard<std::mutex> lock(mapSwapMutex);
+		mapGeneration++;
+		mapLoading = false;
+	}
+	// Outside the lock, the load in flight takes it to find out it's stale
+	mapLoader.Cancel();
+
 	if (localMario.marioId >= 0)
 	{
-		sm64_mario_delete(localMario.marioId);
+		guardedMarioDelete(localMario.marioId);
 	}
 	localMario.marioId = -2;
+	sm64Sema.acquire();
 	sm64_global_terminate();
+	sm64Sema.release();
 	free(texture);
 	Sm64Initialized = false;
 }
@@ -969,7 +1666,7 @@ void SM64::onSetVehicleInput(CarWrapper car, void* params)
 					float curBoostAmt = boostComponent.GetCurrentBoostAmount();
 					if (curBoostAmt >= 0.01f)
 					{
-						curBoostAmt -= attackBoostDamage;
+						curBoostAmt -= tuning.Current().attackBoostDamage;
 						curBoostAmt = curBoostAmt < 0 ? 0 : curBoostAmt;
 					}
 					boostComponent.SetCurrentBoostAmount(curBoostAmt);
@@ -980,93 +1677,6 @@ void SM64::onSetVehicleInput(CarWrapper car, void* params)
 				}
 			}
 
-
-			// Check if mario attacked ball and set velocity if so
-			if (isHost)
-			{
-				auto server = gameWrapper->GetGameEventAsServer();
-				if (server.IsNull())
-				{
-					server = gameWrapper->GetCurrentGameState();
-				}
-
-				if (!server.IsNull())
-				{
-					auto ball = server.GetBall();
-					if (!ball.IsNull())
-					{
-						Vector marioVector(marioInstance->marioBodyState.marioState.position[0],
-							marioInstance->marioBodyState.marioState.position[2],
-							marioInstance->marioBodyState.marioState.position[1]);
-						Vector ballVector = ball.GetLocation();
-						Vector ballVelocity = ball.GetVelocity();
-						float distance = Utils::Distance(marioVector, ballVector);
-
-						float dx = ballVector.X - marioVector.X;
-						float dy = ballVector.Y - marioVector.Y;
-
-						bool attackedRecently = marioInstance->tickCount - marioInstance->lastBallInteraction < (10 * interpolationFactor);
-
-						float angleToBall = atan2f(dy, dx);
-						if (attackedRecently)
-						{
-							// do nothing
-						}
-						else if (distance < GROUND_POUND_BALL_RADIUS &&
-							marioInstance->marioBodyState.action == ACT_GROUND_POUND_LAND)
-						{
-							ballVelocity.X += groundPoundPinchVel * cosf(angleToBall);
-							ballVelocity.Y += groundPoundPinchVel * sinf(angleToBall);
-							ball.SetVelocity(ballVelocity);
-							marioInstance->lastBallInteraction = marioInstance->tickCount;
-						}
-						else if (marioInstance->marioBodyState.action == ACT_JUMP_KICK &&
-							distance < attackBallRadius)
-						{
-							ballVelocity.X += kickBallVelHoriz * cosf(angleToBall);
-							ballVelocity.Y += kickBallVelHoriz * sinf(angleToBall);
-							ballVelocity.Z += kickBallVelVert;
-							ball.SetVelocity(ballVelocity);
-							marioInstance->lastBallInteraction = marioInstance->tickCount;
-						}
-						else if (marioInstance->marioBodyState.action == ACT_MOVE_PUNCHING &&
-							distance < attackBallRadius)
-						{
-							ballVelocity.X += punchBallVelHoriz * cosf(angleToBall);
-							ballVelocity.Y += punchBallVelHoriz * sinf(angleToBall);
-							ballVelocity.Z += punchBallVelVert;
-							ball.SetVelocity(ballVelocity);
-							marioInstance->lastBallInteraction = marioInstance->tickCount;
-						}
-						else if ((marioInstance->marioBodyState.action == ACT_DIVE || marioInstance->marioBodyState.action == ACT_DIVE_SLIDE) &&
-							distance < attackBallRadius)
-						{
-							ballVelocity.X += diveBallVelHoriz * cosf(angleToBall);
-							ballVelocity.Y += diveBallVelHoriz * sinf(angleToBall);
-							ballVelocity.Z += diveBallVelVert;
-							ball.SetVelocity(ballVelocity);
-							marioInstance->lastBallInteraction = marioInstance->tickCount;
-						}
-						else if (marioInstance->marioBodyState.action == ACT_FLYING &&
-							distance < attackBallRadius)
-						{
-							float dz = ballVector.Z - marioVector.Z;
-							float dxVert = atan2f(dz, dx);
-							auto zFactor = sinf(dxVert);
-
-							ballVelocity.X += flyBallVel * cosf(angleToBall) * abs(zFactor);
-							ballVelocity.Y += flyBallVel * sinf(angleToBall) * abs(zFactor);
-							ballVelocity.Z += flyBallVel * zFactor;
-							ball.SetVelocity(ballVelocity);
-							marioInstance->lastBallInteraction = marioInstance->tickCount;
-						}
-
-
-						marioInstance->tickCount++;
-					}
-				}
-
-			}
 		}
 
 
@@ -1130,6 +1740,55 @@ void SM64::onTick(ServerWrapper server)
 
 	}
 
+	resolveBallInteractions(server);
+}
+
+// Every mario's ball hits in one pass, once a game tick instead of in every car's input
+void SM64::resolveBallInteractions(ServerWrapper server)
+{
+	auto ball = server.GetBall();
+	if (ball.IsNull()) return;
+
+	const uint64_t nowMs = netcodeNowMs();
+	ballInteractions.Clear();
+	ballInteractionMarios.clear();
+	const auto gather = [this, nowMs](SM64MarioInstance* marioInstance) {
+		marioInstance->sema.acquire();
+		const float* position = marioInstance->marioBodyState.marioState.position;
+		if (!marioInstance->isCar && marioInstance->marioId >= 0 &&
+			(position[0] != 0.0f || position[1] != 0.0f || position[2] != 0.0f))
+		{
+			ballInteractions.Add(marioInstance->marioBodyState,
+				nowMs - marioInstance->lastBallInteractionMs >= BALL_INTERACTION_COOLDOWN_MS);
+			ballInteractionMarios.push_back(marioInstance);
+		}
+		marioInstance->sema.release();
+	};
+
+	remoteMariosSema.acquire();
+	gather(&localMario);
+	for (auto const& [playerId, marioInstance] : remoteMarios)
+	{
+		gather(marioInstance);
+	}
+
+	const Vector ballLocation = ball.GetLocation();
+	const Vector ballVelocity = ball.GetVelocity();
+	const float location[3] = { ballLocation.X, ballLocation.Y, ballLocation.Z };
+	float velocity[3] = { ballVelocity.X, ballVelocity.Y, ballVelocity.Z };
+	if (ballInteractions.ResolveBall(location, velocity, tuning.Current().ball, ballHits) > 0)
+	{
+		ball.SetVelocity(Vector(velocity[0], velocity[1], velocity[2]));
+		for (size_t i = 0; i < ballInteractionMarios.size(); i++)
+		{
+			if (!ballHits[i]) continue;
+
+			ballInteractionMarios[i]->sema.acquire();
+			ballInteractionMarios[i]->lastBallInteractionMs = nowMs;
+			ballInteractionMarios[i]->sema.release();
+		}
+	}
+	remoteMariosSema.release();
 }
 
 void SM64::onOvertimeStart(ServerWrapper server)
@@ -1161,9 +1820,17 @@ inline void tickMarioInstance(SM64MarioInstance* marioInstance,
 	}
 	if (marioInstance->marioId < 0)
 	{
+		// libsm64 can't create a mario without a floor under it, e.g. while the car is in the air over the wall.
+		// Until a custom map finished loading, the floors there are still the last map's.
+		if (instance->mapLoading || !instance->hasFloorBelow(x, z, y))
+		{
+			marioInstance->sema.release();
+			return;
+		}
+
 		// Unreal swaps coords
 		instance->carRotation = car.GetRotation();
-		marioInstance->marioId = sm64_mario_create(x, z, y);
+		marioInstance->marioId = guardedMarioCreate(x, z, y);
 		if (marioInstance->marioId < 0)
 		{
 			marioInstance->sema.release();
@@ -1174,8 +1841,8 @@ inline void tickMarioInstance(SM64MarioInstance* marioInstance,
 		marioInstance->marioBodyState.marioState.position[1] == 0.0f &&
 		marioInstance->marioBodyState.marioState.position[2] == 0.0f)
 	{
-		 sm64_mario_delete(marioInstance->marioId);
-		 marioInstance->marioId = sm64_mario_create(x, z, y);
+		 guardedMarioDelete(marioInstance->marioId);
+		 marioInstance->marioId = guardedMarioCreate(x, z, y);
 		 if (marioInstance->marioId < 0)
 		 {
 		 	marioInstance->sema.release();
@@ -1193,79 +1860,124 @@ inline void tickMarioInstance(SM64MarioInstance* marioInstance,
 	instance->matchSettingsSema.acquire();
 	bool isPreGame = instance->matchSettings.isPreGame;
 	instance->matchSettingsSema.release();
-	if (!isPreGame && !playerController.IsNull())
+	CarControls controls;
+	if (!playerController.IsNull())
 	{
 		auto playerInputs = playerController.GetVehicleInput();
-		marioInstance->marioInputs.buttonA = playerInputs.Jump;
-		marioInstance->marioInputs.buttonB = playerInputs.Handbrake;
-		marioInstance->marioInputs.buttonZ = playerInputs.Throttle < 0;
-		marioInstance->marioInputs.stickX = playerInputs.Steer;
-		marioInstance->marioInputs.stickY = playerInputs.Pitch;
+		controls.throttle = playerInputs.Throttle;
+		controls.steer = playerInputs.Steer;
+		controls.pitch = playerInputs.Pitch;
+		controls.jump = playerInputs.Jump;
+		controls.handbrake = playerInputs.Handbrake;
+		controls.holdingBoost = playerInputs.HoldingBoost;
+	}
+	const bool canMove = !isPreGame && !playerController.IsNull();
+	const float cameraLocation[3] = { instance->cameraLoc.X, instance->cameraLoc.Y, instance->cameraLoc.Z };
+	MarioInputsFromCar(controls, canMove, instance->currentBoostAount, marioInstance->marioState.position, cameraLocation,
+		&marioInstance->marioInputs);
+
+	ClearMarioAttack(&marioInstance->marioInputs);
+	marioInstance->marioInputs.bljInput =  instance->matchSettings.bljSetup;
+	// Every step starts from these, a rewind replays older inputs and a knockback only counts for one step
+	const struct SM64MarioInputs frameInputs = marioInstance->marioInputs;
+
+	const double now = (double)netcodeNowMs();
+	uint32_t steps = 0;
+	if (self->gameWrapper->IsPaused())
+	{
+		instance->localMarioSteps.Hold(now);
 	}
 	else
 	{
-		marioInstance->marioInputs.buttonA = NULL;
-		marioInstance->marioInputs.buttonB = NULL;
-		marioInstance->marioInputs.buttonZ = NULL;
-		marioInstance->marioInputs.stickX = NULL;
-		marioInstance->marioInputs.stickY = NULL;
+		steps = instance->localMarioSteps.Advance(now);
 	}
 
-	marioInstance->marioInputs.camLookX = marioInstance->marioState.position[0] - instance->cameraLoc.X;
-	marioInstance->marioInputs.camLookZ = marioInstance->marioState.position[2] - instance->cameraLoc.Y;
-
-	auto controllerInput = car.GetPlayerController().GetVehicleInput();
-	marioInstance->marioInputs.isBoosting = controllerInput.HoldingBoost && instance->currentBoostAount >= 0.01f;
+	marioInstance->playerId = car.GetPRI().GetPlayerID();
+	instance->localPlayerId = marioInstance->playerId;
+
+	const bool recordingReplay = steps > 0 && isRecordingReplay;
+	MarioReplayBall replayBall;
+	MarioReplayMario replayMario;
+	if (recordingReplay)
+	{
+		replayMario.carLocation[0] = instance->carLocation.X;
+		replayMario.carLocation[1] = instance->carLocation.Y;
+		replayMario.carLocation[2] = instance->carLocation.Z;
+		std::copy(cameraLocation, cameraLocation + 3, replayMario.cameraLocation);
+		replayMario.controls = controls;
+		replayMario.canMove = canMove;
+		replayMario.boostAmount = instance->currentBoostAount;
+
+		auto server = instance->gameWrapper->GetCurrentGameState();
+		if (!server.IsNull())
+		{
+			auto ball = server.GetBall();
+			if (!ball.IsNull())
+			{
+				const Vector ballLocation = ball.GetLocation();
+				const Vector ballVelocity = ball.GetVelocity();
+				replayBall = { { ballLocation.X, ballLocation.Y, ballLocation.Z },
+					{ ballVelocity.X, ballVelocity.Y, ballVelocity.Z } };
+			}
+		}
+	}
 
-	// Determine interaction between other marios
-	marioInstance->marioInputs.attackInput.isAttacked = false;
-	marioInstance->marioInputs.attackInput.attackedPosX = 0;
-	marioInstance->marioInputs.attackInput.attackedPosY = 0;
-	marioInstance->marioInputs.attackInput.attackedPosZ = 0;
-	if (marioInstance->marioId >= 0)
+	for (uint32_t step = 0; step < steps; step++)
 	{
-		Vector localMarioVector(marioInstance->marioState.position[0],
-			marioInstance->marioState.position[1],
-			marioInstance->marioState.position[2]);
-		for (auto const& [playerId, remoteMarioInstance] : instance->remoteMarios)
+		if (recordingReplay)
 		{
-			if (marioInstance->marioInputs.attackInput.isAttacked ||
-				!sm64_get_interpolation_should_update())
-				break;
-
-			if (remoteMarioInstance->marioId < 0)
-				continue;
-
-			remoteMarioInstance->sema.acquire();
+			recordReplayStep(replayBall, replayMario);
+		}
 
-			Vector remoteMarioVector(remoteMarioInstance->marioBodyState.marioState.position[0],
-				remoteMarioInstance->marioBodyState.marioState.position[1],
-				remoteMarioInstance->marioBodyState.marioState.position[2]);
+		// Rewinds to the host's state and replays our inputs on top of it if it disagrees with what we predicted
+		instance->reconcileLocalMario(marioInstance);
+		marioInstance->marioInputs = frameInputs;
 
-			auto distance = Utils::Distance(localMarioVector, remoteMarioVector);
-			if (distance < 100.0f && remoteMarioInstance->marioBodyState.action & ACT_FLAG_ATTACKING)
+		// Determine interaction between other marios, from where everyone is at this step
+		if (marioInstance->marioId >= 0)
+		{
+			// The host's game tick and a client's render thread both get here, each keeps its own
+			static thread_local MarioInteractionBatch remoteInteractions;
+			remoteInteractions.Clear();
+			for (auto const& [playerId, remoteMarioInstance] : instance->remoteMarios)
 			{
-				marioInstance->marioInputs.attackInput.isAttacked = true;
-				marioInstance->marioInputs.attackInput.attackedPosX = remoteMarioVector.X;
-				marioInstance->marioInputs.attackInput.attackedPosY = remoteMarioVector.Y;
-				marioInstance->marioInputs.attackInput.attackedPosZ = remoteMarioVector.Z;
+				if (remoteMarioInstance->marioId < 0)
+					continue;
+
+				remoteMarioInstance->sema.acquire();
+				remoteInteractions.Add(remoteMarioInstance->marioBodyState);
+				remoteMarioInstance->sema.release();
 			}
-			remoteMarioInstance->sema.release();
+			remoteInteractions.ApplyAttack(marioInstance->marioState.position, -1, &marioInstance->marioInputs);
 		}
-	}
-
-	marioInstance->marioInputs.bljInput =  instance->matchSettings.bljSetup;
 
-	if (!self->gameWrapper->IsPaused())
-	{
 		marioInstance->marioInputs.isInput = true;
 		marioInstance->marioInputs.giveWingcap = true;
-		sm64_mario_tick(marioInstance->marioId,
-			&marioInstance->marioInputs,
-			&marioInstance->marioState,
-			&marioInstance->marioGeometry,
-			&marioInstance->marioBodyState);
+		if (step + 1 == steps)
+		{
+			marioInstance->KeepPreviousGeometry();
+		}
+		guardedMarioTick(marioInstance, &marioInstance->marioState);
+
+		uint32_t inputSequence = marioInstance->predictor.Record(&marioInstance->marioInputs, &marioInstance->marioBodyState);
+		instance->sendMarioInputs(marioInstance);
+
+		// Once the host simulates us, it sends everyone our state instead
+		if (!marioInstance->hostAuthoritative)
+		{
+			int bodyStateLen = instance->encodeBodyState(marioInstance,
+				instance->bodyStateEncoder,
+				inputSequence,
+				self->netcodeOutBuf,
+				SM64_NETCODE_BUF_LEN);
+			if (bodyStateLen > 0)
+			{
+				Networking::SendBytes(NetcodeMessageType::MARIO_BODY_STATE, self->netcodeOutBuf, bodyStateLen, NETCODE_FLAG_RELEVANCE);
+			}
+		}
+		recordBodyState(marioInstance->playerId, marioInstance->marioBodyState);
 	}
+	marioInstance->predictor.SmoothingOffset(now, marioInstance->renderOffset);
 
 	auto marioVector = Vector(marioInstance->marioState.position[0], marioInstance->marioState.position[2], marioInstance->marioState.position[1]);
 	auto marioVel = Vector(marioInstance->marioState.velocity[0], marioInstance->marioState.velocity[2], marioInstance->marioState.velocity[1]);
@@ -1273,7 +1985,7 @@ inline void tickMarioInstance(SM64MarioInstance* marioInstance,
 	instance->cameraLoc = camera.GetLocation();
 	Vector cameraAt = RotateVectorWithQuat(Vector(1, 0, 0), quat);
 
-	if (marioInstance->marioBodyState.marioState.isUpdateFrame)
+	if (steps > 0)
 		MarioAudio::getInstance().UpdateSounds(marioInstance->marioState.soundMask,
 			marioVector,
 			marioVel,
@@ -1282,18 +1994,39 @@ inline void tickMarioInstance(SM64MarioInstance* marioInstance,
 			&marioInstance->slidingHandle,
 			&marioInstance->yahooHandle,
 			marioInstance->marioBodyState.action);
+	marioInstance->sema.release();
+}
 
-	marioInstance->playerId = car.GetPRI().GetPlayerID();
-	if (marioInstance->marioBodyState.marioState.isUpdateFrame)
+// Converts libsm64's geometry into the model's vertices, alpha of the way from the previous step's positions to the
+// last one's. Touches nothing but the mario and the vector, so the tick workers can do this for many marios at once.
+void updateMarioVertices(SM64MarioInstance* marioInstance, std::vector<Vertex>& vertices, float alpha)
+{
+	static_assert(sizeof(Vertex) == sizeof(MarioVertex), "Vertex and MarioVertex must have the same layout");
+
+	MarioVertexSource source;
+	source.position = marioInstance->marioGeometry.position;
+	// Triangles come and go with e.g. the wingcap, those steps are drawn as they are
+	if (marioInstance->previousTrianglesUsed == marioInstance->marioGeometry.numTrianglesUsed)
 	{
-		memcpy(self->netcodeOutBuf, &marioInstance->playerId, sizeof(int));
-		memcpy(self->netcodeOutBuf + sizeof(int), &marioInstance->marioBodyState, sizeof(struct SM64MarioBodyState));
-		Networking::SendBytes(self->netcodeOutBuf, sizeof(struct SM64MarioBodyState) + sizeof(int));
+		source.previousPosition = marioInstance->previousPositions.data();
 	}
-	marioInstance->sema.release();
+	source.color = marioInstance->marioGeometry.color;
+	source.uv = marioInstance->marioGeometry.uv;
+	source.normal = marioInstance->marioGeometry.normal;
+	source.vertexCount = (size_t)marioInstance->marioGeometry.numTrianglesUsed * 3;
+	source.firstTransparentVertex = WINGCAP_VERTEX_INDEX * 3;
+	source.alpha = alpha;
+	// The offset fades out a prediction correction
+	for (int k = 0; k < 3; k++)
+	{
+		source.offset[k] = marioInstance->renderOffset[k];
+	}
+	ConvertMarioVertices(source, reinterpret_cast<MarioVertex*>(vertices.data()));
+	marioInstance->renderBounds = BoundingSphereOf(&vertices.data()->pos.x, source.vertexCount, sizeof(Vertex));
 }
 
-inline void renderMario(SM64MarioInstance* marioInstance, CameraWrapper camera)
+// Leave updateVertices off when the tick workers already converted this frame's geometry
+inline void renderMario(SM64MarioInstance* marioInstance, CameraWrapper camera, float alpha, bool updateVertices = true)
 {
 	if (marioInstance == nullptr) return;
 
@@ -1315,27 +2048,9 @@ inline void renderMario(SM64MarioInstance* marioInstance, CameraWrapper camera)
 		std::vector<Vertex>* vertices = marioInstance->model->GetVertices();
 		if (vertices != nullptr)
 		{
-			for (auto i = 0; i < marioInstance->marioGeometry.numTrianglesUsed * 3; i++)
+			if (updateVertices)
 			{
-				auto position = &marioInstance->marioGeometry.position[i * 3];
-				auto color = &marioInstance->marioGeometry.color[i * 3];
-				auto uv = &marioInstance->marioGeometry.uv[i * 2];
-				auto normal = &marioInstance->marioGeometry.normal[i * 3];
-
-				auto currentVertex = &(*vertices)[i];
-				// Unreal engine swaps x and y coords for 3d model
-				currentVertex->pos.x = position[0];
-				currentVertex->pos.y = position[2];
-				currentVertex->pos.z = position[1];
-				currentVertex->color.x = color[0];
-				currentVertex->color.y = color[1];
-				currentVertex->color.z = color[2];
-				currentVertex->color.w = i >= (WINGCAP_VERTEX_INDEX * 3) ? 0.0f : 1.0f;
-				currentVertex->texCoord.x = uv[0];
-				currentVertex->texCoord.y = uv[1];
-				currentVertex->normal.x = normal[0];
-				currentVertex->normal.y = normal[2];
-				currentVertex->normal.z = normal[1];
+				updateMarioVertices(marioInstance, *vertices, alpha);
 			}
 
 			if (marioInstance->colorIndex >= 0)
@@ -1349,6 +2064,7 @@ inline void renderMario(SM64MarioInstance* marioInstance, CameraWrapper camera)
 					self->teamColors[trueIndex + 5]);
 			}
 
+			marioInstance->model->SetWorldBounds(marioInstance->renderBounds);
 			marioInstance->model->RenderUpdateVertices(marioInstance->marioGeometry.numTrianglesUsed, &camera);
 		}
 
@@ -1356,6 +2072,27 @@ inline void renderMario(SM64MarioInstance* marioInstance, CameraWrapper camera)
 	marioInstance->sema.release();
 }
 
+void SM64::tickRemoteMario(const MarioTickJob& job, bool lastStep)
+{
+	SM64MarioInstance* marioInstance = job.marioInstance;
+	marioInstance->sema.acquire();
+	if (lastStep)
+	{
+		marioInstance->KeepPreviousGeometry();
+	}
+	if (job.hostSimulated)
+	{
+		tickHostSimulatedMario(marioInstance, job.hasInput);
+	}
+	else
+	{
+		marioInstance->marioInputs.isInput = false;
+		marioInstance->marioInputs.giveWingcap = false;
+		guardedMarioTick(marioInstance, &marioInstance->marioBodyState.marioState);
+	}
+	marioInstance->sema.release();
+}
+
 static inline void renderCarGhost(CarWrapper car, CameraWrapper camera)
 {
 	Model* carModel = nullptr;
@@ -1391,7 +2128,9 @@ void SM64::OnRender(CanvasWrapper canvas)
 		octaneModel = new Model(assetsFolder + "Octane.fbx");
 		dominusModel = new Model(assetsFolder + "Dominus.fbx");
 		fennecModel = new Model(assetsFolder + "Fennec.fbx");
-		mapModel = new Model(10000000, nullptr, nullptr, 0, 0, 0, true);
+		// Gets its vertices once a map is loaded, see OnRender
+		mapModel = new Model(0, nullptr, nullptr, 0, 0, 0, true);
+		mapModel->Name = "Map";
 
 		marioModelPoolSema.acquire();
 		for (int i = 0; i < MARIO_MESH_POOL_SIZE; i++)
@@ -1403,15 +2142,31 @@ void SM64::OnRender(CanvasWrapper canvas)
 				SM64_TEXTURE_WIDTH,
 				SM64_TEXTURE_HEIGHT,
 				true,
+				true,
 				true));
+			marioModelPool.back()->Name = "Mario " + std::to_string(i);
 		}
 		marioModelPoolSema.release();
 
 		modelsInitialized = true;
 	}
 
+	// Match settings arrive before we are in a game, so the inbox is drained either way
+	remoteMariosSema.acquire();
+	bool joinRequested = drainControlInbox();
+	remoteMariosSema.release();
+	if (joinRequested)
+	{
+		joinHostGame();
+	}
+
 	auto inGame = gameWrapper->IsInGame() || gameWrapper->IsInReplay() || gameWrapper->IsInOnlineGame();
 	matchSettingsSema.acquire();
+	// Set here rather than for every received body state, so the network threads don't have to wait for it
+	if (inGame && marioStateReceived.exchange(false))
+	{
+		matchSettings.isInSm64Game = true;
+	}
 	bool inSm64Game = matchSettings.isInSm64Game;
 	matchSettingsSema.release();
 	if (!inGame && inSm64Game)
@@ -1434,16 +2189,6 @@ void SM64::OnRender(CanvasWrapper canvas)
 
 	if (server.IsNull()) return;
 
-	auto engine = gameWrapper->GetEngine();
-	if (!engine.IsNull())
-	{
-		auto statGraph = engine.GetStatGraphs().GetPerfStatGraph();
-		auto fps = statGraph.GetTargetFPS();
-		interpolationFactor = maxV(1, fps / 30);
-		if (sm64_get_interpolation_should_update())
-			sm64_set_interpolation_interval(interpolationFactor);
-	}
-
 	auto localCar = gameWrapper->GetLocalCar();
 	std::string localPlayerName = "";
 	if (!localCar.IsNull())
@@ -1537,14 +2282,14 @@ void SM64::OnRender(CanvasWrapper canvas)
 			localMario.MarioActive = true;
 		}
 
-		renderMario(marioInstance, camera);
+		renderMario(marioInstance, camera, localMarioSteps.Alpha((double)netcodeNowMs()));
 	}
 
 	if (!localMario.MarioActive)
 	{
 		if (localMario.marioId >= 0)
 		{
-			sm64_mario_delete(localMario.marioId);
+			guardedMarioDelete(localMario.marioId);
 			localMario.marioId = -2;
 		}
 
@@ -1561,10 +2306,20 @@ void SM64::OnRender(CanvasWrapper canvas)
 		}
 	}
 
-	// Loop through remote marios and render
+	// Loop through remote marios and prepare their tick, anything that looks at other marios or the pools happens here
+	double now = (double)netcodeNowMs();
+	tickJobs.clear();
 	for (auto const& [playerId, marioInstance] : remoteMarios)
 	{
 		marioInstance->sema.acquire();
+		drainMarioInbox(marioInstance);
+		bool hostSimulated = isHost && marioInstance->hostAuthoritative;
+		if (!hostSimulated)
+		{
+			// Sounds and hits are only in the first frame that shows their snapshot
+			marioInstance->interpolator.Sample(now, &marioInstance->marioBodyState);
+		}
+
 		if (marioInstance->isCar)
 		{
 			marioInstance->sema.release();
@@ -1582,18 +2337,68 @@ void SM64::OnRender(CanvasWrapper canvas)
 		}
 		if (marioInstance->marioId < 0)
 		{
-			marioInstance->marioId = sm64_mario_create((int16_t)marioInstance->marioState.position[0],
+			marioInstance->marioId = guardedMarioCreate((int16_t)marioInstance->marioState.position[0],
 				(int16_t)marioInstance->marioState.position[1],
 				(int16_t)marioInstance->marioState.position[2]);
 		}
 
-		marioInstance->marioInputs.isInput = false;
-		marioInstance->marioInputs.giveWingcap = false;
-		sm64_mario_tick(marioInstance->marioId,
-			&marioInstance->marioInputs,
-			&marioInstance->marioBodyState.marioState,
-			&marioInstance->marioGeometry,
-			&marioInstance->marioBodyState);
+		if (isHost && !hostSimulated && marioInstance->marioId >= 0 && marioInstance->ownerInputSequence > 0 &&
+			marioInstance->inputSequencer.Newest() > marioInstance->ownerInputSequence)
+		{
+			// Take over from the owner's newest state, and simulate its inputs after that one from here on
+			marioInstance->inputSequencer.Start(marioInstance->ownerInputSequence);
+			marioInstance->marioBodyState = marioInstance->ownerBodyState;
+			marioInstance->marioBodyState.marioState.soundMask = 0;
+			marioInstance->authorityEncoder = std::make_unique<SnapshotStreamEncoder>(BodyStateCodec());
+			marioInstance->hostAuthoritative = true;
+			marioInstance->interpolator.Reset();
+
+			marioInstance->marioInputs.isInput = false;
+			guardedMarioTick(marioInstance, &marioInstance->marioBodyState.marioState);
+			hostSimulated = true;
+		}
+
+		tickJobs.push_back({ marioInstance, hostSimulated, false });
+		marioInstance->sema.release();
+	}
+
+	// Ticks and vertex conversion only touch their own mario, the workers split them up
+	const uint32_t steps = remoteMarioSteps.Advance(now);
+	const float alpha = remoteMarioSteps.Alpha(now);
+	for (uint32_t step = 0; step < steps; step++)
+	{
+		if (isHost)
+		{
+			gatherHostInteractions();
+		}
+		for (MarioTickJob& job : tickJobs)
+		{
+			if (job.hostSimulated)
+			{
+				job.marioInstance->sema.acquire();
+				job.hasInput = prepareHostSimulatedMario(job.marioInstance, job.interactionIndex);
+				job.marioInstance->sema.release();
+			}
+		}
+		const bool lastStep = step + 1 == steps;
+		tickPool.ParallelFor(tickJobs.size(), [this, lastStep](size_t i) { tickRemoteMario(tickJobs[i], lastStep); });
+	}
+	tickPool.ParallelFor(tickJobs.size(), [this, alpha](size_t i) {
+		SM64MarioInstance* marioInstance = tickJobs[i].marioInstance;
+		marioInstance->sema.acquire();
+		std::vector<Vertex>* vertices = marioInstance->model != nullptr ? marioInstance->model->GetVertices() : nullptr;
+		if (vertices != nullptr)
+		{
+			updateMarioVertices(marioInstance, *vertices, alpha);
+		}
+		marioInstance->sema.release();
+	});
+
+	// Sounds, pools and drawing go back to one mario at a time
+	for (const MarioTickJob& job : tickJobs)
+	{
+		SM64MarioInstance* marioInstance = job.marioInstance;
+		marioInstance->sema.acquire();
 
 		auto marioVector = Vector(marioInstance->marioBodyState.marioState.position[0],
 			marioInstance->marioBodyState.marioState.position[2],
@@ -1620,7 +2425,7 @@ void SM64::OnRender(CanvasWrapper canvas)
 		{
 			if (marioInstance->marioId >= 0)
 			{
-				sm64_mario_delete(marioInstance->marioId);
+				guardedMarioDelete(marioInstance->marioId);
 				marioInstance->marioId = -2;
 			}
 
@@ -1641,10 +2446,16 @@ void SM64::OnRender(CanvasWrapper canvas)
 
 		marioInstance->sema.release();
 
-		renderMario(marioInstance, camera);
+		renderMario(marioInstance, camera, alpha, false);
 	}
 	remoteMariosSema.release();
 
+	// The host's tuning was edited or its file was written
+	if (isHost && tuning.Revision() != sentTuningRevision)
+	{
+		needsSettingSync = true;
+	}
+
 	if (needsSettingSync)
 	{
 		sendSettingsIfHost(server);
@@ -1666,27 +2477,18 @@ void SM64::OnRender(CanvasWrapper canvas)
 
 		if (mapModel != nullptr)
 		{
-			auto modelVertices = mapModel->GetVertices();
-			if (modelVertices != nullptr)
+			if (!mapInitialized)
 			{
-				if (mapInitialized)
-				{
-					mapModel->Render(&camera);
-				}
-				else
-				{
-					for (int i = 0; i < mapVertices.size() / 3; i++)
-					{
-						int index = i * 3;
-						(*modelVertices)[index + 2] = mapVertices[index];
-						(*modelVertices)[index + 1] = mapVertices[index + 1];
-						(*modelVertices)[index] = mapVertices[index + 2];
-					}
-					mapModel->RenderUpdateVertices(mapVertices.size() / 3, &camera);
-					mapInitialized = true;
-				}
-
+				sm64Sema.acquire();
+				std::shared_ptr<MapSurfaces> map = loadedMap;
+				sm64Sema.release();
+
+				// Already in draw order, the renderer uploads it straight from the map into an immutable buffer
+				const size_t vertexCount = map != nullptr ? std::min<size_t>(map->VertexCount(), MAP_MAX_TRIANGLES * 3) : 0;
+				mapModel->SetStaticVertices(map, map != nullptr ? map->Vertices() : nullptr, vertexCount);
+				mapInitialized = true;
 			}
+			mapModel->Render(&camera);
 		}
 
 	}
@@ -1694,7 +2496,15 @@ void SM64::OnRender(CanvasWrapper canvas)
 }
 
 SM64MarioInstance::SM64MarioInstance()
+	: interpolator(sizeof(struct SM64MarioBodyState), SM64::BodyStateKinematics()),
+	predictor(sizeof(struct SM64MarioInputs), sizeof(struct SM64MarioBodyState), offsetof(struct SM64MarioBodyState, marioState.position)),
+	inputSequencer(sizeof(struct SM64MarioInputs))
 {
+	interpolator.GetConfig().delayMs = MarioConfig::getInstance().GetInterpolationDelay();
+	// Each of these happened once, a snapshot shown for several frames must not play the sound or deal the hit again
+	interpolator.AddOneShotField(offsetof(struct SM64MarioBodyState, marioState.soundMask), sizeof(SM64MarioBodyState::marioState.soundMask));
+	interpolator.AddOneShotField(offsetof(struct SM64MarioBodyState, marioState.isAttacked), sizeof(SM64MarioBodyState::marioState.isAttacked));
+	interpolator.AddOneShotField(offsetof(struct SM64MarioBodyState, marioState.isUpdateFrame), sizeof(SM64MarioBodyState::marioState.isUpdateFrame));
 	marioGeometry.position = (float*)malloc(sizeof(float) * 9 * SM64_GEO_MAX_TRIANGLES);
 	marioGeometry.color = (float*)malloc(sizeof(float) * 9 * SM64_GEO_MAX_TRIANGLES);
 	marioGeometry.normal = (float*)malloc(sizeof(float) * 9 * SM64_GEO_MAX_TRIANGLES);
@@ -1709,6 +2519,27 @@ SM64MarioInstance::~SM64MarioInstance()
 	free(marioGeometry.uv);
 }
 
+void SM64MarioInstance::KeepPreviousGeometry()
+{
+	previousTrianglesUsed = marioGeometry.numTrianglesUsed;
+	previousPositions.assign(marioGeometry.position, marioGeometry.position + previousTrianglesUsed * 9);
+}
+
+void SM64MarioInstance::ResetPrediction()
+{
+	hostAuthoritative = false;
+	predictor.Reset();
+	corrections.Update();
+	hasCorrection = false;
+	correctionSequence = 0;
+	renderOffset[0] = 0.0f;
+	renderOffset[1] = 0.0f;
+	renderOffset[2] = 0.0f;
+	inputSequencer.Reset();
+	authorityEncoder.reset();
+	ownerInputSequence = 0;
+}
+
 Model* SM64::getModelFromPool()
 {
 	Model* model = nullptr;
@@ -7,6 +7,7 @@
 #include <semaphore>
 #include <iostream>
 #include <sstream>
+#include <set>
 #include <tchar.h>
 #include <shlwapi.h>
 #include <stdlib.h>
@@ -18,29 +19,56 @@
 #include "../Graphics/Renderer.h"
 #include "../Graphics/GraphicsTypes.h"
 #include "../Graphics/Model.h"
+#include "../Graphics/FrustumCulling.h"
 #include "../Graphics/surface_terrains.h"
 #include "../Modules/Utils.h"
 #include "../Modules/MarioAudio.h"
 #include "../Modules/MarioConfig.h"
 #include "../Modules/Update.h"
+#include "../Modules/WorkerPool.h"
+#include "../Modules/FixedStepScheduler.h"
+#include "../Modules/SurfaceGrid.h"
+#include "../Modules/MapCache.h"
+#include "../Modules/MapLoader.h"
+#include "../Modules/MarioLogic.h"
+#include "../Modules/MarioReplay.h"
+#include "../Modules/MarioInteractions.h"
+#include "../Modules/MarioTuning.h"
+#include "../Modules/MarioVertices.h"
+#include "../Modules/FileHash.h"
 #include "imgui/imgui.h"
 #include "imgui/imgui_additions.h"
 #include "imgui/imgui_internal.h"
 #include "GameModes/RocketGameMode.h"
 #include "../../External/BakkesModSDK/include/bakkesmod/wrappers/PluginManagerWrapper.h"
 #include "Networking/Networking.h"
+#include "Networking/SnapshotCodec.h"
+#include "Networking/BodyStateRecording.h"
+#include "Networking/SnapshotInterpolator.h"
+#include "Networking/InputPrediction.h"
+#include "Networking/LockFreeQueues.h"
 #include "xxHash/xxhash.h"
 
 extern "C" {
     #include "libsm64.h"
 }
 
+// libsm64 isn't reentrant, these take turns with every other libsm64 call, see SM64.cpp
+int32_t guardedMarioCreate(int16_t x, int16_t y, int16_t z);
+void guardedMarioDelete(int32_t marioId);
+void guardedMarioTick(class SM64MarioInstance* marioInstance, struct SM64MarioState* marioState);
+void updateMarioVertices(class SM64MarioInstance* marioInstance, std::vector<Vertex>& vertices, float alpha);
+
 #include "../Graphics/level.h"
 
-#define SM64_NETCODE_BUF_LEN 1024
+#define SM64_NETCODE_BUF_LEN 4096
 #define MARIO_MESH_POOL_SIZE 10
 #define TEAM_COLOR_POOL_SIZE 4
 #define MAX_NUM_PLAYERS 8
+#define MARIO_INBOX_SIZE 64 // Body states per remote mario between two rendered frames, 2 s at 30 Hz
+#define CONTROL_INBOX_SIZE 256
+#define MARIO_TICK_WORKERS 3 // Besides the render thread, which ticks along
+#define BALL_INTERACTION_COOLDOWN_MS (10 * SIM_STEP_MS)
 
 #ifndef minV
 #define minV(a, b) ((a) <= (b) ? (a) : (b))
@@ -62,6 +90,58 @@ struct MatchSettings
     bool playerIsCarFlags[MAX_NUM_PLAYERS] = { 0 };
 
     bool joinGame = false;
+
+    // The host's tuning, used by clients while they play in its game
+    MarioTuning tuning;
+};
+
+// A body state as it was received, handed from the network threads to the render thread
+struct ReceivedBodyState
+{
+    uint64_t arrivalMs = 0;
+    uint32_t inputSequence = 0;
+    uint16_t senderTime = 0;
+    bool authoritative = false;
+    struct SM64MarioBodyState bodyState { 0 };
+};
+
+// The host's state of our own mario after it applied input sequence
+struct MarioCorrection
+{
+    uint32_t sequence = 0;
+    struct SM64MarioBodyState bodyState { 0 };
+};
+
+// Low byte of the newest snapshot id we decoded of every player's body state stream
+struct BodyStateAcks
+{
+    int count = 0;
+    int playerIds[MAX_NUM_PLAYERS] = { 0 };
+    uint8_t ackIds[MAX_NUM_PLAYERS] = { 0 };
+};
+
+enum class MarioControlType
+{
+    NEW_MARIO,
+    ACKS,
+    INPUTS,
+    MATCH_SETTINGS,
+};
+
+class SM64MarioInstance;
+
+// Everything else the network threads hand to the render thread, in the order it was received
+struct MarioControlMessage
+{
+    MarioControlType type = MarioControlType::ACKS;
+    uint32_t generation = 0;
+    int playerId = -1; // The sender for acks and inputs
+    SM64MarioInstance* marioInstance = nullptr;
+    BodyStateAcks acks;
+    uint32_t firstSequence = 0;
+    int inputCount = 0;
+    struct SM64MarioInputs inputs[PREDICTION_MAX_SENT_INPUTS];
+    MatchSettings matchSettings;
 };
 
 class SM64MarioInstance
@@ -70,12 +150,38 @@ public:
     SM64MarioInstance();
     ~SM64MarioInstance();
 
+    // Goes back to the owner simulating this mario, e.g. when it is respawned
+    void ResetPrediction();
+    // Keeps the current geometry to draw in between it and the next step's
+    void KeepPreviousGeometry();
+
 public:
     int32_t marioId = -2;
     struct SM64MarioInputs marioInputs { 0 };
     struct SM64MarioState marioState { 0 };
     struct SM64MarioGeometryBuffers marioGeometry { 0 };
+    std::vector<float> previousPositions;
+    int previousTrianglesUsed = 0;
     struct SM64MarioBodyState marioBodyState { 0 };
+    // Remote marios only, body states are received into the inbox and played back from the interpolator a little behind the sender
+    SpscRing<ReceivedBodyState> inbox{ MARIO_INBOX_SIZE };
+    SnapshotInterpolator interpolator;
+    // Set once the host simulates this mario from its owner's inputs, the host's body state wins from then on
+    bool hostAuthoritative = false;
+    // Local mario on clients: inputs the host hasn't simulated yet, replayed when its state disagrees with ours
+    InputPredictor predictor;
+    TripleBuffer<MarioCorrection> corrections;
+    bool hasCorrection = false;
+    uint32_t correctionSequence = 0;
+    struct SM64MarioBodyState correctionState { 0 };
+    float renderOffset[3] = { 0.0f, 0.0f, 0.0f };
+    // Around the last converted geometry, the renderer culls the mario with it
+    BoundingSphere renderBounds;
+    // Remote marios on the host: the owner's inputs and the newest state it sent, to take over from
+    InputSequencer inputSequencer;
+    std::unique_ptr<SnapshotStreamEncoder> authorityEncoder;
+    uint32_t ownerInputSequence = 0;
+    struct SM64MarioBodyState ownerBodyState { 0 };
     bool MarioActive = true;
     Model* model = nullptr;
     std::counting_semaphore<1> sema{ 1 };
@@ -84,11 +190,19 @@ public:
     int colorIndex = -1;
     int playerId = -1;
     int teamIndex = -1;
-    unsigned long tickCount = 0;
-    unsigned long lastBallInteraction = 0;
+    uint64_t lastBallInteractionMs = 0;
     bool isCar = false;
 };
 
+// A remote mario prepared for ticking on the worker pool
+struct MarioTickJob
+{
+    SM64MarioInstance* marioInstance = nullptr;
+    bool hostSimulated = false;
+    bool hasInput = false;
+    int interactionIndex = -1; // In hostInteractions
+};
+
 class SM64 final : public RocketGameMode
 {
 public:
@@ -112,16 +226,39 @@ public:
     void SendSettingsToClients();
 
     void MatchSettingsMessageReceived(char* buf, int len);
-    void MarioMessageReceived(char* buf, int len);
+    void MarioMessageReceived(char* buf, int len, uint32_t sequence, bool authoritative);
+    void MarioInputMessageReceived(char* buf, int len);
     void SendJoinCommandToClients();
 
-    void LoadStaticSurfaces(Model* model = nullptr);
+    // Where the snapshot codec finds libsm64's body state fields, recordings start with it
+    static BodyStateLayout MarioBodyStateLayout();
+    static const SnapshotCodec& BodyStateCodec();
+    static SnapshotKinematics BodyStateKinematics();
+    static bool StartBodyStateRecording(const std::filesystem::path& path);
+    static void StopBodyStateRecording();
+    // Records the local mario's controls and the ball every step, for the headless harness
+    static bool StartReplayRecording(const std::filesystem::path& path);
+    static void StopReplayRecording();
+
+    // Loads the map's surfaces in the background and swaps them in once they're ready, "" loads the default map
+    void LoadMap(const std::string& arena);
+    // nullptr loads the default map
+    void LoadStaticSurfaces(std::shared_ptr<MapSurfaces> map = nullptr);
+    // In libsm64 coordinates, y is up
+    bool hasFloorBelow(int16_t x, int16_t y, int16_t z);
+
+    // Called from tickMarioInstance with the mario's sema held
+    int encodeBodyState(SM64MarioInstance* marioInstance, SnapshotStreamEncoder& encoder, uint32_t inputSequence,
+        char* out, int outLen);
+    void sendMarioInputs(SM64MarioInstance* marioInstance);
+    void reconcileLocalMario(SM64MarioInstance* marioInstance);
 
 private:
     void onCharacterSpawn(ServerWrapper server);
     void onCountdownEnd(ServerWrapper server);
     void onOvertimeStart(ServerWrapper server);
     void onTick(ServerWrapper server);
+    void resolveBallInteractions(ServerWrapper server);
     void onSetVehicleInput(CarWrapper car, void* params);
     void onNameplateTick(ServerWrapper caller, void* params);
     void sendSettingsIfHost(ServerWrapper server);
@@ -134,6 +271,18 @@ private:
     void addModelToPool(Model*);
     int getColorIndexFromPool(int teamIndex);
     void addColorIndexToPool(int colorIndex);
+    size_t writeAcks(uint8_t* data, size_t offset, size_t maxLen, size_t reserve);
+    bool readAcks(const uint8_t* data, size_t len, size_t& offset, BodyStateAcks& acks);
+    void publishAcks();
+    void applyAcks(int senderId, const BodyStateAcks& acks);
+    bool drainControlInbox();
+    bool applyMatchSettings(const MatchSettings& settings);
+    void joinHostGame();
+    void drainMarioInbox(SM64MarioInstance* marioInstance);
+    void gatherHostInteractions();
+    bool prepareHostSimulatedMario(SM64MarioInstance* marioInstance, int interactionIndex);
+    void tickHostSimulatedMario(SM64MarioInstance* marioInstance, bool hasInput);
+    void tickRemoteMario(const MarioTickJob& job, bool lastStep);
 
 public:
     SM64MarioInstance localMario;
@@ -145,8 +294,22 @@ public:
     std::vector<Model*> marioModelPool;
     std::counting_semaphore<1> marioModelPoolSema{ 1 };
     float currentBoostAount = 0.33f;
+    // Only taken by the game and render hooks, the network threads hand everything over through the inboxes
     std::map<int, SM64MarioInstance*> remoteMarios;
     std::counting_semaphore<1> remoteMariosSema{ 1 };
+    SnapshotStreamEncoder bodyStateEncoder{ BodyStateCodec() };
+    MpscQueue<MarioControlMessage> controlInbox{ CONTROL_INBOX_SIZE };
+    TripleBuffer<BodyStateAcks> bodyStateAcks;
+    // Receiving side of the body state streams, only touched by the network threads under receiveSema
+    std::counting_semaphore<1> receiveSema{ 1 };
+    NetcodeSequenceFilter bodyStateFilter;
+    std::map<int, SnapshotStreamDecoder> bodyStateDecoders;
+    std::map<int, SM64MarioInstance*> receivingMarios;
+    std::set<int> hostAuthoritativeStreams;
+    // Bumped when leaving a game, control messages from before that are dropped
+    std::atomic<uint32_t> receiveGeneration = 0;
+    std::atomic<int> localPlayerId = -1;
+    std::atomic<bool> marioStateReceived = false;
     Vector carLocation;
     MatchSettings matchSettings;
     std::counting_semaphore<1> matchSettingsSema{ 1 };
@@ -164,18 +327,38 @@ public:
     };
     int menuStackCount = 0;
     bool Sm64Initialized = false;
-    uint32_t interpolationInterval = 1;
+    // Marios only tick on these 30 Hz steps, rendered frames in between draw them part way to the next step
+    FixedStepScheduler localMarioSteps;
+    FixedStepScheduler remoteMarioSteps;
 
     Model* ballModel = nullptr;
     Model* octaneModel = nullptr;
     Model* dominusModel = nullptr;
     Model* fennecModel = nullptr;
     Model* mapModel = nullptr;
-    std::vector<Vertex> mapVertices;
-    bool mapInitialized = false;
+    // Surfaces and render vertices of the loaded custom map, swapped under the libsm64 guard
+    std::shared_ptr<MapSurfaces> loadedMap;
+    // Index over the loaded static surfaces, rebuilt together with them under the libsm64 guard
+    SurfaceGrid surfaceGrid;
+    std::atomic<bool> mapInitialized = false;
+    // Guards the swap of a loaded map, only the newest LoadMap gets swapped in
+    std::mutex mapSwapMutex;
+    uint64_t mapGeneration = 0;
+    std::atomic<bool> mapLoading = false;
+    // After everything its loads touch, so it is destroyed, and its thread joined, first
+    MapLoader mapLoader{ MAP_LOAD_WORKERS };
+    WorkerPool tickPool{ MARIO_TICK_WORKERS };
+    // Only touched by the render thread, kept around so a frame doesn't allocate
+    std::vector<MarioTickJob> tickJobs;
+    MarioInteractionBatch hostInteractions;
+    // Only touched by the host's game tick
+    MarioInteractionBatch ballInteractions;
+    std::vector<SM64MarioInstance*> ballInteractionMarios;
+    std::vector<uint8_t> ballHits;
 
 private:
     /* SM64 Members */
+    MappedFile romFile;
     uint8_t* texture = nullptr;
     vec3 cameraPos;
     float cameraRot;
@@ -185,17 +368,10 @@ private:
     struct SM64MarioBodyState marioBodyStateIn;
     std::shared_ptr<CVarManagerWrapper> cvarManager;
     bool isHost = false;
-    float groundPoundPinchVel;
-    float attackBallRadius;
-    float kickBallVelHoriz;
-    float kickBallVelVert;
-    float punchBallVelHoriz;
-    float punchBallVelVert;
-    float attackBoostDamage;
-    float diveBallVelHoriz;
-    float diveBallVelVert;
-    float flyBallVel;
-    int interpolationFactor = 1;
+    MarioTuningTable tuning;
+    MarioTuning editedTuning;
+    // Revision of the tuning last sent to the clients
+    std::atomic<uint32_t> sentTuningRevision = 0;
 
 protected:
     const std::string vehicleInputCheck = "Function TAGame.Car_TA.SetVehicleInput";
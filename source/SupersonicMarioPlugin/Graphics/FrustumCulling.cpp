@@ -0,0 +1,191 @@
+// FrustumCulling.cpp
+// Bounding spheres and a view frustum to leave out draws the camera can't see.
+
+#include "FrustumCulling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE
+#endif
+
+static_assert(sizeof(BoundingSphere) == 4 * sizeof(float), "CullSpheres loads a BoundingSphere as one float4");
+
+namespace
+{
+	inline const float* positionAt(const float* positions, size_t i, size_t stride)
+	{
+		return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + i * stride);
+	}
+
+	// Signed distance of the sphere's center, in the same order of operations as the SSE2 path
+	inline float planeDistance(const float plane[4], const float center[3])
+	{
+		return center[0] * plane[0] + center[1] * plane[1] + center[2] * plane[2] + plane[3];
+	}
+}
+
+BoundingSphere BoundingSphereOf(const float* positions, size_t count, size_t stride)
+{
+	BoundingSphere sphere;
+	if (count == 0) return sphere;
+
+	// Around the center of the box, not the smallest sphere, but one pass over the points less to find it
+	float min[3] = { positions[0], positions[1], positions[2] };
+	float max[3] = { min[0], min[1], min[2] };
+	for (size_t i = 1; i < count; i++)
+	{
+		const float* position = positionAt(positions, i, stride);
+		for (int k = 0; k < 3; k++)
+		{
+			min[k] = std::min(min[k], position[k]);
+			max[k] = std::max(max[k], position[k]);
+		}
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		sphere.center[k] = 0.5f * (min[k] + max[k]);
+	}
+
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* position = positionAt(positions, i, stride);
+		const float dx = position[0] - sphere.center[0];
+		const float dy = position[1] - sphere.center[1];
+		const float dz = position[2] - sphere.center[2];
+		radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	// Rounding would otherwise leave the farthest point a hair outside
+	sphere.radius = std::sqrt(radiusSquared) * 1.0001f;
+	return sphere;
+}
+
+BoundingSphere TransformBoundingSphere(const BoundingSphere& sphere, const float world[16])
+{
+	if (!sphere.Valid()) return sphere;
+
+	BoundingSphere transformed;
+	for (int k = 0; k < 3; k++)
+	{
+		transformed.center[k] = sphere.center[0] * world[k] + sphere.center[1] * world[4 + k] +
+			sphere.center[2] * world[8 + k] + world[12 + k];
+	}
+
+	// The most a direction can stretch is the square root of the largest eigenvalue of M * M^T, for the upper 3x3
+	// M. Its largest absolute row sum bounds that eigenvalue, exactly for rotations and uniform scales.
+	float maxRowSum = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		float rowSum = 0.0f;
+		for (int j = 0; j < 3; j++)
+		{
+			const float dot = world[i * 4] * world[j * 4] + world[i * 4 + 1] * world[j * 4 + 1] +
+				world[i * 4 + 2] * world[j * 4 + 2];
+			rowSum += std::abs(dot);
+		}
+		maxRowSum = std::max(maxRowSum, rowSum);
+	}
+	transformed.radius = sphere.radius * std::sqrt(maxRowSum) * 1.0001f;
+	return transformed;
+}
+
+Frustum FrustumFromViewProjection(const float viewProjection[16])
+{
+	// Clip space is x and y within [-w, w] and z within [0, w], so each plane is a sum of the matrix' columns
+	const float* m = viewProjection;
+	const float column[4][4] = {
+		{ m[0], m[4], m[8], m[12] },
+		{ m[1], m[5], m[9], m[13] },
+		{ m[2], m[6], m[10], m[14] },
+		{ m[3], m[7], m[11], m[15] },
+	};
+
+	Frustum frustum;
+	for (int k = 0; k < 4; k++)
+	{
+		frustum.planes[0][k] = column[3][k] + column[0][k]; // Left
+		frustum.planes[1][k] = column[3][k] - column[0][k]; // Right
+		frustum.planes[2][k] = column[3][k] + column[1][k]; // Bottom
+		frustum.planes[3][k] = column[3][k] - column[1][k]; // Top
+		frustum.planes[4][k] = column[2][k]; // Near
+		frustum.planes[5][k] = column[3][k] - column[2][k]; // Far
+	}
+	for (float* plane : frustum.planes)
+	{
+		const float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		for (int k = 0; k < 4; k++)
+		{
+			plane[k] *= scale;
+		}
+	}
+	return frustum;
+}
+
+bool SphereVisible(const Frustum& frustum, const BoundingSphere& sphere)
+{
+	if (!sphere.Valid()) return true;
+
+	for (const float* plane : frustum.planes)
+	{
+		if (planeDistance(plane, sphere.center) < -sphere.radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t CullSpheresScalar(const Frustum& frustum, const BoundingSphere* spheres, size_t count, uint8_t* visible)
+{
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		visible[i] = SphereVisible(frustum, spheres[i]) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
+
+size_t CullSpheres(const Frustum& frustum, const BoundingSphere* spheres, size_t count, uint8_t* visible)
+{
+#ifdef FRUSTUM_CULLING_SSE
+	size_t visibleCount = 0;
+	size_t i = 0;
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		// Four spheres as x, y, z and radius of each
+		__m128 x = _mm_loadu_ps(spheres[i].center);
+		__m128 y = _mm_loadu_ps(spheres[i + 1].center);
+		__m128 z = _mm_loadu_ps(spheres[i + 2].center);
+		__m128 radius = _mm_loadu_ps(spheres[i + 3].center);
+		_MM_TRANSPOSE4_PS(x, y, z, radius);
+		const __m128 negativeRadius = _mm_sub_ps(zero, radius);
+
+		__m128 outside = zero;
+		for (const float* plane : frustum.planes)
+		{
+			__m128 distance = _mm_mul_ps(x, _mm_set1_ps(plane[0]));
+			distance = _mm_add_ps(distance, _mm_mul_ps(y, _mm_set1_ps(plane[1])));
+			distance = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(plane[2])));
+			distance = _mm_add_ps(distance, _mm_set1_ps(plane[3]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+		}
+
+		// No bounds is always visible
+		const int outsideMask = _mm_movemask_ps(outside) & ~_mm_movemask_ps(_mm_cmplt_ps(radius, zero));
+		for (int k = 0; k < 4; k++)
+		{
+			visible[i + k] = (outsideMask >> k) & 1 ? 0 : 1;
+			visibleCount += visible[i + k];
+		}
+	}
+	return visibleCount + CullSpheresScalar(frustum, spheres + i, count - i, visible + i);
+#else
+	return CullSpheresScalar(frustum, spheres, count, visible);
+#endif
+}
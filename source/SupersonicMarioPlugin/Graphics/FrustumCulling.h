@@ -0,0 +1,42 @@
+#pragma once
+// FrustumCulling.h
+// Bounding spheres and a view frustum to leave out draws the camera can't see.
+//
+// Matrices are row major for row vectors, like DirectXMath's, so a point
+// is p * world * viewProjection. The frustum's planes are taken from the
+// view-projection the renderer draws with, far plane included, so a
+// sphere is only culled if the GPU would have clipped all of it anyway.
+// CullSpheres tests four spheres at a time with SSE2 and falls back to
+// CullSpheresScalar, which FrustumCullingCheck compares it against.
+//
+// Doesn't know D3D, the renderer passes its matrices in as floats.
+
+#include <cstddef>
+#include <cstdint>
+
+struct BoundingSphere
+{
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	// Negative for no bounds, which is never culled
+	float radius = -1.0f;
+
+	bool Valid() const { return radius >= 0.0f; }
+};
+
+// Inside is where a * x + b * y + c * z + d >= 0, with (a, b, c) unit length
+struct Frustum
+{
+	float planes[6][4];
+};
+
+// Around points that are stride bytes apart, or no bounds for no points
+BoundingSphere BoundingSphereOf(const float* positions, size_t count, size_t stride);
+// Still holds every point of the sphere after the transform, scaled and rotated included
+BoundingSphere TransformBoundingSphere(const BoundingSphere& sphere, const float world[16]);
+
+Frustum FrustumFromViewProjection(const float viewProjection[16]);
+bool SphereVisible(const Frustum& frustum, const BoundingSphere& sphere);
+
+// Sets visible[i] to 1 if spheres[i] may be seen, else 0, and returns how many may be
+size_t CullSpheres(const Frustum& frustum, const BoundingSphere* spheres, size_t count, uint8_t* visible);
+size_t CullSpheresScalar(const Frustum& frustum, const BoundingSphere* spheres, size_t count, uint8_t* visible);
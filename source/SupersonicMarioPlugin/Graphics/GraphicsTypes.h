@@ -23,11 +23,6 @@ typedef struct PS_ConstantBufferData_t
 
 	DirectX::XMFLOAT4 dynamicLightColorStrengths[MAX_LIGHTS];
 	DirectX::XMFLOAT4 dynamicLightPositions[MAX_LIGHTS];
-
-	DirectX::XMFLOAT3 capColor;
-	float padding;
-	DirectX::XMFLOAT3 shirtColor;
-	float padding2;
 } PS_ConstantBufferData;
 
 typedef struct Light_t
@@ -36,4 +31,13 @@ typedef struct Light_t
 	float posX, posY, posZ = 0.0f;
 	float strength = 0.0f;
 	bool showBulb = false;
-} Light;
\ No newline at end of file
+} Light;
+
+// Bytes a model holds, on the CPU and in its GPU buffers and textures
+typedef struct ModelMemoryUsage_t
+{
+	std::string name;
+	size_t meshes = 0;
+	size_t cpuBytes = 0;
+	size_t gpuBytes = 0;
+} ModelMemoryUsage;
\ No newline at end of file
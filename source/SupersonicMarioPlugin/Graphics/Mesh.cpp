@@ -1,8 +1,5 @@
 #include "Mesh.h"
 
-#define NEAR_Z 50.0f
-#define FAR_Z 20000.0f
-
 Mesh::Mesh(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	int inWindowWidth,
 	int inWindowHeight,
@@ -11,103 +8,90 @@ Mesh::Mesh(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	uint8_t* inAltTexture,
 	size_t inTexSize,
 	uint16_t inTexWidth,
-	uint16_t inTexHeight)
+	uint16_t inTexHeight,
+	bool inPackedVertices)
 {
-	init(deviceIn, inWindowWidth, inWindowHeight, maxTriangles, 0, inTexture, inAltTexture, inTexSize, inTexWidth, inTexHeight);
+	init(deviceIn, inWindowWidth, inWindowHeight, maxTriangles, 0, inTexture, inAltTexture, inTexSize, inTexWidth, inTexHeight,
+		inPackedVertices);
 }
 
 Mesh::Mesh(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	int inWindowWidth,
 	int inWindowHeight,
-	std::vector<Vertex> *inVertices,
-	std::vector<UINT>* inIndices,
+	const Vertex* inVertices,
+	size_t inVertexCount,
+	const UINT* inIndices,
+	size_t inIndexCount,
 	uint8_t* inTexture,
 	size_t inTexSize,
 	uint16_t inTexWidth,
 	uint16_t inTexHeight)
 {
+	device = deviceIn;
+	windowWidth = inWindowWidth;
+	windowHeight = inWindowHeight;
 	IsTransparent = true;
-	for (int i = 0; i < inVertices->size(); i++)
-	{
-		Vertices.push_back((*inVertices)[i]);
-	}
-	for (int i = 0; i < inIndices->size(); i++)
-	{
-		Indices.push_back((*inIndices)[i]);
-	}
-	auto maxTrialges = Indices.size() / 3;
-	init(deviceIn, inWindowWidth, inWindowHeight, maxTrialges, Indices.size(), inTexture, nullptr, inTexSize, inTexWidth, inTexHeight);
-	NumTrianglesUsed = maxTrialges;
-}
-
-void Mesh::RenderUpdateVertices(size_t numTrianglesUsed, Vector camLocation, Vector camRotation, float fov)
-{
-	if (UpdateVertices) return;
-
-	Render(camLocation, camRotation, fov);
+	Static = true;
 
-	NumTrianglesUsed = numTrianglesUsed;
-	UpdateVertices = true;
-}
-	
-void Mesh::Render(Vector camLocation, Vector camRotation, float fov)
-{
-	float aspectRatio = static_cast<float>(this->windowWidth) / static_cast<float>(this->windowHeight);
+	NumIndices = inIndexCount;
+	MaxTriangles = (inIndexCount > 0 ? inIndexCount : inVertexCount) / 3;
+	NumTrianglesUsed = MaxTriangles;
 
-	float fovRadians = DirectX::XMConvertToRadians(fov);
-	float verticalFovRadians = 2 * atan(tan(fovRadians / 2) / aspectRatio);
-
-	DirectX::XMMATRIX identity = DirectX::XMMatrixIdentity();
-
-	DirectX::XMMATRIX scale = DirectX::XMMatrixScaling(scaleVector.X, scaleVector.Y, scaleVector.Z);
-
-	DirectX::XMMATRIX translation = DirectX::XMMatrixTranslation(translationVector.X, translationVector.Y, translationVector.Z);
-
-	DirectX::XMMATRIX rotation = DirectX::XMMatrixRotationRollPitchYaw(rotPitch, rotYaw, rotRoll);
-
-	DirectX::FXMVECTOR quat = DirectX::XMVectorSet(quatX, quatY, quatZ, quatW);
-	DirectX::XMMATRIX quatRotation = DirectX::XMMatrixRotationQuaternion(quat);
+	texData = inTexture;
+	texSize = inTexSize;
+	texWidth = inTexWidth;
+	texHeight = inTexHeight;
 
-	auto camLocationVector = DirectX::XMVectorSet(camLocation.X, camLocation.Y, camLocation.Z, 0.0f);
-	auto camTarget = DirectX::XMVectorSet(camRotation.X, camRotation.Y, camRotation.Z, 0.0f);
-	camTarget = DirectX::XMVectorAdd(camTarget, camLocationVector);
-	DirectX::XMMATRIX view = DirectX::XMMatrixLookAtLH(camLocationVector, camTarget, this->DEFAULT_UP_VECTOR);
+	D3D11_BUFFER_DESC vbDesc = { 0 };
+	vbDesc.ByteWidth = (UINT)(sizeof(Vertex) * inVertexCount);
+	vbDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vbDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	vbDesc.StructureByteStride = sizeof(Vertex);
+	D3D11_SUBRESOURCE_DATA vbData = { inVertices, 0, 0 };
+	if (SUCCEEDED(device->CreateBuffer(&vbDesc, &vbData, VertexBuffer.GetAddressOf())))
+	{
+		vertexBufferBytes = vbDesc.ByteWidth;
+	}
 
-	DirectX::XMMATRIX projection = DirectX::XMMatrixPerspectiveFovLH(verticalFovRadians, aspectRatio, NEAR_Z, FAR_Z);
+	if (inIndexCount > 0)
+	{
+		D3D11_BUFFER_DESC ibDesc = { 0 };
+		ibDesc.ByteWidth = (UINT)(sizeof(UINT) * inIndexCount);
+		ibDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		ibDesc.Usage = D3D11_USAGE_IMMUTABLE;
+		D3D11_SUBRESOURCE_DATA ibData = { inIndices, 0, 0 };
+		if (SUCCEEDED(device->CreateBuffer(&ibDesc, &ibData, IndexBuffer.GetAddressOf())))
+		{
+			indexBufferBytes = ibDesc.ByteWidth;
+		}
+	}
 
-	VertexConstBufferData.world = identity * rotation * quatRotation * scale * translation;
-	VertexConstBufferData.wvp = VertexConstBufferData.world * view * projection;
+	// Nothing to draw from if the upload failed
+	if (VertexBuffer == nullptr || (inIndexCount > 0 && IndexBuffer == nullptr))
+	{
+		NumTrianglesUsed = 0;
+	}
 
-	render = true;
+	createTextures();
 }
 
-void Mesh::SetTranslation(float x, float y, float z)
+void Mesh::RenderUpdateVertices(size_t numTrianglesUsed, const DirectX::XMMATRIX& world,
+	const DirectX::XMMATRIX& viewProjection)
 {
-	translationVector.X = x;
-	translationVector.Y = y;
-	translationVector.Z = z;
-}
+	Render(world, viewProjection);
+	if (Static) return;
 
-void Mesh::SetScale(float x, float y, float z)
-{
-	scaleVector.X = x;
-	scaleVector.Y = y;
-	scaleVector.Z = z;
+	// Still set from a culled frame, the upload waits for a visible one
+	NumTrianglesUsed = numTrianglesUsed;
+	UpdateVertices = true;
 }
 
-void Mesh::SetRotation(float roll, float pitch, float yaw)
+void Mesh::Render(const DirectX::XMMATRIX& world, const DirectX::XMMATRIX& viewProjection)
 {
-	rotRoll = roll;
-	rotPitch = pitch;
-	rotYaw = yaw;
-}
+	VertexConstBufferData.world = world;
+	VertexConstBufferData.wvp = world * viewProjection;
 
-void Mesh::SetRotationQuat(float x, float y, float z, float w)
-{
-	quatX = x;
-	quatY = y;
-	quatZ = z;
-	quatW = w;
+	render = true;
 }
 
 void Mesh::SetCapColor(float r, float g, float b)
@@ -129,6 +113,16 @@ void Mesh::SetShowAltTexture(bool val)
 	ShowAltTexture = val;
 }
 
+size_t Mesh::CpuBytes() const
+{
+	return Vertices.capacity() * sizeof(Vertex) + Indices.capacity() * sizeof(unsigned int);
+}
+
+size_t Mesh::GpuBytes() const
+{
+	return vertexBufferBytes + indexBufferBytes + textureBytes;
+}
+
 void Mesh::init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	int inWindowWidth,
 	int inWindowHeight,
@@ -138,9 +132,11 @@ void Mesh::init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	uint8_t* inAltTexture,
 	size_t inTexSize,
 	uint16_t inTexWidth,
-	uint16_t inTexHeight)
+	uint16_t inTexHeight,
+	bool inPackedVertices)
 {
 	device = deviceIn;
+	PackedVertices = inPackedVertices;
 	windowWidth = inWindowWidth;
 	windowHeight = inWindowHeight;
 
@@ -173,17 +169,22 @@ void Mesh::init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	texWidth = inTexWidth;
 	texHeight = inTexHeight;
 
+	const size_t vertexSize = PackedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
 	D3D11_BUFFER_DESC vbDesc = { 0 };
 	ZeroMemory(&vbDesc, sizeof(D3D11_BUFFER_DESC));
-	vbDesc.ByteWidth = (UINT)(sizeof(Vertex) * vertexCount);
+	vbDesc.ByteWidth = (UINT)(vertexSize * vertexCount);
 	vbDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vbDesc.Usage = D3D11_USAGE_DYNAMIC;
 	vbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	vbDesc.StructureByteStride = sizeof(Vertex);
+	vbDesc.StructureByteStride = (UINT)vertexSize;
 
+	// Packed meshes start out empty, they draw nothing before their first upload
 	D3D11_SUBRESOURCE_DATA vbData = { Vertices.data(), 0, 0 };
 
-	device->CreateBuffer(&vbDesc, &vbData, VertexBuffer.GetAddressOf());
+	if (SUCCEEDED(device->CreateBuffer(&vbDesc, PackedVertices ? nullptr : &vbData, VertexBuffer.GetAddressOf())))
+	{
+		vertexBufferBytes = vbDesc.ByteWidth;
+	}
 
 	D3D11_BUFFER_DESC ibDesc;
 	ZeroMemory(&ibDesc, sizeof(ibDesc));
@@ -195,24 +196,16 @@ void Mesh::init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 
 	D3D11_SUBRESOURCE_DATA ibData = { Indices.data(), 0, 0 };
 
-	device->CreateBuffer(&ibDesc, &ibData, IndexBuffer.GetAddressOf());
-
-	// Create constant buffer
-	// We need to send the world view projection (WVP) matrix to the shader
-	D3D11_BUFFER_DESC cbDesc = { 0 };
-	ZeroMemory(&cbDesc, sizeof(D3D11_BUFFER_DESC));
-	cbDesc.ByteWidth = static_cast<UINT>(sizeof(VS_ConstantBufferData) + (16 - (sizeof(VS_ConstantBufferData) % 16)));
-	cbDesc.Usage = D3D11_USAGE_DYNAMIC;
-	cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	cbDesc.MiscFlags = 0;
-	cbDesc.StructureByteStride = 0;
-
-	D3D11_SUBRESOURCE_DATA cbData = { &VertexConstBufferData, 0, 0 };
-
-	device->CreateBuffer(&cbDesc, &cbData, VertexConstantBuffer.GetAddressOf());
+	if (SUCCEEDED(device->CreateBuffer(&ibDesc, &ibData, IndexBuffer.GetAddressOf())))
+	{
+		indexBufferBytes = ibDesc.ByteWidth;
+	}
 
+	createTextures();
+}
 
+void Mesh::createTextures()
+{
 	// If there's texture data, create a shader resource view for it
 	if (texData != nullptr)
 	{
@@ -247,15 +240,17 @@ void Mesh::init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 		if (texture != nullptr)
 		{
 			device->CreateShaderResourceView(texture, &shaderResourceViewDesc, TextureResourceView.GetAddressOf());
+			textureBytes += 4 * (size_t)texWidth * texHeight;
 		}
 
-		if (inAltTexture != nullptr)
+		if (altTexData != nullptr)
 		{
 			subresourceData.pSysMem = altTexData;
 
 			ID3D11Texture2D* altTexture;
 			device->CreateTexture2D(&texture2dDesc, &subresourceData, &altTexture);
 			device->CreateShaderResourceView(altTexture, &shaderResourceViewDesc, AltTextureResourceView.GetAddressOf());
+			textureBytes += 4 * (size_t)texWidth * texHeight;
 		}
 
 	}
@@ -263,6 +258,16 @@ void Mesh::init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 	{
 		std::string texturePath = Utils::GetBakkesmodFolderPath() + "data\\assets\\transparent.png";
 		std::wstring texturePathWide(texturePath.begin(), texturePath.end());
-		DirectX::CreateWICTextureFromFile(this->device.Get(), texturePathWide.c_str(), nullptr, TextureResourceView.GetAddressOf());
+		Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+		DirectX::CreateWICTextureFromFile(this->device.Get(), texturePathWide.c_str(), resource.GetAddressOf(),
+			TextureResourceView.GetAddressOf());
+
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+		if (resource != nullptr && SUCCEEDED(resource.As(&texture)))
+		{
+			D3D11_TEXTURE2D_DESC desc;
+			texture->GetDesc(&desc);
+			textureBytes += 4 * (size_t)desc.Width * desc.Height;
+		}
 	}
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "../Modules/Utils.h"
 #include <WICTextureLoader.h>
 #include "GraphicsTypes.h"
+#include "Modules/PackedVertices.h"
 
 class Renderer;
 
@@ -26,25 +27,30 @@ public:
 		uint8_t* inAltTexture = nullptr,
 		size_t inTexSize = 0,
 		uint16_t inTexWidth = 0,
-		uint16_t inTexHeight = 0);
+		uint16_t inTexHeight = 0,
+		bool inPackedVertices = false);
+	// Static geometry, uploaded once into immutable buffers of exactly its size and not kept on the CPU.
+	// Without indices the vertices are drawn in order, three per triangle.
 	Mesh(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
 		int inWindowWidth,
 		int inWindowHeight,
-		std::vector<Vertex>* inVertices,
-		std::vector<UINT>* inIndices,
+		const Vertex* inVertices,
+		size_t inVertexCount,
+		const UINT* inIndices,
+		size_t inIndexCount,
 		uint8_t* inTexture,
 		size_t inTexSize,
 		uint16_t inTexWidth,
 		uint16_t inTexHeight);
-	void Render(Vector camLocation, Vector camRotation, float fov);
-	void RenderUpdateVertices(size_t numTrianglesUsed, Vector camLocation, Vector camRotation, float fov);
-	void SetTranslation(float x, float y, float z);
-	void SetScale(float x, float y, float z);
-	void SetRotation(float roll, float pitch, float yaw);
-	void SetRotationQuat(float x, float y, float z, float w);
+	// The model's world matrix, and the view-projection the renderer builds once per camera
+	void Render(const DirectX::XMMATRIX& world, const DirectX::XMMATRIX& viewProjection);
+	void RenderUpdateVertices(size_t numTrianglesUsed, const DirectX::XMMATRIX& world, const DirectX::XMMATRIX& viewProjection);
 	void SetCapColor(float r, float g, float b);
 	void SetShirtColor(float r, float g, float b);
 	void SetShowAltTexture(bool val);
+	// What the mesh holds on the CPU, and in its buffers and textures on the GPU
+	size_t CpuBytes() const;
+	size_t GpuBytes() const;
 
 private:
 	void init(Microsoft::WRL::ComPtr<ID3D11Device> deviceIn,
@@ -56,22 +62,26 @@ private:
 		uint8_t* inAltTexture = nullptr,
 		size_t inTexSize = 0,
 		uint16_t inTexWidth = 0,
-		uint16_t inTexHeight = 0);
-	float rotRoll, rotPitch, rotYaw = 0.0f;
-	float quatX, quatY, quatZ, quatW = 0.0f;
+		uint16_t inTexHeight = 0,
+		bool inPackedVertices = false);
+	void createTextures();
 
 public:
 	size_t MaxTriangles = 0;
 	size_t NumTrianglesUsed = 0;
 	bool UpdateVertices = false;
+	// Its buffers are immutable, RenderUpdateVertices only moves it
+	bool Static = false;
 	std::vector<Vertex> Vertices;
+	// Vertices are uploaded as PackedVertex, relative to PackedBounds
+	bool PackedVertices = false;
+	PackedVertexBounds PackedBounds;
 	std::vector<unsigned int> Indices;
 	size_t NumIndices = 0;
 	bool IsTransparent = false;
 	bool ShowAltTexture = false;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> VertexBuffer = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> IndexBuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> VertexConstantBuffer = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> TextureResourceView = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> AltTextureResourceView = nullptr;
 	float CapColorR, CapColorG, CapColorB;
@@ -83,11 +93,10 @@ private:
 	uint8_t* altTexData = nullptr;
 	size_t texSize;
 	uint16_t texWidth, texHeight;
+	size_t vertexBufferBytes = 0;
+	size_t indexBufferBytes = 0;
+	size_t textureBytes = 0;
 	int windowWidth, windowHeight;
-	const DirectX::XMVECTOR DEFAULT_UP_VECTOR = DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
-	Vector translationVector = Vector(0.0f, 0.0f, 0.0f);
-	Vector scaleVector = Vector(1.0f, 1.0f, 1.0f);
-	Vector rotationVector = Vector(0.0f, 0.0f, 0.0f);
 	Microsoft::WRL::ComPtr<ID3D11Device> device = nullptr;
 
 };
\ No newline at end of file
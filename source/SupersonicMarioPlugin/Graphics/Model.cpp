@@ -12,13 +12,14 @@ void backgroundLoadData(Model* self)
 Model::Model(std::string path, bool inRenderAlways)
 {
 	modelPath = path;
+	Name = std::filesystem::path(path).filename().string();
 	std::thread loadMeshesThread(backgroundLoadData, this);
 	loadMeshesThread.detach();
 	renderAlways = inRenderAlways;
 	Renderer::getInstance().AddModel(this);
 }
 
-Model::Model(std::vector<std::string> meshPaths, bool inRenderAlways)
+Model::Model(std::vector<std::string> meshPaths, bool inRenderAlways, bool addToRenderer)
 {
 	renderAlways = inRenderAlways;
 	for(int i = 0; i < meshPaths.size(); i++)
@@ -26,8 +27,15 @@ Model::Model(std::vector<std::string> meshPaths, bool inRenderAlways)
 		modelPath = meshPaths[i];
 		LoadModel();
 	}
+	if (!meshPaths.empty())
+	{
+		Name = std::filesystem::path(meshPaths[0]).filename().string();
+	}
 	backgroundDataLoaded = true;
-	Renderer::getInstance().AddModel(this);
+	if (addToRenderer)
+	{
+		Renderer::getInstance().AddModel(this);
+	}
 }
 
 Model::Model(size_t inMaxTriangles,
@@ -37,7 +45,8 @@ Model::Model(size_t inMaxTriangles,
 	uint16_t inTexWidth,
 	uint16_t inTexHeight,
 	bool inRenderAlways,
-	bool noCull)
+	bool noCull,
+	bool inPackedVertices)
 {
 	maxTriangles = inMaxTriangles;
 	texture = inTexture;
@@ -47,6 +56,7 @@ Model::Model(size_t inMaxTriangles,
 	renderAlways = inRenderAlways;
 	backgroundDataLoaded = true;
 	NoCull = noCull;
+	packedVertices = inPackedVertices;
 	Renderer::getInstance().AddModel(this);
 }
 
@@ -68,23 +78,116 @@ bool Model::ShouldRender()
 
 void Model::InitMeshes(Microsoft::WRL::ComPtr<ID3D11Device> device, int windowWidth, int windowHeight)
 {
+	std::vector<Mesh*> newMeshes;
+	std::vector<float> positions;
+	for (const std::vector<Vertex>& vertices : modelVerticesArr)
+	{
+		for (const Vertex& vertex : vertices)
+		{
+			positions.insert(positions.end(), { vertex.pos.x, vertex.pos.y, vertex.pos.z });
+		}
+	}
+	const BoundingSphere bounds = BoundingSphereOf(positions.data(), positions.size() / 3, 3 * sizeof(float));
+
 	if (modelVerticesArr.size() == 0)
 	{
-		Mesh* newMesh = new Mesh(device, windowWidth, windowHeight, maxTriangles, texture, altTexture, texSize, texWidth, texHeight);
-		Meshes.push_back(newMesh);
+		if (maxTriangles > 0)
+		{
+			newMeshes.push_back(new Mesh(device, windowWidth, windowHeight, maxTriangles, texture, altTexture, texSize,
+				texWidth, texHeight, packedVertices));
+		}
 	}
 	else
 	{
 		for (int i = 0; i < modelVerticesArr.size(); i++)
 		{
-			std::vector<Vertex>* vertices = &modelVerticesArr[i];
-			std::vector<UINT>* indices = &modelIndicesArr[i];
-			Mesh* newMesh = new Mesh(device, windowWidth, windowHeight, vertices, indices, texture, texSize, texWidth, texHeight);
-			Meshes.push_back(newMesh);
+			const std::vector<Vertex>& vertices = modelVerticesArr[i];
+			const std::vector<UINT>& indices = modelIndicesArr[i];
+			newMeshes.push_back(new Mesh(device, windowWidth, windowHeight, vertices.data(), vertices.size(), indices.data(),
+				indices.size(), texture, texSize, texWidth, texHeight));
 		}
 	}
 
+	sema.acquire();
+	Meshes = std::move(newMeshes);
+	Bounds = bounds;
+	// The GPU has its own copy now
+	std::vector<std::vector<Vertex>>().swap(modelVerticesArr);
+	std::vector<std::vector<UINT>>().swap(modelIndicesArr);
 	meshesInitialized = true;
+	sema.release();
+}
+
+void Model::SetStaticVertices(std::shared_ptr<const void> owner, const Vertex* vertices, size_t vertexCount)
+{
+	sema.acquire();
+	staticOwner = std::move(owner);
+	staticVertices = vertices;
+	staticVertexCount = vertexCount - vertexCount % 3;
+	staticVerticesPending = true;
+	sema.release();
+}
+
+void Model::UploadStaticVertices(Microsoft::WRL::ComPtr<ID3D11Device> device, int windowWidth, int windowHeight)
+{
+	sema.acquire();
+	if (!staticVerticesPending)
+	{
+		sema.release();
+		return;
+	}
+	std::shared_ptr<const void> owner = std::move(staticOwner);
+	const Vertex* vertices = staticVertices;
+	const size_t vertexCount = staticVertexCount;
+	staticVertices = nullptr;
+	staticVertexCount = 0;
+	staticVerticesPending = false;
+	sema.release();
+
+	std::vector<Mesh*> newMeshes;
+	if (vertexCount > 0)
+	{
+		newMeshes.push_back(new Mesh(device, windowWidth, windowHeight, vertices, vertexCount, nullptr, 0, texture, texSize,
+			texWidth, texHeight));
+	}
+
+	sema.acquire();
+	std::swap(Meshes, newMeshes);
+	sema.release();
+
+	for (Mesh* mesh : newMeshes)
+	{
+		delete mesh;
+	}
+}
+
+ModelMemoryUsage Model::GetMemoryUsage()
+{
+	ModelMemoryUsage usage;
+	usage.name = Name;
+
+	sema.acquire();
+	// Still being imported otherwise
+	if (backgroundDataLoaded)
+	{
+		for (const std::vector<Vertex>& vertices : modelVerticesArr)
+		{
+			usage.cpuBytes += vertices.capacity() * sizeof(Vertex);
+		}
+		for (const std::vector<UINT>& indices : modelIndicesArr)
+		{
+			usage.cpuBytes += indices.capacity() * sizeof(UINT);
+		}
+	}
+	usage.meshes = Meshes.size();
+	for (const Mesh* mesh : Meshes)
+	{
+		usage.cpuBytes += mesh->CpuBytes();
+		usage.gpuBytes += mesh->GpuBytes();
+	}
+	sema.release();
+
+	return usage;
 }
 
 bool Model::LoadModel()
@@ -232,25 +335,42 @@ void Model::SetShowAltTexture(bool val)
 	currentFrame.showAltTexture = val;
 }
 
-void Model::SetFrame(Frame* frame)
+void Model::SetWorldBounds(const BoundingSphere& bounds)
+{
+	currentFrame.worldBounds = bounds;
+}
+
+DirectX::XMMATRIX Model::FrameWorld(const Frame* frame) const
+{
+	DirectX::XMMATRIX scale = DirectX::XMMatrixScaling(frame->scaleVector.X, frame->scaleVector.Y, frame->scaleVector.Z);
+	DirectX::XMMATRIX translation = DirectX::XMMatrixTranslation(frame->translationVector.X,
+		frame->translationVector.Y,
+		frame->translationVector.Z);
+	DirectX::XMMATRIX rotation = DirectX::XMMatrixRotationRollPitchYaw(frame->rotPitch, frame->rotYaw, frame->rotRoll);
+	DirectX::XMMATRIX quatRotation = DirectX::XMMatrixRotationQuaternion(
+		DirectX::XMVectorSet(frame->quatX, frame->quatY, frame->quatZ, frame->quatW));
+
+	return rotation * quatRotation * scale * translation;
+}
+
+BoundingSphere Model::FrameBounds(const Frame* frame, const DirectX::XMMATRIX& world) const
+{
+	if (frame->worldBounds.Valid())
+	{
+		return frame->worldBounds;
+	}
+
+	DirectX::XMFLOAT4X4 worldFloats;
+	DirectX::XMStoreFloat4x4(&worldFloats, world);
+	return TransformBoundingSphere(Bounds, &worldFloats.m[0][0]);
+}
+
+void Model::SetFrame(Frame* frame, const DirectX::XMMATRIX& world, const DirectX::XMMATRIX& viewProjection)
 {
 	for (auto i = 0; i < Meshes.size(); i++)
 	{
 		Mesh* mesh = Meshes[i];
 
-		mesh->SetTranslation(frame->translationVector.X,
-			frame->translationVector.Y,
-			frame->translationVector.Z);
-		mesh->SetScale(frame->scaleVector.X,
-			frame->scaleVector.Y,
-			frame->scaleVector.Z);
-		mesh->SetRotation(frame->rotRoll,
-			frame->rotPitch,
-			frame->rotYaw);
-		mesh->SetRotationQuat(frame->quatX,
-			frame->quatY,
-			frame->quatZ,
-			frame->quatW);
 		mesh->SetCapColor(frame->CapColorR,
 			frame->CapColorG,
 			frame->CapColorB);
@@ -261,16 +381,11 @@ void Model::SetFrame(Frame* frame)
 
 		if (frame->updateVertices)
 		{
-			mesh->RenderUpdateVertices(frame->numTrianglesUsed,
-				frame->camLocation,
-				frame->camRotation,
-				frame->fov);
+			mesh->RenderUpdateVertices(frame->numTrianglesUsed, world, viewProjection);
 		}
 		else
 		{
-			mesh->Render(frame->camLocation,
-				frame->camRotation,
-				frame->fov);
+			mesh->Render(world, viewProjection);
 		}
 	}
 }
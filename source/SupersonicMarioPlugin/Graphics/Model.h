@@ -1,5 +1,6 @@
 #pragma once
 #include "GraphicsTypes.h"
+#include "FrustumCulling.h"
 #include "Mesh.h"
 #include "Modules/Utils.h"
 #include "Renderer.h"
@@ -30,10 +31,14 @@ public:
 		float fov;
 		size_t numTrianglesUsed;
 		bool showAltTexture;
+		// In world space, e.g. around a mario's geometry, instead of the model's own bounds
+		BoundingSphere worldBounds;
 	} Frame;
 
 	Model(std::string path, bool inRenderAlways = false);
-	Model(std::vector<std::string> meshPaths, bool inRenderAlways = false);
+	// addToRenderer false only imports the meshes, e.g. to read their triangles off another thread
+	Model(std::vector<std::string> meshPaths, bool inRenderAlways = false, bool addToRenderer = true);
+	// inMaxTriangles 0 makes no mesh, for models whose vertices are set with SetStaticVertices
 	Model(size_t inMaxTriangles,
 		uint8_t* inTexture,
 		uint8_t* inAltTexture,
@@ -41,10 +46,17 @@ public:
 		uint16_t inTexWidth,
 		uint16_t inTexHeight,
 		bool inRenderAlways = false,
-		bool noCull = false);
+		bool noCull = false,
+		bool inPackedVertices = false);
 	bool NeedsInitialized();
 	bool ShouldRender();
 	void InitMeshes(Microsoft::WRL::ComPtr<ID3D11Device> device, int windowWidth, int windowHeight);
+	// Replaces the meshes with one static mesh of these vertices, three per triangle in draw order.
+	// owner keeps the vertices alive until the render thread uploaded them, nothing is kept after.
+	void SetStaticVertices(std::shared_ptr<const void> owner, const Vertex* vertices, size_t vertexCount);
+	// Render thread, uploads what SetStaticVertices was last given
+	void UploadStaticVertices(Microsoft::WRL::ComPtr<ID3D11Device> device, int windowWidth, int windowHeight);
+	ModelMemoryUsage GetMemoryUsage();
 
 	// Model loading
 	bool LoadModel();
@@ -61,8 +73,13 @@ public:
 	void SetCapColor(float r, float g, float b);
 	void SetShirtColor(float r, float g, float b);
 	void SetShowAltTexture(bool val);
+	// Bounds of the frames rendered from now on, for models that aren't moved by their world matrix
+	void SetWorldBounds(const BoundingSphere& bounds);
 
-	void SetFrame(Frame* frame);
+	DirectX::XMMATRIX FrameWorld(const Frame* frame) const;
+	// Where the frame is drawn, for culling, invalid if the model has no bounds
+	BoundingSphere FrameBounds(const Frame* frame, const DirectX::XMMATRIX& world) const;
+	void SetFrame(Frame* frame, const DirectX::XMMATRIX& world, const DirectX::XMMATRIX& viewProjection);
 	std::vector<Vertex>* GetVertices();
 	std::vector<Frame>* GetFrames();
 private:
@@ -77,6 +94,10 @@ public:
 	std::vector<Frame> Frames;
 	bool Disabled = false;
 	bool NoCull = false;
+	// For the memory report, the file name for imported models
+	std::string Name;
+	// Around the imported meshes in model space, set when they are uploaded
+	BoundingSphere Bounds;
 private:
 	bool meshesInitialized = false;
 	std::string modelPath;
@@ -90,5 +111,13 @@ private:
 	size_t texSize = 0;
 	uint16_t texWidth = 0;
 	uint16_t texHeight = 0;
+	// Uploaded every frame, so worth packing
+	bool packedVertices = false;
+
+	// Set by SetStaticVertices, waiting for UploadStaticVertices
+	bool staticVerticesPending = false;
+	std::shared_ptr<const void> staticOwner;
+	const Vertex* staticVertices = nullptr;
+	size_t staticVertexCount = 0;
 
 };
\ No newline at end of file
@@ -1,11 +1,32 @@
 #include "Renderer.h"
 
+#include <numeric>
+
 using namespace Microsoft::WRL;
 using namespace DirectX;
 
 Renderer* instance = nullptr;
 
+struct Renderer::FrameDraw
+{
+	Model* model;
+	Model::Frame frame;
+	XMMATRIX world;
+	size_t cameraView;
+};
+
+namespace
+{
+	inline bool sameVector(const Vector& a, const Vector& b)
+	{
+		return a.X == b.X && a.Y == b.Y && a.Z == b.Z;
+	}
+}
+
 #define PRESENT_INDEX 8
+#define DRAW_CONSTANTS_MIN_CAPACITY 256 // Draws a frame before the constants buffer has to grow
+#define NEAR_Z 50.0f
+#define FAR_Z 20000.0f
 typedef HRESULT(__stdcall* Present)(IDXGISwapChain*, UINT, UINT);
 static Present oPresent = NULL;
 HRESULT __stdcall hkPresent(IDXGISwapChain* pThis, UINT SyncInterval, UINT Flags)
@@ -138,6 +159,7 @@ void Renderer::InitBuffers()
 void Renderer::CreatePipeline()
 {
 	ComPtr<ID3DBlob> vertexShaderBlob = LoadShader(shaderData, "vs_5_0", "VS").Get();
+	ComPtr<ID3DBlob> packedVertexShaderBlob = LoadShader(shaderData, "vs_5_0", "VSPacked").Get();
 	ComPtr<ID3DBlob> pixelShaderTexturesBlob = LoadShader(shaderData, "ps_5_0", "PSTex").Get();
 	ComPtr<ID3DBlob> pixelShaderTransparentTextureBlox = LoadShader(shaderData, "ps_5_0", "PSTexTransparent").Get();
 	ComPtr<ID3DBlob> pixelShaderBlob = LoadShader(shaderData, "ps_5_0", "PS").Get();
@@ -145,6 +167,9 @@ void Renderer::CreatePipeline()
 	device->CreateVertexShader(vertexShaderBlob->GetBufferPointer(),
 		vertexShaderBlob->GetBufferSize(), nullptr, vertexShader.GetAddressOf());
 
+	device->CreateVertexShader(packedVertexShaderBlob->GetBufferPointer(),
+		packedVertexShaderBlob->GetBufferSize(), nullptr, packedVertexShader.GetAddressOf());
+
 	device->CreatePixelShader(pixelShaderTexturesBlob->GetBufferPointer(),
 		pixelShaderTexturesBlob->GetBufferSize(), nullptr, pixelShaderTextures.GetAddressOf());
 
@@ -154,17 +179,32 @@ void Renderer::CreatePipeline()
 	device->CreatePixelShader(pixelShaderBlob->GetBufferPointer(),
 		pixelShaderBlob->GetBufferSize(), nullptr, pixelShader.GetAddressOf());
 
-	D3D11_INPUT_ELEMENT_DESC inputLayoutDesc[4] =
+	D3D11_INPUT_ELEMENT_DESC inputLayoutDesc[5] =
 	{
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 		{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "DRAW_INDEX", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
 	};
 
 	device->CreateInputLayout(inputLayoutDesc, ARRAYSIZE(inputLayoutDesc), vertexShaderBlob->GetBufferPointer(),
 		vertexShaderBlob->GetBufferSize(), inputLayout.GetAddressOf());
 
+	// PackedVertex
+	D3D11_INPUT_ELEMENT_DESC packedInputLayoutDesc[5] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "DRAW_INDEX", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+	};
+
+	device->CreateInputLayout(packedInputLayoutDesc, ARRAYSIZE(packedInputLayoutDesc),
+		packedVertexShaderBlob->GetBufferPointer(), packedVertexShaderBlob->GetBufferSize(),
+		packedInputLayout.GetAddressOf());
+
 	D3D11_SAMPLER_DESC samplerDesc;
 	ZeroMemory(&samplerDesc, sizeof(D3D11_SAMPLER_DESC));
 	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
@@ -262,25 +302,23 @@ void Renderer::DrawModels()
 	context->OMSetRenderTargets(1, mainRenderTargetView.GetAddressOf(), depthStencilView.Get());
 	context->ClearDepthStencilView(depthStencilView.Get(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
-	context->VSSetShader(vertexShader.Get(), nullptr, 0);
-	context->PSSetShader(pixelShader.Get(), nullptr, 0);
-
-	context->IASetInputLayout(inputLayout.Get());
 	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-	context->RSSetState(rasterizerState.Get());
 	context->OMSetDepthStencilState(depthStencilState.Get(), 0);
-
 	context->OMSetBlendState(blendState.Get(), NULL, 0xFFFFFFFF);
+	context->PSSetSamplers(0, 1, samplerState.GetAddressOf());
 
+	// The lights are the same for every draw
 	Lighting.UpdateLights(&PixelConstBufferData);
-
-	context->UpdateSubresource(pixelConstantBuffer.Get(), 0, 0, &PixelConstBufferData, 0, 0);
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	context->Map(pixelConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+	memcpy(mappedResource.pData, &PixelConstBufferData, sizeof(PS_ConstantBufferData));
+	context->Unmap(pixelConstantBuffer.Get(), 0);
 	context->PSSetConstantBuffers(0, 1, pixelConstantBuffer.GetAddressOf());
 
-	UINT stride = sizeof(Vertex);
-	UINT offset = 0;
-
+	// Every model's frames first, so they are culled together
+	cameraViews.clear();
+	frameDraws.clear();
+	frameBounds.clear();
 	for (auto k = 0; k < models.size(); k++)
 	{
 		auto model = models[k];
@@ -289,6 +327,7 @@ void Renderer::DrawModels()
 		{
 			model->InitMeshes(device, windowWidth, windowHeight);
 		}
+		model->UploadStaticVertices(device, windowWidth, windowHeight);
 
 		if (!model->ShouldRender())
 		{
@@ -298,93 +337,250 @@ void Renderer::DrawModels()
 		auto frames = model->GetFrames();
 		for (auto m = 0; m < frames->size(); m++)
 		{
-			auto frame = (*frames)[m];
-			model->SetFrame(&frame);
+			FrameDraw draw;
+			draw.model = model;
+			draw.frame = (*frames)[m];
+			draw.world = model->FrameWorld(&draw.frame);
+			draw.cameraView = cameraViewOf(draw.frame.camLocation, draw.frame.camRotation, draw.frame.fov);
+			frameDraws.push_back(draw);
+			frameBounds.push_back(model->FrameBounds(&draw.frame, draw.world));
+		}
 
-			if (model->NoCull)
-			{
-				context->RSSetState(rasterizerStateNoCull.Get());
-			}
+		model->Frames.clear();
+	}
 
-			for (auto i = 0; i < model->Meshes.size(); i++)
-			{
-				auto mesh = model->Meshes[i];
-
-				if (!mesh->render) {
-					mesh->UpdateVertices = false;
-					continue;
-				};
-				//mesh->render = false;
-
-				PixelConstBufferData.capColor.x = mesh->CapColorR;
-				PixelConstBufferData.capColor.y = mesh->CapColorG;
-				PixelConstBufferData.capColor.z = mesh->CapColorB;
-				PixelConstBufferData.shirtColor.x = mesh->ShirtColorR;
-				PixelConstBufferData.shirtColor.y = mesh->ShirtColorG;
-				PixelConstBufferData.shirtColor.z = mesh->ShirtColorB;
-
-				// Map the pixel constant buffer
-				D3D11_MAPPED_SUBRESOURCE mappedResource;
-				context->Map(pixelConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-				memcpy(mappedResource.pData, &PixelConstBufferData, sizeof(PS_ConstantBufferData));
-				context->Unmap(pixelConstantBuffer.Get(), 0);
-
-				// Map the vertex constant buffer on the GPU
-				context->Map(mesh->VertexConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-				memcpy(mappedResource.pData, &mesh->VertexConstBufferData, sizeof(VS_ConstantBufferData));
-				context->Unmap(mesh->VertexConstantBuffer.Get(), 0);
-
-				context->UpdateSubresource(mesh->VertexConstantBuffer.Get(), 0, 0, &mesh->VertexConstBufferData, 0, 0);
-				context->VSSetConstantBuffers(0, 1, mesh->VertexConstantBuffer.GetAddressOf());
-
-				if (mesh->UpdateVertices)
-				{
-					context->Map(mesh->VertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-					memcpy(mappedResource.pData, (void*)mesh->Vertices.data(), sizeof(Vertex) * mesh->NumTrianglesUsed * 3);
-					context->Unmap(mesh->VertexBuffer.Get(), 0);
-					mesh->UpdateVertices = false;
-				}
+	// The frames of one camera follow each other, usually all of them are of one
+	frameVisible.resize(frameDraws.size());
+	for (size_t first = 0; first < frameDraws.size();)
+	{
+		size_t last = first + 1;
+		while (last < frameDraws.size() && frameDraws[last].cameraView == frameDraws[first].cameraView)
+		{
+			last++;
+		}
+		CullSpheres(cameraViews[frameDraws[first].cameraView].frustum, frameBounds.data() + first, last - first,
+			frameVisible.data() + first);
+		first = last;
+	}
 
-				context->IASetVertexBuffers(0, 1, mesh->VertexBuffer.GetAddressOf(), &stride, &offset);
-				context->IASetIndexBuffer(mesh->IndexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+	renderQueue.Clear();
+	for (size_t d = 0; d < frameDraws.size(); d++)
+	{
+		FrameDraw& draw = frameDraws[d];
+		Model* model = draw.model;
+		model->SetFrame(&draw.frame, draw.world, cameraViews[draw.cameraView].viewProjection);
+		// Culled meshes keep their new vertices until a frame of them is seen
+		if (!frameVisible[d]) continue;
+
+		for (auto i = 0; i < model->Meshes.size(); i++)
+		{
+			auto mesh = model->Meshes[i];
 
-				if (mesh->TextureResourceView != nullptr)
+			if (!mesh->render) {
+				mesh->UpdateVertices = false;
+				continue;
+			};
+			//mesh->render = false;
+
+			if (mesh->UpdateVertices)
+			{
+				context->Map(mesh->VertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+				if (mesh->PackedVertices)
 				{
-					if (mesh->IsTransparent)
-					{
-						context->PSSetShader(pixelShaderTexturesTransparent.Get(), nullptr, 0);
-					}
-					else
-					{
-						context->PSSetShader(pixelShaderTextures.Get(), nullptr, 0);
-					}
-					context->PSSetSamplers(0, 1, samplerState.GetAddressOf());
-					if (mesh->ShowAltTexture && mesh->AltTextureResourceView != nullptr)
-					{
-						context->PSSetShaderResources(0, 1, mesh->AltTextureResourceView.GetAddressOf());
-					}
-					else
-					{
-						context->PSSetShaderResources(0, 1, mesh->TextureResourceView.GetAddressOf());
-					}
+					static_assert(sizeof(Vertex) == sizeof(MarioVertex), "Vertex and MarioVertex must match");
+					const size_t vertexCount = mesh->NumTrianglesUsed * 3;
+					const MarioVertex* vertices = reinterpret_cast<const MarioVertex*>(mesh->Vertices.data());
+					mesh->PackedBounds = PackedVertexBoundsOf(vertices, vertexCount);
+					PackVertices(vertices, vertexCount, mesh->PackedBounds, (PackedVertex*)mappedResource.pData);
 				}
 				else
 				{
-					context->PSSetShader(pixelShader.Get(), nullptr, 0);
+					memcpy(mappedResource.pData, (void*)mesh->Vertices.data(), sizeof(Vertex) * mesh->NumTrianglesUsed * 3);
 				}
-				context->DrawIndexed((UINT)mesh->NumTrianglesUsed * 3, 0, 0);
+				context->Unmap(mesh->VertexBuffer.Get(), 0);
+				mesh->UpdateVertices = false;
 			}
+
+			if (mesh->NumTrianglesUsed == 0) continue;
+			queueMesh(model, mesh);
 		}
+	}
+
+	renderQueue.Submit(*this);
+}
 
-		if (model->NoCull)
+size_t Renderer::cameraViewOf(Vector location, Vector rotation, float fov)
+{
+	if (!cameraViews.empty())
+	{
+		const CameraView& last = cameraViews.back();
+		if (sameVector(last.location, location) && sameVector(last.rotation, rotation) && last.fov == fov)
 		{
-			context->RSSetState(rasterizerState.Get());
+			return cameraViews.size() - 1;
 		}
-		model->Frames.clear();
+	}
+
+	CameraView view;
+	view.location = location;
+	view.rotation = rotation;
+	view.fov = fov;
+
+	float aspectRatio = static_cast<float>(windowWidth) / static_cast<float>(windowHeight);
+	float fovRadians = XMConvertToRadians(fov);
+	float verticalFovRadians = 2 * atan(tan(fovRadians / 2) / aspectRatio);
 
+	auto camLocationVector = XMVectorSet(location.X, location.Y, location.Z, 0.0f);
+	auto camTarget = XMVectorSet(rotation.X, rotation.Y, rotation.Z, 0.0f);
+	camTarget = XMVectorAdd(camTarget, camLocationVector);
+	XMMATRIX lookAt = XMMatrixLookAtLH(camLocationVector, camTarget, XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f));
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(verticalFovRadians, aspectRatio, NEAR_Z, FAR_Z);
+	view.viewProjection = lookAt * projection;
 
+	XMFLOAT4X4 viewProjectionFloats;
+	XMStoreFloat4x4(&viewProjectionFloats, view.viewProjection);
+	view.frustum = FrustumFromViewProjection(&viewProjectionFloats.m[0][0]);
+
+	cameraViews.push_back(view);
+	return cameraViews.size() - 1;
+}
+
+void Renderer::queueMesh(const Model* model, const Mesh* mesh)
+{
+	DrawState state;
+	state.packedVertices = mesh->PackedVertices;
+	state.noCull = model->NoCull;
+	if (mesh->TextureResourceView != nullptr)
+	{
+		state.pass = mesh->IsTransparent ? DrawPass::Occluder : DrawPass::Textured;
+		state.texture = mesh->ShowAltTexture && mesh->AltTextureResourceView != nullptr ?
+			mesh->AltTextureResourceView.Get() : mesh->TextureResourceView.Get();
 	}
+	state.mesh = mesh;
+	state.indexCount = (uint32_t)mesh->NumTrianglesUsed * 3;
+
+	DrawConstants constants;
+	static_assert(sizeof(DirectX::XMMATRIX) == sizeof(constants.wvp), "DrawConstants must hold an XMMATRIX");
+	memcpy(constants.wvp, &mesh->VertexConstBufferData.wvp, sizeof(constants.wvp));
+	memcpy(constants.world, &mesh->VertexConstBufferData.world, sizeof(constants.world));
+	const PackedVertexBounds bounds = mesh->PackedVertices ? mesh->PackedBounds : PackedVertexBounds();
+	for (int k = 0; k < 3; k++)
+	{
+		constants.positionOrigin[k] = bounds.origin[k];
+		constants.positionScale[k] = bounds.scale[k];
+	}
+	constants.positionOrigin[3] = 0.0f;
+	constants.positionScale[3] = 0.0f;
+	const float capColor[4] = { mesh->CapColorR, mesh->CapColorG, mesh->CapColorB, 0.0f };
+	const float shirtColor[4] = { mesh->ShirtColorR, mesh->ShirtColorG, mesh->ShirtColorB, 0.0f };
+	memcpy(constants.capColor, capColor, sizeof(capColor));
+	memcpy(constants.shirtColor, shirtColor, sizeof(shirtColor));
+
+	renderQueue.Add(state, constants);
+}
+
+void Renderer::reserveDrawConstants(size_t count)
+{
+	if (count <= drawConstantCapacity) return;
+
+	drawConstantCapacity = std::max({ count, drawConstantCapacity * 2, (size_t)DRAW_CONSTANTS_MIN_CAPACITY });
+	drawConstantView.Reset();
+	drawConstantBuffer.Reset();
+	drawIndexBuffer.Reset();
+
+	D3D11_BUFFER_DESC constantsDesc = { 0 };
+	constantsDesc.ByteWidth = (UINT)(sizeof(DrawConstants) * drawConstantCapacity);
+	constantsDesc.Usage = D3D11_USAGE_DYNAMIC;
+	constantsDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	constantsDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	constantsDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	constantsDesc.StructureByteStride = sizeof(DrawConstants);
+	device->CreateBuffer(&constantsDesc, nullptr, drawConstantBuffer.GetAddressOf());
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	ZeroMemory(&viewDesc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+	viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+	viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	viewDesc.Buffer.FirstElement = 0;
+	viewDesc.Buffer.NumElements = (UINT)drawConstantCapacity;
+	device->CreateShaderResourceView(drawConstantBuffer.Get(), &viewDesc, drawConstantView.GetAddressOf());
+
+	// Instance i of a draw reads DRAW_INDEX from here at its first constant + i, which is its constants' index
+	std::vector<UINT> drawIndices(drawConstantCapacity);
+	std::iota(drawIndices.begin(), drawIndices.end(), 0);
+	D3D11_BUFFER_DESC indicesDesc = { 0 };
+	indicesDesc.ByteWidth = (UINT)(sizeof(UINT) * drawConstantCapacity);
+	indicesDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	indicesDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	D3D11_SUBRESOURCE_DATA indicesData = { drawIndices.data(), 0, 0 };
+	device->CreateBuffer(&indicesDesc, &indicesData, drawIndexBuffer.GetAddressOf());
+}
 
+void Renderer::WriteDrawConstants(const DrawConstants* constants, size_t count)
+{
+	reserveDrawConstants(count);
 
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	context->Map(drawConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+	memcpy(mappedResource.pData, constants, sizeof(DrawConstants) * count);
+	context->Unmap(drawConstantBuffer.Get(), 0);
+	context->VSSetShaderResources(1, 1, drawConstantView.GetAddressOf());
+}
 
-}
\ No newline at end of file
+void Renderer::SetPipeline(DrawPass pass, bool packedVertices, bool noCull)
+{
+	context->VSSetShader(packedVertices ? packedVertexShader.Get() : vertexShader.Get(), nullptr, 0);
+	context->IASetInputLayout(packedVertices ? packedInputLayout.Get() : inputLayout.Get());
+	switch (pass)
+	{
+	case DrawPass::Occluder:
+		context->PSSetShader(pixelShaderTexturesTransparent.Get(), nullptr, 0);
+		break;
+	case DrawPass::Textured:
+		context->PSSetShader(pixelShaderTextures.Get(), nullptr, 0);
+		break;
+	default:
+		context->PSSetShader(pixelShader.Get(), nullptr, 0);
+		break;
+	}
+	context->RSSetState(noCull ? rasterizerStateNoCull.Get() : rasterizerState.Get());
+}
+
+void Renderer::SetTexture(const void* texture)
+{
+	ID3D11ShaderResourceView* view = (ID3D11ShaderResourceView*)texture;
+	context->PSSetShaderResources(0, 1, &view);
+}
+
+void Renderer::SetMesh(const void* queuedMesh, bool packedVertices)
+{
+	const Mesh* mesh = (const Mesh*)queuedMesh;
+	ID3D11Buffer* buffers[2] = { mesh->VertexBuffer.Get(), drawIndexBuffer.Get() };
+	const UINT strides[2] = { packedVertices ? (UINT)sizeof(PackedVertex) : (UINT)sizeof(Vertex), (UINT)sizeof(UINT) };
+	const UINT offsets[2] = { 0, 0 };
+	context->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+	context->IASetIndexBuffer(mesh->IndexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+	boundMeshIndexed = mesh->IndexBuffer != nullptr;
+}
+
+void Renderer::Draw(uint32_t indexCount, uint32_t firstConstant, uint32_t instanceCount)
+{
+	// Static meshes without indices, like the map, are drawn in vertex order
+	if (boundMeshIndexed)
+	{
+		context->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, firstConstant);
+	}
+	else
+	{
+		context->DrawInstanced(indexCount, instanceCount, 0, firstConstant);
+	}
+}
+
+std::vector<ModelMemoryUsage> Renderer::GetMemoryUsage()
+{
+	std::vector<ModelMemoryUsage> usages;
+	for (Model* model : models)
+	{
+		usages.push_back(model->GetMemoryUsage());
+	}
+	return usages;
+}
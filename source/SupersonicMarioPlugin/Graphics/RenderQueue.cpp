@@ -0,0 +1,119 @@
+// RenderQueue.cpp
+// Collects a frame's draws, sorts them by pipeline state and draws them with as few state changes as it can.
+
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+namespace
+{
+	inline auto pipelineKey(const DrawState& state)
+	{
+		return std::make_tuple(state.pass, state.packedVertices, state.noCull);
+	}
+
+	inline auto sortKey(const DrawState& state)
+	{
+		return std::make_tuple(state.pass, state.packedVertices, state.noCull, state.texture, state.mesh,
+			state.indexCount);
+	}
+}
+
+void RenderQueue::Clear()
+{
+	items.clear();
+	constants.clear();
+}
+
+void RenderQueue::Add(const DrawState& state, const DrawConstants& drawConstants)
+{
+	items.push_back(state);
+	constants.push_back(drawConstants);
+}
+
+void RenderQueue::Submit(RenderBackend& backend)
+{
+	if (items.empty()) return;
+
+	// Stable, so items with the same state keep the order they were added in
+	order.resize(items.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+		return std::less<>()(sortKey(items[a]), sortKey(items[b]));
+	});
+
+	sortedConstants.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		sortedConstants[i] = constants[order[i]];
+	}
+	backend.WriteDrawConstants(sortedConstants.data(), sortedConstants.size());
+
+	const DrawState* bound = nullptr;
+	for (size_t first = 0; first < order.size();)
+	{
+		const DrawState& state = items[order[first]];
+		size_t last = first + 1;
+		while (last < order.size() && sortKey(items[order[last]]) == sortKey(state))
+		{
+			last++;
+		}
+
+		if (bound == nullptr || pipelineKey(*bound) != pipelineKey(state))
+		{
+			backend.SetPipeline(state.pass, state.packedVertices, state.noCull);
+		}
+		if (bound == nullptr || bound->texture != state.texture)
+		{
+			backend.SetTexture(state.texture);
+		}
+		if (bound == nullptr || bound->mesh != state.mesh || bound->packedVertices != state.packedVertices)
+		{
+			backend.SetMesh(state.mesh, state.packedVertices);
+		}
+		bound = &state;
+
+		backend.Draw(state.indexCount, (uint32_t)first, (uint32_t)(last - first));
+		first = last;
+	}
+}
+
+void NullRenderBackend::WriteDrawConstants(const DrawConstants* constants, size_t count)
+{
+	counts.constantMaps++;
+	written.assign(constants, constants + count);
+}
+
+void NullRenderBackend::SetPipeline(DrawPass pass, bool packedVertices, bool noCull)
+{
+	counts.pipelineChanges++;
+	current.pass = pass;
+	current.packedVertices = packedVertices;
+	current.noCull = noCull;
+}
+
+void NullRenderBackend::SetTexture(const void* texture)
+{
+	counts.textureChanges++;
+	current.texture = texture;
+}
+
+void NullRenderBackend::SetMesh(const void* mesh, bool packedVertices)
+{
+	counts.meshChanges++;
+	current.mesh = mesh;
+	current.packedVertices = packedVertices;
+}
+
+void NullRenderBackend::Draw(uint32_t indexCount, uint32_t firstConstant, uint32_t instanceCount)
+{
+	counts.draws++;
+	counts.instances += instanceCount;
+	current.indexCount = indexCount;
+	for (uint32_t i = 0; i < instanceCount && firstConstant + i < written.size(); i++)
+	{
+		drawn.push_back({ current, written[firstConstant + i] });
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+// RenderQueue.h
+// Collects a frame's draws, sorts them by pipeline state and draws them with as few state changes as it can.
+//
+// Models add one item per mesh and frame, with its state and its
+// constants. Submit sorts the items by pass, vertex format, culling,
+// texture and mesh, writes every item's constants into one buffer with a
+// single map, and draws runs of items on the same mesh, like the car
+// ghosts, as one instanced draw. Each instance finds its constants by
+// the draw index the renderer streams per instance. The passes are drawn
+// in order, so the invisible occluders are in the depth buffer before any
+// mario is drawn.
+//
+// Doesn't know D3D, the renderer is a RenderBackend. NullRenderBackend
+// only counts what it is asked to do, which RenderQueueCheck uses to
+// compare against drawing mesh by mesh.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// In the order they are drawn
+enum class DrawPass : uint8_t
+{
+	Occluder, // Invisible, only hides what is behind it
+	Textured,
+	Untextured
+};
+
+struct DrawState
+{
+	DrawPass pass = DrawPass::Untextured;
+	bool packedVertices = false;
+	bool noCull = false;
+	const void* texture = nullptr;
+	// Vertex and index buffers
+	const void* mesh = nullptr;
+	// Vertices for meshes without indices
+	uint32_t indexCount = 0;
+};
+
+// Matches DrawConstants in Graphics/shaders.h, row major matrices
+struct DrawConstants
+{
+	float wvp[16];
+	float world[16];
+	float positionOrigin[4];
+	float positionScale[4];
+	float capColor[4];
+	float shirtColor[4];
+};
+static_assert(sizeof(DrawConstants) % 16 == 0, "DrawConstants must stay a multiple of 16 bytes");
+
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() = default;
+
+	// All of a frame's constants at once, in draw order
+	virtual void WriteDrawConstants(const DrawConstants* constants, size_t count) = 0;
+	virtual void SetPipeline(DrawPass pass, bool packedVertices, bool noCull) = 0;
+	virtual void SetTexture(const void* texture) = 0;
+	virtual void SetMesh(const void* mesh, bool packedVertices) = 0;
+	// Instance i uses the constants at firstConstant + i
+	virtual void Draw(uint32_t indexCount, uint32_t firstConstant, uint32_t instanceCount) = 0;
+};
+
+class RenderQueue
+{
+public:
+	void Clear();
+	void Add(const DrawState& state, const DrawConstants& constants);
+	size_t Size() const { return items.size(); }
+	// Draws everything added since Clear
+	void Submit(RenderBackend& backend);
+
+private:
+	std::vector<DrawState> items;
+	std::vector<DrawConstants> constants;
+	std::vector<uint32_t> order;
+	std::vector<DrawConstants> sortedConstants;
+};
+
+// Counts what it is asked to do instead of drawing
+class NullRenderBackend : public RenderBackend
+{
+public:
+	struct Counts
+	{
+		uint64_t constantMaps = 0;
+		uint64_t pipelineChanges = 0;
+		uint64_t textureChanges = 0;
+		uint64_t meshChanges = 0;
+		uint64_t draws = 0;
+		uint64_t instances = 0;
+	};
+
+	// A drawn instance, to check every item is drawn once with its own constants
+	struct DrawnInstance
+	{
+		DrawState state;
+		DrawConstants constants;
+	};
+
+	void WriteDrawConstants(const DrawConstants* constants, size_t count) override;
+	void SetPipeline(DrawPass pass, bool packedVertices, bool noCull) override;
+	void SetTexture(const void* texture) override;
+	void SetMesh(const void* mesh, bool packedVertices) override;
+	void Draw(uint32_t indexCount, uint32_t firstConstant, uint32_t instanceCount) override;
+
+	Counts counts;
+	std::vector<DrawnInstance> drawn;
+
+private:
+	std::vector<DrawConstants> written;
+	DrawState current;
+};
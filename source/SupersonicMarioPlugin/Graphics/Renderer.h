@@ -11,6 +11,8 @@
 #include <bakkesmod/wrappers/wrapperstructs.h>
 #include "Lighting.h"
 #include "GraphicsTypes.h"
+#include "RenderQueue.h"
+#include "FrustumCulling.h"
 #include "Modules/Utils.h"
 #include "Model.h"
 
@@ -19,8 +21,9 @@
 #define safe_release(p) if (p) { p->Release(); p = nullptr; } 
 
 class Model;
+class Mesh;
 
-class Renderer
+class Renderer : public RenderBackend
 {
 public:
 	static Renderer& getInstance()
@@ -29,6 +32,8 @@ public:
 		return instance;
 	}
 	void AddModel(Model* model);
+	// Per model, for rp_render_memory
+	std::vector<ModelMemoryUsage> GetMemoryUsage();
 	bool Init(IDXGISwapChain* pThis, UINT SyncInterval, UINT Flags);
 	void OnPresent(IDXGISwapChain* pThis, UINT SyncInterval, UINT Flags);
 	bool Initialized = false;
@@ -46,12 +51,39 @@ private:
 	Microsoft::WRL::ComPtr<ID3DBlob> LoadShader(const char* shaderData, std::string targetShaderVersion, std::string shaderEntry);
 	void InitBuffers();
 	void DrawModels();
+	void queueMesh(const Model* model, const Mesh* mesh);
+	// Index into cameraViews, built the first time a frame of the camera is drawn
+	size_t cameraViewOf(Vector location, Vector rotation, float fov);
+	void reserveDrawConstants(size_t count);
+
+	// RenderBackend, what the render queue draws with
+	void WriteDrawConstants(const DrawConstants* constants, size_t count) override;
+	void SetPipeline(DrawPass pass, bool packedVertices, bool noCull) override;
+	void SetTexture(const void* texture) override;
+	void SetMesh(const void* mesh, bool packedVertices) override;
+	void Draw(uint32_t indexCount, uint32_t firstConstant, uint32_t instanceCount) override;
 	
 	bool drawModels = false;
 	bool pipelineInitialized = false;
 	bool firstInit = true;
 	int windowWidth, windowHeight;
 	std::vector<Model*> models;
+	RenderQueue renderQueue;
+
+	// A camera's view-projection and frustum, built once per frame instead of for every mesh
+	struct CameraView
+	{
+		Vector location, rotation;
+		float fov;
+		DirectX::XMMATRIX viewProjection;
+		Frustum frustum;
+	};
+	// A model's frame, culled before its meshes are drawn, see Render.cpp
+	struct FrameDraw;
+	std::vector<CameraView> cameraViews;
+	std::vector<FrameDraw> frameDraws;
+	std::vector<BoundingSphere> frameBounds;
+	std::vector<uint8_t> frameVisible;
 
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11Device> device = nullptr;
@@ -59,10 +91,12 @@ private:
 	D3D11_VIEWPORT viewport;
 
 	Microsoft::WRL::ComPtr<ID3D11VertexShader> vertexShader = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11VertexShader> packedVertexShader = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixelShaderTextures = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixelShaderTexturesTransparent = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixelShader = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11InputLayout> packedInputLayout = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerState = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizerState = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizerStateNoCull = nullptr;
@@ -71,4 +105,10 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> depthStencilView = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11BlendState> blendState = nullptr;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> pixelConstantBuffer = nullptr;
+	// Every draw's DrawConstants of a frame, and the DRAW_INDEX instance stream that picks them
+	Microsoft::WRL::ComPtr<ID3D11Buffer> drawConstantBuffer = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> drawConstantView = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> drawIndexBuffer = nullptr;
+	size_t drawConstantCapacity = 0;
+	bool boundMeshIndexed = true;
 };
\ No newline at end of file
@@ -1,16 +1,22 @@
 #pragma once
 
 constexpr const char* shaderData = R"(
-Texture2D tex;
+Texture2D tex : register(t0);
 SamplerState sampleType;
 
 #pragma pack_matrix( row_major )
 
-cbuffer VS_constantBuffer
+// One per draw, see RenderQueue
+struct DrawConstants
 {
-    matrix wvp;
-    matrix world;
+    row_major matrix wvp;
+    row_major matrix world;
+    float4 positionOrigin;
+    float4 positionScale;
+    float4 capColor;
+    float4 shirtColor;
 };
+StructuredBuffer<DrawConstants> drawConstants : register(t1);
 
 struct VS_Input
 {
@@ -18,6 +24,17 @@ struct VS_Input
     float4 color : COLOR;
     float2 texcoord : TEXCOORD;
     float3 normal : NORMAL;
+    uint drawIndex : DRAW_INDEX;
+};
+
+// PackedVertex, for meshes that are uploaded every frame
+struct VS_PackedInput
+{
+    float4 pos : POSITION;
+    float4 color : COLOR;
+    float2 texcoord : TEXCOORD;
+    float2 normal : NORMAL;
+    uint drawIndex : DRAW_INDEX;
 };
 
 struct VS_Output
@@ -27,19 +44,45 @@ struct VS_Output
     float2 texcoord : TEXCOORD;
     float3 normal : NORMAL;
     float3 worldPos : WORLD_POSITION;
+    nointerpolation float3 capColor : CAP_COLOR;
+    nointerpolation float3 shirtColor : SHIRT_COLOR;
 };
 
 VS_Output VS(VS_Input input)
 {
+    DrawConstants draw = drawConstants[input.drawIndex];
     VS_Output vsout;
-    vsout.pos = mul(input.pos, wvp);
+    vsout.pos = mul(input.pos, draw.wvp);
     vsout.color = input.color;
     vsout.texcoord = input.texcoord;
-    vsout.normal = (float3)normalize(mul(float4(input.normal, 0.0f), world));
-    vsout.worldPos = (float3)mul(input.pos, world);
+    vsout.normal = (float3)normalize(mul(float4(input.normal, 0.0f), draw.world));
+    vsout.worldPos = (float3)mul(input.pos, draw.world);
+    vsout.capColor = draw.capColor.xyz;
+    vsout.shirtColor = draw.shirtColor.xyz;
     return vsout;
 }
 
+float3 decodeOctahedral(float2 encoded)
+{
+    float3 normal = float3(encoded.x, encoded.y, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float fold = saturate(-normal.z);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return normalize(normal);
+}
+
+VS_Output VSPacked(VS_PackedInput input)
+{
+    DrawConstants draw = drawConstants[input.drawIndex];
+    VS_Input unpacked;
+    unpacked.pos = float4(draw.positionOrigin.xyz + input.pos.xyz * draw.positionScale.xyz, 1.0f);
+    unpacked.color = input.color;
+    unpacked.texcoord = input.texcoord;
+    unpacked.normal = decodeOctahedral(input.normal);
+    unpacked.drawIndex = input.drawIndex;
+    return VS(unpacked);
+}
+
 static const int numLights = 16;
 cbuffer PS_constantBuffer
 {
@@ -48,10 +91,6 @@ cbuffer PS_constantBuffer
 
     float4 dynamicLightColorStrengths[numLights];
     float4 dynamicLightPositions[numLights];
-    float3 capColor;
-    float padding;
-    float3 shirtColor;
-    float padding2;
 };
 
 float4 PSTex(VS_Output input) : SV_Target
@@ -66,15 +105,15 @@ float4 PSTex(VS_Output input) : SV_Target
 
     if(input.color.x >= 0.99f && input.color.y <= 0.01f && input.color.z <= 0.01f)
     {
-        input.color.x = capColor.x;
-        input.color.y = capColor.y;
-        input.color.z = capColor.z;
+        input.color.x = input.capColor.x;
+        input.color.y = input.capColor.y;
+        input.color.z = input.capColor.z;
     }
     else if(input.color.x < 0.01f && input.color.y <= 0.01f && input.color.z >= 0.99f)
     {
-        input.color.x = shirtColor.x;
-        input.color.y = shirtColor.y;
-        input.color.z = shirtColor.z;
+        input.color.x = input.shirtColor.x;
+        input.color.y = input.shirtColor.y;
+        input.color.z = input.shirtColor.z;
     }
 
     float4 mixedColor = lerp(input.color, textureColor, textureColor.w < 0.3f ? 0.0f : textureColor.w);
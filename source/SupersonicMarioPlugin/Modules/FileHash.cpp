@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "FileHash.h"
+
+#include "Utils.h"
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+
+	file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		// Empty files can't be mapped
+		Close();
+		return false;
+	}
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (view != nullptr)
+	{
+		UnmapViewOfFile(view);
+		view = nullptr;
+	}
+	if (mapping != nullptr)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
+
+bool HashFileStreamed(const std::filesystem::path& path, XXH128_hash_t* hash, size_t chunkSize)
+{
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	XXH3_state_t* state = XXH3_createState();
+	XXH3_128bits_reset(state);
+
+	std::vector<uint8_t> chunk(chunkSize);
+	bool ok = true;
+	while (true)
+	{
+		DWORD read = 0;
+		if (!ReadFile(file, chunk.data(), (DWORD)chunk.size(), &read, nullptr))
+		{
+			ok = false;
+			break;
+		}
+		if (read == 0)
+		{
+			break;
+		}
+		XXH3_128bits_update(state, chunk.data(), read);
+	}
+
+	if (ok)
+	{
+		*hash = XXH3_128bits_digest(state);
+	}
+	XXH3_freeState(state);
+	CloseHandle(file);
+	return ok;
+}
+
+bool HashFileMapped(const std::filesystem::path& path, XXH128_hash_t* hash)
+{
+	MappedFile file;
+	if (!file.Open(path)) return false;
+
+	*hash = XXH3_128bits(file.Data(), file.Size());
+	return true;
+}
+
+FileHashCache::FileHashCache()
+{
+	cachePath = Utils::GetBakkesmodFolderPath() + FILE_HASH_CACHE_FILE_NAME;
+	load();
+}
+
+bool FileHashCache::Hash(const std::filesystem::path& path, XXH128_hash_t* hash)
+{
+	std::error_code error;
+	const std::filesystem::path absolutePath = std::filesystem::absolute(path, error);
+	const uint64_t size = std::filesystem::file_size(absolutePath, error);
+	if (error) return false;
+	const int64_t writeTime = std::filesystem::last_write_time(absolutePath, error).time_since_epoch().count();
+	if (error) return false;
+
+	const std::wstring key = absolutePath.wstring();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto entry = entries.find(key);
+		if (entry != entries.end() && entry->second.size == size && entry->second.writeTime == writeTime)
+		{
+			*hash = entry->second.hash;
+			return true;
+		}
+	}
+
+	// Hashed without the lock held, two threads hashing the same file both get the same result
+	if (!HashFileStreamed(absolutePath, hash)) return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entries[key] = { size, writeTime, *hash };
+	save();
+	return true;
+}
+
+void FileHashCache::Forget(const std::filesystem::path& path)
+{
+	std::error_code error;
+	const std::wstring key = std::filesystem::absolute(path, error).wstring();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (entries.erase(key) > 0)
+	{
+		save();
+	}
+}
+
+// One file per line: hash high, hash low, size, write time, path
+void FileHashCache::load()
+{
+	std::ifstream in(cachePath);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		Entry entry;
+		fields >> std::hex >> entry.hash.high64 >> entry.hash.low64 >> std::dec >> entry.size >> entry.writeTime;
+		std::string path;
+		std::getline(fields >> std::ws, path);
+		if (fields.fail() || path.empty()) continue;
+
+		entries[std::filesystem::path(std::u8string(path.begin(), path.end())).wstring()] = entry;
+	}
+}
+
+void FileHashCache::save() const
+{
+	std::ofstream out(cachePath, std::ios::trunc);
+	for (const auto& [path, entry] : entries)
+	{
+		const std::u8string utf8Path = std::filesystem::path(path).u8string();
+		out << fmt::format("{:016x} {:016x} {} {} {}\n", entry.hash.high64, entry.hash.low64, entry.size,
+			entry.writeTime, std::string(utf8Path.begin(), utf8Path.end()));
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+// FileHash.h
+// Hashing large files without reading them into memory.
+//
+// Map packages are hundreds of MB. They are streamed through XXH3 in
+// fixed size chunks, and the result is remembered by path, size and last
+// write time, so a map that didn't change is never hashed again, not even
+// after a restart.
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
+#include "xxHash/xxhash.h"
+
+#define FILE_HASH_CACHE_FILE_NAME "data\\supersonicmario_hashes.txt"
+#define FILE_HASH_CHUNK_SIZE (1 << 20)
+
+// Read only view of a whole file
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Closes whatever was open before
+	bool Open(const std::filesystem::path& path);
+	void Close();
+
+	const uint8_t* Data() const { return (const uint8_t*)view; }
+	size_t Size() const { return size; }
+	bool IsOpen() const { return view != nullptr; }
+
+private:
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const void* view = nullptr;
+	size_t size = 0;
+};
+
+// Reads the file chunkSize bytes at a time into a buffer of that size
+bool HashFileStreamed(const std::filesystem::path& path, XXH128_hash_t* hash, size_t chunkSize = FILE_HASH_CHUNK_SIZE);
+// Hashes a mapped view of the file, its pages are file backed and can be dropped again
+bool HashFileMapped(const std::filesystem::path& path, XXH128_hash_t* hash);
+
+class FileHashCache
+{
+public:
+	static FileHashCache& getInstance()
+	{
+		static FileHashCache instance;
+		return instance;
+	}
+
+	// Only hashes the file when its size or write time changed since it was last hashed
+	bool Hash(const std::filesystem::path& path, XXH128_hash_t* hash);
+	void Forget(const std::filesystem::path& path);
+
+private:
+	FileHashCache();
+	void load();
+	void save() const;
+
+	struct Entry
+	{
+		uint64_t size;
+		int64_t writeTime;
+		XXH128_hash_t hash;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<std::wstring, Entry> entries;
+	std::filesystem::path cachePath;
+};
@@ -0,0 +1,70 @@
+// FixedStepScheduler.cpp
+// Fixed rate simulation clock, independent of how often it is asked.
+
+#include "FixedStepScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+FixedStepScheduler::FixedStepScheduler(double stepMs, uint32_t maxStepsPerFrame)
+	: stepMs(stepMs), maxStepsPerFrame(maxStepsPerFrame)
+{
+}
+
+uint32_t FixedStepScheduler::Advance(double nowMs)
+{
+	if (!started)
+	{
+		Hold(nowMs);
+		return 0;
+	}
+
+	const double elapsed = nowMs - originMs;
+	if (elapsed < 0.0)
+	{
+		return 0;
+	}
+
+	const uint64_t due = (uint64_t)std::floor(elapsed / stepMs);
+	if (due <= stepsRun)
+	{
+		return 0;
+	}
+
+	uint64_t steps = due - stepsRun;
+	if (steps > maxStepsPerFrame)
+	{
+		const uint64_t dropped = steps - maxStepsPerFrame;
+		originMs += dropped * stepMs;
+		stats.droppedSteps += dropped;
+		steps = maxStepsPerFrame;
+	}
+	stepsRun += steps;
+	stats.steps += steps;
+	stats.mostStepsInAFrame = std::max(stats.mostStepsInAFrame, (uint32_t)steps);
+	return (uint32_t)steps;
+}
+
+float FixedStepScheduler::Alpha(double nowMs) const
+{
+	if (!started)
+	{
+		return 1.0f;
+	}
+
+	const double alpha = (nowMs - originMs) / stepMs - (double)stepsRun;
+	return (float)std::clamp(alpha, 0.0, 1.0);
+}
+
+void FixedStepScheduler::Hold(double nowMs)
+{
+	originMs = nowMs - stepsRun * stepMs;
+	started = true;
+}
+
+void FixedStepScheduler::Reset()
+{
+	originMs = 0.0;
+	stepsRun = 0;
+	started = false;
+}
@@ -0,0 +1,49 @@
+#pragma once
+// FixedStepScheduler.h
+// Fixed rate simulation clock, independent of how often it is asked.
+//
+// Steps are counted from a fixed origin instead of summing frame times, so
+// the number of steps after any amount of time is the same at every frame
+// rate and never drifts. When a caller falls too far behind, the steps past
+// the per frame budget are dropped instead of caught up, which moves the
+// origin so the clock doesn't spiral.
+
+#include <cstdint>
+
+#define SIM_STEP_MS (1000.0 / 30.0) // SM64 runs its logic at 30 Hz
+#define SIM_MAX_STEPS_PER_FRAME 4   // Catches up at most 133 ms in one frame
+
+class FixedStepScheduler
+{
+public:
+	struct Stats
+	{
+		uint64_t steps = 0;
+		uint64_t droppedSteps = 0;
+		uint32_t mostStepsInAFrame = 0;
+	};
+
+	explicit FixedStepScheduler(double stepMs = SIM_STEP_MS, uint32_t maxStepsPerFrame = SIM_MAX_STEPS_PER_FRAME);
+
+	// Returns how many steps are due since the last call. The first call only starts the clock.
+	uint32_t Advance(double nowMs);
+	// How far the clock is past the last step, in steps from 0 to 1, to draw in between the last two
+	float Alpha(double nowMs) const;
+	// Keeps the clock from running, e.g. while the game is paused. The next step is a whole step away.
+	void Hold(double nowMs);
+	void Reset();
+
+	// Steps run since the clock was started
+	uint64_t Step() const { return stepsRun; }
+	double StepMs() const { return stepMs; }
+	const Stats& GetStats() const { return stats; }
+	void ResetStats() { stats = Stats(); }
+
+private:
+	double stepMs;
+	uint32_t maxStepsPerFrame;
+	double originMs = 0.0;
+	uint64_t stepsRun = 0;
+	bool started = false;
+	Stats stats;
+};
@@ -0,0 +1,167 @@
+#include "pch.h"
+#include "MapCache.h"
+
+#include "../Graphics/surface_terrains.h"
+
+namespace
+{
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + 15) & ~(uint64_t)15;
+	}
+}
+
+MapSurfaces::~MapSurfaces()
+{
+	if (view != nullptr)
+	{
+		UnmapViewOfFile(view);
+	}
+	if (mapping != nullptr)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+}
+
+std::shared_ptr<MapSurfaces> MapSurfaces::FromArrays(std::vector<struct SM64Surface>&& surfaces,
+	std::vector<Vertex>&& vertices)
+{
+	auto map = std::make_shared<MapSurfaces>();
+	map->ownedSurfaces = std::move(surfaces);
+	map->ownedVertices = std::move(vertices);
+	map->surfaces = map->ownedSurfaces.data();
+	map->surfaceCount = (uint32_t)map->ownedSurfaces.size();
+	map->vertices = map->ownedVertices.data();
+	map->vertexCount = (uint32_t)map->ownedVertices.size();
+	return map;
+}
+
+void MapSurfaces::ConvertSurfaces(const Vertex* corners, size_t begin, size_t end, struct SM64Surface* surfaces)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		struct SM64Surface* surface = &surfaces[i];
+		const Vertex* surfaceVertices = &corners[i * 3];
+		surface->type = SURFACE_DEFAULT;
+		surface->force = 0;
+		surface->terrain = TERRAIN_GRASS;
+
+		surface->vertices[2][0] = (int16_t)surfaceVertices[0].pos.x;
+		surface->vertices[2][1] = -(int16_t)surfaceVertices[0].pos.z;
+		surface->vertices[2][2] = -(int16_t)surfaceVertices[0].pos.y;
+
+		surface->vertices[1][0] = (int16_t)surfaceVertices[1].pos.x;
+		surface->vertices[1][1] = -(int16_t)surfaceVertices[1].pos.z;
+		surface->vertices[1][2] = -(int16_t)surfaceVertices[1].pos.y;
+
+		surface->vertices[0][0] = (int16_t)surfaceVertices[2].pos.x;
+		surface->vertices[0][1] = -(int16_t)surfaceVertices[2].pos.z;
+		surface->vertices[0][2] = -(int16_t)surfaceVertices[2].pos.y;
+	}
+}
+
+void MapSurfaces::ConvertRenderVertices(const Vertex* corners, size_t begin, size_t end, Vertex* vertices)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		// Flipping y and z flips the winding, so the corners go in backwards
+		for (int k = 0; k < 3; k++)
+		{
+			const Vertex& corner = corners[i * 3 + k];
+			Vertex v = {};
+
+			v.pos.x = corner.pos.x;
+			v.pos.y = -corner.pos.y;
+			v.pos.z = -corner.pos.z;
+
+			v.normal.x = corner.pos.x;
+			v.normal.y = -corner.pos.y;
+			v.normal.z = -corner.pos.z;
+
+			vertices[i * 3 + 2 - k] = v;
+		}
+	}
+}
+
+std::filesystem::path MapSurfaces::CachePath(XXH128_hash_t mapHash)
+{
+	return std::filesystem::path(Utils::GetBakkesmodFolderPath() + MAP_CACHE_FOLDER) /
+		fmt::format("{:016x}{:016x}.smpmap", mapHash.high64, mapHash.low64);
+}
+
+std::shared_ptr<MapSurfaces> MapSurfaces::OpenCache(const std::filesystem::path& path, XXH128_hash_t mapHash)
+{
+	auto map = std::make_shared<MapSurfaces>();
+	map->file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (map->file == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(map->file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(MapCacheHeader)) return nullptr;
+
+	map->mapping = CreateFileMappingW(map->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (map->mapping == nullptr) return nullptr;
+
+	map->view = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (map->view == nullptr) return nullptr;
+
+	const uint8_t* data = (const uint8_t*)map->view;
+	const MapCacheHeader* header = (const MapCacheHeader*)data;
+	const uint64_t size = (uint64_t)fileSize.QuadPart;
+	if (memcmp(header->magic, MAP_CACHE_MAGIC, sizeof(MAP_CACHE_MAGIC)) != 0 ||
+		header->version != MAP_CACHE_VERSION ||
+		header->surfaceSize != sizeof(struct SM64Surface) ||
+		header->vertexSize != sizeof(Vertex) ||
+		!XXH128_isEqual(header->mapHash, mapHash) ||
+		header->surfacesOffset > size ||
+		header->verticesOffset > size ||
+		(size - header->surfacesOffset) / sizeof(struct SM64Surface) < header->surfaceCount ||
+		(size - header->verticesOffset) / sizeof(Vertex) < header->vertexCount)
+	{
+		return nullptr;
+	}
+
+	map->surfaces = (const struct SM64Surface*)(data + header->surfacesOffset);
+	map->surfaceCount = header->surfaceCount;
+	map->vertices = (const Vertex*)(data + header->verticesOffset);
+	map->vertexCount = header->vertexCount;
+	return map;
+}
+
+bool MapSurfaces::WriteCache(const std::filesystem::path& path, XXH128_hash_t mapHash) const
+{
+	MapCacheHeader header = {};
+	memcpy(header.magic, MAP_CACHE_MAGIC, sizeof(MAP_CACHE_MAGIC));
+	header.version = MAP_CACHE_VERSION;
+	header.surfaceSize = sizeof(struct SM64Surface);
+	header.vertexSize = sizeof(Vertex);
+	header.surfaceCount = surfaceCount;
+	header.vertexCount = vertexCount;
+	header.mapHash = mapHash;
+	header.surfacesOffset = alignUp(sizeof(MapCacheHeader));
+	header.verticesOffset = alignUp(header.surfacesOffset + (uint64_t)surfaceCount * sizeof(struct SM64Surface));
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+	std::filesystem::path partialPath = path;
+	partialPath += ".partial";
+	{
+		std::ofstream out(partialPath, std::ios::binary | std::ios::trunc);
+		if (!out) return false;
+
+		const char padding[16] = {};
+		out.write((const char*)&header, sizeof(header));
+		out.write(padding, header.surfacesOffset - sizeof(header));
+		out.write((const char*)surfaces, (std::streamsize)surfaceCount * sizeof(struct SM64Surface));
+		out.write(padding, header.verticesOffset - header.surfacesOffset - (uint64_t)surfaceCount * sizeof(struct SM64Surface));
+		out.write((const char*)vertices, (std::streamsize)vertexCount * sizeof(Vertex));
+		if (!out) return false;
+	}
+
+	std::filesystem::rename(partialPath, path, error);
+	return !error;
+}
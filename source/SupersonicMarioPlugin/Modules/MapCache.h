@@ -0,0 +1,85 @@
+#pragma once
+// MapCache.h
+// Collision surfaces and render vertices of custom maps, cached on disk by map hash.
+//
+// Importing a map's FBX through Assimp and converting it to SM64 surfaces
+// takes seconds, so the result is written to a cache file named after the
+// map's hash the first time a map is hosted or joined. Later loads map the
+// cache file into memory and hand its arrays straight to libsm64.
+//
+// Cache file layout, everything little endian:
+//   MapCacheHeader
+//   SM64Surface[surfaceCount] at surfacesOffset
+//   Vertex[vertexCount] at verticesOffset, in the order the renderer draws them
+// Both arrays start on a 16 byte boundary.
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "../Graphics/GraphicsTypes.h"
+#include "xxHash/xxhash.h"
+
+extern "C" {
+	#include "libsm64.h"
+}
+
+#define MAP_CACHE_FOLDER "data\\assets\\mapcache\\"
+#define MAP_CACHE_MAGIC "SMPMAPC"
+#define MAP_CACHE_VERSION 2
+
+struct MapCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	// Sizes of the structs it was written with, a libsm64 or renderer update makes old caches stale
+	uint32_t surfaceSize;
+	uint32_t vertexSize;
+	uint32_t surfaceCount;
+	uint32_t vertexCount;
+	uint32_t reserved;
+	XXH128_hash_t mapHash;
+	uint64_t surfacesOffset;
+	uint64_t verticesOffset;
+};
+
+class MapSurfaces
+{
+public:
+	MapSurfaces() = default;
+	~MapSurfaces();
+	MapSurfaces(const MapSurfaces&) = delete;
+	MapSurfaces& operator=(const MapSurfaces&) = delete;
+
+	// Takes over arrays filled by the conversions below
+	static std::shared_ptr<MapSurfaces> FromArrays(std::vector<struct SM64Surface>&& surfaces, std::vector<Vertex>&& vertices);
+	// Convert triangles [begin, end) of the model's triangle corners, three per triangle, so they can be split up
+	static void ConvertSurfaces(const Vertex* corners, size_t begin, size_t end, struct SM64Surface* surfaces);
+	static void ConvertRenderVertices(const Vertex* corners, size_t begin, size_t end, Vertex* vertices);
+	// Maps a cache file written by WriteCache, nullptr if it is missing, stale or broken
+	static std::shared_ptr<MapSurfaces> OpenCache(const std::filesystem::path& path, XXH128_hash_t mapHash);
+	static std::filesystem::path CachePath(XXH128_hash_t mapHash);
+
+	// Writes next to the destination first and renames it, a cache file is either whole or not there
+	bool WriteCache(const std::filesystem::path& path, XXH128_hash_t mapHash) const;
+
+	const struct SM64Surface* Surfaces() const { return surfaces; }
+	uint32_t SurfaceCount() const { return surfaceCount; }
+	const Vertex* Vertices() const { return vertices; }
+	uint32_t VertexCount() const { return vertexCount; }
+	bool Mapped() const { return view != nullptr; }
+
+private:
+	const struct SM64Surface* surfaces = nullptr;
+	uint32_t surfaceCount = 0;
+	const Vertex* vertices = nullptr;
+	uint32_t vertexCount = 0;
+
+	// Either converted here
+	std::vector<struct SM64Surface> ownedSurfaces;
+	std::vector<Vertex> ownedVertices;
+	// or mapped from a cache file
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const void* view = nullptr;
+};
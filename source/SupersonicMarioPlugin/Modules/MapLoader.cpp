@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "MapLoader.h"
+
+#include "FileHash.h"
+#include "Utils.h"
+#include "../Graphics/Model.h"
+
+namespace
+{
+	struct SupportedMap
+	{
+		XXH128_hash_t hash;
+		const char* fbx;
+	};
+
+	const SupportedMap supportedMaps[] = {
+		{ { 0x5073cdbb305dc3e5, 0x388fab8b69718b78 }, "LethSM64.fbx" },
+		//{ { 0xe9708ff5ad55b6e1, 0x7165ef3aff368c3 }, "LethBlockFort.fbx" },
+		//{ { 17947140482627331743, 11142468266187614088 }, "LethParkourEgypt.fbx" },
+		//{ { 0xfd9d4ae1ff8facd5, 0xb38fe29c8455095f }, "LethFallGuys.fbx" },
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	double millisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+}
+
+MapLoader::MapLoader(size_t workerCount) : convertPool(workerCount)
+{
+	thread = std::thread(&MapLoader::loaderLoop, this);
+}
+
+MapLoader::~MapLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	thread.join();
+}
+
+std::future<std::shared_ptr<MapSurfaces>> MapLoader::Load(const std::string& arena, bool useCache,
+	LoadedCallback onLoaded)
+{
+	Request request{ arena, useCache, std::move(onLoaded) };
+	std::future<std::shared_ptr<MapSurfaces>> loaded = request.loaded.get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(std::move(request));
+	}
+	wake.notify_one();
+	return loaded;
+}
+
+MapLoadTimings MapLoader::LastTimings()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return lastTimings;
+}
+
+void MapLoader::Cancel()
+{
+	std::deque<Request> dropped;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		dropped.swap(requests);
+		idle.wait(lock, [this]() { return !loading; });
+	}
+	for (Request& request : dropped)
+	{
+		request.loaded.set_value(nullptr);
+	}
+}
+
+void MapLoader::loaderLoop()
+{
+	while (true)
+	{
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+			if (stopping)
+			{
+				break;
+			}
+			request = std::move(requests.front());
+			requests.pop_front();
+			loading = true;
+		}
+
+		MapLoadTimings timings;
+		const auto start = Clock::now();
+		std::shared_ptr<MapSurfaces> map = load(request.arena, request.useCache, timings);
+		if (map != nullptr)
+		{
+			BM_INFO_LOG("Loaded {:s} in {:.1f}ms, {:d} surfaces {:s}: hash {:.1f}ms, cache {:.1f}ms, import {:.1f}ms, "
+				"surfaces {:.1f}ms, render vertices {:.1f}ms, cache write {:.1f}ms", quote(request.arena),
+				millisecondsSince(start), map->SurfaceCount(), timings.fromCache ? "from its cache" : "converted",
+				timings.hashMs, timings.cacheMs, timings.importMs, timings.surfacesMs, timings.verticesMs,
+				timings.writeMs);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			lastTimings = timings;
+		}
+
+		if (request.onLoaded)
+		{
+			request.onLoaded(map);
+		}
+		request.loaded.set_value(map);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			loading = false;
+		}
+		idle.notify_all();
+	}
+
+	// Whoever still waits gets nothing
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Request& request : requests)
+	{
+		request.loaded.set_value(nullptr);
+	}
+	requests.clear();
+}
+
+std::shared_ptr<MapSurfaces> MapLoader::load(const std::string& arena, bool useCache, MapLoadTimings& timings)
+{
+	std::filesystem::path arenaPath(arena);
+	std::error_code error;
+	if (!std::filesystem::exists(arenaPath, error))
+	{
+		arenaPath = std::filesystem::path(Utils::GetMapFolderPath()) / (arena + ".upk");
+		if (!std::filesystem::exists(arenaPath, error))
+		{
+			BM_ERROR_LOG("Could not find map file for extraction.");
+			return nullptr;
+		}
+	}
+
+	auto stageStart = Clock::now();
+	XXH128_hash_t mapHash;
+	if (!FileHashCache::getInstance().Hash(arenaPath, &mapHash))
+	{
+		BM_ERROR_LOG("Could not read map file {:s}", quote(arenaPath.string()));
+		return nullptr;
+	}
+	timings.hashMs = millisecondsSince(stageStart);
+
+	const SupportedMap* supportedMap = nullptr;
+	for (const SupportedMap& candidate : supportedMaps)
+	{
+		if (XXH128_isEqual(mapHash, candidate.hash))
+		{
+			supportedMap = &candidate;
+			break;
+		}
+	}
+	if (supportedMap == nullptr)
+	{
+		return nullptr; // map not found
+	}
+
+	const std::filesystem::path cachePath = MapSurfaces::CachePath(mapHash);
+	if (useCache)
+	{
+		stageStart = Clock::now();
+		std::shared_ptr<MapSurfaces> cached = MapSurfaces::OpenCache(cachePath, mapHash);
+		timings.cacheMs = millisecondsSince(stageStart);
+		if (cached != nullptr)
+		{
+			timings.fromCache = true;
+			return cached;
+		}
+	}
+
+	stageStart = Clock::now();
+	std::vector<std::string> fbxList;
+	fbxList.push_back(Utils::GetBakkesmodFolderPath() + "data\\assets\\" + supportedMap->fbx);
+	// Only imported, the renderer never sees this model
+	std::unique_ptr<Model> model = std::make_unique<Model>(fbxList, false, false);
+	std::vector<Vertex> corners;
+	for (size_t i = 0; i < model->modelIndicesArr.size(); i++)
+	{
+		const auto& indices = model->modelIndicesArr[i];
+		const auto& modelVertices = model->modelVerticesArr[i];
+		for (UINT index : indices)
+		{
+			corners.push_back(modelVertices[index]);
+		}
+	}
+	model.reset();
+	timings.importMs = millisecondsSince(stageStart);
+
+	const size_t triangleCount = corners.size() / 3;
+	const size_t batches = (triangleCount + MAP_CONVERT_BATCH - 1) / MAP_CONVERT_BATCH;
+	stageStart = Clock::now();
+	std::vector<struct SM64Surface> surfaces(triangleCount);
+	convertPool.ParallelFor(batches, [&](size_t batch) {
+		const size_t begin = batch * MAP_CONVERT_BATCH;
+		MapSurfaces::ConvertSurfaces(corners.data(), begin, std::min(begin + MAP_CONVERT_BATCH, triangleCount),
+			surfaces.data());
+	});
+	timings.surfacesMs = millisecondsSince(stageStart);
+
+	stageStart = Clock::now();
+	std::vector<Vertex> vertices(triangleCount * 3);
+	convertPool.ParallelFor(batches, [&](size_t batch) {
+		const size_t begin = batch * MAP_CONVERT_BATCH;
+		MapSurfaces::ConvertRenderVertices(corners.data(), begin, std::min(begin + MAP_CONVERT_BATCH, triangleCount),
+			vertices.data());
+	});
+	timings.verticesMs = millisecondsSince(stageStart);
+
+	std::shared_ptr<MapSurfaces> map = MapSurfaces::FromArrays(std::move(surfaces), std::move(vertices));
+	stageStart = Clock::now();
+	if (!map->WriteCache(cachePath, mapHash))
+	{
+		BM_WARNING_LOG("Could not write map cache {:s}", quote(cachePath.string()));
+	}
+	timings.writeMs = millisecondsSince(stageStart);
+	return map;
+}
@@ -0,0 +1,80 @@
+#pragma once
+// MapLoader.h
+// Loads the collision surfaces of custom maps on a background thread.
+//
+// A load goes through stages: hash the map package, open its cache file,
+// or import its FBX, convert the triangles to surfaces and to render
+// vertices, and write the cache file. The conversions are split over a
+// worker pool. Loads run one after the other in the order they were
+// asked for, and every stage's time is logged when a load finishes.
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "MapCache.h"
+#include "WorkerPool.h"
+
+#define MAP_LOAD_WORKERS 3
+#define MAP_CONVERT_BATCH 4096 // Triangles per worker pool job
+
+struct MapLoadTimings
+{
+	double hashMs = 0.0;
+	double cacheMs = 0.0;
+	double importMs = 0.0;
+	double surfacesMs = 0.0;
+	double verticesMs = 0.0;
+	double writeMs = 0.0;
+	bool fromCache = false;
+};
+
+class MapLoader
+{
+public:
+	// Called on the loader thread with what the future gets, before the future gets it
+	using LoadedCallback = std::function<void(const std::shared_ptr<MapSurfaces>& map)>;
+
+	explicit MapLoader(size_t workerCount);
+	~MapLoader();
+
+	MapLoader(const MapLoader&) = delete;
+	MapLoader& operator=(const MapLoader&) = delete;
+
+	// Arena is a package path or a map name in the map folder. Maps that aren't supported load as nullptr.
+	std::future<std::shared_ptr<MapSurfaces>> Load(const std::string& arena, bool useCache = true,
+		LoadedCallback onLoaded = nullptr);
+	// Timings of the last finished load
+	MapLoadTimings LastTimings();
+	// Drops the queued loads without calling their callbacks and waits for the one in flight, callback included.
+	// Nothing asked for before it calls back after it returns.
+	void Cancel();
+
+private:
+	struct Request
+	{
+		std::string arena;
+		bool useCache;
+		LoadedCallback onLoaded;
+		std::promise<std::shared_ptr<MapSurfaces>> loaded;
+	};
+
+	void loaderLoop();
+	std::shared_ptr<MapSurfaces> load(const std::string& arena, bool useCache, MapLoadTimings& timings);
+
+	WorkerPool convertPool;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	// Guarded by mutex
+	std::deque<Request> requests;
+	MapLoadTimings lastTimings;
+	bool loading = false;
+	bool stopping = false;
+};
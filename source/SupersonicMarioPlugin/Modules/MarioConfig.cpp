@@ -9,6 +9,7 @@ MarioConfig::MarioConfig()
 {
 	conf.option(VOLUME_LOOKUP).shortflag("v").defaultValue(VOLUME_DEFAULT).required(true).description("Volume");
 	conf.option(ROM_LOOKUP).shortflag("r").defaultValue(defaultRomPath).required(true).description("Rom");
+	conf.option(INTERP_DELAY_LOOKUP).shortflag("d").defaultValue(INTERP_DELAY_DEFAULT).required(true).description("Remote mario interpolation delay");
 	configPath = Utils::GetBakkesmodFolderPath() + CONFIG_FILE_NAME;
 	conf.config(configPath);
 }
@@ -46,4 +47,20 @@ std::string MarioConfig::GetRomPath()
 	std::string result = conf[ROM_LOOKUP].getString();
 	Utils::trim(result);
 	return result;
-}
\ No newline at end of file
+}
+
+void MarioConfig::SetInterpolationDelay(int delayMs)
+{
+	conf[INTERP_DELAY_LOOKUP] = delayMs;
+	conf.serialize(configPath);
+}
+
+int MarioConfig::GetInterpolationDelay()
+{
+	auto delayConf = conf[INTERP_DELAY_LOOKUP];
+	if (delayConf.isEmpty())
+	{
+		SetInterpolationDelay(INTERP_DELAY_DEFAULT);
+	}
+	return conf[INTERP_DELAY_LOOKUP].getInt();
+}
@@ -8,6 +8,8 @@
 #define VOLUME_LOOKUP "volume"
 #define VOLUME_DEFAULT 50
 #define ROM_LOOKUP "rom"
+#define INTERP_DELAY_LOOKUP "interpdelay"
+#define INTERP_DELAY_DEFAULT 100
 
 class MarioConfig
 {
@@ -21,6 +23,8 @@ public:
 	int GetVolume();
 	void SetRomPath(std::string romPath);
 	std::string GetRomPath();
+	void SetInterpolationDelay(int delayMs);
+	int GetInterpolationDelay();
 
 private:
 	MarioConfig();
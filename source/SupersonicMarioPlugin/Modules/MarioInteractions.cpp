@@ -0,0 +1,135 @@
+// MarioInteractions.cpp
+// Knockbacks between marios and ball hits, decided for every mario at once.
+
+#include "MarioInteractions.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MARIO_INTERACTIONS_SSE
+#endif
+
+namespace
+{
+	// Squared floats round differently than MarioLogic's distances, the slack keeps every mario they would pick
+	inline float broadRadiusSquared(float radius)
+	{
+		const float slack = radius * 1.001f + 1.0f;
+		return slack * slack;
+	}
+}
+
+void MarioInteractionBatch::Clear()
+{
+	count = 0;
+	x.clear();
+	y.clear();
+	z.clear();
+	action.clear();
+	canHitBall.clear();
+}
+
+int MarioInteractionBatch::Add(const struct SM64MarioBodyState& bodyState, bool canHit)
+{
+	if (count == x.size())
+	{
+		const size_t padded = count + 4;
+		x.resize(padded, 0.0f);
+		y.resize(padded, 0.0f);
+		z.resize(padded, 0.0f);
+		action.resize(padded, 0);
+		canHitBall.resize(padded, 0);
+	}
+
+	x[count] = bodyState.marioState.position[0];
+	y[count] = bodyState.marioState.position[1];
+	z[count] = bodyState.marioState.position[2];
+	action[count] = bodyState.action;
+	canHitBall[count] = canHit;
+	return (int)count++;
+}
+
+uint32_t MarioInteractionBatch::nearMask(size_t first, const float point[3], float radiusSquared) const
+{
+#ifdef MARIO_INTERACTIONS_SSE
+	const __m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[first]), _mm_set1_ps(point[0]));
+	const __m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[first]), _mm_set1_ps(point[1]));
+	const __m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[first]), _mm_set1_ps(point[2]));
+	const __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+	uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(distanceSquared, _mm_set1_ps(radiusSquared)));
+#else
+	uint32_t mask = 0;
+	for (size_t k = 0; k < 4; k++)
+	{
+		const float dx = x[first + k] - point[0];
+		const float dy = y[first + k] - point[1];
+		const float dz = z[first + k] - point[2];
+		mask |= (uint32_t)(dx * dx + dy * dy + dz * dz < radiusSquared) << k;
+	}
+#endif
+
+	// Padding after the last mario
+	if (count - first < 4)
+	{
+		mask &= (1u << (count - first)) - 1;
+	}
+	return mask;
+}
+
+int MarioInteractionBatch::FindAttacker(const float position[3], int except) const
+{
+	const float radiusSquared = broadRadiusSquared(MARIO_ATTACK_RADIUS);
+	for (size_t first = 0; first < count; first += 4)
+	{
+		for (uint32_t mask = nearMask(first, position, radiusSquared); mask != 0; mask &= mask - 1)
+		{
+			const int i = (int)first + std::countr_zero(mask);
+			const float otherPosition[3] = { x[i], y[i], z[i] };
+			if (i != except && MarioAttackReaches(position, otherPosition, action[i]))
+			{
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+bool MarioInteractionBatch::ApplyAttack(const float position[3], int except, struct SM64MarioInputs* inputs) const
+{
+	const int attacker = FindAttacker(position, except);
+	if (attacker < 0)
+	{
+		return false;
+	}
+
+	const float attackerPosition[3] = { x[attacker], y[attacker], z[attacker] };
+	SetMarioAttacked(attackerPosition, inputs);
+	return true;
+}
+
+int MarioInteractionBatch::ResolveBall(const float ballLocation[3], float ballVelocity[3], const BallInteractionTuning& tuning,
+	std::vector<uint8_t>& hits) const
+{
+	hits.assign(count, 0);
+
+	// Unreal swaps y and z
+	const float ball[3] = { ballLocation[0], ballLocation[2], ballLocation[1] };
+	const float radiusSquared = broadRadiusSquared(std::max(tuning.groundPoundBallRadius, tuning.attackBallRadius));
+	int hitCount = 0;
+	for (size_t first = 0; first < count; first += 4)
+	{
+		for (uint32_t mask = nearMask(first, ball, radiusSquared); mask != 0; mask &= mask - 1)
+		{
+			const int i = (int)first + std::countr_zero(mask);
+			const float marioLocation[3] = { x[i], z[i], y[i] };
+			if (canHitBall[i] && ApplyBallInteraction(marioLocation, action[i], ballLocation, ballVelocity, tuning))
+			{
+				hits[i] = 1;
+				hitCount++;
+			}
+		}
+	}
+	return hitCount;
+}
@@ -0,0 +1,47 @@
+#pragma once
+// MarioInteractions.h
+// Knockbacks between marios and ball hits, decided for every mario at once.
+//
+// Every mario's position and action are gathered once per step into one
+// array per coordinate. A pass of 4 wide squared distance tests then finds
+// the few marios close enough to matter, and only those go through the
+// MarioLogic rules, which still decide. The distance test has some slack,
+// so it never drops a mario the rules would have picked, and the results
+// are the same as checking every mario against every other one.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "MarioLogic.h"
+
+class MarioInteractionBatch
+{
+public:
+	void Clear();
+	// Returns the mario's index, marios are looked at in the order they were added
+	int Add(const struct SM64MarioBodyState& bodyState, bool canHitBall = true);
+
+	// First attacking mario within reach of position, in libsm64 coordinates, other than except. -1 if none.
+	int FindAttacker(const float position[3], int except = -1) const;
+	// Marks inputs as attacked by that mario. Returns whether there was one.
+	bool ApplyAttack(const float position[3], int except, struct SM64MarioInputs* inputs) const;
+	// Adds what every mario that can hit the ball does to it to its velocity, both in Unreal coordinates.
+	// hits gets a 1 for every mario that hit it. Returns how many did.
+	int ResolveBall(const float ballLocation[3], float ballVelocity[3], const BallInteractionTuning& tuning,
+		std::vector<uint8_t>& hits) const;
+
+	size_t Size() const { return count; }
+
+private:
+	// Bit k is set if mario first + k may be within the radius of point
+	uint32_t nearMask(size_t first, const float point[3], float radiusSquared) const;
+
+	size_t count = 0;
+	// libsm64 coordinates, padded to a multiple of 4
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<uint32_t> action;
+	std::vector<uint8_t> canHitBall;
+};
@@ -0,0 +1,136 @@
+// MarioLogic.cpp
+// Game rules between marios, cars and the ball, without Rocket League.
+
+#include "MarioLogic.h"
+
+#include <cmath>
+
+namespace
+{
+	// Same precision as Utils::Distance, so the plugin's results don't change
+	float distance(const float a[3], const float b[3])
+	{
+		return (float)std::sqrt(std::pow(b[0] - a[0], 2.0) + std::pow(b[1] - a[1], 2.0) + std::pow(b[2] - a[2], 2.0));
+	}
+}
+
+void MarioInputsFromCar(const CarControls& controls, bool canMove, float boostAmount, const float marioPosition[3],
+	const float cameraLocation[3], struct SM64MarioInputs* inputs)
+{
+	if (canMove)
+	{
+		inputs->buttonA = controls.jump;
+		inputs->buttonB = controls.handbrake;
+		inputs->buttonZ = controls.throttle < 0;
+		inputs->stickX = controls.steer;
+		inputs->stickY = controls.pitch;
+	}
+	else
+	{
+		inputs->buttonA = 0;
+		inputs->buttonB = 0;
+		inputs->buttonZ = 0;
+		inputs->stickX = 0;
+		inputs->stickY = 0;
+	}
+
+	// Unreal swaps y and z
+	inputs->camLookX = marioPosition[0] - cameraLocation[0];
+	inputs->camLookZ = marioPosition[2] - cameraLocation[1];
+	inputs->isBoosting = controls.holdingBoost && boostAmount >= 0.01f;
+}
+
+void ClearMarioAttack(struct SM64MarioInputs* inputs)
+{
+	inputs->attackInput.isAttacked = false;
+	inputs->attackInput.attackedPosX = 0;
+	inputs->attackInput.attackedPosY = 0;
+	inputs->attackInput.attackedPosZ = 0;
+}
+
+bool MarioAttackReaches(const float position[3], const float otherPosition[3], uint32_t otherAction)
+{
+	return distance(position, otherPosition) < MARIO_ATTACK_RADIUS && (otherAction & ACT_FLAG_ATTACKING);
+}
+
+void SetMarioAttacked(const float attackerPosition[3], struct SM64MarioInputs* inputs)
+{
+	inputs->attackInput.isAttacked = true;
+	inputs->attackInput.attackedPosX = attackerPosition[0];
+	inputs->attackInput.attackedPosY = attackerPosition[1];
+	inputs->attackInput.attackedPosZ = attackerPosition[2];
+}
+
+bool ApplyMarioAttack(const float position[3], const struct SM64MarioBodyState& other, struct SM64MarioInputs* inputs)
+{
+	if (!MarioAttackReaches(position, other.marioState.position, other.action))
+	{
+		return false;
+	}
+
+	SetMarioAttacked(other.marioState.position, inputs);
+	return true;
+}
+
+bool ApplyBallInteraction(const struct SM64MarioBodyState& bodyState, const float ballLocation[3], float ballVelocity[3],
+	const BallInteractionTuning& tuning)
+{
+	const float marioLocation[3] = {
+		bodyState.marioState.position[0],
+		bodyState.marioState.position[2],
+		bodyState.marioState.position[1]
+	};
+	return ApplyBallInteraction(marioLocation, bodyState.action, ballLocation, ballVelocity, tuning);
+}
+
+bool ApplyBallInteraction(const float marioLocation[3], uint32_t action, const float ballLocation[3], float ballVelocity[3],
+	const BallInteractionTuning& tuning)
+{
+	const float ballDistance = distance(marioLocation, ballLocation);
+	const float dx = ballLocation[0] - marioLocation[0];
+	const float dy = ballLocation[1] - marioLocation[1];
+	const float angleToBall = atan2f(dy, dx);
+
+	if (ballDistance < tuning.groundPoundBallRadius && action == ACT_GROUND_POUND_LAND)
+	{
+		ballVelocity[0] += tuning.groundPoundPinchVel * cosf(angleToBall);
+		ballVelocity[1] += tuning.groundPoundPinchVel * sinf(angleToBall);
+		return true;
+	}
+	if (ballDistance >= tuning.attackBallRadius)
+	{
+		return false;
+	}
+
+	if (action == ACT_JUMP_KICK)
+	{
+		ballVelocity[0] += tuning.kickBallVelHoriz * cosf(angleToBall);
+		ballVelocity[1] += tuning.kickBallVelHoriz * sinf(angleToBall);
+		ballVelocity[2] += tuning.kickBallVelVert;
+		return true;
+	}
+	if (action == ACT_MOVE_PUNCHING)
+	{
+		ballVelocity[0] += tuning.punchBallVelHoriz * cosf(angleToBall);
+		ballVelocity[1] += tuning.punchBallVelHoriz * sinf(angleToBall);
+		ballVelocity[2] += tuning.punchBallVelVert;
+		return true;
+	}
+	if (action == ACT_DIVE || action == ACT_DIVE_SLIDE)
+	{
+		ballVelocity[0] += tuning.diveBallVelHoriz * cosf(angleToBall);
+		ballVelocity[1] += tuning.diveBallVelHoriz * sinf(angleToBall);
+		ballVelocity[2] += tuning.diveBallVelVert;
+		return true;
+	}
+	if (action == ACT_FLYING)
+	{
+		const float dz = ballLocation[2] - marioLocation[2];
+		const float zFactor = sinf(atan2f(dz, dx));
+		ballVelocity[0] += tuning.flyBallVel * cosf(angleToBall) * fabsf(zFactor);
+		ballVelocity[1] += tuning.flyBallVel * sinf(angleToBall) * fabsf(zFactor);
+		ballVelocity[2] += tuning.flyBallVel * zFactor;
+		return true;
+	}
+	return false;
+}
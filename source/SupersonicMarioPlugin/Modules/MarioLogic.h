@@ -0,0 +1,68 @@
+#pragma once
+// MarioLogic.h
+// Game rules between marios, cars and the ball, without Rocket League.
+//
+// Everything here only takes plain values, so the plugin and the headless
+// replay harness in ../SupersonicMarioHeadless run the same rules. Positions
+// are in libsm64 coordinates (y up) unless they say Unreal (z up).
+
+#include <cstdint>
+
+extern "C" {
+	#include "libsm64.h"
+}
+
+#define MARIO_ATTACK_RADIUS 100.0f
+#define GROUND_POUND_BALL_RADIUS 200.0f
+#define GROUND_POUND_PINCH_VELOCITY 2708.0f
+#define ATTACK_BALL_RADIUS 261.0f
+#define KICK_BALL_VEL_HORIZ 583.0f
+#define KICK_BALL_VEL_VERT 305.0f
+#define PUNCH_BALL_VEL_HORIZ 1388.0f
+#define PUNCH_BALL_VEL_VERT 250.0f
+#define DIVE_BALL_VEL_HORIZ 639.0f
+#define DIVE_BALL_VEL_VERT 166.6f
+#define FLY_BALL_VEL 500.0f
+
+struct BallInteractionTuning
+{
+	float groundPoundBallRadius = GROUND_POUND_BALL_RADIUS;
+	float groundPoundPinchVel = GROUND_POUND_PINCH_VELOCITY;
+	float attackBallRadius = ATTACK_BALL_RADIUS;
+	float kickBallVelHoriz = KICK_BALL_VEL_HORIZ;
+	float kickBallVelVert = KICK_BALL_VEL_VERT;
+	float punchBallVelHoriz = PUNCH_BALL_VEL_HORIZ;
+	float punchBallVelVert = PUNCH_BALL_VEL_VERT;
+	float diveBallVelHoriz = DIVE_BALL_VEL_HORIZ;
+	float diveBallVelVert = DIVE_BALL_VEL_VERT;
+	float flyBallVel = FLY_BALL_VEL;
+};
+
+// What the player holds on the car's controller
+struct CarControls
+{
+	float throttle = 0.0f;
+	float steer = 0.0f;
+	float pitch = 0.0f;
+	bool jump = false;
+	bool handbrake = false;
+	bool holdingBoost = false;
+};
+
+// Maps the car's controls onto mario's buttons and stick, the camera is in Unreal coordinates.
+// Without canMove, e.g. in the pregame, mario stands still.
+void MarioInputsFromCar(const CarControls& controls, bool canMove, float boostAmount, const float marioPosition[3],
+	const float cameraLocation[3], struct SM64MarioInputs* inputs);
+void ClearMarioAttack(struct SM64MarioInputs* inputs);
+// Whether a mario at otherPosition doing otherAction reaches a mario at position
+bool MarioAttackReaches(const float position[3], const float otherPosition[3], uint32_t otherAction);
+void SetMarioAttacked(const float attackerPosition[3], struct SM64MarioInputs* inputs);
+// Marks mario as attacked if the other mario attacks within reach of position. Returns whether it did.
+bool ApplyMarioAttack(const float position[3], const struct SM64MarioBodyState& other, struct SM64MarioInputs* inputs);
+// Adds what mario's current action does to the ball to its velocity, both in Unreal coordinates.
+// Returns whether mario hit the ball.
+bool ApplyBallInteraction(const struct SM64MarioBodyState& bodyState, const float ballLocation[3], float ballVelocity[3],
+	const BallInteractionTuning& tuning);
+// Same with mario's location in Unreal coordinates
+bool ApplyBallInteraction(const float marioLocation[3], uint32_t action, const float ballLocation[3], float ballVelocity[3],
+	const BallInteractionTuning& tuning);
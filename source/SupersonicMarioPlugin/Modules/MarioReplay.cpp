@@ -0,0 +1,166 @@
+// MarioReplay.cpp
+// Compact recordings of what drives the marios, to simulate them again headless.
+
+#include "MarioReplay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define BUTTON_JUMP 1
+#define BUTTON_HANDBRAKE 2
+#define BUTTON_BOOST 4
+#define BUTTON_CAN_MOVE 8
+
+namespace
+{
+	int16_t packUnits(float value)
+	{
+		return (int16_t)std::clamp(std::lround(value), (long)INT16_MIN, (long)INT16_MAX);
+	}
+
+	int8_t packAxis(float value)
+	{
+		return (int8_t)std::lround(std::clamp(value, -1.0f, 1.0f) * MARIO_REPLAY_STICK_SCALE);
+	}
+
+	PackedMarioStep pack(const MarioReplayMario& mario)
+	{
+		PackedMarioStep step;
+		for (int i = 0; i < 3; i++)
+		{
+			step.carLocation[i] = packUnits(mario.carLocation[i]);
+			step.cameraLocation[i] = packUnits(mario.cameraLocation[i]);
+		}
+		step.throttle = packAxis(mario.controls.throttle);
+		step.steer = packAxis(mario.controls.steer);
+		step.pitch = packAxis(mario.controls.pitch);
+		step.buttons = (mario.controls.jump ? BUTTON_JUMP : 0) |
+			(mario.controls.handbrake ? BUTTON_HANDBRAKE : 0) |
+			(mario.controls.holdingBoost ? BUTTON_BOOST : 0) |
+			(mario.canMove ? BUTTON_CAN_MOVE : 0);
+		step.boostAmount = (uint8_t)std::lround(std::clamp(mario.boostAmount, 0.0f, 1.0f) * 255.0f);
+		return step;
+	}
+
+	MarioReplayMario unpack(const PackedMarioStep& step)
+	{
+		MarioReplayMario mario;
+		for (int i = 0; i < 3; i++)
+		{
+			mario.carLocation[i] = step.carLocation[i];
+			mario.cameraLocation[i] = step.cameraLocation[i];
+		}
+		mario.controls.throttle = step.throttle / MARIO_REPLAY_STICK_SCALE;
+		mario.controls.steer = step.steer / MARIO_REPLAY_STICK_SCALE;
+		mario.controls.pitch = step.pitch / MARIO_REPLAY_STICK_SCALE;
+		mario.controls.jump = step.buttons & BUTTON_JUMP;
+		mario.controls.handbrake = step.buttons & BUTTON_HANDBRAKE;
+		mario.controls.holdingBoost = step.buttons & BUTTON_BOOST;
+		mario.canMove = step.buttons & BUTTON_CAN_MOVE;
+		mario.boostAmount = step.boostAmount / 255.0f;
+		return mario;
+	}
+}
+
+void QuantizeReplayBall(MarioReplayBall& ball)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		ball.location[i] = packUnits(ball.location[i]);
+		ball.velocity[i] = packUnits(ball.velocity[i]);
+	}
+}
+
+void QuantizeReplayMario(MarioReplayMario& mario)
+{
+	mario = unpack(pack(mario));
+}
+
+MarioReplayWriter::~MarioReplayWriter()
+{
+	Close();
+}
+
+bool MarioReplayWriter::Open(const std::filesystem::path& path, uint32_t marioCount)
+{
+	Close();
+	if (marioCount == 0 || marioCount > MARIO_REPLAY_MAX_MARIOS) return false;
+
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	header = {};
+	memcpy(header.magic, MARIO_REPLAY_MAGIC, sizeof(MARIO_REPLAY_MAGIC));
+	header.version = MARIO_REPLAY_VERSION;
+	header.marioCount = marioCount;
+	file.write((const char*)&header, sizeof(header));
+	packed.resize(marioCount);
+	return (bool)file;
+}
+
+bool MarioReplayWriter::WriteStep(const MarioReplayBall& ball, const MarioReplayMario* marios)
+{
+	if (!file.is_open()) return false;
+
+	PackedBallStep ballStep;
+	for (int i = 0; i < 3; i++)
+	{
+		ballStep.location[i] = packUnits(ball.location[i]);
+		ballStep.velocity[i] = packUnits(ball.velocity[i]);
+	}
+	for (uint32_t i = 0; i < header.marioCount; i++)
+	{
+		packed[i] = pack(marios[i]);
+	}
+	file.write((const char*)&ballStep, sizeof(ballStep));
+	file.write((const char*)packed.data(), packed.size() * sizeof(PackedMarioStep));
+	header.stepCount++;
+	return (bool)file;
+}
+
+void MarioReplayWriter::Close()
+{
+	if (!file.is_open()) return;
+
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	file.close();
+}
+
+bool MarioReplayReader::Open(const std::filesystem::path& path)
+{
+	file.open(path, std::ios::binary);
+	if (!file.read((char*)&header, sizeof(header))) return false;
+
+	if (memcmp(header.magic, MARIO_REPLAY_MAGIC, sizeof(MARIO_REPLAY_MAGIC)) != 0 ||
+		header.version != MARIO_REPLAY_VERSION ||
+		header.marioCount == 0 || header.marioCount > MARIO_REPLAY_MAX_MARIOS)
+	{
+		file.close();
+		return false;
+	}
+	packed.resize(header.marioCount);
+	return true;
+}
+
+bool MarioReplayReader::ReadStep(MarioReplayBall* ball, MarioReplayMario* marios)
+{
+	PackedBallStep ballStep;
+	if (!file.read((char*)&ballStep, sizeof(ballStep)) ||
+		!file.read((char*)packed.data(), packed.size() * sizeof(PackedMarioStep)))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		ball->location[i] = ballStep.location[i];
+		ball->velocity[i] = ballStep.velocity[i];
+	}
+	for (uint32_t i = 0; i < header.marioCount; i++)
+	{
+		marios[i] = unpack(packed[i]);
+	}
+	return true;
+}
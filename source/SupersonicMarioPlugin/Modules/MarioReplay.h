@@ -0,0 +1,108 @@
+#pragma once
+// MarioReplay.h
+// Compact recordings of what drives the marios, to simulate them again headless.
+//
+// A replay holds one step per 30 Hz simulation step. Every step has the
+// ball and, for each mario, the car it belongs to, the camera and the
+// controls, quantized to 17 bytes a mario. Feeding the steps through
+// MarioLogic and libsm64 gives the same body states every time, see
+// ../SupersonicMarioHeadless.
+//
+// File layout, little endian:
+//   MarioReplayHeader
+//   stepCount * (PackedBallStep, marioCount * PackedMarioStep)
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "MarioLogic.h"
+
+#define MARIO_REPLAY_MAGIC "SMPRPLY"
+#define MARIO_REPLAY_VERSION 1
+#define MARIO_REPLAY_MAX_MARIOS 64
+#define MARIO_REPLAY_STICK_SCALE 127.0f
+
+struct MarioReplayHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t marioCount;
+	uint32_t stepCount; // Written on close, 0 in a replay that is still being recorded
+	uint32_t reserved;
+};
+
+struct MarioReplayBall
+{
+	float location[3] = {};
+	float velocity[3] = {};
+};
+
+struct MarioReplayMario
+{
+	float carLocation[3] = {};
+	float cameraLocation[3] = {};
+	CarControls controls;
+	bool canMove = false;
+	float boostAmount = 0.0f;
+};
+
+// Locations and velocities in whole Unreal units, the field fits in 16 bits
+#pragma pack(push, 1)
+struct PackedBallStep
+{
+	int16_t location[3];
+	int16_t velocity[3];
+};
+
+struct PackedMarioStep
+{
+	int16_t carLocation[3];
+	int16_t cameraLocation[3];
+	int8_t throttle;
+	int8_t steer;
+	int8_t pitch;
+	uint8_t buttons;
+	uint8_t boostAmount; // 0-255 for 0-1
+};
+#pragma pack(pop)
+
+// Rounds to what a replay stores, to simulate exactly what a recording will play back
+void QuantizeReplayBall(MarioReplayBall& ball);
+void QuantizeReplayMario(MarioReplayMario& mario);
+
+class MarioReplayWriter
+{
+public:
+	~MarioReplayWriter();
+
+	bool Open(const std::filesystem::path& path, uint32_t marioCount);
+	// Takes MarioCount() marios
+	bool WriteStep(const MarioReplayBall& ball, const MarioReplayMario* marios);
+	void Close();
+
+	bool IsOpen() const { return file.is_open(); }
+	uint32_t MarioCount() const { return header.marioCount; }
+
+private:
+	std::ofstream file;
+	MarioReplayHeader header = {};
+	std::vector<PackedMarioStep> packed;
+};
+
+class MarioReplayReader
+{
+public:
+	bool Open(const std::filesystem::path& path);
+	// Fills MarioCount() marios, false at the end of the replay
+	bool ReadStep(MarioReplayBall* ball, MarioReplayMario* marios);
+
+	uint32_t MarioCount() const { return header.marioCount; }
+	uint32_t StepCount() const { return header.stepCount; }
+
+private:
+	std::ifstream file;
+	MarioReplayHeader header = {};
+	std::vector<PackedMarioStep> packed;
+};
@@ -0,0 +1,213 @@
+#include "pch.h"
+#include "MarioTuning.h"
+
+#include <fstream>
+
+namespace
+{
+	struct TuningField
+	{
+		const char* name;
+		float* (*get)(MarioTuning& tuning);
+	};
+
+	#define TUNING_FIELD(name, member) { name, [](MarioTuning& tuning) { return &tuning.member; } }
+	const TuningField tuningFields[] = {
+		TUNING_FIELD("attackBoostDamage", attackBoostDamage),
+		TUNING_FIELD("groundPoundBallRadius", ball.groundPoundBallRadius),
+		TUNING_FIELD("groundPoundPinchVel", ball.groundPoundPinchVel),
+		TUNING_FIELD("attackBallRadius", ball.attackBallRadius),
+		TUNING_FIELD("kickBallVelHoriz", ball.kickBallVelHoriz),
+		TUNING_FIELD("kickBallVelVert", ball.kickBallVelVert),
+		TUNING_FIELD("punchBallVelHoriz", ball.punchBallVelHoriz),
+		TUNING_FIELD("punchBallVelVert", ball.punchBallVelVert),
+		TUNING_FIELD("diveBallVelHoriz", ball.diveBallVelHoriz),
+		TUNING_FIELD("diveBallVelVert", ball.diveBallVelVert),
+		TUNING_FIELD("flyBallVel", ball.flyBallVel),
+	};
+	#undef TUNING_FIELD
+
+	bool sameTuning(const MarioTuning& a, const MarioTuning& b)
+	{
+		return memcmp(&a, &b, sizeof(MarioTuning)) == 0;
+	}
+}
+
+MarioTuningTable::MarioTuningTable()
+{
+	published.push_back(std::make_unique<const MarioTuning>(local));
+	current.store(published.back().get(), std::memory_order_release);
+}
+
+MarioTuningTable::~MarioTuningTable()
+{
+	{
+		std::lock_guard<std::mutex> lock(watchMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (watcher.joinable())
+	{
+		watcher.join();
+	}
+}
+
+void MarioTuningTable::Watch(const std::filesystem::path& watchPath)
+{
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		path = watchPath;
+	}
+
+	std::error_code error;
+	if (!std::filesystem::exists(watchPath, error) && !Save())
+	{
+		BM_WARNING_LOG("could not write the default tuning to {:s}", quote(watchPath.string()));
+	}
+
+	if (!watcher.joinable())
+	{
+		watcher = std::thread(&MarioTuningTable::watchLoop, this);
+	}
+}
+
+bool MarioTuningTable::Save()
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	if (path.empty()) return false;
+
+	std::ofstream file(path, std::ios::trunc);
+	file << "{\n";
+	file << fmt::format("    \"version\": {}", local.version);
+	for (const TuningField& field : tuningFields)
+	{
+		file << fmt::format(",\n    \"{}\": {}", field.name, *field.get(local));
+	}
+	file << "\n}\n";
+	return (bool)file;
+}
+
+void MarioTuningTable::Publish(const MarioTuning& tuning)
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	local = tuning;
+	if (!overridden)
+	{
+		use(local);
+	}
+}
+
+void MarioTuningTable::Override(const MarioTuning& tuning)
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	overridden = true;
+	use(tuning);
+}
+
+void MarioTuningTable::ReleaseOverride()
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	if (!overridden) return;
+
+	overridden = false;
+	use(local);
+}
+
+void MarioTuningTable::use(const MarioTuning& tuning)
+{
+	if (sameTuning(tuning, Current())) return;
+
+	published.push_back(std::make_unique<const MarioTuning>(tuning));
+	current.store(published.back().get(), std::memory_order_release);
+	revision.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool MarioTuningTable::load(MarioTuning& tuning)
+{
+	std::filesystem::path loadPath;
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		loadPath = path;
+	}
+
+	simdjson::ondemand::parser parser;
+	simdjson::padded_string data;
+	if (simdjson::padded_string::load(loadPath.string()).get(data) != simdjson::SUCCESS)
+	{
+		BM_ERROR_LOG("could not read tuning {:s}", quote(loadPath.string()));
+		return false;
+	}
+
+	try {
+		simdjson::ondemand::document doc = parser.iterate(data);
+		simdjson::ondemand::object table = doc.get_object();
+		for (auto entry : table)
+		{
+			const std::string_view key = entry.unescaped_key();
+			if (key == "version")
+			{
+				tuning.version = (uint32_t)entry.value().get_uint64();
+				continue;
+			}
+
+			bool known = false;
+			for (const TuningField& field : tuningFields)
+			{
+				if (key == field.name)
+				{
+					*field.get(tuning) = (float)entry.value().get_double();
+					known = true;
+					break;
+				}
+			}
+			if (!known)
+			{
+				BM_WARNING_LOG("unknown tuning {:s}", quote(std::string(key)));
+			}
+		}
+	}
+	catch (const simdjson::simdjson_error& e) {
+		BM_ERROR_LOG("failed to parse tuning {:s}, {:s}", quote(loadPath.string()), quote(e.what()));
+		return false;
+	}
+
+	if (tuning.version != MARIO_TUNING_VERSION)
+	{
+		BM_ERROR_LOG("tuning {:s} is version {}, expected {}", quote(loadPath.string()), tuning.version,
+			MARIO_TUNING_VERSION);
+		return false;
+	}
+	return true;
+}
+
+void MarioTuningTable::watchLoop()
+{
+	while (true)
+	{
+		std::filesystem::path watchPath;
+		{
+			std::lock_guard<std::mutex> lock(writeMutex);
+			watchPath = path;
+		}
+
+		std::error_code error;
+		const std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(watchPath, error);
+		if (!error && writeTime != lastWriteTime)
+		{
+			lastWriteTime = writeTime;
+			// Fields the file leaves out keep their defaults
+			MarioTuning tuning;
+			if (load(tuning))
+			{
+				Publish(tuning);
+				BM_INFO_LOG("loaded tuning {:s}", quote(watchPath.string()));
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(watchMutex);
+		if (wake.wait_for(lock, std::chrono::milliseconds(MARIO_TUNING_POLL_MS), [this]() { return stopping; }))
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+// MarioTuning.h
+// Tuning of mario's interactions, loaded from a file and swapped in while playing.
+//
+// The table is a flat json file of numbers in the data folder, written
+// with the defaults the first time. A thread watches it and loads it again
+// whenever it is written, so tuning doesn't need a rebuild. Every version
+// of the table stays around once it was published, and switching to a new
+// one is a single atomic pointer store, so reading it from the game and
+// render threads never waits. The host sends its table to everyone with
+// the match settings, and clients use that one instead of their own for
+// as long as they play in its game.
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MarioLogic.h"
+
+#define MARIO_TUNING_FILE_NAME "data\\supersonicmario_tuning.json"
+#define MARIO_TUNING_VERSION 1 // Files and match settings with another version are not used
+#define MARIO_TUNING_POLL_MS 500
+#define ATTACK_BOOST_DAMAGE 0.20f
+
+// Plain values only, it is sent as it is in the match settings
+struct MarioTuning
+{
+	uint32_t version = MARIO_TUNING_VERSION;
+	float attackBoostDamage = ATTACK_BOOST_DAMAGE;
+	BallInteractionTuning ball;
+};
+
+class MarioTuningTable
+{
+public:
+	MarioTuningTable();
+	~MarioTuningTable();
+
+	MarioTuningTable(const MarioTuningTable&) = delete;
+	MarioTuningTable& operator=(const MarioTuningTable&) = delete;
+
+	// Loads path now and again every time it is written. Writes the defaults to it if it doesn't exist.
+	void Watch(const std::filesystem::path& path);
+	// Writes the local tuning to the watched file
+	bool Save();
+
+	// The tuning in use, never waits
+	const MarioTuning& Current() const { return *current.load(std::memory_order_acquire); }
+	// Goes up every time another tuning is put in use
+	uint32_t Revision() const { return revision.load(std::memory_order_acquire); }
+
+	// Replaces the local tuning, e.g. from the sliders
+	void Publish(const MarioTuning& tuning);
+	// Uses tuning, e.g. the host's, instead of the local one until ReleaseOverride
+	void Override(const MarioTuning& tuning);
+	void ReleaseOverride();
+
+private:
+	// Assumes writeMutex is already locked. Don't lock here!
+	void use(const MarioTuning& tuning);
+	bool load(MarioTuning& tuning);
+	void watchLoop();
+
+	std::atomic<const MarioTuning*> current;
+	std::atomic<uint32_t> revision = 0;
+
+	std::mutex writeMutex;
+	// Guarded by writeMutex. Readers may still hold any table that was in use, they are freed with the table.
+	std::vector<std::unique_ptr<const MarioTuning>> published;
+	MarioTuning local;
+	bool overridden = false;
+	std::filesystem::path path;
+	std::filesystem::file_time_type lastWriteTime;
+
+	std::thread watcher;
+	std::mutex watchMutex;
+	std::condition_variable wake;
+	// Guarded by watchMutex
+	bool stopping = false;
+};
@@ -0,0 +1,93 @@
+// MarioVertices.cpp
+// Converts libsm64's mario geometry into render vertices.
+
+#include "MarioVertices.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MARIO_VERTICES_SSE
+#endif
+
+namespace
+{
+	inline void convertVertex(const MarioVertexSource& source, size_t i, MarioVertex& vertex)
+	{
+		const float* current = &source.position[i * 3];
+		float position[3];
+		for (int k = 0; k < 3; k++)
+		{
+			position[k] = source.previousPosition != nullptr ? source.previousPosition[i * 3 + k] +
+				(current[k] - source.previousPosition[i * 3 + k]) * source.alpha : current[k];
+		}
+		const float* color = &source.color[i * 3];
+		const float* uv = &source.uv[i * 2];
+		const float* normal = &source.normal[i * 3];
+
+		// Unreal engine swaps y and z
+		vertex.pos[0] = position[0] + source.offset[0];
+		vertex.pos[1] = position[2] + source.offset[2];
+		vertex.pos[2] = position[1] + source.offset[1];
+		vertex.color[0] = color[0];
+		vertex.color[1] = color[1];
+		vertex.color[2] = color[2];
+		vertex.color[3] = i >= source.firstTransparentVertex ? 0.0f : 1.0f;
+		vertex.texCoord[0] = uv[0];
+		vertex.texCoord[1] = uv[1];
+		vertex.normal[0] = normal[0];
+		vertex.normal[1] = normal[2];
+		vertex.normal[2] = normal[1];
+	}
+}
+
+void ConvertMarioVerticesScalar(const MarioVertexSource& source, MarioVertex* vertices)
+{
+	for (size_t i = 0; i < source.vertexCount; i++)
+	{
+		convertVertex(source, i, vertices[i]);
+	}
+}
+
+void ConvertMarioVertices(const MarioVertexSource& source, MarioVertex* vertices)
+{
+#ifdef MARIO_VERTICES_SSE
+	// A vertex is three float4s out: [x z y r] [g b a u] [v nx nz ny]. Every load takes one float past the vertex,
+	// so the last one is left to the scalar loop to not read past the end of libsm64's arrays.
+	const size_t count = source.vertexCount > 0 ? source.vertexCount - 1 : 0;
+	const __m128 alpha = _mm_set1_ps(source.alpha);
+	const __m128 offset = _mm_setr_ps(source.offset[0], source.offset[1], source.offset[2], 0.0f);
+	const __m128 opaque = _mm_set_ss(1.0f);
+	const __m128 transparent = _mm_setzero_ps();
+	float* out = reinterpret_cast<float*>(vertices);
+	size_t i = 0;
+	for (; i < count; i++, out += 12)
+	{
+		__m128 position = _mm_loadu_ps(&source.position[i * 3]);
+		if (source.previousPosition != nullptr)
+		{
+			const __m128 previous = _mm_loadu_ps(&source.previousPosition[i * 3]);
+			position = _mm_add_ps(previous, _mm_mul_ps(_mm_sub_ps(position, previous), alpha));
+		}
+		position = _mm_add_ps(position, offset);
+		const __m128 color = _mm_loadu_ps(&source.color[i * 3]);
+		const __m128 uv = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)&source.uv[i * 2]));
+		const __m128 normal = _mm_loadu_ps(&source.normal[i * 3]);
+		const __m128 vertexAlpha = i >= source.firstTransparentVertex ? transparent : opaque;
+
+		// [y y r r] -> [x z y r]
+		const __m128 positionColor = _mm_shuffle_ps(position, color, _MM_SHUFFLE(0, 0, 1, 1));
+		_mm_storeu_ps(out, _mm_shuffle_ps(position, positionColor, _MM_SHUFFLE(2, 0, 2, 0)));
+		// [a u 0 v] -> [g b a u]
+		const __m128 alphaUv = _mm_unpacklo_ps(vertexAlpha, uv);
+		_mm_storeu_ps(out + 4, _mm_shuffle_ps(color, alphaUv, _MM_SHUFFLE(1, 0, 2, 1)));
+		// [v v nx nx] -> [v nx nz ny]
+		const __m128 uvNormal = _mm_shuffle_ps(uv, normal, _MM_SHUFFLE(0, 0, 1, 1));
+		_mm_storeu_ps(out + 8, _mm_shuffle_ps(uvNormal, normal, _MM_SHUFFLE(1, 2, 2, 0)));
+	}
+	for (; i < source.vertexCount; i++)
+	{
+		convertVertex(source, i, vertices[i]);
+	}
+#else
+	ConvertMarioVerticesScalar(source, vertices);
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+// MarioVertices.h
+// Converts libsm64's mario geometry into render vertices.
+//
+// libsm64 hands out a mario as separate arrays of positions, colors, uvs
+// and normals, the renderer wants one vertex after the other with y and z
+// swapped for Unreal. ConvertMarioVertices does that with SSE2 a whole
+// vertex at a time, ConvertMarioVerticesScalar is the plain loop it has to
+// match exactly. MarioVertexBench compares and times the two.
+
+#include <cstddef>
+#include <cstdint>
+
+// Same layout as the renderer's Vertex, which has DirectX types this module can't use
+struct MarioVertex
+{
+	float pos[3];
+	float color[4];
+	float texCoord[2];
+	float normal[3];
+};
+static_assert(sizeof(MarioVertex) == 12 * sizeof(float), "MarioVertex must stay packed like Vertex");
+
+struct MarioVertexSource
+{
+	const float* position = nullptr;
+	// Positions of the previous step to blend from, nullptr to use position as it is
+	const float* previousPosition = nullptr;
+	const float* color = nullptr;
+	const float* uv = nullptr;
+	const float* normal = nullptr;
+	size_t vertexCount = 0;
+	// Vertices from here on, e.g. the wingcap's, are drawn transparent
+	size_t firstTransparentVertex = SIZE_MAX;
+	// How far to go from previousPosition to position
+	float alpha = 1.0f;
+	// Added to every position after blending, in libsm64 coordinates
+	float offset[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+void ConvertMarioVertices(const MarioVertexSource& source, MarioVertex* vertices);
+void ConvertMarioVerticesScalar(const MarioVertexSource& source, MarioVertex* vertices);
@@ -0,0 +1,179 @@
+// PackedVertices.cpp
+// A 20 byte vertex for meshes that are uploaded again every frame, like the marios.
+
+#include "PackedVertices.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PACKED_VERTICES_SSE
+#endif
+
+namespace
+{
+	// Rounds half away from zero like std::lround, without its call or a branch on the sign
+	inline int32_t roundToInt(float value)
+	{
+		return (int32_t)(value + std::copysign(0.5f, value));
+	}
+
+	inline int16_t toSnorm16(float value)
+	{
+		return (int16_t)roundToInt(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+	}
+
+	inline uint16_t toUnorm16(float value)
+	{
+		return (uint16_t)roundToInt(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f);
+	}
+
+	inline uint8_t toUnorm8(float value)
+	{
+		return (uint8_t)roundToInt(std::min(std::max(value, 0.0f), 1.0f) * 255.0f);
+	}
+
+	// As the input assembler reads them
+	inline float fromSnorm16(int16_t value)
+	{
+		return std::max(value / 32767.0f, -1.0f);
+	}
+
+	inline float signNotZero(float value)
+	{
+		return std::copysign(1.0f, value);
+	}
+}
+
+PackedVertexBounds PackedVertexBoundsOf(const MarioVertex* vertices, size_t count)
+{
+	PackedVertexBounds bounds;
+	if (count == 0) return bounds;
+
+	float min[3] = { vertices[0].pos[0], vertices[0].pos[1], vertices[0].pos[2] };
+	float max[3] = { min[0], min[1], min[2] };
+	for (size_t i = 1; i < count; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			min[k] = std::min(min[k], vertices[i].pos[k]);
+			max[k] = std::max(max[k], vertices[i].pos[k]);
+		}
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		bounds.origin[k] = (min[k] + max[k]) * 0.5f;
+		// Flat meshes still need a scale to divide by
+		bounds.scale[k] = std::max((max[k] - min[k]) * 0.5f, 1e-6f);
+	}
+	return bounds;
+}
+
+void PackVertices(const MarioVertex* vertices, size_t count, const PackedVertexBounds& bounds, PackedVertex* packed)
+{
+	const float inverseScale[3] = { 1.0f / bounds.scale[0], 1.0f / bounds.scale[1], 1.0f / bounds.scale[2] };
+#ifdef PACKED_VERTICES_SSE
+	// Rounds to nearest even rather than half away from zero, both are within half a step
+	const __m128 origin = _mm_setr_ps(bounds.origin[0], bounds.origin[1], bounds.origin[2], 0.0f);
+	// Zero in w, which drops the color that comes along with the position's load
+	const __m128 inverse = _mm_setr_ps(inverseScale[0], inverseScale[1], inverseScale[2], 0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128i unsignedBias = _mm_set1_epi32(32768);
+	const __m128i unsignedFlip = _mm_set1_epi16((short)0x8000);
+#endif
+	for (size_t i = 0; i < count; i++)
+	{
+		const MarioVertex& vertex = vertices[i];
+		// Built on the stack, packed may be write combined memory that is slow to read back
+		PackedVertex out;
+#ifdef PACKED_VERTICES_SSE
+		__m128 position = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(vertex.pos), origin), inverse);
+		position = _mm_mul_ps(_mm_min_ps(_mm_max_ps(position, minusOne), one), _mm_set1_ps(32767.0f));
+		const __m128i positionWords = _mm_cvtps_epi32(position);
+		_mm_storel_epi64((__m128i*)out.pos, _mm_packs_epi32(positionWords, positionWords));
+
+		__m128 color = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(vertex.color), zero), one);
+		const __m128i colorWords = _mm_cvtps_epi32(_mm_mul_ps(color, _mm_set1_ps(255.0f)));
+		const __m128i colorShorts = _mm_packs_epi32(colorWords, colorWords);
+		const int colorBytes = _mm_cvtsi128_si32(_mm_packus_epi16(colorShorts, colorShorts));
+		memcpy(out.color, &colorBytes, sizeof(out.color));
+
+		// packs only saturates signed, so the uvs go through it shifted down by half
+		__m128 uv = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)vertex.texCoord));
+		uv = _mm_mul_ps(_mm_min_ps(_mm_max_ps(uv, zero), one), _mm_set1_ps(65535.0f));
+		const __m128i uvWords = _mm_sub_epi32(_mm_cvtps_epi32(uv), unsignedBias);
+		const int uvShorts = _mm_cvtsi128_si32(_mm_xor_si128(_mm_packs_epi32(uvWords, uvWords), unsignedFlip));
+		memcpy(out.texCoord, &uvShorts, sizeof(out.texCoord));
+#else
+		for (int k = 0; k < 3; k++)
+		{
+			out.pos[k] = toSnorm16((vertex.pos[k] - bounds.origin[k]) * inverseScale[k]);
+		}
+		out.pos[3] = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			out.color[k] = toUnorm8(vertex.color[k]);
+		}
+		out.texCoord[0] = toUnorm16(vertex.texCoord[0]);
+		out.texCoord[1] = toUnorm16(vertex.texCoord[1]);
+#endif
+		EncodeOctahedral(vertex.normal, out.normal);
+		packed[i] = out;
+	}
+}
+
+void UnpackVertex(const PackedVertex& packed, const PackedVertexBounds& bounds, MarioVertex& vertex)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		vertex.pos[k] = bounds.origin[k] + fromSnorm16(packed.pos[k]) * bounds.scale[k];
+	}
+	for (int k = 0; k < 4; k++)
+	{
+		vertex.color[k] = packed.color[k] / 255.0f;
+	}
+	vertex.texCoord[0] = packed.texCoord[0] / 65535.0f;
+	vertex.texCoord[1] = packed.texCoord[1] / 65535.0f;
+
+	float normal[3];
+	DecodeOctahedral(packed.normal, normal);
+	const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	for (int k = 0; k < 3; k++)
+	{
+		vertex.normal[k] = normal[k] / length;
+	}
+}
+
+void EncodeOctahedral(const float normal[3], int16_t encoded[2])
+{
+	const float length = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+	if (length == 0.0f)
+	{
+		encoded[0] = 0;
+		encoded[1] = 0;
+		return;
+	}
+
+	const float u = normal[0] / length;
+	const float v = normal[1] / length;
+	// The lower half folds over the diagonals. Selected rather than branched on, normals point every which way.
+	const float foldedU = (1.0f - std::abs(v)) * signNotZero(u);
+	const float foldedV = (1.0f - std::abs(u)) * signNotZero(v);
+	const bool lower = normal[2] < 0.0f;
+	encoded[0] = toSnorm16(lower ? foldedU : u);
+	encoded[1] = toSnorm16(lower ? foldedV : v);
+}
+
+void DecodeOctahedral(const int16_t encoded[2], float normal[3])
+{
+	normal[0] = fromSnorm16(encoded[0]);
+	normal[1] = fromSnorm16(encoded[1]);
+	normal[2] = 1.0f - std::abs(normal[0]) - std::abs(normal[1]);
+	const float fold = std::max(-normal[2], 0.0f);
+	normal[0] += normal[0] >= 0.0f ? -fold : fold;
+	normal[1] += normal[1] >= 0.0f ? -fold : fold;
+}
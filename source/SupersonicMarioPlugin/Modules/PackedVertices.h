@@ -0,0 +1,41 @@
+#pragma once
+// PackedVertices.h
+// A 20 byte vertex for meshes that are uploaded again every frame, like the marios.
+//
+// A render vertex is 48 bytes of floats. Packed, the position is snorm16
+// relative to the mesh's bounds, the color rgba8, the uv unorm16 and the
+// normal an octahedral snorm16 pair, which the vertex shader's VSPacked
+// decodes again. Colors of exactly 0 and 1, which the pixel shader looks
+// for to tint the cap and shirt, come back exactly. UnpackVertex decodes
+// like the shader does, MarioVertexBench checks the error against the
+// float vertices with it.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "MarioVertices.h"
+
+// Matches VS_PackedInput in Graphics/shaders.h
+struct PackedVertex
+{
+	int16_t pos[4]; // xyz snorm16 in units of the bounds' scale from its origin, w unused
+	uint8_t color[4];
+	uint16_t texCoord[2];
+	int16_t normal[2]; // Octahedral
+};
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex must match the packed input layout");
+
+// Packed positions are origin + pos * scale, sent to the shader with the mesh's constants
+struct PackedVertexBounds
+{
+	float origin[3] = { 0.0f, 0.0f, 0.0f };
+	float scale[3] = { 1.0f, 1.0f, 1.0f };
+};
+
+PackedVertexBounds PackedVertexBoundsOf(const MarioVertex* vertices, size_t count);
+void PackVertices(const MarioVertex* vertices, size_t count, const PackedVertexBounds& bounds, PackedVertex* packed);
+void UnpackVertex(const PackedVertex& packed, const PackedVertexBounds& bounds, MarioVertex& vertex);
+
+void EncodeOctahedral(const float normal[3], int16_t encoded[2]);
+// Not normalized, like decodeOctahedral in the shader before it normalizes
+void DecodeOctahedral(const int16_t encoded[2], float normal[3]);
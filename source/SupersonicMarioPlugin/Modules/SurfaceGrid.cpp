@@ -0,0 +1,399 @@
+#include "pch.h"
+#include "SurfaceGrid.h"
+
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SURFACE_GRID_SSE
+#endif
+
+namespace
+{
+	// Same sign for all three edges, whichever way the triangle winds
+	inline bool insideTriangle(float pa, float pb, const float a[3], const float b[3])
+	{
+		const float e0 = (b[0] - pb) * (a[1] - a[0]) - (a[0] - pa) * (b[1] - b[0]);
+		const float e1 = (b[1] - pb) * (a[2] - a[1]) - (a[1] - pa) * (b[2] - b[1]);
+		const float e2 = (b[2] - pb) * (a[0] - a[2]) - (a[2] - pa) * (b[0] - b[2]);
+		return (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) || (e0 <= 0.0f && e1 <= 0.0f && e2 <= 0.0f);
+	}
+
+#ifdef SURFACE_GRID_SSE
+	inline __m128 edge(__m128 pa, __m128 pb, __m128 a0, __m128 b0, __m128 a1, __m128 b1)
+	{
+		return _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(b0, pb), _mm_sub_ps(a1, a0)), _mm_mul_ps(_mm_sub_ps(a0, pa), _mm_sub_ps(b1, b0)));
+	}
+
+	inline __m128 insideTriangle4(__m128 pa, __m128 pb, const float* a0, const float* a1, const float* a2,
+		const float* b0, const float* b1, const float* b2)
+	{
+		const __m128 va0 = _mm_loadu_ps(a0), va1 = _mm_loadu_ps(a1), va2 = _mm_loadu_ps(a2);
+		const __m128 vb0 = _mm_loadu_ps(b0), vb1 = _mm_loadu_ps(b1), vb2 = _mm_loadu_ps(b2);
+		const __m128 e0 = edge(pa, pb, va0, vb0, va1, vb1);
+		const __m128 e1 = edge(pa, pb, va1, vb1, va2, vb2);
+		const __m128 e2 = edge(pa, pb, va2, vb2, va0, vb0);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 positive = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+		const __m128 negative = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(e0, zero), _mm_cmple_ps(e1, zero)), _mm_cmple_ps(e2, zero));
+		return _mm_or_ps(positive, negative);
+	}
+#endif
+}
+
+void SurfaceGrid::SurfaceList::Clear()
+{
+	for (int k = 0; k < 3; k++)
+	{
+		x[k].clear();
+		y[k].clear();
+		z[k].clear();
+	}
+	nx.clear();
+	ny.clear();
+	nz.clear();
+	originOffset.clear();
+	minY.clear();
+	maxY.clear();
+	surface.clear();
+	cellStart.clear();
+}
+
+void SurfaceGrid::SurfaceList::Pad()
+{
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	while (surface.size() % 4 != 0)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			x[k].push_back(nan);
+			y[k].push_back(nan);
+			z[k].push_back(nan);
+		}
+		nx.push_back(nan);
+		ny.push_back(nan);
+		nz.push_back(nan);
+		originOffset.push_back(nan);
+		minY.push_back(nan);
+		maxY.push_back(nan);
+		surface.push_back(-1);
+	}
+}
+
+void SurfaceGrid::Clear()
+{
+	floors.Clear();
+	ceilings.Clear();
+	walls.Clear();
+	allFloors.Clear();
+	allWalls.Clear();
+	cellsX = 0;
+	cellsZ = 0;
+	surfaceCount = 0;
+	memset(bounds, 0, sizeof(bounds));
+}
+
+void SurfaceGrid::Build(const struct SM64Surface* surfaces, size_t count)
+{
+	Clear();
+	if (surfaces == nullptr || count == 0) return;
+
+	std::vector<Triangle> floorTriangles, ceilingTriangles, wallTriangles;
+	float maxX = -std::numeric_limits<float>::max();
+	float maxZ = -std::numeric_limits<float>::max();
+	minX = std::numeric_limits<float>::max();
+	minZ = std::numeric_limits<float>::max();
+	bounds[0][1] = std::numeric_limits<float>::max();
+	bounds[1][1] = -std::numeric_limits<float>::max();
+	for (size_t i = 0; i < count; i++)
+	{
+		Triangle triangle;
+		for (int k = 0; k < 3; k++)
+		{
+			triangle.x[k] = (float)surfaces[i].vertices[k][0];
+			triangle.y[k] = (float)surfaces[i].vertices[k][1];
+			triangle.z[k] = (float)surfaces[i].vertices[k][2];
+			minX = std::min(minX, triangle.x[k]);
+			maxX = std::max(maxX, triangle.x[k]);
+			minZ = std::min(minZ, triangle.z[k]);
+			maxZ = std::max(maxZ, triangle.z[k]);
+			bounds[0][1] = std::min(bounds[0][1], triangle.y[k]);
+			bounds[1][1] = std::max(bounds[1][1], triangle.y[k]);
+		}
+
+		// Normal and classification as SM64 loads them
+		const float nx = (triangle.y[1] - triangle.y[0]) * (triangle.z[2] - triangle.z[1]) - (triangle.z[1] - triangle.z[0]) * (triangle.y[2] - triangle.y[1]);
+		const float ny = (triangle.z[1] - triangle.z[0]) * (triangle.x[2] - triangle.x[1]) - (triangle.x[1] - triangle.x[0]) * (triangle.z[2] - triangle.z[1]);
+		const float nz = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[1]) - (triangle.y[1] - triangle.y[0]) * (triangle.x[2] - triangle.x[1]);
+		const float magnitude = std::sqrt(nx * nx + ny * ny + nz * nz);
+		if (magnitude < 0.0001f) continue;
+
+		triangle.nx = nx / magnitude;
+		triangle.ny = ny / magnitude;
+		triangle.nz = nz / magnitude;
+		triangle.originOffset = -(triangle.nx * triangle.x[0] + triangle.ny * triangle.y[0] + triangle.nz * triangle.z[0]);
+		triangle.surface = (int32_t)i;
+		if (triangle.ny > 0.01f)
+		{
+			floorTriangles.push_back(triangle);
+		}
+		else if (triangle.ny < -0.01f)
+		{
+			ceilingTriangles.push_back(triangle);
+		}
+		else
+		{
+			wallTriangles.push_back(triangle);
+		}
+	}
+	surfaceCount = count;
+	bounds[0][0] = minX;
+	bounds[0][2] = minZ;
+	bounds[1][0] = maxX;
+	bounds[1][2] = maxZ;
+
+	// Walls reach into the cells their largest query radius touches, so a query only ever looks at one cell
+	minX -= SURFACE_GRID_MAX_WALL_RADIUS;
+	minZ -= SURFACE_GRID_MAX_WALL_RADIUS;
+	maxX += SURFACE_GRID_MAX_WALL_RADIUS;
+	maxZ += SURFACE_GRID_MAX_WALL_RADIUS;
+	cellSize = std::max(SURFACE_GRID_CELL_SIZE, std::max(maxX - minX, maxZ - minZ) / SURFACE_GRID_MAX_CELLS);
+	cellsX = std::max(1, (int)std::ceil((maxX - minX) / cellSize));
+	cellsZ = std::max(1, (int)std::ceil((maxZ - minZ) / cellSize));
+
+	buildList(floorTriangles, 0.0f, floors, &allFloors);
+	buildList(ceilingTriangles, 0.0f, ceilings, nullptr);
+	buildList(wallTriangles, SURFACE_GRID_MAX_WALL_RADIUS, walls, &allWalls);
+}
+
+void SurfaceGrid::buildList(const std::vector<Triangle>& triangles, float margin, SurfaceList& grid, SurfaceList* all)
+{
+	const auto push = [](SurfaceList& list, const Triangle& triangle) {
+		for (int k = 0; k < 3; k++)
+		{
+			list.x[k].push_back(triangle.x[k]);
+			list.y[k].push_back(triangle.y[k]);
+			list.z[k].push_back(triangle.z[k]);
+		}
+		list.nx.push_back(triangle.nx);
+		list.ny.push_back(triangle.ny);
+		list.nz.push_back(triangle.nz);
+		list.originOffset.push_back(triangle.originOffset);
+		// SM64 lets walls reach 5 units past their vertices
+		list.minY.push_back(std::min({ triangle.y[0], triangle.y[1], triangle.y[2] }) - 5.0f);
+		list.maxY.push_back(std::max({ triangle.y[0], triangle.y[1], triangle.y[2] }) + 5.0f);
+		list.surface.push_back(triangle.surface);
+	};
+
+	std::vector<std::vector<uint32_t>> cellTriangles((size_t)cellsX * cellsZ);
+	for (uint32_t i = 0; i < triangles.size(); i++)
+	{
+		const Triangle& triangle = triangles[i];
+		const float lowX = std::min({ triangle.x[0], triangle.x[1], triangle.x[2] }) - margin;
+		const float highX = std::max({ triangle.x[0], triangle.x[1], triangle.x[2] }) + margin;
+		const float lowZ = std::min({ triangle.z[0], triangle.z[1], triangle.z[2] }) - margin;
+		const float highZ = std::max({ triangle.z[0], triangle.z[1], triangle.z[2] }) + margin;
+		const int cellX0 = std::clamp((int)((lowX - minX) / cellSize), 0, cellsX - 1);
+		const int cellX1 = std::clamp((int)((highX - minX) / cellSize), 0, cellsX - 1);
+		const int cellZ0 = std::clamp((int)((lowZ - minZ) / cellSize), 0, cellsZ - 1);
+		const int cellZ1 = std::clamp((int)((highZ - minZ) / cellSize), 0, cellsZ - 1);
+		for (int cellZ = cellZ0; cellZ <= cellZ1; cellZ++)
+		{
+			for (int cellX = cellX0; cellX <= cellX1; cellX++)
+			{
+				cellTriangles[(size_t)cellZ * cellsX + cellX].push_back(i);
+			}
+		}
+	}
+
+	for (const std::vector<uint32_t>& cell : cellTriangles)
+	{
+		grid.cellStart.push_back((uint32_t)grid.surface.size());
+		for (uint32_t i : cell)
+		{
+			push(grid, triangles[i]);
+		}
+		grid.Pad();
+	}
+	grid.cellStart.push_back((uint32_t)grid.surface.size());
+
+	if (all == nullptr) return;
+
+	all->cellStart.push_back(0);
+	for (const Triangle& triangle : triangles)
+	{
+		push(*all, triangle);
+	}
+	all->Pad();
+	all->cellStart.push_back((uint32_t)all->surface.size());
+}
+
+void SurfaceGrid::Bounds(float low[3], float high[3]) const
+{
+	for (int k = 0; k < 3; k++)
+	{
+		low[k] = bounds[0][k];
+		high[k] = bounds[1][k];
+	}
+}
+
+bool SurfaceGrid::cellAt(float x, float z, int* cellX, int* cellZ) const
+{
+	if (cellsX == 0 || x < minX || z < minZ) return false;
+
+	*cellX = (int)((x - minX) / cellSize);
+	*cellZ = (int)((z - minZ) / cellSize);
+	return *cellX < cellsX && *cellZ < cellsZ;
+}
+
+int32_t SurfaceGrid::findPlane(const SurfaceList& list, uint32_t cell, float x, float y, float z, bool floor, float* height) const
+{
+	const uint32_t begin = list.cellStart[cell];
+	const uint32_t end = list.cellStart[cell + 1];
+	float best = floor ? -std::numeric_limits<float>::max() : std::numeric_limits<float>::max();
+	int32_t bestSurface = -1;
+
+#ifdef SURFACE_GRID_SSE
+	const __m128 px = _mm_set1_ps(x);
+	const __m128 pz = _mm_set1_ps(z);
+	const __m128 limit = _mm_set1_ps(floor ? y + SURFACE_GRID_FLOOR_OFFSET : y - SURFACE_GRID_FLOOR_OFFSET);
+	for (uint32_t i = begin; i < end; i += 4)
+	{
+		const __m128 inside = insideTriangle4(px, pz, &list.x[0][i], &list.x[1][i], &list.x[2][i],
+			&list.z[0][i], &list.z[1][i], &list.z[2][i]);
+		if (_mm_movemask_ps(inside) == 0) continue;
+
+		// Height of the plane at (x, z)
+		const __m128 planeHeight = _mm_div_ps(
+			_mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_loadu_ps(&list.nx[i])),
+				_mm_mul_ps(pz, _mm_loadu_ps(&list.nz[i]))), _mm_loadu_ps(&list.originOffset[i]))),
+			_mm_loadu_ps(&list.ny[i]));
+		const __m128 inReach = floor ? _mm_cmple_ps(planeHeight, limit) : _mm_cmpge_ps(planeHeight, limit);
+		int mask = _mm_movemask_ps(_mm_and_ps(inside, inReach));
+		if (mask == 0) continue;
+
+		float heights[4];
+		_mm_storeu_ps(heights, planeHeight);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if ((mask & (1 << lane)) != 0 && (floor ? heights[lane] > best : heights[lane] < best))
+			{
+				best = heights[lane];
+				bestSurface = list.surface[i + lane];
+			}
+		}
+	}
+#else
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const float a[3] = { list.x[0][i], list.x[1][i], list.x[2][i] };
+		const float b[3] = { list.z[0][i], list.z[1][i], list.z[2][i] };
+		if (!insideTriangle(x, z, a, b)) continue;
+
+		const float planeHeight = -(x * list.nx[i] + z * list.nz[i] + list.originOffset[i]) / list.ny[i];
+		const bool inReach = floor ? planeHeight <= y + SURFACE_GRID_FLOOR_OFFSET : planeHeight >= y - SURFACE_GRID_FLOOR_OFFSET;
+		if (inReach && (floor ? planeHeight > best : planeHeight < best))
+		{
+			best = planeHeight;
+			bestSurface = list.surface[i];
+		}
+	}
+#endif
+
+	if (bestSurface >= 0 && height != nullptr)
+	{
+		*height = best;
+	}
+	return bestSurface;
+}
+
+int SurfaceGrid::findWalls(const SurfaceList& list, uint32_t cell, float x, float y, float z, float radius, int32_t* found,
+	int foundCount, int maxWalls) const
+{
+	const uint32_t begin = list.cellStart[cell];
+	const uint32_t end = list.cellStart[cell + 1];
+	// Walls facing along x are tested in the y/z plane, the others in the x/y plane
+	const auto inside = [&](uint32_t i) {
+		const bool projectX = std::abs(list.nx[i]) > 0.707f;
+		const float a[3] = { projectX ? list.z[0][i] : list.x[0][i], projectX ? list.z[1][i] : list.x[1][i], projectX ? list.z[2][i] : list.x[2][i] };
+		const float b[3] = { list.y[0][i], list.y[1][i], list.y[2][i] };
+		return insideTriangle(projectX ? z : x, y, a, b);
+	};
+
+#ifdef SURFACE_GRID_SSE
+	const __m128 px = _mm_set1_ps(x);
+	const __m128 py = _mm_set1_ps(y);
+	const __m128 pz = _mm_set1_ps(z);
+	const __m128 reach = _mm_set1_ps(radius);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	for (uint32_t i = begin; i < end && foundCount < maxWalls; i += 4)
+	{
+		// Cheap rejections for all four first, the point has to be in the wall's height and within radius of its plane
+		const __m128 inHeight = _mm_and_ps(_mm_cmpge_ps(py, _mm_loadu_ps(&list.minY[i])), _mm_cmple_ps(py, _mm_loadu_ps(&list.maxY[i])));
+		const __m128 offset = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_loadu_ps(&list.nx[i])), _mm_mul_ps(py, _mm_loadu_ps(&list.ny[i]))),
+			_mm_add_ps(_mm_mul_ps(pz, _mm_loadu_ps(&list.nz[i])), _mm_loadu_ps(&list.originOffset[i])));
+		const __m128 nearPlane = _mm_cmple_ps(_mm_andnot_ps(signMask, offset), reach);
+		int mask = _mm_movemask_ps(_mm_and_ps(inHeight, nearPlane));
+		for (int lane = 0; lane < 4 && mask != 0 && foundCount < maxWalls; lane++)
+		{
+			if ((mask & (1 << lane)) != 0 && inside(i + lane))
+			{
+				found[foundCount++] = list.surface[i + lane];
+			}
+		}
+	}
+#else
+	for (uint32_t i = begin; i < end && foundCount < maxWalls; i++)
+	{
+		if (y < list.minY[i] || y > list.maxY[i]) continue;
+
+		const float offset = x * list.nx[i] + y * list.ny[i] + z * list.nz[i] + list.originOffset[i];
+		if (std::abs(offset) > radius || !inside(i)) continue;
+
+		found[foundCount++] = list.surface[i];
+	}
+#endif
+
+	return foundCount;
+}
+
+int32_t SurfaceGrid::FindFloor(float x, float y, float z, float* height) const
+{
+	int cellX, cellZ;
+	if (!cellAt(x, z, &cellX, &cellZ)) return -1;
+
+	return findPlane(floors, (uint32_t)(cellZ * cellsX + cellX), x, y, z, true, height);
+}
+
+int32_t SurfaceGrid::FindCeiling(float x, float y, float z, float* height) const
+{
+	int cellX, cellZ;
+	if (!cellAt(x, z, &cellX, &cellZ)) return -1;
+
+	return findPlane(ceilings, (uint32_t)(cellZ * cellsX + cellX), x, y, z, false, height);
+}
+
+int SurfaceGrid::FindWalls(float x, float y, float z, float radius, int32_t* found, int maxWalls) const
+{
+	int cellX, cellZ;
+	if (!cellAt(x, z, &cellX, &cellZ)) return 0;
+
+	radius = std::min(radius, SURFACE_GRID_MAX_WALL_RADIUS);
+	return findWalls(walls, (uint32_t)(cellZ * cellsX + cellX), x, y, z, radius, found, 0, maxWalls);
+}
+
+int32_t SurfaceGrid::FindFloorScan(float x, float y, float z, float* height) const
+{
+	if (allFloors.cellStart.empty()) return -1;
+
+	return findPlane(allFloors, 0, x, y, z, true, height);
+}
+
+int SurfaceGrid::FindWallsScan(float x, float y, float z, float radius, int32_t* found, int maxWalls) const
+{
+	if (allWalls.cellStart.empty()) return 0;
+
+	radius = std::min(radius, SURFACE_GRID_MAX_WALL_RADIUS);
+	return findWalls(allWalls, 0, x, y, z, radius, found, 0, maxWalls);
+}
@@ -0,0 +1,83 @@
+#pragma once
+// SurfaceGrid.h
+// Uniform grid over the static collision surfaces for floor, ceiling and wall queries.
+//
+// Surfaces are split into floors, ceilings and walls the way SM64 does and
+// put in every cell their X/Z bounds touch. Every cell keeps its triangles
+// as structure of arrays padded to a multiple of four, so the queries test
+// four triangles per SSE instruction. The padding is NaN, which fails every
+// comparison.
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+	#include "libsm64.h"
+}
+
+#define SURFACE_GRID_CELL_SIZE 512.0f
+#define SURFACE_GRID_MAX_CELLS 256        // Per axis, cells grow on larger maps
+#define SURFACE_GRID_FLOOR_OFFSET 78.0f   // Floors this far above the point still count, like SM64's find_floor
+#define SURFACE_GRID_MAX_WALL_RADIUS 200.0f
+
+class SurfaceGrid
+{
+public:
+	void Build(const struct SM64Surface* surfaces, size_t count);
+	void Clear();
+
+	// Highest floor under the point, like libsm64's find_floor. Returns the surface index or -1.
+	int32_t FindFloor(float x, float y, float z, float* height) const;
+	// Lowest ceiling over the point. Returns the surface index or -1.
+	int32_t FindCeiling(float x, float y, float z, float* height) const;
+	// Walls closer than radius to the point, at most maxWalls of them. Returns how many.
+	int FindWalls(float x, float y, float z, float radius, int32_t* walls, int maxWalls) const;
+
+	// The same queries testing every surface, to check and time the grid against
+	int32_t FindFloorScan(float x, float y, float z, float* height) const;
+	int FindWallsScan(float x, float y, float z, float radius, int32_t* walls, int maxWalls) const;
+
+	// Corners of the box around every surface, x/y/z
+	void Bounds(float low[3], float high[3]) const;
+	size_t Surfaces() const { return surfaceCount; }
+	size_t Cells() const { return (size_t)cellsX * cellsZ; }
+	bool Empty() const { return surfaceCount == 0; }
+
+private:
+	// Triangles of one kind, cell i's are [cellStart[i], cellStart[i + 1])
+	struct SurfaceList
+	{
+		std::vector<float> x[3], y[3], z[3];
+		std::vector<float> nx, ny, nz, originOffset;
+		std::vector<float> minY, maxY;
+		std::vector<int32_t> surface;
+		std::vector<uint32_t> cellStart;
+
+		void Clear();
+		void Pad();
+	};
+	struct Triangle
+	{
+		float x[3], y[3], z[3];
+		float nx, ny, nz, originOffset;
+		int32_t surface;
+	};
+
+	// Cells get every triangle whose x/z bounds grown by margin touch them, all gets them once if given
+	void buildList(const std::vector<Triangle>& triangles, float margin, SurfaceList& grid, SurfaceList* all);
+	int32_t findPlane(const SurfaceList& list, uint32_t cell, float x, float y, float z, bool floor, float* height) const;
+	int findWalls(const SurfaceList& list, uint32_t cell, float x, float y, float z, float radius, int32_t* walls,
+		int found, int maxWalls) const;
+	bool cellAt(float x, float z, int* cellX, int* cellZ) const;
+
+	SurfaceList floors, ceilings, walls;
+	// One cell holding everything, for the scans
+	SurfaceList allFloors, allWalls;
+	float minX = 0.0f;
+	float minZ = 0.0f;
+	float bounds[2][3] = {};
+	float cellSize = SURFACE_GRID_CELL_SIZE;
+	int cellsX = 0;
+	int cellsZ = 0;
+	size_t surfaceCount = 0;
+};
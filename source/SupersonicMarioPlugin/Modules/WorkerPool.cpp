@@ -0,0 +1,91 @@
+// WorkerPool.cpp
+// Fixed set of worker threads for splitting work within a single frame.
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(size_t workerCount)
+{
+	for (size_t i = 0; i < workerCount; i++)
+	{
+		threads.emplace_back(&WorkerPool::workerLoop, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& job)
+{
+	if (threads.empty() || count <= 1)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			job(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &job;
+		jobCount = count;
+		nextIndex = 0;
+		generation++;
+	}
+	wake.notify_all();
+
+	runJobs(job, count);
+
+	// Every index is taken by now, wait for the workers still running one. Workers that wake up after this see no job.
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return busyWorkers == 0; });
+	currentJob = nullptr;
+}
+
+void WorkerPool::runJobs(const std::function<void(size_t)>& job, size_t count)
+{
+	for (size_t i = nextIndex++; i < count; i = nextIndex++)
+	{
+		job(i);
+	}
+}
+
+void WorkerPool::workerLoop()
+{
+	uint64_t seenGeneration = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		wake.wait(lock, [this, &seenGeneration]() { return stopping || generation != seenGeneration; });
+		if (stopping)
+		{
+			return;
+		}
+		seenGeneration = generation;
+		if (currentJob == nullptr)
+		{
+			continue;
+		}
+
+		const std::function<void(size_t)>& job = *currentJob;
+		const size_t count = jobCount;
+		busyWorkers++;
+		lock.unlock();
+		runJobs(job, count);
+		lock.lock();
+		if (--busyWorkers == 0)
+		{
+			finished.notify_all();
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+// WorkerPool.h
+// Fixed set of worker threads for splitting work within a single frame.
+//
+// ParallelFor hands out indices to the workers and to the calling thread,
+// which works along instead of sleeping, and returns once every index has
+// been handled. Workers sleep on a condition variable between calls, so an
+// idle pool costs nothing.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+public:
+	// Threads besides the calling one, 0 runs everything on the caller
+	explicit WorkerPool(size_t workerCount);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Calls job(i) for every i below count and returns once all of them returned. One ParallelFor at a time.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+	size_t Workers() const { return threads.size(); }
+
+private:
+	void workerLoop();
+	void runJobs(const std::function<void(size_t)>& job, size_t count);
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	// Guarded by mutex, except the indices which workers take without it
+	const std::function<void(size_t)>* currentJob = nullptr;
+	size_t jobCount = 0;
+	uint64_t generation = 0;
+	size_t busyWorkers = 0;
+	bool stopping = false;
+	std::atomic<size_t> nextIndex = 0;
+};
@@ -0,0 +1,26 @@
+// BodyStateRecording.cpp
+// Snapshot codec fields of a mario's body state, and the file format body states are recorded in.
+
+#include "BodyStateRecording.h"
+
+std::vector<SnapshotQuantizedField> BodyStateQuantizedFields(const BodyStateLayout& layout)
+{
+    return {
+        // libsm64 velocities are per frame and marios tick once per snapshot
+        { layout.positionOffset, 3, BODY_STATE_POSITION_SCALE, (int32_t)layout.velocityOffset },
+        { layout.velocityOffset, 3, BODY_STATE_VELOCITY_SCALE },
+        { layout.faceAngleOffset, 1, BODY_STATE_ANGLE_SCALE },
+    };
+}
+
+bool BodyStateLayoutValid(const BodyStateLayout& layout)
+{
+    for (const SnapshotQuantizedField& field : BodyStateQuantizedFields(layout))
+    {
+        if (field.offset % sizeof(float) != 0 || (uint64_t)field.offset + field.count * sizeof(float) > layout.size)
+        {
+            return false;
+        }
+    }
+    return layout.size > 0;
+}
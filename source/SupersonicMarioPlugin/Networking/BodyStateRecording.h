@@ -0,0 +1,42 @@
+#pragma once
+// BodyStateRecording.h
+// Snapshot codec fields of a mario's body state, and the file format body states are recorded in.
+//
+// The codec only needs to know where a SM64MarioBodyState keeps the
+// fields it quantizes. The plugin fills a BodyStateLayout from libsm64's
+// header, and a recording starts with that layout, so tools that don't
+// include libsm64, like SnapshotCodecBench, encode recorded body states
+// exactly the way the plugin does.
+//
+// A recording is a BodyStateRecordingHeader followed by records of a
+// uint64_t millisecond timestamp, an int32_t player id and the body state.
+
+#include <cstdint>
+#include <vector>
+
+#include "SnapshotCodec.h"
+
+#define BODY_STATE_RECORDING_MAGIC 0x32424D53 // "SMB2", "SMBS" recordings had no layout
+// Fixed point steps per unit for quantized body state fields
+#define BODY_STATE_POSITION_SCALE 8.0f
+#define BODY_STATE_VELOCITY_SCALE 64.0f
+#define BODY_STATE_ANGLE_SCALE 4096.0f
+
+struct BodyStateLayout
+{
+    uint32_t size = 0;
+    uint32_t positionOffset = 0; // float[3]
+    uint32_t velocityOffset = 0; // float[3]
+    uint32_t faceAngleOffset = 0; // float
+};
+
+struct BodyStateRecordingHeader
+{
+    uint32_t magic = BODY_STATE_RECORDING_MAGIC;
+    BodyStateLayout layout;
+};
+
+// Everything not listed is still delta encoded, just losslessly
+std::vector<SnapshotQuantizedField> BodyStateQuantizedFields(const BodyStateLayout& layout);
+// Whether every field lies within the body state
+bool BodyStateLayoutValid(const BodyStateLayout& layout);
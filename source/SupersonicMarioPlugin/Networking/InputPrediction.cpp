@@ -0,0 +1,239 @@
+// InputPrediction.cpp
+// Sequenced inputs for client side prediction with host reconciliation.
+
+#include "InputPrediction.h"
+
+#include <algorithm>
+#include <cmath>
+
+InputPredictor::InputPredictor(size_t inputSize, size_t stateSize, uint32_t positionOffset)
+    : InputPredictor(inputSize, stateSize, positionOffset, Config())
+{
+}
+
+InputPredictor::InputPredictor(size_t inputSize, size_t stateSize, uint32_t positionOffset, Config config)
+    : inputSize(inputSize), stateSize(stateSize), positionOffset(positionOffset), config(config)
+{
+    for (Entry& e : history)
+    {
+        e.input.resize(inputSize);
+        e.state.resize(stateSize);
+    }
+}
+
+uint32_t InputPredictor::Record(const void* input, const void* predictedState)
+{
+    const uint32_t sequence = nextSequence++;
+    Entry& e = entry(sequence);
+    e.sequence = sequence;
+    memcpy(e.input.data(), input, inputSize);
+    memcpy(e.state.data(), predictedState, stateSize);
+    stats.predictedInputs++;
+    return sequence;
+}
+
+size_t InputPredictor::UnackedInputs(size_t maxInputs, void* out, uint32_t* firstSequence) const
+{
+    const uint32_t last = LastSequence();
+    const uint32_t unacked = last - ackedSequence;
+    const size_t count = std::min<size_t>({ maxInputs, unacked, PREDICTION_HISTORY_SIZE });
+    const uint32_t first = last - (uint32_t)count + 1;
+
+    uint8_t* outBytes = static_cast<uint8_t*>(out);
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(outBytes + i * inputSize, entry(first + (uint32_t)i).input.data(), inputSize);
+    }
+    *firstSequence = first;
+    return count;
+}
+
+bool InputPredictor::Reconcile(uint32_t ackSequence, const void* state, double nowMs, const RestoreFn& restore, const StepFn& step)
+{
+    if (ackSequence <= ackedSequence)
+    {
+        return false;
+    }
+    stats.acks++;
+
+    const uint32_t last = LastSequence();
+    float authoritative[3];
+    position(state, authoritative);
+
+    // Nothing to compare against when the host is further along than we remember, just take its state
+    const bool known = ackSequence <= last && entry(ackSequence).sequence == ackSequence;
+    if (known)
+    {
+        float predicted[3];
+        position(entry(ackSequence).state.data(), predicted);
+        const float error = std::hypot(predicted[0] - authoritative[0], predicted[1] - authoritative[1],
+            predicted[2] - authoritative[2]);
+        if (error <= config.tolerance)
+        {
+            ackedSequence = ackSequence;
+            return false;
+        }
+        stats.lastError = error;
+        stats.maxError = std::max(stats.maxError, error);
+    }
+    else
+    {
+        stats.lostHistory++;
+    }
+
+    float before[3];
+    if (last > 0 && entry(last).sequence == last)
+    {
+        position(entry(last).state.data(), before);
+    }
+    else
+    {
+        memcpy(before, authoritative, sizeof(before));
+    }
+
+    // Rewind to the host's state and run the inputs it hasn't applied yet on top of it again
+    restore(state);
+    float after[3];
+    memcpy(after, authoritative, sizeof(after));
+    if (known)
+    {
+        for (uint32_t sequence = ackSequence + 1; sequence <= last; sequence++)
+        {
+            Entry& e = entry(sequence);
+            step(e.input.data(), e.state.data());
+            stats.replayedInputs++;
+        }
+        if (last > ackSequence)
+        {
+            position(entry(last).state.data(), after);
+        }
+        ackedSequence = ackSequence;
+    }
+    else
+    {
+        // The inputs in between are gone, continue from the host's state as if they were all applied
+        ackedSequence = std::max(ackSequence, last);
+        nextSequence = ackedSequence + 1;
+    }
+
+    // Keep drawing where we were and fade out the difference, on top of what is left of the last correction
+    float remaining[3];
+    SmoothingOffset(nowMs, remaining);
+    for (int i = 0; i < 3; i++)
+    {
+        correction[i] = remaining[i] + before[i] - after[i];
+    }
+    correctionMs = nowMs;
+    stats.corrections++;
+    return true;
+}
+
+void InputPredictor::SmoothingOffset(double nowMs, float offset[3]) const
+{
+    const double elapsed = nowMs - correctionMs;
+    const float weight = config.smoothingMs > 0.0 ? (float)std::clamp(1.0 - elapsed / config.smoothingMs, 0.0, 1.0) : 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        offset[i] = correction[i] * weight;
+    }
+}
+
+void InputPredictor::Reset()
+{
+    for (Entry& e : history)
+    {
+        e.sequence = 0;
+    }
+    nextSequence = 1;
+    ackedSequence = 0;
+    memset(correction, 0, sizeof(correction));
+    correctionMs = 0.0;
+    stats = Stats();
+}
+
+void InputPredictor::position(const void* state, float out[3]) const
+{
+    memcpy(out, static_cast<const uint8_t*>(state) + positionOffset, 3 * sizeof(float));
+}
+
+InputSequencer::InputSequencer(size_t inputSize)
+    : inputSize(inputSize)
+{
+    for (Slot& slot : slots)
+    {
+        slot.input.resize(inputSize);
+    }
+}
+
+void InputSequencer::Start(uint32_t processedSequence)
+{
+    started = true;
+    processed = processedSequence;
+    newest = std::max(newest, processed);
+}
+
+size_t InputSequencer::Push(uint32_t firstSequence, const void* inputs, size_t count)
+{
+    size_t added = 0;
+    const uint8_t* inputBytes = static_cast<const uint8_t*>(inputs);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint32_t sequence = firstSequence + (uint32_t)i;
+        Slot& slot = slots[sequence % INPUT_SEQUENCER_MAX_QUEUED];
+        if (sequence <= processed || slot.sequence == sequence)
+        {
+            stats.duplicates++;
+            continue;
+        }
+        // Before the simulation has started only the newest inputs matter
+        if (started && sequence - processed > INPUT_SEQUENCER_MAX_QUEUED)
+        {
+            stats.overflows++;
+            continue;
+        }
+
+        slot.sequence = sequence;
+        memcpy(slot.input.data(), inputBytes + i * inputSize, inputSize);
+        newest = std::max(newest, sequence);
+        stats.received++;
+        added++;
+    }
+    return added;
+}
+
+bool InputSequencer::Next(void* input)
+{
+    const uint32_t sequence = processed + 1;
+    const Slot& slot = slots[sequence % INPUT_SEQUENCER_MAX_QUEUED];
+    if (!started || slot.sequence != sequence)
+    {
+        stats.stalls += started ? 1 : 0;
+        return false;
+    }
+
+    memcpy(input, slot.input.data(), inputSize);
+    processed = sequence;
+    return true;
+}
+
+size_t InputSequencer::Queued() const
+{
+    size_t queued = 0;
+    for (const Slot& slot : slots)
+    {
+        queued += slot.sequence > processed ? 1 : 0;
+    }
+    return queued;
+}
+
+void InputSequencer::Reset()
+{
+    for (Slot& slot : slots)
+    {
+        slot.sequence = 0;
+    }
+    started = false;
+    processed = 0;
+    newest = 0;
+    stats = Stats();
+}
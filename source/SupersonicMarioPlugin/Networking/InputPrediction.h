@@ -0,0 +1,137 @@
+#pragma once
+// InputPrediction.h
+// Sequenced inputs for client side prediction with host reconciliation.
+//
+// The client simulates its own player immediately and records every input
+// it simulated, numbered, together with the state it predicted. The inputs
+// are sent to the host, which simulates them in order and sends back its
+// authoritative state along with the sequence of the last input it applied.
+// When that state differs from what the client predicted for the same input,
+// the client restores the host's state and replays every input the host had
+// not seen yet, so it ends up where the host will be once those inputs
+// arrive. The jump between the old and the new prediction is handed out as
+// an offset that fades over smoothingMs, to draw instead of snapping.
+//
+// Inputs and states are opaque fixed-size structs, like SnapshotCodec
+// snapshots. The simulation itself is passed in as restore and step
+// callbacks, so any simulation can be reconciled, a headless one included.
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#define PREDICTION_HISTORY_SIZE 128 // Inputs kept for replay, about 4 s of 30 Hz game frames
+#define PREDICTION_MAX_SENT_INPUTS 8 // Unacked inputs repeated in every input message, to ride out packet loss
+#define PREDICTION_DEFAULT_TOLERANCE 4.0f
+#define PREDICTION_DEFAULT_SMOOTHING_MS 150.0
+#define INPUT_SEQUENCER_MAX_QUEUED 64
+
+class InputPredictor
+{
+public:
+    struct Config
+    {
+        float tolerance = PREDICTION_DEFAULT_TOLERANCE; // Position error that is corrected rather than ignored
+        double smoothingMs = PREDICTION_DEFAULT_SMOOTHING_MS;
+    };
+
+    struct Stats
+    {
+        uint64_t predictedInputs = 0;
+        uint64_t acks = 0;
+        uint64_t corrections = 0;
+        uint64_t replayedInputs = 0;
+        uint64_t lostHistory = 0; // Acks for inputs that already fell out of the history
+        float lastError = 0.0f;   // Position error of the last correction
+        float maxError = 0.0f;
+    };
+
+    // Puts the simulation into an authoritative state
+    using RestoreFn = std::function<void(const void* state)>;
+    // Simulates one input from the current state and writes the resulting state
+    using StepFn = std::function<void(const void* input, void* stateOut)>;
+
+    InputPredictor(size_t inputSize, size_t stateSize, uint32_t positionOffset);
+    InputPredictor(size_t inputSize, size_t stateSize, uint32_t positionOffset, Config config);
+
+    // Records an input that was just simulated and the state it led to. Returns its sequence, starting at 1.
+    uint32_t Record(const void* input, const void* predictedState);
+    // Copies up to maxInputs of the newest unacked inputs into out, oldest first. Returns how many were copied.
+    size_t UnackedInputs(size_t maxInputs, void* out, uint32_t* firstSequence) const;
+    // Handles the host's state after it applied input ackSequence. Returns true if the prediction was corrected.
+    bool Reconcile(uint32_t ackSequence, const void* state, double nowMs, const RestoreFn& restore, const StepFn& step);
+    // Offset to draw the player at, relative to its simulated position
+    void SmoothingOffset(double nowMs, float offset[3]) const;
+    void Reset();
+
+    uint32_t LastSequence() const { return nextSequence - 1; }
+    uint32_t AckedSequence() const { return ackedSequence; }
+    Config& GetConfig() { return config; }
+    const Stats& GetStats() const { return stats; }
+
+private:
+    struct Entry
+    {
+        uint32_t sequence = 0;
+        std::vector<uint8_t> input;
+        std::vector<uint8_t> state;
+    };
+
+    Entry& entry(uint32_t sequence) { return history[sequence % PREDICTION_HISTORY_SIZE]; }
+    const Entry& entry(uint32_t sequence) const { return history[sequence % PREDICTION_HISTORY_SIZE]; }
+    void position(const void* state, float out[3]) const;
+
+    size_t inputSize;
+    size_t stateSize;
+    uint32_t positionOffset;
+    Config config;
+    Stats stats;
+    Entry history[PREDICTION_HISTORY_SIZE];
+    uint32_t nextSequence = 1;
+    uint32_t ackedSequence = 0;
+    float correction[3] = {};
+    double correctionMs = 0.0;
+};
+
+class InputSequencer
+{
+public:
+    struct Stats
+    {
+        uint64_t received = 0;
+        uint64_t duplicates = 0;
+        uint64_t stalls = 0;    // Times the next input hadn't arrived when it was needed
+        uint64_t overflows = 0; // Inputs dropped because too many were queued
+    };
+
+    explicit InputSequencer(size_t inputSize);
+
+    // Simulation starts after input processed, from the client's own state at that input
+    void Start(uint32_t processed);
+    // Adds count consecutive inputs starting at firstSequence. Returns how many of them were new.
+    size_t Push(uint32_t firstSequence, const void* inputs, size_t count);
+    // Takes the input after the last processed one. Returns false if it hasn't arrived yet.
+    bool Next(void* input);
+    void Reset();
+
+    bool Started() const { return started; }
+    uint32_t Processed() const { return processed; }
+    uint32_t Newest() const { return newest; }
+    size_t Queued() const;
+    const Stats& GetStats() const { return stats; }
+
+private:
+    struct Slot
+    {
+        uint32_t sequence = 0;
+        std::vector<uint8_t> input;
+    };
+
+    size_t inputSize;
+    Stats stats;
+    Slot slots[INPUT_SEQUENCER_MAX_QUEUED];
+    bool started = false;
+    uint32_t processed = 0;
+    uint32_t newest = 0;
+};
@@ -0,0 +1,194 @@
+#pragma once
+// LockFreeQueues.h
+// Lock-free handoff from the network threads to the render thread.
+//
+// TripleBuffer passes the newest value of something from one producer to one
+// consumer, neither side ever waits and values nobody picked up in time are
+// simply replaced. SpscRing is a bounded queue for one producer and one
+// consumer, for streams where every value matters. MpscQueue is a bounded
+// queue any number of producers can push to, drained by a single consumer.
+//
+// "One producer" means one at a time: producers serialized by a lock of their
+// own still count as one, as long as the consumer never takes that lock.
+// Nothing here allocates after construction, full queues reject the push.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#define LOCK_FREE_CACHE_LINE 64
+
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Producer: the value to fill in, handed over by Publish()
+    T& Back() { return buffers[back]; }
+    void Publish()
+    {
+        back = middle.exchange(back | DIRTY, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Consumer: swaps in the newest published value. Returns false if nothing new was published since the last call.
+    bool Update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & DIRTY) == 0)
+        {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    const T& Front() const { return buffers[front]; }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t DIRTY = 0x4;
+
+    T buffers[3] = {};
+    uint8_t back = 0;
+    alignas(LOCK_FREE_CACHE_LINE) std::atomic<uint8_t> middle = 1;
+    alignas(LOCK_FREE_CACHE_LINE) uint8_t front = 2;
+};
+
+template <typename T>
+class SpscRing
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscRing(size_t minCapacity)
+    {
+        while (capacity < minCapacity)
+        {
+            capacity <<= 1;
+        }
+        slots = std::make_unique<T[]>(capacity);
+    }
+
+    bool TryPush(const T& value)
+    {
+        const size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - cachedHead == capacity)
+        {
+            cachedHead = headIndex.load(std::memory_order_acquire);
+            if (tail - cachedHead == capacity)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        slots[tail & (capacity - 1)] = value;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& value)
+    {
+        const size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == cachedTail)
+        {
+            cachedTail = tailIndex.load(std::memory_order_acquire);
+            if (head == cachedTail)
+            {
+                return false;
+            }
+        }
+        value = slots[head & (capacity - 1)];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Capacity() const { return capacity; }
+    // Pushes rejected because the consumer fell behind
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    size_t capacity = 1;
+    std::unique_ptr<T[]> slots;
+    // Each side caches the other's index, so it only touches the other side's cache line when it looks full or empty
+    alignas(LOCK_FREE_CACHE_LINE) std::atomic<size_t> tailIndex = 0;
+    size_t cachedHead = 0;
+    std::atomic<uint64_t> dropped = 0;
+    alignas(LOCK_FREE_CACHE_LINE) std::atomic<size_t> headIndex = 0;
+    size_t cachedTail = 0;
+};
+
+template <typename T>
+class MpscQueue
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit MpscQueue(size_t minCapacity)
+    {
+        while (capacity < minCapacity)
+        {
+            capacity <<= 1;
+        }
+        cells = std::make_unique<Cell[]>(capacity);
+        for (size_t i = 0; i < capacity; i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(const T& value)
+    {
+        // Producers claim a cell by moving the tail, a cell's sequence says whether the consumer is done with it
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = cells[tail & (capacity - 1)];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)sequence - (intptr_t)tail;
+            if (diff == 0)
+            {
+                if (tailIndex.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                tail = tailIndex.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& value)
+    {
+        Cell& cell = cells[headIndex & (capacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != headIndex + 1)
+        {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(headIndex + capacity, std::memory_order_release);
+        headIndex++;
+        return true;
+    }
+
+    size_t Capacity() const { return capacity; }
+    // Pushes rejected because the consumer fell behind
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence = 0;
+        T value = {};
+    };
+
+    size_t capacity = 1;
+    std::unique_ptr<Cell[]> cells;
+    alignas(LOCK_FREE_CACHE_LINE) std::atomic<size_t> tailIndex = 0;
+    std::atomic<uint64_t> dropped = 0;
+    alignas(LOCK_FREE_CACHE_LINE) size_t headIndex = 0;
+};
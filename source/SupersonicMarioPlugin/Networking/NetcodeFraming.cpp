@@ -0,0 +1,166 @@
+// NetcodeFraming.cpp
+// Length-prefixed message framing for the SM64 netcode streams.
+
+#include "NetcodeFraming.h"
+
+size_t NetcodeFraming::WriteFrame(char* out, size_t outLen, NetcodeMessageType type, uint32_t sequence,
+    const char* payload, size_t payloadLen, uint8_t flags)
+{
+    const size_t frameLen = sizeof(NetcodeFrameHeader) + payloadLen;
+    if (out == nullptr || frameLen > outLen || payloadLen > NETCODE_MAX_PAYLOAD_SIZE)
+    {
+        return 0;
+    }
+
+    NetcodeFrameHeader header;
+    header.type = static_cast<uint8_t>(type);
+    header.flags = flags;
+    header.length = static_cast<uint32_t>(payloadLen);
+    header.sequence = sequence;
+    memcpy(out, &header, sizeof(header));
+    if (payloadLen > 0)
+    {
+        memcpy(out + sizeof(header), payload, payloadLen);
+    }
+
+    return frameLen;
+}
+
+bool NetcodeFraming::ReadFrame(char* data, size_t len, NetcodeFrame& frame)
+{
+    if (data == nullptr || len < sizeof(NetcodeFrameHeader))
+    {
+        return false;
+    }
+
+    memcpy(&frame.header, data, sizeof(NetcodeFrameHeader));
+    if (frame.header.magic != NETCODE_FRAME_MAGIC || sizeof(NetcodeFrameHeader) + frame.header.length != len)
+    {
+        return false;
+    }
+
+    frame.data = data;
+    frame.payload = data + sizeof(NetcodeFrameHeader);
+    frame.payloadLen = static_cast<int>(frame.header.length);
+    return true;
+}
+
+bool NetcodeFraming::ReadFrames(char* data, size_t len, const std::function<void(const NetcodeFrame& frame)>& onFrame)
+{
+    size_t offset = 0;
+    while (offset < len)
+    {
+        if (len - offset < sizeof(NetcodeFrameHeader))
+        {
+            return false;
+        }
+
+        NetcodeFrameHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        const size_t frameLen = sizeof(NetcodeFrameHeader) + header.length;
+        NetcodeFrame frame;
+        if (len - offset < frameLen || !ReadFrame(data + offset, frameLen, frame))
+        {
+            return false;
+        }
+
+        onFrame(frame);
+        offset += frameLen;
+    }
+
+    return true;
+}
+
+long long NetcodeFrameReader::dispatch(char* data, size_t len, const frame_callback_t& onFrame)
+{
+    size_t offset = 0;
+    while (len - offset >= sizeof(NetcodeFrameHeader))
+    {
+        NetcodeFrame frame;
+        memcpy(&frame.header, data + offset, sizeof(NetcodeFrameHeader));
+        if (frame.header.magic != NETCODE_FRAME_MAGIC || frame.header.length > NETCODE_MAX_PAYLOAD_SIZE)
+        {
+            return -1;
+        }
+
+        const size_t frameLen = sizeof(NetcodeFrameHeader) + frame.header.length;
+        if (len - offset < frameLen)
+        {
+            break;
+        }
+
+        frame.data = data + offset;
+        frame.payload = frame.data + sizeof(NetcodeFrameHeader);
+        frame.payloadLen = static_cast<int>(frame.header.length);
+        onFrame(frame);
+        offset += frameLen;
+    }
+
+    return static_cast<long long>(offset);
+}
+
+bool NetcodeFrameReader::Feed(char* data, size_t len, const frame_callback_t& onFrame)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+
+    // Fast path, nothing is pending so complete frames are dispatched straight out of the recv buffer
+    // and only a trailing partial frame gets copied.
+    if (Buffered() == 0)
+    {
+        buffer.clear();
+        readOffset = 0;
+        const long long consumed = dispatch(data, len, onFrame);
+        if (consumed < 0)
+        {
+            Reset();
+            return false;
+        }
+        buffer.insert(buffer.end(), data + consumed, data + len);
+        return true;
+    }
+
+    // Compact before growing so a long lived connection doesn't keep an ever growing buffer
+    if (readOffset > 0)
+    {
+        buffer.erase(buffer.begin(), buffer.begin() + readOffset);
+        readOffset = 0;
+    }
+    buffer.insert(buffer.end(), data, data + len);
+
+    const long long consumed = dispatch(buffer.data(), buffer.size(), onFrame);
+    if (consumed < 0)
+    {
+        Reset();
+        return false;
+    }
+    readOffset = static_cast<size_t>(consumed);
+    if (readOffset == buffer.size())
+    {
+        buffer.clear();
+        readOffset = 0;
+    }
+
+    return true;
+}
+
+void NetcodeFrameReader::Reset()
+{
+    buffer.clear();
+    readOffset = 0;
+}
+
+bool NetcodeSequenceFilter::Accept(int streamId, uint32_t sequence)
+{
+    auto it = latest.find(streamId);
+    if (it != latest.end() && !NetcodeFraming::IsNewerSequence(sequence, it->second))
+    {
+        stale++;
+        return false;
+    }
+
+    latest[streamId] = sequence;
+    return true;
+}
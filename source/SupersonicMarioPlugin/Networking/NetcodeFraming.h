@@ -0,0 +1,114 @@
+#pragma once
+// NetcodeFraming.h
+// Length-prefixed message framing for the SM64 netcode streams.
+//
+// Every message sent over the netcode sockets is prefixed with a
+// NetcodeFrameHeader. TCP does not preserve message boundaries, so
+// receivers push whatever recv() returned into a NetcodeFrameReader,
+// which hands back complete frames no matter how the kernel split or
+// coalesced the segments.
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#define NETCODE_FRAME_MAGIC 0x3436 // "64"
+#define NETCODE_MAX_PAYLOAD_SIZE 65536
+#define NETCODE_FLAG_AUTHORITATIVE 0x01 // Body state simulated by the host from the player's inputs
+#define NETCODE_FLAG_RELEVANCE 0x02 // Payload starts with a NetcodeRelevance, see RelayInterest.h
+
+enum class NetcodeMessageType : uint8_t
+{
+    MARIO_BODY_STATE = 1,
+    MATCH_SETTINGS = 2,
+    UDP_HELLO = 3,     // Client -> host over UDP, payload is the session token offered over TCP
+    UDP_HELLO_ACK = 4, // Host -> client over UDP, echoes the token back
+    UDP_READY = 5,     // Client -> host over TCP, body state for this client can move to UDP
+    MARIO_INPUT = 6,   // Client -> host, sequenced inputs for the host to simulate, never relayed
+    UDP_OFFER = 7,     // Client -> host over TCP, the session token its UDP hellos will carry
+};
+
+#pragma pack(push, 1)
+struct NetcodeFrameHeader
+{
+    uint16_t magic = NETCODE_FRAME_MAGIC;
+    uint8_t type = 0;
+    uint8_t flags = 0;
+    uint32_t length = 0; // Payload length, excluding this header
+    uint32_t sequence = 0;
+};
+
+// Lets relays find out whose body state a frame carries and where that mario is, without decoding the snapshot
+struct NetcodeRelevance
+{
+    int32_t playerId = 0;
+    int16_t position[3] = {}; // Rounded to whole units
+};
+#pragma pack(pop)
+
+// View of a complete frame. Only valid for the duration of the callback it was passed to.
+struct NetcodeFrame
+{
+    NetcodeFrameHeader header;
+    char* data = nullptr; // Start of the raw frame, header included
+    char* payload = nullptr;
+    int payloadLen = 0;
+
+    NetcodeMessageType Type() const { return static_cast<NetcodeMessageType>(header.type); }
+    int Size() const { return static_cast<int>(sizeof(NetcodeFrameHeader)) + payloadLen; }
+};
+
+namespace NetcodeFraming
+{
+    // Writes a header followed by the payload into out. Returns the frame size, or 0 if out is too small.
+    size_t WriteFrame(char* out, size_t outLen, NetcodeMessageType type, uint32_t sequence,
+        const char* payload, size_t payloadLen, uint8_t flags = 0);
+
+    // Parses a single frame that must span the whole of [data, data + len).
+    bool ReadFrame(char* data, size_t len, NetcodeFrame& frame);
+    // Parses a datagram holding one or more whole frames. Returns false at the first corrupt or truncated frame.
+    bool ReadFrames(char* data, size_t len, const std::function<void(const NetcodeFrame& frame)>& onFrame);
+
+    // Serial number comparison, so the sequence counter can wrap.
+    inline bool IsNewerSequence(uint32_t sequence, uint32_t latest)
+    {
+        return static_cast<int32_t>(sequence - latest) > 0;
+    }
+}
+
+// Streaming reassembly buffer for a single connection.
+class NetcodeFrameReader
+{
+public:
+    typedef std::function<void(const NetcodeFrame& frame)> frame_callback_t;
+
+    // Consumes len bytes and calls onFrame for every frame that is now complete.
+    // Returns false if the stream is corrupt, in which case the connection should be dropped.
+    bool Feed(char* data, size_t len, const frame_callback_t& onFrame);
+    void Reset();
+    size_t Buffered() const { return buffer.size() - readOffset; }
+
+private:
+    // Parses frames from [data, data + len). Returns the number of bytes consumed, or -1 on a corrupt header.
+    static long long dispatch(char* data, size_t len, const frame_callback_t& onFrame);
+
+    std::vector<char> buffer;
+    size_t readOffset = 0;
+};
+
+// Keeps the newest sequence number per stream and rejects anything older,
+// so reordered or duplicated unreliable messages never overwrite newer state.
+class NetcodeSequenceFilter
+{
+public:
+    bool Accept(int streamId, uint32_t sequence);
+    void Forget(int streamId) { latest.erase(streamId); }
+    void Reset() { latest.clear(); }
+    uint64_t Stale() const { return stale; }
+
+private:
+    std::unordered_map<int, uint32_t> latest;
+    uint64_t stale = 0;
+};
@@ -0,0 +1,179 @@
+// NetcodeRelay.cpp
+// Platform independent core of the netcode relay.
+
+#include "NetcodeRelay.h"
+
+#include <algorithm>
+#include <cstring>
+
+NetcodeRelay::NetcodeRelay(std::unique_ptr<RelayIoBackend> inBackend, Hooks inHooks)
+    : backend(std::move(inBackend)), hooks(std::move(inHooks))
+{
+    callbacks.onAccept = [this](relay_conn_t conn) {
+        readers[conn];
+        connectionCount = readers.size();
+    };
+    callbacks.onData = [this](relay_conn_t conn, char* data, size_t len) {
+        bool validStream = readers[conn].Feed(data, len, [this, conn](const NetcodeFrame& frame) {
+            if (frame.Type() == NetcodeMessageType::UDP_OFFER)
+            {
+                if (frame.payloadLen == sizeof(uint32_t) && udpPeers.count(conn) == 0)
+                {
+                    uint32_t udpToken;
+                    memcpy(&udpToken, frame.payload, sizeof(udpToken));
+                    udpOffers[conn] = udpToken;
+                    if (hooks.onUdpOffer)
+                    {
+                        hooks.onUdpOffer(conn, udpToken);
+                    }
+                }
+                return;
+            }
+            if (frame.Type() == NetcodeMessageType::UDP_READY)
+            {
+                // This client gets body state over UDP from now on, but only with the token it offered on this connection
+                auto offer = udpOffers.find(conn);
+                if (frame.payloadLen == sizeof(uint32_t) && offer != udpOffers.end() &&
+                    memcmp(&offer->second, frame.payload, sizeof(uint32_t)) == 0)
+                {
+                    uint32_t udpToken = offer->second;
+                    udpPeers[conn] = udpToken;
+                    if (hooks.onUdpReady)
+                    {
+                        hooks.onUdpReady(conn, udpToken);
+                    }
+                }
+                return;
+            }
+
+            interest.Observe(conn, frame.data, frame.Size());
+            // Inputs are only for whoever simulates them
+            if (frame.Type() != NetcodeMessageType::MARIO_INPUT)
+            {
+                addFrame(conn, frame);
+            }
+            if (hooks.onFrame)
+            {
+                hooks.onFrame(conn, frame);
+            }
+        });
+
+        if (!validStream)
+        {
+            backend->Close(conn);
+            dropConnection(conn);
+        }
+    };
+    callbacks.onClose = [this](relay_conn_t conn) {
+        dropConnection(conn);
+    };
+}
+
+relay_conn_t NetcodeRelay::Connect(const std::string& host, uint16_t port)
+{
+    relay_conn_t conn = backend->Connect(host, port);
+    if (conn != 0)
+    {
+        readers[conn];
+        connectionCount = readers.size();
+    }
+    return conn;
+}
+
+void NetcodeRelay::RunOnce(int maxWaitMs)
+{
+    // Only wake up early while frames are waiting for the end of the tick window
+    int timeoutMs = maxWaitMs;
+    if (!batch.Empty())
+    {
+        auto remaining = std::chrono::milliseconds(RELAY_TICK_WINDOW_MS) - (std::chrono::steady_clock::now() - batchStart);
+        timeoutMs = static_cast<int>(std::clamp<long long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count(), 0, maxWaitMs));
+    }
+
+    backend->Poll(timeoutMs, callbacks);
+
+    if (!batch.Empty() && std::chrono::steady_clock::now() - batchStart >= std::chrono::milliseconds(RELAY_TICK_WINDOW_MS))
+    {
+        flush();
+    }
+}
+
+void NetcodeRelay::Broadcast(const char* frame, size_t len)
+{
+    auto copy = std::make_shared<std::vector<char>>(frame, frame + len);
+    backend->Post([this, copy]() {
+        NetcodeFrame parsed;
+        if (NetcodeFraming::ReadFrame(copy->data(), copy->size(), parsed))
+        {
+            interest.Observe(RELAY_LOCAL_SOURCE, parsed.data, parsed.Size());
+            addFrame(RELAY_LOCAL_SOURCE, parsed);
+        }
+    });
+}
+
+void NetcodeRelay::Wake()
+{
+    backend->Post([]() {});
+}
+
+void NetcodeRelay::addFrame(uint64_t source, const NetcodeFrame& frame)
+{
+    if (batch.Empty())
+    {
+        batchStart = std::chrono::steady_clock::now();
+    }
+    batch.Add(source, frame.data, frame.Size());
+}
+
+void NetcodeRelay::dropConnection(relay_conn_t conn)
+{
+    readers.erase(conn);
+    interest.Forget(conn);
+    connectionCount = readers.size();
+    uint32_t udpToken = 0;
+    auto offer = udpOffers.find(conn);
+    if (offer != udpOffers.end())
+    {
+        udpToken = offer->second;
+        udpOffers.erase(offer);
+    }
+    udpPeers.erase(conn);
+
+    if (hooks.onDisconnect)
+    {
+        hooks.onDisconnect(conn, udpToken);
+    }
+}
+
+// Sends everything relayed during the last tick window as one queued gather write per connection
+void NetcodeRelay::flush()
+{
+    interest.Update();
+    for (const auto& [conn, reader] : readers)
+    {
+        // Clients on UDP already get body state there
+        bool onUdp = udpPeers.count(conn) > 0;
+        size_t len = batch.Gather(conn, slices, [this, conn, onUdp](const RelayBatch::Entry& entry) {
+            if (entry.type != NetcodeMessageType::MARIO_BODY_STATE)
+            {
+                return true;
+            }
+            return !onUdp && interest.Relevant(conn, batch.FrameData(entry), entry.len);
+        });
+        if (len == 0)
+        {
+            continue;
+        }
+
+        if (backend->Send(conn, { batch.Arena(), slices }))
+        {
+            stats.sendCalls++;
+            stats.bytesSent += len;
+        }
+    }
+
+    stats.ticks++;
+    stats.framesRelayed += batch.Frames();
+    batch.Clear();
+}
@@ -0,0 +1,78 @@
+#pragma once
+// NetcodeRelay.h
+// Platform independent core of the netcode relay.
+//
+// Reassembles frames per connection, batches them per tick window and hands
+// each connection its share of the batch through a RelayIoBackend, with body
+// state of far away marios thinned out by a RelayInterest. Everything except
+// Broadcast/Wake runs on the relay thread that calls RunOnce.
+
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#include "NetcodeFraming.h"
+#include "RelayBatch.h"
+#include "RelayIoBackend.h"
+#include "RelayInterest.h"
+
+#define RELAY_IDLE_POLL_MS 100
+
+// Source id for frames that originate on the relay host itself
+#define RELAY_LOCAL_SOURCE 0
+
+class NetcodeRelay
+{
+public:
+    struct Hooks
+    {
+        // Called for every complete frame that is relayed
+        std::function<void(relay_conn_t conn, const NetcodeFrame& frame)> onFrame;
+        // A client announced the token its UDP hellos will carry, hellos with any other token go unanswered
+        std::function<void(relay_conn_t conn, uint32_t udpToken)> onUdpOffer;
+        // A client finished the UDP handshake with the token it offered and now gets body state over UDP
+        std::function<void(relay_conn_t conn, uint32_t udpToken)> onUdpReady;
+        // udpToken is 0 if the client never offered a UDP channel
+        std::function<void(relay_conn_t conn, uint32_t udpToken)> onDisconnect;
+    };
+
+    NetcodeRelay(std::unique_ptr<RelayIoBackend> backend, Hooks hooks);
+
+    bool Listen(uint16_t port) { return backend->Listen(port); }
+    // Outgoing connections get the same treatment as accepted ones
+    relay_conn_t Connect(const std::string& host, uint16_t port);
+
+    // Waits for socket events for at most maxWaitMs, or less while a batch is pending, and flushes the batch when its tick window is over
+    void RunOnce(int maxWaitMs = RELAY_IDLE_POLL_MS);
+
+    // Queues an already framed message for every connection with the next tick. Safe to call from any thread.
+    void Broadcast(const char* frame, size_t len);
+    // Makes a RunOnce that is waiting return. Safe to call from any thread.
+    void Wake();
+
+    // Safe to call from any thread
+    size_t Connections() const { return connectionCount; }
+    const RelayBackendStats& BackendStats() const { return backend->Stats(); }
+    RelayStats& Stats() { return stats; }
+    RelayInterest::Stats& InterestStats() { return interest.GetStats(); }
+    // Only safe to change before the relay thread starts
+    RelayInterest::Config& InterestConfig() { return interest.GetConfig(); }
+
+private:
+    void addFrame(uint64_t source, const NetcodeFrame& frame);
+    void dropConnection(relay_conn_t conn);
+    void flush();
+
+    std::unique_ptr<RelayIoBackend> backend;
+    Hooks hooks;
+    RelayIoBackend::Callbacks callbacks;
+    std::unordered_map<relay_conn_t, NetcodeFrameReader> readers;
+    std::atomic<size_t> connectionCount = 0;
+    std::unordered_map<relay_conn_t, uint32_t> udpOffers;
+    std::unordered_map<relay_conn_t, uint32_t> udpPeers;
+    RelayInterest interest;
+    RelayBatch batch;
+    std::chrono::steady_clock::time_point batchStart;
+    std::vector<RelaySlice> slices;
+    RelayStats stats;
+};
@@ -470,16 +470,55 @@ bool Networking::PingHost(const std::string& host, unsigned short port, HostStat
 
 // Registers a callback for when generic data is received from a client or the server
 // On a TCP connection. This is used for SM64 Netcode.
-void Networking::RegisterCallback(void (*clbk)(char* buf, int len))
+void Networking::RegisterCallback(void (*clbk)(const NetcodeFrame& frame))
 {
     TcpClient::getInstance().RegisterMessageCallback(clbk);
     TcpServer::getInstance().RegisterMessageCallback(clbk);
+    UdpTransport::getInstance().RegisterMessageCallback(clbk);
 }
 
 // Send generic data to players in custom lan match.
-// Used for SM64 Netcode.
-void Networking::SendBytes(char* buf, int len)
+// Used for SM64 Netcode. The payload is framed here, so receivers get it back whole.
+// Body state and inputs go over UDP to everyone that completed the UDP handshake, everything else stays on TCP.
+void Networking::SendBytes(NetcodeMessageType type, char* buf, int len, uint8_t flags)
 {
-    TcpClient::getInstance().SendBytes(buf, len);
-    TcpServer::getInstance().SendBytes(buf, len);
-}
\ No newline at end of file
+    static std::atomic<uint32_t> nextSequence = 0;
+    thread_local std::vector<char> frameBuf;
+
+    frameBuf.resize(sizeof(NetcodeFrameHeader) + len);
+    const size_t frameLen = NetcodeFraming::WriteFrame(frameBuf.data(), frameBuf.size(), type, nextSequence++, buf, len, flags);
+    if (frameLen == 0) {
+        BM_ERROR_LOG("netcode message too large to frame: {:d} bytes", len);
+        return;
+    }
+
+    UdpTransport& udp = UdpTransport::getInstance();
+    const bool isUnreliable = type == NetcodeMessageType::MARIO_BODY_STATE || type == NetcodeMessageType::MARIO_INPUT;
+    if (isUnreliable) {
+        udp.SendBytes(frameBuf.data(), static_cast<int>(frameLen));
+    }
+    if (!isUnreliable || !udp.IsConnected()) {
+        TcpClient::getInstance().SendBytes(frameBuf.data(), static_cast<int>(frameLen));
+    }
+    TcpServer::getInstance().SendBytes(frameBuf.data(), static_cast<int>(frameLen));
+}
+
+
+/// <summary>Keeps calling send until the whole buffer is written or the socket errors.</summary>
+/// <param name="sock">Socket to send on</param>
+/// <param name="buf">Buffer to send</param>
+/// <param name="len">Length of the buffer</param>
+/// <returns>Number of bytes sent, or SOCKET_ERROR</returns>
+int Networking::SendAll(SOCKET sock, const char* buf, int len)
+{
+    int sent = 0;
+    while (sent < len) {
+        const int result = send(sock, buf + sent, len - sent, 0);
+        if (result == SOCKET_ERROR) {
+            return SOCKET_ERROR;
+        }
+        sent += result;
+    }
+
+    return sent;
+}
@@ -12,11 +12,17 @@
 #include <sstream>
 #include <thread>
 #include <semaphore>
+#include <atomic>
+#include <set>
 #include "cpp-httplib/httplib.h"
+#include "NetcodeFraming.h"
+#include "RelayBatch.h"
+#include "NetcodeRelay.h"
 
 #pragma comment (lib, "ws2_32.lib")
 
 #define TCP_BUF_SIZE 1048576
+#define UDP_BUF_SIZE 65536
 
 extern httplib::Client http;
 extern httplib::Client https;
@@ -61,11 +67,15 @@ namespace Networking
 
     bool PingHost(const std::string& host, unsigned short port, HostStatus* result = nullptr, bool threaded = false);
 
-    void RegisterCallback(void (*clbk)(char* buf, int len));
-    void SendBytes(char* buf, int len);
+    void RegisterCallback(void (*clbk)(const NetcodeFrame& frame));
+    void SendBytes(NetcodeMessageType type, char* buf, int len, uint8_t flags = 0);
+    int SendAll(SOCKET sock, const char* buf, int len);
 }
 
-// Singleton server used for communicating custom netcode without exploiting RL's in-game chat
+SOCKET GetBoundSocket(const u_short port, const std::string& localIP = "0.0.0.0");
+
+// Singleton server used for communicating custom netcode without exploiting RL's in-game chat.
+// Sockets are owned by a NetcodeRelay that runs on its own thread, see NetcodeRelay.h.
 class TcpServer
 {
 public:
@@ -77,20 +87,22 @@ public:
 
     void StartServer(int inPort);
     void StopServer();
-    void RegisterMessageCallback(void (*clbk)(char* buf, int len));
-    void SendBytes(char* buf, int len);
+    void RegisterMessageCallback(void (*clbk)(const NetcodeFrame& frame));
+    // Queues an already framed message for every client. Clients on UDP do not get body state here.
+    void SendBytes(const char* buf, int len);
 
 private:
     TcpServer();
+    ~TcpServer();
 
 public:
-    void (*msgReceivedClbk)(char* buf, int len) = nullptr;
+    void (*msgReceivedClbk)(const NetcodeFrame& frame) = nullptr;
     int port = 7778;
-    fd_set master;
-    SOCKET stopServerSocket = INVALID_SOCKET;
-    std::counting_semaphore<1> masterSetSema{ 1 };
-    SOCKET serverExitSocket;
-    SOCKET listening;
+    std::atomic<bool> running = false;
+    std::atomic<bool> stopRequested = false;
+    std::thread relayThread;
+    std::unique_ptr<NetcodeRelay> relay; // Guarded by relaySema
+    std::counting_semaphore<1> relaySema{ 1 };
     std::map<SOCKET, int> playerIdMap;
     int nextPlayerId = 1;
 
@@ -110,8 +122,8 @@ public:
 
     void ConnectToServer(std::string inIpAddress, int inPort);
     void DisconnectFromServer();
-    void RegisterMessageCallback(void (*clbk)(char* buf, int len));
-    void (*msgReceivedClbk)(char* buf, int len) = nullptr;
+    void RegisterMessageCallback(void (*clbk)(const NetcodeFrame& frame));
+    void (*msgReceivedClbk)(const NetcodeFrame& frame) = nullptr;
     void SendBytes(char* buf, int len);
 
 private:
@@ -123,6 +135,107 @@ public:
     std::string serverIp = "127.0.0.1";
     int serverPort = 7778;
     SOCKET sock = INVALID_SOCKET;
+    NetcodeFrameReader frameReader;
+};
+
+// Unreliable UDP channel for SM64 body state. Only the newest snapshot matters,
+// so a lost datagram must not hold up the ones after it like it would on TCP.
+// Match settings and everything else stay on the reliable TcpServer/TcpClient path.
+class UdpTransport
+{
+public:
+    static UdpTransport& getInstance()
+    {
+        static UdpTransport instance;
+        return instance;
+    }
+
+    // Exists from the moment a TCP connection offers its token, gets an address from the first hello with that
+    // token, and only sends and receives body state once the same connection confirms with UDP_READY
+    struct Peer
+    {
+        sockaddr_in addr;
+        uint32_t token;
+        bool hasAddr;
+        bool confirmed;
+        std::chrono::steady_clock::time_point offeredAt;
+    };
+
+    struct Stats
+    {
+        uint64_t sent;
+        uint64_t received;
+        uint64_t impairedDropped;
+        uint64_t impairedDelayed;
+    };
+
+    void StartHost(int inPort);
+    void ConnectToHost(const std::string& inIpAddress, int inPort);
+    void Stop();
+    void RegisterMessageCallback(void (*clbk)(const NetcodeFrame& frame));
+    bool IsConnected() const { return isHost ? sock != INVALID_SOCKET : handshakeDone.load(); }
+
+    // Sends an already framed message to the host, or to every peer when hosting
+    void SendBytes(const char* buf, int len);
+    // Host only, forwards a frame to every peer except the one it came from
+    void RelayBytes(const char* buf, int len, const sockaddr_in* from);
+    // Host only, queues a frame from a TCP only client for every peer, sent with the next relay tick
+    void QueueRelay(const char* buf, int len);
+    // Host only, called from the TCP relay thread for the UDP_OFFER and UDP_READY of a live connection
+    void OfferPeer(uint32_t peerToken);
+    void ConfirmPeer(uint32_t peerToken);
+    void DropPeer(uint32_t peerToken);
+    RelayInterest::Stats& InterestStats() { return interest.GetStats(); }
+
+    // Local loss/latency injection for testing on localhost, applied to everything this side sends
+    void SetImpairment(int inLossPercent, int inLatencyMs, int inJitterMs);
+    Stats GetStats() const;
+
+private:
+    UdpTransport() = default;
+    void sendTo(const sockaddr_in& addr, const char* buf, int len);
+    void sendTo(const sockaddr_in& addr, const RelaySlice* slices, size_t sliceCount);
+    void flushDelayed();
+    void flushRelayBatch();
+    void expireUnconfirmedPeers();
+    friend void udpThread(SOCKET threadSock);
+    friend void handleHostDatagram(const NetcodeFrame& frame, const sockaddr_in& from);
+
+    struct DelayedDatagram
+    {
+        std::chrono::steady_clock::time_point sendAt;
+        sockaddr_in addr;
+        std::vector<char> data;
+    };
+
+public:
+    UdpTransport(UdpTransport const&) = delete;
+    void operator=(UdpTransport const&) = delete;
+    void (*msgReceivedClbk)(const NetcodeFrame& frame) = nullptr;
+    std::atomic<SOCKET> sock = INVALID_SOCKET;
+    bool isHost = false;
+    std::atomic<bool> handshakeDone = false;
+    sockaddr_in hostAddr = {};
+    uint32_t token = 0;
+    std::vector<Peer> peers;
+    std::counting_semaphore<1> peersSema{ 1 };
+    RelayStats relayStats;
+
+private:
+    RelayBatch relayBatch;
+    std::chrono::steady_clock::time_point relayBatchStart;
+    std::counting_semaphore<1> relayBatchSema{ 1 };
+    RelayInterest interest; // Keyed by peer token, like the relay batch
+    std::counting_semaphore<1> interestSema{ 1 };
+    std::atomic<int> lossPercent = 0;
+    std::atomic<int> latencyMs = 0;
+    std::atomic<int> jitterMs = 0;
+    std::vector<DelayedDatagram> delayed;
+    std::counting_semaphore<1> delayedSema{ 1 };
+    std::atomic<uint64_t> sentCount = 0;
+    std::atomic<uint64_t> receivedCount = 0;
+    std::atomic<uint64_t> droppedCount = 0;
+    std::atomic<uint64_t> delayedCount = 0;
 };
 
 // Predefine types without including them.
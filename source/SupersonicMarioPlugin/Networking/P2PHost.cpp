@@ -71,7 +71,7 @@ constexpr timeval NETWORK_TIMEOUT = { 3, 0 };
 /// <param name="port">Local port to bind socket to</param>
 /// <param name="localIP">Local IP to bind socket to</param>
 /// <returns>Bound socket</returns>
-SOCKET GetBoundSocket(const u_short port, const std::string& localIP = "0.0.0.0")
+SOCKET GetBoundSocket(const u_short port, const std::string& localIP)
 {
     // Create a socket for sending data.
     const SOCKET sendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
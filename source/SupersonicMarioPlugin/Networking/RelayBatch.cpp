@@ -0,0 +1,77 @@
+// RelayBatch.cpp
+// Per tick collection of relayed frames for gather writes.
+
+#include "RelayBatch.h"
+
+void RelayBatch::Add(uint64_t source, const char* frame, size_t len)
+{
+    if (len < sizeof(NetcodeFrameHeader))
+    {
+        return;
+    }
+
+    NetcodeFrameHeader header;
+    memcpy(&header, frame, sizeof(header));
+    entries.push_back({ source, static_cast<NetcodeMessageType>(header.type), arena->size(), static_cast<uint32_t>(len) });
+    arena->insert(arena->end(), frame, frame + len);
+}
+
+void RelayBatch::Clear()
+{
+    // Sends still queued on a slow connection keep the old arena alive
+    if (arena.use_count() > 1)
+    {
+        arena = std::make_shared<std::vector<char>>();
+    }
+    arena->clear();
+    entries.clear();
+}
+
+size_t RelayBatch::Gather(uint64_t destination, std::vector<RelaySlice>& out, const entry_filter_t& filter,
+    size_t maxSliceLen) const
+{
+    out.clear();
+    size_t total = 0;
+    for (const Entry& entry : entries)
+    {
+        if (entry.source == destination || (filter && !filter(entry)))
+        {
+            continue;
+        }
+
+        // Frames that are adjacent in the arena go out as one slice
+        const char* data = arena->data() + entry.offset;
+        if (!out.empty() && out.back().data + out.back().len == data && out.back().len + entry.len <= maxSliceLen)
+        {
+            out.back().len += entry.len;
+        }
+        else
+        {
+            out.push_back({ data, entry.len });
+        }
+        total += entry.len;
+    }
+
+    return total;
+}
+
+void RelayBatch::SplitRuns(const std::vector<RelaySlice>& slices, size_t maxLen, std::vector<std::pair<size_t, size_t>>& runs)
+{
+    runs.clear();
+    size_t runStart = 0;
+    size_t runLen = 0;
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+        if (i > runStart && runLen + slices[i].len > maxLen)
+        {
+            runs.emplace_back(runStart, i - runStart);
+            runStart = i;
+            runLen = 0;
+        }
+        runLen += slices[i].len;
+    }
+    if (runStart < slices.size())
+    {
+        runs.emplace_back(runStart, slices.size() - runStart);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+// RelayBatch.h
+// Collects the frames a relay receives during one tick window, so each
+// connection gets a single gather write per tick instead of one send per
+// frame per connection.
+//
+// Frames are copied once into the batch arena when added. Flushing only
+// hands out slices into that arena, which the caller passes straight to
+// WSASend/WSASendTo/sendmsg. Queued sends that outlive the tick can hold on
+// to the arena through Arena(), Clear() then starts a new one.
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "NetcodeFraming.h"
+
+#define RELAY_TICK_WINDOW_MS 8
+#define RELAY_DATAGRAM_MTU 1200
+
+struct RelaySlice
+{
+    const char* data;
+    uint32_t len;
+};
+
+struct RelayStats
+{
+    std::atomic<uint64_t> ticks = 0;
+    std::atomic<uint64_t> sendCalls = 0;
+    std::atomic<uint64_t> bytesSent = 0;
+    std::atomic<uint64_t> framesRelayed = 0;
+
+    void Reset()
+    {
+        ticks = 0;
+        sendCalls = 0;
+        bytesSent = 0;
+        framesRelayed = 0;
+    }
+};
+
+class RelayBatch
+{
+public:
+    struct Entry
+    {
+        uint64_t source;
+        NetcodeMessageType type;
+        size_t offset;
+        uint32_t len;
+    };
+
+    typedef std::function<bool(const Entry& entry)> entry_filter_t;
+
+    void Add(uint64_t source, const char* frame, size_t len);
+    void Clear();
+    bool Empty() const { return entries.empty(); }
+    size_t Frames() const { return entries.size(); }
+    size_t Bytes() const { return arena->size(); }
+    // Keeps the slices handed out by Gather valid past Clear
+    std::shared_ptr<const std::vector<char>> Arena() const { return arena; }
+    // The frame an entry refers to, valid until the next Add or Clear
+    const char* FrameData(const Entry& entry) const { return arena->data() + entry.offset; }
+
+    // Fills out with every frame for destination, skipping its own frames and any the filter rejects.
+    // Adjacent frames are merged into one slice up to maxSliceLen. Returns the total number of bytes in out.
+    // Slices are only valid until the next Add or Clear, unless Arena() is held.
+    size_t Gather(uint64_t destination, std::vector<RelaySlice>& out, const entry_filter_t& filter = nullptr,
+        size_t maxSliceLen = SIZE_MAX) const;
+
+    // Splits slices into runs no larger than maxLen, for packing into datagrams. A single larger slice gets a run of its own.
+    static void SplitRuns(const std::vector<RelaySlice>& slices, size_t maxLen, std::vector<std::pair<size_t, size_t>>& runs);
+
+private:
+    std::shared_ptr<std::vector<char>> arena = std::make_shared<std::vector<char>>();
+    std::vector<Entry> entries;
+};
@@ -0,0 +1,171 @@
+// RelayInterest.cpp
+// Distance based send rates for relayed body state.
+
+#include "RelayInterest.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool RelayInterest::readRelevance(const char* frame, size_t len, NetcodeFrameHeader& header, NetcodeRelevance& relevance)
+{
+    if (len < sizeof(NetcodeFrameHeader) + sizeof(NetcodeRelevance))
+    {
+        return false;
+    }
+
+    memcpy(&header, frame, sizeof(header));
+    if (static_cast<NetcodeMessageType>(header.type) != NetcodeMessageType::MARIO_BODY_STATE ||
+        (header.flags & NETCODE_FLAG_RELEVANCE) == 0)
+    {
+        return false;
+    }
+
+    memcpy(&relevance, frame + sizeof(NetcodeFrameHeader), sizeof(relevance));
+    return true;
+}
+
+void RelayInterest::Observe(uint64_t source, const char* frame, size_t len)
+{
+    if (len < sizeof(NetcodeFrameHeader) + sizeof(int32_t))
+    {
+        return;
+    }
+
+    // Whoever sends a mario's inputs, or its body state without the host's say so, owns that mario
+    NetcodeFrameHeader header;
+    NetcodeRelevance relevance;
+    int32_t ownPlayerId;
+    bool owner = false;
+    if (readRelevance(frame, len, header, relevance))
+    {
+        positions[relevance.playerId] = { (float)relevance.position[0], (float)relevance.position[1], (float)relevance.position[2] };
+        ownPlayerId = relevance.playerId;
+        owner = (header.flags & NETCODE_FLAG_AUTHORITATIVE) == 0;
+    }
+    else
+    {
+        memcpy(&header, frame, sizeof(header));
+        memcpy(&ownPlayerId, frame + sizeof(NetcodeFrameHeader), sizeof(ownPlayerId));
+        owner = static_cast<NetcodeMessageType>(header.type) == NetcodeMessageType::MARIO_INPUT;
+    }
+
+    if (owner)
+    {
+        std::vector<int>& ownPlayerIds = receivers[source].ownPlayerIds;
+        if (std::find(ownPlayerIds.begin(), ownPlayerIds.end(), ownPlayerId) == ownPlayerIds.end())
+        {
+            ownPlayerIds.push_back(ownPlayerId);
+        }
+    }
+}
+
+void RelayInterest::Update()
+{
+    for (auto& [conn, receiver] : receivers)
+    {
+        updateReceiver(receiver);
+    }
+}
+
+void RelayInterest::updateReceiver(Receiver& receiver)
+{
+    // A receiver relaying for a group of players is as close to a mario as the closest of them
+    byDistance.clear();
+    for (const auto& [playerId, position] : positions)
+    {
+        if (std::find(receiver.ownPlayerIds.begin(), receiver.ownPlayerIds.end(), playerId) != receiver.ownPlayerIds.end())
+        {
+            continue;
+        }
+
+        float distance = INFINITY;
+        for (int ownPlayerId : receiver.ownPlayerIds)
+        {
+            auto own = positions.find(ownPlayerId);
+            if (own == positions.end())
+            {
+                continue;
+            }
+            const float dx = position.x - own->second.x;
+            const float dy = position.y - own->second.y;
+            const float dz = position.z - own->second.z;
+            distance = std::min(distance, std::sqrt(dx * dx + dy * dy + dz * dz));
+        }
+        byDistance.emplace_back(distance, playerId);
+    }
+
+    std::erase_if(receiver.streams, [this](const auto& stream) { return positions.count(stream.first) == 0; });
+    if (byDistance.empty() || byDistance.front().first == INFINITY)
+    {
+        // Nowhere to measure from yet
+        receiver.streams.clear();
+        return;
+    }
+
+    // Every stream keeps its floor, the nearest ones share what is left of the budget
+    std::sort(byDistance.begin(), byDistance.end());
+    float remaining = std::max(config.receiverBudget - config.minRate * byDistance.size(), 0.0f);
+    for (const auto& [distance, playerId] : byDistance)
+    {
+        float rate = distance <= config.fullRateDistance ? 1.0f : std::max(config.minRate, config.fullRateDistance / distance);
+        float extra = std::min(rate - config.minRate, remaining);
+        remaining -= extra;
+        receiver.streams[playerId].rate = config.minRate + extra;
+    }
+}
+
+bool RelayInterest::Relevant(uint64_t destination, const char* frame, size_t len)
+{
+    NetcodeFrameHeader header;
+    NetcodeRelevance relevance;
+    if (!config.enabled || !readRelevance(frame, len, header, relevance))
+    {
+        return true;
+    }
+
+    auto receiver = receivers.find(destination);
+    if (receiver == receivers.end())
+    {
+        stats.relevant++;
+        return true;
+    }
+
+    // Nothing to rate yet, or the receiver's own mario as the host simulates it
+    auto stream = receiver->second.streams.find(relevance.playerId);
+    if (stream == receiver->second.streams.end())
+    {
+        stats.relevant++;
+        return true;
+    }
+
+    stream->second.credit += stream->second.rate;
+    if (stream->second.credit < 1.0f)
+    {
+        stats.skipped++;
+        return false;
+    }
+    stream->second.credit -= 1.0f;
+    stats.relevant++;
+    return true;
+}
+
+void RelayInterest::Forget(uint64_t conn)
+{
+    auto receiver = receivers.find(conn);
+    if (receiver == receivers.end())
+    {
+        return;
+    }
+
+    for (int playerId : receiver->second.ownPlayerIds)
+    {
+        positions.erase(playerId);
+    }
+    receivers.erase(receiver);
+}
+
+void RelayInterest::Reset()
+{
+    positions.clear();
+    receivers.clear();
+}
@@ -0,0 +1,97 @@
+#pragma once
+// RelayInterest.h
+// Distance based send rates for relayed body state.
+//
+// Body state frames flagged with NETCODE_FLAG_RELEVANCE start with the
+// mario's player id and rough position. From those, and from the inputs and
+// body states each connection sends, a relay learns which marios every
+// receiver owns and how far every other mario is from them. Marios within
+// fullRateDistance of a receiver are relayed to it every frame, further ones
+// at a rate that falls off with distance down to minRate. On top of that a
+// receiver only gets receiverBudget streams worth of frames per tick: the
+// nearest marios keep their rate and the furthest are cut back to minRate,
+// so a receiver's share of the bandwidth stops growing with the lobby size
+// except for the minRate floor.
+//
+// Skipped frames only ever delay a receiver's acks, minRate has to keep them
+// inside SNAPSHOT_HISTORY_SIZE frames so delta baselines stay available.
+// Receivers always get every frame of their own marios, and frames without
+// the flag are always relayed.
+
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "NetcodeFraming.h"
+
+#define RELEVANCE_FULL_RATE_DISTANCE 2000.0f // About a fifth of the field
+#define RELEVANCE_MIN_RATE 0.125f            // Every 8th frame, 3.75 Hz for 30 Hz body state
+#define RELEVANCE_RECEIVER_BUDGET 8.0f
+
+class RelayInterest
+{
+public:
+    struct Config
+    {
+        bool enabled = true;
+        float fullRateDistance = RELEVANCE_FULL_RATE_DISTANCE;
+        float minRate = RELEVANCE_MIN_RATE;
+        float receiverBudget = RELEVANCE_RECEIVER_BUDGET;
+    };
+
+    struct Stats
+    {
+        std::atomic<uint64_t> relevant = 0; // Flagged frames relayed to a receiver
+        std::atomic<uint64_t> skipped = 0;  // Flagged frames held back from a receiver
+
+        void Reset()
+        {
+            relevant = 0;
+            skipped = 0;
+        }
+    };
+
+    RelayInterest() = default;
+    explicit RelayInterest(Config config) : config(config) {}
+
+    // Learns from a frame source sent, or relayed on behalf of others. Called for every frame, relayed or not.
+    void Observe(uint64_t source, const char* frame, size_t len);
+    // Recomputes every receiver's rates from the newest positions, once per tick before the frames are handed out
+    void Update();
+    // Whether destination gets this frame. Called once per frame per destination, skipped frames count towards the next one.
+    bool Relevant(uint64_t destination, const char* frame, size_t len);
+    // The connection is gone, as a receiver and as an owner of marios
+    void Forget(uint64_t conn);
+    void Reset();
+
+    Config& GetConfig() { return config; }
+    Stats& GetStats() { return stats; }
+
+private:
+    struct Position
+    {
+        float x, y, z;
+    };
+
+    struct StreamRate
+    {
+        float rate = 1.0f;
+        float credit = 1.0f; // A frame goes out whenever a whole one has built up
+    };
+
+    struct Receiver
+    {
+        std::vector<int> ownPlayerIds;
+        std::unordered_map<int, StreamRate> streams;
+    };
+
+    static bool readRelevance(const char* frame, size_t len, NetcodeFrameHeader& header, NetcodeRelevance& relevance);
+    void updateReceiver(Receiver& receiver);
+
+    Config config;
+    Stats stats;
+    std::unordered_map<int, Position> positions;
+    std::unordered_map<uint64_t, Receiver> receivers;
+    std::vector<std::pair<float, int>> byDistance;
+};
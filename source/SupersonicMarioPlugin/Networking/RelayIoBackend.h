@@ -0,0 +1,115 @@
+#pragma once
+// RelayIoBackend.h
+// Event driven socket I/O for the netcode relay.
+//
+// A backend owns the listening socket and every accepted connection, and
+// is driven from a single relay thread through Poll(). Each connection has
+// its own send queue, so a client that stops reading only fills its own
+// queue instead of blocking sends to everyone else. Once a queue is over
+// RELAY_MAX_QUEUED_BYTES new sends to it are dropped, and a connection that
+// stays over it for RELAY_SLOW_CLIENT_TIMEOUT_MS is closed.
+//
+// IOCP is used on Windows and epoll on Linux, see RelayIoBackend::Create.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RelayBatch.h"
+
+#define RELAY_RECV_BUF_SIZE 65536
+#define RELAY_MAX_QUEUED_BYTES (256 * 1024)
+#define RELAY_SLOW_CLIENT_TIMEOUT_MS 2000
+
+typedef uint64_t relay_conn_t;
+
+// Scatter/gather send that keeps the buffers it points into alive until it is written
+struct RelaySendItem
+{
+    std::shared_ptr<const std::vector<char>> owner;
+    std::vector<RelaySlice> slices;
+
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        for (const RelaySlice& slice : slices)
+        {
+            bytes += slice.len;
+        }
+        return bytes;
+    }
+
+    static RelaySendItem Copy(const char* data, size_t len)
+    {
+        auto buffer = std::make_shared<std::vector<char>>(data, data + len);
+        return { buffer, { { buffer->data(), static_cast<uint32_t>(len) } } };
+    }
+};
+
+// Written by the relay thread, readable from anywhere
+// Tracks how long a connection's send queue has been over RELAY_MAX_QUEUED_BYTES
+struct RelaySlowClientTimer
+{
+    std::chrono::steady_clock::time_point overSince;
+    bool over = false;
+
+    // Returns true once the queue has been full for too long and the connection should be closed
+    bool Full()
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!over)
+        {
+            over = true;
+            overSince = now;
+        }
+        return now - overSince > std::chrono::milliseconds(RELAY_SLOW_CLIENT_TIMEOUT_MS);
+    }
+
+    void Drained() { over = false; }
+};
+
+struct RelayBackendStats
+{
+    std::atomic<uint64_t> sendCalls = 0;
+    std::atomic<uint64_t> bytesSent = 0;
+    std::atomic<uint64_t> droppedSends = 0;
+    std::atomic<uint64_t> slowClientsClosed = 0;
+};
+
+typedef void (*relay_log_t)(const std::string& msg);
+
+class RelayIoBackend
+{
+public:
+    struct Callbacks
+    {
+        std::function<void(relay_conn_t conn)> onAccept;
+        std::function<void(relay_conn_t conn, char* data, size_t len)> onData;
+        std::function<void(relay_conn_t conn)> onClose;
+    };
+
+    virtual ~RelayIoBackend() = default;
+
+    // IOCP on Windows, epoll on Linux
+    static std::unique_ptr<RelayIoBackend> Create(relay_log_t log = nullptr);
+
+    virtual bool Listen(uint16_t port) = 0;
+    // Opens an outgoing connection that is handled like an accepted one. Returns 0 on failure.
+    virtual relay_conn_t Connect(const std::string& host, uint16_t port) = 0;
+
+    // Waits up to timeoutMs for socket events and dispatches them. Relay thread only.
+    virtual void Poll(int timeoutMs, const Callbacks& callbacks) = 0;
+    // Queues a send. Returns false if it was dropped because the connection is too far behind. Relay thread only.
+    virtual bool Send(relay_conn_t conn, RelaySendItem item) = 0;
+    // Relay thread only.
+    virtual void Close(relay_conn_t conn) = 0;
+    virtual std::vector<relay_conn_t> Connections() const = 0;
+    virtual const RelayBackendStats& Stats() const = 0;
+
+    // Runs fn on the relay thread during the next Poll. Safe to call from any thread.
+    virtual void Post(std::function<void()> fn) = 0;
+};
@@ -0,0 +1,475 @@
+// RelayIoBackendEpoll.cpp
+// epoll relay I/O backend, used when the relay runs on Linux.
+
+#ifdef __linux__
+
+#include "RelayIoBackend.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#define EPOLL_LISTEN_ID UINT64_MAX
+#define EPOLL_WAKE_ID (UINT64_MAX - 1)
+#define EPOLL_MAX_EVENTS 256
+#define EPOLL_MAX_IOV 64
+
+namespace
+{
+    class EpollRelayBackend final : public RelayIoBackend
+    {
+    public:
+        explicit EpollRelayBackend(relay_log_t log);
+        ~EpollRelayBackend() override;
+
+        bool Listen(uint16_t port) override;
+        relay_conn_t Connect(const std::string& host, uint16_t port) override;
+        void Poll(int timeoutMs, const Callbacks& callbacks) override;
+        bool Send(relay_conn_t conn, RelaySendItem item) override;
+        void Close(relay_conn_t conn) override;
+        std::vector<relay_conn_t> Connections() const override;
+        const RelayBackendStats& Stats() const override { return stats; }
+        void Post(std::function<void()> fn) override;
+
+    private:
+        struct Connection
+        {
+            int fd = -1;
+            std::deque<RelaySendItem> queue;
+            size_t queuedBytes = 0;
+            size_t headOffset = 0; // Bytes of the front item already written
+        RelaySlowClientTimer slowTimer;
+            bool wantWrite = false;
+        };
+
+        void logError(const std::string& what) const;
+        relay_conn_t addConnection(int fd);
+        void flush(relay_conn_t id, Connection& conn);
+        void setWantWrite(relay_conn_t id, Connection& conn, bool wantWrite);
+        void readConnection(relay_conn_t id, const Callbacks& callbacks);
+        void runPosted();
+        void processPendingCloses(const Callbacks& callbacks);
+
+        relay_log_t log;
+        int epollFd = -1;
+        int wakeFd = -1;
+        int listenFd = -1;
+        relay_conn_t nextConnId = 1;
+        std::unordered_map<relay_conn_t, Connection> connections;
+        std::vector<relay_conn_t> pendingCloses;
+        std::mutex postMutex;
+        std::vector<std::function<void()>> posted;
+        RelayBackendStats stats;
+        std::vector<char> recvBuf = std::vector<char>(RELAY_RECV_BUF_SIZE);
+    };
+
+    EpollRelayBackend::EpollRelayBackend(relay_log_t log) : log(log)
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0)
+        {
+            logError("failed to create epoll instance");
+            return;
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = EPOLL_WAKE_ID;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+    }
+
+    EpollRelayBackend::~EpollRelayBackend()
+    {
+        for (auto& [id, conn] : connections)
+        {
+            close(conn.fd);
+        }
+        if (listenFd >= 0)
+        {
+            close(listenFd);
+        }
+        if (wakeFd >= 0)
+        {
+            close(wakeFd);
+        }
+        if (epollFd >= 0)
+        {
+            close(epollFd);
+        }
+    }
+
+    void EpollRelayBackend::logError(const std::string& what) const
+    {
+        if (log != nullptr)
+        {
+            log(what + ": " + strerror(errno));
+        }
+    }
+
+    bool EpollRelayBackend::Listen(uint16_t port)
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0)
+        {
+            logError("failed to create listening socket");
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0)
+        {
+            logError("failed to listen on port " + std::to_string(port));
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = EPOLL_LISTEN_ID;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        return true;
+    }
+
+    relay_conn_t EpollRelayBackend::Connect(const std::string& host, uint16_t port)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == nullptr)
+        {
+            if (log != nullptr)
+            {
+                log("failed to resolve " + host);
+            }
+            return 0;
+        }
+
+        // Connecting blocks, it only happens once at startup
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int connected = fd >= 0 ? connect(fd, result->ai_addr, result->ai_addrlen) : -1;
+        freeaddrinfo(result);
+        if (connected < 0)
+        {
+            logError("failed to connect to " + host + ":" + std::to_string(port));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return 0;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return addConnection(fd);
+    }
+
+    relay_conn_t EpollRelayBackend::addConnection(int fd)
+    {
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        relay_conn_t id = nextConnId++;
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = id;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            logError("failed to watch connection");
+            close(fd);
+            return 0;
+        }
+
+        connections[id].fd = fd;
+        return id;
+    }
+
+    void EpollRelayBackend::Poll(int timeoutMs, const Callbacks& callbacks)
+    {
+        runPosted();
+        processPendingCloses(callbacks);
+
+        epoll_event events[EPOLL_MAX_EVENTS];
+        int count = epoll_wait(epollFd, events, EPOLL_MAX_EVENTS, timeoutMs);
+        for (int i = 0; i < count; i++)
+        {
+            const relay_conn_t id = events[i].data.u64;
+            if (id == EPOLL_WAKE_ID)
+            {
+                uint64_t value;
+                while (read(wakeFd, &value, sizeof(value)) > 0)
+                {
+                }
+                runPosted();
+            }
+            else if (id == EPOLL_LISTEN_ID)
+            {
+                int fd;
+                while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    relay_conn_t conn = addConnection(fd);
+                    if (conn != 0 && callbacks.onAccept)
+                    {
+                        callbacks.onAccept(conn);
+                    }
+                }
+            }
+            else
+            {
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    readConnection(id, callbacks);
+                }
+
+                auto it = connections.find(id);
+                if (it != connections.end() && (events[i].events & EPOLLOUT))
+                {
+                    flush(id, it->second);
+                }
+            }
+        }
+
+        processPendingCloses(callbacks);
+    }
+
+    void EpollRelayBackend::readConnection(relay_conn_t id, const Callbacks& callbacks)
+    {
+        while (true)
+        {
+            // The data callback may close this very connection
+            auto it = connections.find(id);
+            if (it == connections.end())
+            {
+                return;
+            }
+
+            ssize_t bytesIn = recv(it->second.fd, recvBuf.data(), recvBuf.size(), 0);
+            if (bytesIn > 0)
+            {
+                if (callbacks.onData)
+                {
+                    callbacks.onData(id, recvBuf.data(), static_cast<size_t>(bytesIn));
+                }
+                continue;
+            }
+            if (bytesIn < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            if (bytesIn < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            pendingCloses.push_back(id);
+            return;
+        }
+    }
+
+    bool EpollRelayBackend::Send(relay_conn_t id, RelaySendItem item)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+        {
+            return false;
+        }
+
+        Connection& conn = it->second;
+        if (conn.queuedBytes > RELAY_MAX_QUEUED_BYTES)
+        {
+            if (conn.slowTimer.Full())
+            {
+                stats.slowClientsClosed++;
+                pendingCloses.push_back(id);
+            }
+            stats.droppedSends++;
+            return false;
+        }
+
+        conn.queuedBytes += item.Bytes();
+        conn.queue.push_back(std::move(item));
+        if (!conn.wantWrite)
+        {
+            flush(id, conn);
+        }
+        return true;
+    }
+
+    void EpollRelayBackend::flush(relay_conn_t id, Connection& conn)
+    {
+        while (!conn.queue.empty())
+        {
+            iovec iov[EPOLL_MAX_IOV];
+            int iovCount = 0;
+            size_t skip = conn.headOffset;
+            for (const RelaySendItem& item : conn.queue)
+            {
+                for (const RelaySlice& slice : item.slices)
+                {
+                    if (iovCount == EPOLL_MAX_IOV)
+                    {
+                        break;
+                    }
+                    if (skip >= slice.len)
+                    {
+                        skip -= slice.len;
+                        continue;
+                    }
+                    iov[iovCount].iov_base = const_cast<char*>(slice.data) + skip;
+                    iov[iovCount].iov_len = slice.len - skip;
+                    iovCount++;
+                    skip = 0;
+                }
+                if (iovCount == EPOLL_MAX_IOV)
+                {
+                    break;
+                }
+            }
+
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovCount;
+            ssize_t sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                // Wait for EPOLLOUT if the kernel buffer is full, anything else is fatal for the connection
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    setWantWrite(id, conn, true);
+                }
+                else
+                {
+                    pendingCloses.push_back(id);
+                }
+                return;
+            }
+
+            stats.sendCalls++;
+            stats.bytesSent += sent;
+            conn.queuedBytes -= sent;
+            size_t remaining = conn.headOffset + sent;
+            while (!conn.queue.empty() && remaining >= conn.queue.front().Bytes())
+            {
+                remaining -= conn.queue.front().Bytes();
+                conn.queue.pop_front();
+            }
+            conn.headOffset = remaining;
+            if (conn.queuedBytes <= RELAY_MAX_QUEUED_BYTES)
+            {
+                conn.slowTimer.Drained();
+            }
+        }
+
+        setWantWrite(id, conn, false);
+    }
+
+    void EpollRelayBackend::setWantWrite(relay_conn_t id, Connection& conn, bool wantWrite)
+    {
+        if (conn.wantWrite == wantWrite)
+        {
+            return;
+        }
+
+        conn.wantWrite = wantWrite;
+        epoll_event ev = {};
+        ev.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+
+    void EpollRelayBackend::Close(relay_conn_t id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+        {
+            return;
+        }
+
+        close(it->second.fd);
+        connections.erase(it);
+    }
+
+    void EpollRelayBackend::processPendingCloses(const Callbacks& callbacks)
+    {
+        std::vector<relay_conn_t> closing;
+        closing.swap(pendingCloses);
+        for (relay_conn_t id : closing)
+        {
+            if (connections.count(id) == 0)
+            {
+                continue;
+            }
+            Close(id);
+            if (callbacks.onClose)
+            {
+                callbacks.onClose(id);
+            }
+        }
+    }
+
+    std::vector<relay_conn_t> EpollRelayBackend::Connections() const
+    {
+        std::vector<relay_conn_t> ids;
+        ids.reserve(connections.size());
+        for (const auto& [id, conn] : connections)
+        {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    void EpollRelayBackend::Post(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            posted.push_back(std::move(fn));
+        }
+        uint64_t one = 1;
+        (void)!write(wakeFd, &one, sizeof(one));
+    }
+
+    void EpollRelayBackend::runPosted()
+    {
+        std::vector<std::function<void()>> running;
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            running.swap(posted);
+        }
+        for (auto& fn : running)
+        {
+            fn();
+        }
+    }
+}
+
+std::unique_ptr<RelayIoBackend> RelayIoBackend::Create(relay_log_t log)
+{
+    return std::make_unique<EpollRelayBackend>(log);
+}
+
+#endif
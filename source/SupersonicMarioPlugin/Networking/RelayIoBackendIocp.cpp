@@ -0,0 +1,597 @@
+// RelayIoBackendIocp.cpp
+// I/O completion port relay backend, used by the plugin on Windows.
+
+#ifdef _WIN32
+
+#include "RelayIoBackend.h"
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <MSWSock.h>
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#pragma comment (lib, "ws2_32.lib")
+
+#define IOCP_WAKE_KEY 1
+#define IOCP_SOCKET_KEY 2
+#define IOCP_PENDING_ACCEPTS 4
+#define IOCP_MAX_COMPLETIONS 64
+#define IOCP_MAX_WSABUFS 64
+#define IOCP_ACCEPT_ADDR_LEN (sizeof(sockaddr_in) + 16)
+
+namespace
+{
+    enum class IocpOp
+    {
+        ACCEPT,
+        RECV,
+        SEND
+    };
+
+    struct Connection;
+
+    struct IocpRequest
+    {
+        OVERLAPPED overlapped = {};
+        IocpOp op;
+        Connection* owner = nullptr;
+    };
+
+    struct AcceptRequest : IocpRequest
+    {
+        SOCKET sock = INVALID_SOCKET;
+        char addrBuf[2 * IOCP_ACCEPT_ADDR_LEN];
+    };
+
+    struct Connection
+    {
+        relay_conn_t id = 0;
+        SOCKET sock = INVALID_SOCKET;
+        IocpRequest recvReq;
+        IocpRequest sendReq;
+        std::vector<char> recvBuf = std::vector<char>(RELAY_RECV_BUF_SIZE);
+        std::deque<RelaySendItem> queue;
+        size_t queuedBytes = 0;
+        size_t headOffset = 0; // Bytes of the front item already written
+        RelaySlowClientTimer slowTimer;
+        bool sending = false;
+        int pendingOps = 0; // The connection is only freed once the kernel is done with both requests
+    };
+
+    class IocpRelayBackend final : public RelayIoBackend
+    {
+    public:
+        explicit IocpRelayBackend(relay_log_t log);
+        ~IocpRelayBackend() override;
+
+        bool Listen(uint16_t port) override;
+        relay_conn_t Connect(const std::string& host, uint16_t port) override;
+        void Poll(int timeoutMs, const Callbacks& callbacks) override;
+        bool Send(relay_conn_t conn, RelaySendItem item) override;
+        void Close(relay_conn_t conn) override;
+        std::vector<relay_conn_t> Connections() const override;
+        const RelayBackendStats& Stats() const override { return stats; }
+        void Post(std::function<void()> fn) override;
+
+    private:
+        void logError(const std::string& what) const;
+        relay_conn_t addConnection(SOCKET sock);
+        bool postAccept(AcceptRequest& req);
+        bool postRecv(Connection& conn);
+        void startSend(Connection& conn);
+        void completeAccept(AcceptRequest& req, bool ok, const Callbacks& callbacks);
+        void completeRecv(Connection& conn, bool ok, DWORD bytes, const Callbacks& callbacks);
+        void completeSend(Connection& conn, bool ok, DWORD bytes);
+        void releaseOp(Connection& conn);
+        void runPosted();
+        void processPendingCloses(const Callbacks& callbacks);
+
+        relay_log_t log;
+        bool wsaStarted = false;
+        HANDLE iocp = nullptr;
+        SOCKET listenSock = INVALID_SOCKET;
+        LPFN_ACCEPTEX acceptEx = nullptr;
+        AcceptRequest acceptReqs[IOCP_PENDING_ACCEPTS];
+        int pendingAccepts = 0;
+        relay_conn_t nextConnId = 1;
+        std::unordered_map<relay_conn_t, std::unique_ptr<Connection>> connections;
+        // Closed connections wait here until their outstanding requests complete
+        std::unordered_map<Connection*, std::unique_ptr<Connection>> closing;
+        std::vector<relay_conn_t> pendingCloses;
+        std::mutex postMutex;
+        std::vector<std::function<void()>> posted;
+        RelayBackendStats stats;
+    };
+
+    IocpRelayBackend::IocpRelayBackend(relay_log_t log) : log(log)
+    {
+        WSADATA wsData;
+        wsaStarted = WSAStartup(MAKEWORD(2, 2), &wsData) == 0;
+        if (!wsaStarted)
+        {
+            logError("Can't initialize winsock");
+            return;
+        }
+
+        iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+        if (iocp == nullptr)
+        {
+            logError("Can't create completion port");
+        }
+    }
+
+    IocpRelayBackend::~IocpRelayBackend()
+    {
+        for (auto& [id, conn] : connections)
+        {
+            closesocket(conn->sock);
+            conn->sock = INVALID_SOCKET;
+            if (conn->pendingOps > 0)
+            {
+                Connection* raw = conn.get();
+                closing[raw] = std::move(conn);
+            }
+        }
+        connections.clear();
+
+        // Pending accepts complete with an error and close their socket once the listening socket is gone
+        if (listenSock != INVALID_SOCKET)
+        {
+            closesocket(listenSock);
+            listenSock = INVALID_SOCKET;
+        }
+
+        // Closing the sockets aborts their requests, wait for the kernel to hand back the OVERLAPPEDs before freeing them
+        Callbacks none;
+        for (int i = 0; i < 50 && iocp != nullptr && (!closing.empty() || pendingAccepts > 0); i++)
+        {
+            Poll(10, none);
+        }
+
+        if (iocp != nullptr)
+        {
+            CloseHandle(iocp);
+        }
+        if (wsaStarted)
+        {
+            WSACleanup();
+        }
+    }
+
+    void IocpRelayBackend::logError(const std::string& what) const
+    {
+        if (log != nullptr)
+        {
+            log(what + ". Error#" + std::to_string(WSAGetLastError()));
+        }
+    }
+
+    bool IocpRelayBackend::Listen(uint16_t port)
+    {
+        listenSock = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+        if (listenSock == INVALID_SOCKET)
+        {
+            logError("Can't create a socket");
+            return false;
+        }
+
+        sockaddr_in hint = {};
+        hint.sin_family = AF_INET;
+        hint.sin_port = htons(port);
+        hint.sin_addr.S_un.S_addr = INADDR_ANY;
+        if (bind(listenSock, (sockaddr*)&hint, sizeof(hint)) == SOCKET_ERROR || listen(listenSock, SOMAXCONN) == SOCKET_ERROR)
+        {
+            logError("Couldn't start listening on port " + std::to_string(port));
+            closesocket(listenSock);
+            listenSock = INVALID_SOCKET;
+            return false;
+        }
+
+        GUID acceptExGuid = WSAID_ACCEPTEX;
+        DWORD bytes = 0;
+        if (WSAIoctl(listenSock, SIO_GET_EXTENSION_FUNCTION_POINTER, &acceptExGuid, sizeof(acceptExGuid),
+            &acceptEx, sizeof(acceptEx), &bytes, nullptr, nullptr) == SOCKET_ERROR)
+        {
+            logError("Can't load AcceptEx");
+            return false;
+        }
+
+        CreateIoCompletionPort((HANDLE)listenSock, iocp, IOCP_SOCKET_KEY, 0);
+        for (AcceptRequest& req : acceptReqs)
+        {
+            req.op = IocpOp::ACCEPT;
+            postAccept(req);
+        }
+        return pendingAccepts > 0;
+    }
+
+    bool IocpRelayBackend::postAccept(AcceptRequest& req)
+    {
+        req.sock = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+        if (req.sock == INVALID_SOCKET)
+        {
+            logError("Can't create a socket");
+            return false;
+        }
+
+        req.overlapped = {};
+        DWORD bytes = 0;
+        if (!acceptEx(listenSock, req.sock, req.addrBuf, 0, IOCP_ACCEPT_ADDR_LEN, IOCP_ACCEPT_ADDR_LEN, &bytes, &req.overlapped)
+            && WSAGetLastError() != ERROR_IO_PENDING)
+        {
+            logError("AcceptEx failed");
+            closesocket(req.sock);
+            req.sock = INVALID_SOCKET;
+            return false;
+        }
+
+        pendingAccepts++;
+        return true;
+    }
+
+    relay_conn_t IocpRelayBackend::Connect(const std::string& host, uint16_t port)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == nullptr)
+        {
+            logError("Can't resolve " + host);
+            return 0;
+        }
+
+        // Connecting blocks, it only happens once at startup
+        SOCKET sock = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+        int connResult = sock != INVALID_SOCKET ? connect(sock, result->ai_addr, (int)result->ai_addrlen) : SOCKET_ERROR;
+        freeaddrinfo(result);
+        if (connResult == SOCKET_ERROR)
+        {
+            logError("Can't connect to " + host + ":" + std::to_string(port));
+            if (sock != INVALID_SOCKET)
+            {
+                closesocket(sock);
+            }
+            return 0;
+        }
+
+        return addConnection(sock);
+    }
+
+    relay_conn_t IocpRelayBackend::addConnection(SOCKET sock)
+    {
+        int flags = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&flags, sizeof(flags));
+        if (CreateIoCompletionPort((HANDLE)sock, iocp, IOCP_SOCKET_KEY, 0) == nullptr)
+        {
+            logError("Can't associate connection with the completion port");
+            closesocket(sock);
+            return 0;
+        }
+
+        auto conn = std::make_unique<Connection>();
+        conn->id = nextConnId++;
+        conn->sock = sock;
+        conn->recvReq.op = IocpOp::RECV;
+        conn->recvReq.owner = conn.get();
+        conn->sendReq.op = IocpOp::SEND;
+        conn->sendReq.owner = conn.get();
+
+        relay_conn_t id = conn->id;
+        Connection& ref = *conn;
+        connections[id] = std::move(conn);
+        if (!postRecv(ref))
+        {
+            Close(id);
+            return 0;
+        }
+        return id;
+    }
+
+    bool IocpRelayBackend::postRecv(Connection& conn)
+    {
+        WSABUF wsaBuf = { (ULONG)conn.recvBuf.size(), conn.recvBuf.data() };
+        DWORD flags = 0;
+        conn.recvReq.overlapped = {};
+        if (WSARecv(conn.sock, &wsaBuf, 1, nullptr, &flags, &conn.recvReq.overlapped, nullptr) == SOCKET_ERROR
+            && WSAGetLastError() != WSA_IO_PENDING)
+        {
+            return false;
+        }
+
+        conn.pendingOps++;
+        return true;
+    }
+
+    // Only one WSASend per connection is in flight, it takes as much of the queue as fits in one call
+    void IocpRelayBackend::startSend(Connection& conn)
+    {
+        if (conn.sending || conn.queue.empty())
+        {
+            return;
+        }
+
+        WSABUF wsaBufs[IOCP_MAX_WSABUFS];
+        DWORD bufCount = 0;
+        size_t skip = conn.headOffset;
+        for (const RelaySendItem& item : conn.queue)
+        {
+            for (const RelaySlice& slice : item.slices)
+            {
+                if (bufCount == IOCP_MAX_WSABUFS)
+                {
+                    break;
+                }
+                if (skip >= slice.len)
+                {
+                    skip -= slice.len;
+                    continue;
+                }
+                wsaBufs[bufCount].buf = const_cast<char*>(slice.data) + skip;
+                wsaBufs[bufCount].len = (ULONG)(slice.len - skip);
+                bufCount++;
+                skip = 0;
+            }
+            if (bufCount == IOCP_MAX_WSABUFS)
+            {
+                break;
+            }
+        }
+
+        conn.sendReq.overlapped = {};
+        if (WSASend(conn.sock, wsaBufs, bufCount, nullptr, 0, &conn.sendReq.overlapped, nullptr) == SOCKET_ERROR
+            && WSAGetLastError() != WSA_IO_PENDING)
+        {
+            pendingCloses.push_back(conn.id);
+            return;
+        }
+
+        conn.sending = true;
+        conn.pendingOps++;
+        stats.sendCalls++;
+    }
+
+    void IocpRelayBackend::Poll(int timeoutMs, const Callbacks& callbacks)
+    {
+        runPosted();
+        processPendingCloses(callbacks);
+
+        OVERLAPPED_ENTRY entries[IOCP_MAX_COMPLETIONS];
+        ULONG count = 0;
+        if (!GetQueuedCompletionStatusEx(iocp, entries, IOCP_MAX_COMPLETIONS, &count, (DWORD)timeoutMs, FALSE))
+        {
+            count = 0;
+        }
+
+        for (ULONG i = 0; i < count; i++)
+        {
+            if (entries[i].lpCompletionKey == IOCP_WAKE_KEY)
+            {
+                runPosted();
+                continue;
+            }
+
+            IocpRequest* req = CONTAINING_RECORD(entries[i].lpOverlapped, IocpRequest, overlapped);
+            // Internal holds the NTSTATUS of the request, zero on success
+            const bool ok = entries[i].lpOverlapped->Internal == 0;
+            const DWORD bytes = entries[i].dwNumberOfBytesTransferred;
+            switch (req->op)
+            {
+                case IocpOp::ACCEPT:
+                    completeAccept(*static_cast<AcceptRequest*>(req), ok, callbacks);
+                    break;
+                case IocpOp::RECV:
+                    completeRecv(*req->owner, ok, bytes, callbacks);
+                    break;
+                case IocpOp::SEND:
+                    completeSend(*req->owner, ok, bytes);
+                    break;
+            }
+        }
+
+        processPendingCloses(callbacks);
+    }
+
+    void IocpRelayBackend::completeAccept(AcceptRequest& req, bool ok, const Callbacks& callbacks)
+    {
+        pendingAccepts--;
+        SOCKET client = req.sock;
+        req.sock = INVALID_SOCKET;
+        if (listenSock == INVALID_SOCKET)
+        {
+            closesocket(client);
+            return;
+        }
+
+        if (ok && setsockopt(client, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (const char*)&listenSock, sizeof(listenSock)) == 0)
+        {
+            relay_conn_t conn = addConnection(client);
+            if (conn != 0 && callbacks.onAccept)
+            {
+                callbacks.onAccept(conn);
+            }
+        }
+        else
+        {
+            closesocket(client);
+        }
+
+        postAccept(req);
+    }
+
+    void IocpRelayBackend::completeRecv(Connection& conn, bool ok, DWORD bytes, const Callbacks& callbacks)
+    {
+        const relay_conn_t id = conn.id;
+        releaseOp(conn);
+        if (connections.count(id) == 0)
+        {
+            return;
+        }
+
+        if (!ok || bytes == 0)
+        {
+            pendingCloses.push_back(id);
+            return;
+        }
+
+        if (callbacks.onData)
+        {
+            callbacks.onData(id, conn.recvBuf.data(), bytes);
+        }
+
+        // The data callback may have closed the connection
+        if (connections.count(id) > 0 && !postRecv(conn))
+        {
+            pendingCloses.push_back(id);
+        }
+    }
+
+    void IocpRelayBackend::completeSend(Connection& conn, bool ok, DWORD bytes)
+    {
+        const relay_conn_t id = conn.id;
+        conn.sending = false;
+        releaseOp(conn);
+        if (connections.count(id) == 0)
+        {
+            return;
+        }
+
+        if (!ok)
+        {
+            pendingCloses.push_back(id);
+            return;
+        }
+
+        stats.bytesSent += bytes;
+        conn.queuedBytes -= bytes;
+        size_t remaining = conn.headOffset + bytes;
+        while (!conn.queue.empty() && remaining >= conn.queue.front().Bytes())
+        {
+            remaining -= conn.queue.front().Bytes();
+            conn.queue.pop_front();
+        }
+        conn.headOffset = remaining;
+        if (conn.queuedBytes <= RELAY_MAX_QUEUED_BYTES)
+        {
+            conn.slowTimer.Drained();
+        }
+
+        startSend(conn);
+    }
+
+    // Frees a closed connection once its last outstanding request came back
+    void IocpRelayBackend::releaseOp(Connection& conn)
+    {
+        conn.pendingOps--;
+        if (conn.sock == INVALID_SOCKET && conn.pendingOps == 0)
+        {
+            closing.erase(&conn);
+        }
+    }
+
+    bool IocpRelayBackend::Send(relay_conn_t id, RelaySendItem item)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+        {
+            return false;
+        }
+
+        Connection& conn = *it->second;
+        if (conn.queuedBytes > RELAY_MAX_QUEUED_BYTES)
+        {
+            if (conn.slowTimer.Full())
+            {
+                stats.slowClientsClosed++;
+                pendingCloses.push_back(id);
+            }
+            stats.droppedSends++;
+            return false;
+        }
+
+        conn.queuedBytes += item.Bytes();
+        conn.queue.push_back(std::move(item));
+        startSend(conn);
+        return true;
+    }
+
+    void IocpRelayBackend::Close(relay_conn_t id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+        {
+            return;
+        }
+
+        // Closing the socket aborts the outstanding requests, their completions free the connection
+        Connection* conn = it->second.get();
+        closesocket(conn->sock);
+        conn->sock = INVALID_SOCKET;
+        if (conn->pendingOps > 0)
+        {
+            closing[conn] = std::move(it->second);
+        }
+        connections.erase(it);
+    }
+
+    void IocpRelayBackend::processPendingCloses(const Callbacks& callbacks)
+    {
+        std::vector<relay_conn_t> closingIds;
+        closingIds.swap(pendingCloses);
+        for (relay_conn_t id : closingIds)
+        {
+            if (connections.count(id) == 0)
+            {
+                continue;
+            }
+            Close(id);
+            if (callbacks.onClose)
+            {
+                callbacks.onClose(id);
+            }
+        }
+    }
+
+    std::vector<relay_conn_t> IocpRelayBackend::Connections() const
+    {
+        std::vector<relay_conn_t> ids;
+        ids.reserve(connections.size());
+        for (const auto& [id, conn] : connections)
+        {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    void IocpRelayBackend::Post(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            posted.push_back(std::move(fn));
+        }
+        PostQueuedCompletionStatus(iocp, 0, IOCP_WAKE_KEY, nullptr);
+    }
+
+    void IocpRelayBackend::runPosted()
+    {
+        std::vector<std::function<void()>> running;
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            running.swap(posted);
+        }
+        for (auto& fn : running)
+        {
+            fn();
+        }
+    }
+}
+
+std::unique_ptr<RelayIoBackend> RelayIoBackend::Create(relay_log_t log)
+{
+    return std::make_unique<IocpRelayBackend>(log);
+}
+
+#endif
@@ -0,0 +1,459 @@
+// SnapshotCodec.cpp
+// Quantized, delta-compressed encoding of fixed-size state snapshots.
+
+#include "SnapshotCodec.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    uint32_t zigzag(int32_t value)
+    {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    int32_t unzigzag(uint32_t value)
+    {
+        return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    bool isNewerId(uint16_t id, uint16_t than)
+    {
+        return static_cast<int16_t>(id - than) > 0;
+    }
+
+    // Acks only carry an id's low byte, which may not be 0
+    bool isUsableId(uint16_t id)
+    {
+        return (id & 0xFF) != SNAPSHOT_NEEDS_KEYFRAME;
+    }
+}
+
+size_t SnapshotVarint::Write(uint32_t value, uint8_t* out, size_t outLen)
+{
+    size_t len = 0;
+    do
+    {
+        if (len == outLen)
+        {
+            return 0;
+        }
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[len++] = byte | (value != 0 ? 0x80 : 0);
+    } while (value != 0);
+
+    return len;
+}
+
+size_t SnapshotVarint::Read(const uint8_t* in, size_t inLen, uint32_t* value)
+{
+    uint32_t result = 0;
+    for (size_t i = 0; i < inLen && i < SNAPSHOT_VARINT_MAX_SIZE; i++)
+    {
+        result |= static_cast<uint32_t>(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0)
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+SnapshotCodec::SnapshotCodec(size_t snapshotSize, const std::vector<SnapshotQuantizedField>& quantizedFields)
+    : snapshotSize(snapshotSize), wordScale((snapshotSize + sizeof(uint32_t) - 1) / sizeof(uint32_t), 0.0f),
+      wordRate(wordScale.size(), -1)
+{
+    for (const SnapshotQuantizedField& field : quantizedFields)
+    {
+        // Only word aligned floats can be quantized, anything else is still sent losslessly
+        if (field.offset % sizeof(uint32_t) != 0)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < field.count; i++)
+        {
+            const size_t word = field.offset / sizeof(uint32_t) + i;
+            if ((word + 1) * sizeof(uint32_t) <= snapshotSize)
+            {
+                wordScale[word] = field.scale;
+            }
+        }
+    }
+
+    for (const SnapshotQuantizedField& field : quantizedFields)
+    {
+        if (field.offset % sizeof(uint32_t) != 0 || field.rateOffset < 0 || field.rateOffset % sizeof(uint32_t) != 0)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < field.count; i++)
+        {
+            const size_t word = field.offset / sizeof(uint32_t) + i;
+            const size_t rateWord = field.rateOffset / sizeof(uint32_t) + i;
+            // Rates have to be fixed point too, so both ends predict the exact same word
+            if (word < WordCount() && rateWord < WordCount() && wordScale[word] != 0.0f && wordScale[rateWord] != 0.0f)
+            {
+                wordRate[word] = static_cast<int32_t>(rateWord);
+            }
+        }
+    }
+}
+
+size_t SnapshotCodec::MaxEncodedSize() const
+{
+    const size_t groups = (WordCount() + 7) / 8;
+    return (groups + 7) / 8 + groups + WordCount() * SNAPSHOT_VARINT_MAX_SIZE;
+}
+
+void SnapshotCodec::Quantize(const void* snapshot, uint32_t* words) const
+{
+    words[WordCount() - 1] = 0;
+    memcpy(words, snapshot, snapshotSize);
+
+    for (size_t i = 0; i < WordCount(); i++)
+    {
+        if (wordScale[i] == 0.0f)
+        {
+            continue;
+        }
+
+        float value;
+        memcpy(&value, &words[i], sizeof(float));
+        const double scaled = static_cast<double>(value) * wordScale[i];
+        int32_t fixed = 0;
+        if (!std::isnan(scaled))
+        {
+            fixed = static_cast<int32_t>(std::clamp(std::round(scaled), -2147483648.0, 2147483647.0));
+        }
+        words[i] = static_cast<uint32_t>(fixed);
+    }
+}
+
+void SnapshotCodec::Dequantize(const uint32_t* words, void* snapshot) const
+{
+    uint8_t* out = static_cast<uint8_t*>(snapshot);
+    for (size_t i = 0; i < WordCount(); i++)
+    {
+        uint32_t word = words[i];
+        if (wordScale[i] != 0.0f)
+        {
+            const float value = static_cast<float>(static_cast<int32_t>(word) / static_cast<double>(wordScale[i]));
+            memcpy(&word, &value, sizeof(float));
+        }
+
+        const size_t offset = i * sizeof(uint32_t);
+        memcpy(out + offset, &word, std::min(sizeof(uint32_t), snapshotSize - offset));
+    }
+}
+
+void SnapshotCodec::Predict(const uint32_t* baseline, uint32_t age, uint32_t* predicted) const
+{
+    for (size_t i = 0; i < WordCount(); i++)
+    {
+        predicted[i] = baseline[i];
+        if (wordRate[i] < 0)
+        {
+            continue;
+        }
+
+        const int32_t rate = static_cast<int32_t>(baseline[wordRate[i]]);
+        const double moved = std::round(rate * (static_cast<double>(wordScale[i]) / wordScale[wordRate[i]]) * age);
+        predicted[i] += static_cast<uint32_t>(static_cast<int32_t>(std::clamp(moved, -2147483648.0, 2147483647.0)));
+    }
+}
+
+size_t SnapshotCodec::Encode(const uint32_t* words, const uint32_t* baseline, uint8_t* out, size_t outLen) const
+{
+    const size_t wordCount = WordCount();
+    const size_t groups = (wordCount + 7) / 8;
+    const size_t groupMaskLen = (groups + 7) / 8;
+    if (outLen < groupMaskLen)
+    {
+        return 0;
+    }
+
+    memset(out, 0, groupMaskLen);
+    size_t pos = groupMaskLen;
+    for (size_t group = 0; group < groups; group++)
+    {
+        const size_t first = group * 8;
+        const size_t last = std::min(first + 8, wordCount);
+
+        uint8_t wordMask = 0;
+        for (size_t i = first; i < last; i++)
+        {
+            if (words[i] != (baseline != nullptr ? baseline[i] : 0))
+            {
+                wordMask |= 1 << (i - first);
+            }
+        }
+        if (wordMask == 0)
+        {
+            continue;
+        }
+
+        if (pos == outLen)
+        {
+            return 0;
+        }
+        out[group / 8] |= 1 << (group % 8);
+        out[pos++] = wordMask;
+
+        for (size_t i = first; i < last; i++)
+        {
+            if ((wordMask & (1 << (i - first))) == 0)
+            {
+                continue;
+            }
+
+            // Fixed point words change by small amounts, raw words tend to flip a few low bits
+            const uint32_t base = baseline != nullptr ? baseline[i] : 0;
+            const uint32_t delta = wordScale[i] != 0.0f
+                ? zigzag(static_cast<int32_t>(words[i] - base))
+                : words[i] ^ base;
+            const size_t written = SnapshotVarint::Write(delta, out + pos, outLen - pos);
+            if (written == 0)
+            {
+                return 0;
+            }
+            pos += written;
+        }
+    }
+
+    return pos;
+}
+
+size_t SnapshotCodec::Decode(const uint8_t* in, size_t inLen, const uint32_t* baseline, uint32_t* words) const
+{
+    const size_t wordCount = WordCount();
+    const size_t groups = (wordCount + 7) / 8;
+    const size_t groupMaskLen = (groups + 7) / 8;
+    if (inLen < groupMaskLen)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < wordCount; i++)
+    {
+        words[i] = baseline != nullptr ? baseline[i] : 0;
+    }
+
+    size_t pos = groupMaskLen;
+    for (size_t group = 0; group < groups; group++)
+    {
+        if ((in[group / 8] & (1 << (group % 8))) == 0)
+        {
+            continue;
+        }
+        if (pos == inLen)
+        {
+            return 0;
+        }
+
+        const uint8_t wordMask = in[pos++];
+        const size_t first = group * 8;
+        for (size_t bit = 0; bit < 8; bit++)
+        {
+            if ((wordMask & (1 << bit)) == 0)
+            {
+                continue;
+            }
+            const size_t i = first + bit;
+            uint32_t delta;
+            const size_t read = i < wordCount ? SnapshotVarint::Read(in + pos, inLen - pos, &delta) : 0;
+            if (read == 0)
+            {
+                return 0;
+            }
+            pos += read;
+
+            words[i] = wordScale[i] != 0.0f
+                ? words[i] + static_cast<uint32_t>(unzigzag(delta))
+                : words[i] ^ delta;
+        }
+    }
+
+    return pos;
+}
+
+SnapshotStreamEncoder::SnapshotStreamEncoder(const SnapshotCodec& codec)
+    : codec(codec), history(SNAPSHOT_HISTORY_SIZE * codec.WordCount()), words(codec.WordCount()),
+      predicted(codec.WordCount())
+{
+}
+
+int SnapshotStreamEncoder::findBaseline(uint64_t nowMs)
+{
+    // Peers that stopped acking have most likely left, they shouldn't pin the baseline forever
+    std::erase_if(peers, [nowMs](const auto& peer) {
+        return nowMs > peer.second.lastAckMs + SNAPSHOT_PEER_TIMEOUT_MS;
+    });
+    if (peers.empty())
+    {
+        return -1;
+    }
+
+    int baselineSlot = -1;
+    for (int slot = 0; slot < SNAPSHOT_HISTORY_SIZE; slot++)
+    {
+        const uint16_t id = historyIds[slot];
+        if (id == 0 || (baselineSlot >= 0 && !isNewerId(id, historyIds[baselineSlot])))
+        {
+            continue;
+        }
+
+        const bool ackedByAll = std::all_of(peers.begin(), peers.end(), [slot, id](const auto& peer) {
+            return peer.second.acked[slot] == id;
+        });
+        if (ackedByAll)
+        {
+            baselineSlot = slot;
+        }
+    }
+
+    return baselineSlot;
+}
+
+size_t SnapshotStreamEncoder::Encode(const void* snapshot, uint64_t nowMs, uint8_t* out, size_t outLen)
+{
+    if (outLen < SNAPSHOT_STREAM_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    const uint16_t snapshotId = nextSnapshotId;
+    const int baselineSlot = snapshotId % SNAPSHOT_KEYFRAME_INTERVAL != 0 ? findBaseline(nowMs) : -1;
+    // The history only reaches 32 snapshots back, so the age always fits a byte
+    const uint8_t baselineAge = baselineSlot >= 0 ? static_cast<uint8_t>(snapshotId - historyIds[baselineSlot]) : 0;
+    const uint32_t* baseline = nullptr;
+    if (baselineSlot >= 0)
+    {
+        codec.Predict(&history[baselineSlot * codec.WordCount()], baselineAge, predicted.data());
+        baseline = predicted.data();
+    }
+
+    codec.Quantize(snapshot, words.data());
+    memcpy(out, &snapshotId, sizeof(uint16_t));
+    out[sizeof(uint16_t)] = baselineAge;
+    const size_t encoded = codec.Encode(words.data(), baseline, out + SNAPSHOT_STREAM_HEADER_SIZE,
+        outLen - SNAPSHOT_STREAM_HEADER_SIZE);
+    if (encoded == 0)
+    {
+        return 0;
+    }
+
+    const int slot = snapshotId % SNAPSHOT_HISTORY_SIZE;
+    std::copy(words.begin(), words.end(), history.begin() + slot * codec.WordCount());
+    historyIds[slot] = snapshotId;
+
+    // A low byte of 0 is reserved for keyframe requests
+    if (!isUsableId(++nextSnapshotId))
+    {
+        nextSnapshotId++;
+    }
+
+    return SNAPSHOT_STREAM_HEADER_SIZE + encoded;
+}
+
+void SnapshotStreamEncoder::Ack(int peerId, uint8_t ack, uint64_t nowMs)
+{
+    PeerAcks& peer = peers[peerId];
+    peer.lastAckMs = nowMs;
+    if (ack == SNAPSHOT_NEEDS_KEYFRAME)
+    {
+        memset(peer.acked, 0, sizeof(peer.acked));
+        return;
+    }
+
+    // The newest id handed out with this low byte. An ack older than 256 snapshots can land on the wrong one,
+    // which the receiver turns into a keyframe request once that baseline is used.
+    uint16_t snapshotId = static_cast<uint16_t>((nextSnapshotId & 0xFF00) | ack);
+    if (!isNewerId(nextSnapshotId, snapshotId))
+    {
+        snapshotId -= 0x100;
+    }
+
+    const int slot = snapshotId % SNAPSHOT_HISTORY_SIZE;
+    if (historyIds[slot] == snapshotId)
+    {
+        peer.acked[slot] = snapshotId;
+    }
+}
+
+void SnapshotStreamEncoder::Reset()
+{
+    nextSnapshotId = 1;
+    memset(historyIds, 0, sizeof(historyIds));
+    peers.clear();
+}
+
+SnapshotStreamDecoder::SnapshotStreamDecoder(const SnapshotCodec& codec)
+    : codec(codec), history(SNAPSHOT_HISTORY_SIZE * codec.WordCount()), words(codec.WordCount()),
+      predicted(codec.WordCount())
+{
+}
+
+SnapshotStreamDecoder::Result SnapshotStreamDecoder::Decode(const uint8_t* in, size_t inLen, void* snapshot,
+    uint16_t* snapshotId, size_t* bytesConsumed)
+{
+    if (inLen < SNAPSHOT_STREAM_HEADER_SIZE)
+    {
+        return Result::CORRUPT;
+    }
+
+    uint16_t id;
+    memcpy(&id, in, sizeof(uint16_t));
+    const uint8_t baselineAge = in[sizeof(uint16_t)];
+    const uint16_t baselineId = static_cast<uint16_t>(id - baselineAge);
+    if (!isUsableId(id) || (baselineAge != 0 && !isUsableId(baselineId)))
+    {
+        return Result::CORRUPT;
+    }
+
+    const uint32_t* baseline = nullptr;
+    if (baselineAge != 0)
+    {
+        const int baselineSlot = baselineId % SNAPSHOT_HISTORY_SIZE;
+        if (historyIds[baselineSlot] != baselineId)
+        {
+            ackId = SNAPSHOT_NEEDS_KEYFRAME;
+            return Result::MISSING_BASELINE;
+        }
+        codec.Predict(&history[baselineSlot * codec.WordCount()], baselineAge, predicted.data());
+        baseline = predicted.data();
+    }
+
+    // Decode into scratch first, the target slot may still hold the baseline
+    const size_t read = codec.Decode(in + SNAPSHOT_STREAM_HEADER_SIZE, inLen - SNAPSHOT_STREAM_HEADER_SIZE, baseline,
+        words.data());
+    if (read == 0)
+    {
+        return Result::CORRUPT;
+    }
+
+    const int slot = id % SNAPSHOT_HISTORY_SIZE;
+    std::copy(words.begin(), words.end(), history.begin() + slot * codec.WordCount());
+    historyIds[slot] = id;
+    if (ackId == SNAPSHOT_NEEDS_KEYFRAME || isNewerId(id, ackId))
+    {
+        ackId = id;
+    }
+
+    codec.Dequantize(words.data(), snapshot);
+    *snapshotId = id;
+    if (bytesConsumed != nullptr)
+    {
+        *bytesConsumed = SNAPSHOT_STREAM_HEADER_SIZE + read;
+    }
+    return Result::OK;
+}
+
+void SnapshotStreamDecoder::Reset()
+{
+    memset(historyIds, 0, sizeof(historyIds));
+    ackId = SNAPSHOT_NEEDS_KEYFRAME;
+}
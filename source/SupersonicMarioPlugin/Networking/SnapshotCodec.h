@@ -0,0 +1,130 @@
+#pragma once
+// SnapshotCodec.h
+// Quantized, delta-compressed encoding of fixed-size state snapshots.
+//
+// A snapshot is handled as an array of 32-bit words. Float fields that are
+// listed as quantized are converted to fixed point first, so small movements
+// turn into small integer deltas. A snapshot is encoded against a baseline
+// the receiver already has as a two-level change mask (one bit per group of
+// 8 words, then one bit per word of each changed group) followed by a varint
+// per changed word. Unchanged words only cost their mask bits. Quantized
+// fields can name a rate field they advance by every snapshot, like a
+// position and its velocity, and are then delta'd against where the rate
+// would have taken them since the baseline, so steady movement costs mask
+// bits too.
+//
+// SnapshotStreamEncoder/SnapshotStreamDecoder wrap the codec for a single
+// stream, picking the newest snapshot every peer has acknowledged as the
+// baseline and falling back to a keyframe when there is none. Acks only
+// carry the low byte of a snapshot id: ids with a zero low byte are never
+// handed out, and the history is far shorter than 256 snapshots.
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#define SNAPSHOT_HISTORY_SIZE 32
+#define SNAPSHOT_PEER_TIMEOUT_MS 2000
+#define SNAPSHOT_NEEDS_KEYFRAME 0 // Ack value a receiver sends when it is missing a baseline
+#define SNAPSHOT_KEYFRAME_INTERVAL 64 // Lets receivers that never ack, or only just joined, catch up
+#define SNAPSHOT_VARINT_MAX_SIZE 5
+#define SNAPSHOT_STREAM_HEADER_SIZE 3 // uint16 snapshot id, uint8 baseline age
+
+struct SnapshotQuantizedField
+{
+    uint32_t offset; // Byte offset of the first float
+    uint32_t count;  // Number of consecutive floats
+    float scale;     // Fixed point steps per unit
+    int32_t rateOffset = -1; // Quantized floats these advance by every snapshot, -1 for none
+};
+
+class SnapshotCodec
+{
+public:
+    SnapshotCodec(size_t snapshotSize, const std::vector<SnapshotQuantizedField>& quantizedFields);
+
+    size_t SnapshotSize() const { return snapshotSize; }
+    size_t WordCount() const { return wordScale.size(); }
+    size_t MaxEncodedSize() const;
+
+    void Quantize(const void* snapshot, uint32_t* words) const;
+    void Dequantize(const uint32_t* words, void* snapshot) const;
+
+    // Moves the fields that have a rate age snapshots ahead of baseline, the result is what Encode should diff against.
+    void Predict(const uint32_t* baseline, uint32_t age, uint32_t* predicted) const;
+    // Encodes words against baseline, or against all zeros if baseline is null. Returns bytes written, 0 if out is too small.
+    size_t Encode(const uint32_t* words, const uint32_t* baseline, uint8_t* out, size_t outLen) const;
+    // Decodes into words. Returns bytes consumed, 0 if the input is truncated or corrupt.
+    size_t Decode(const uint8_t* in, size_t inLen, const uint32_t* baseline, uint32_t* words) const;
+
+private:
+    size_t snapshotSize;
+    std::vector<float> wordScale; // 0 for words that are delta'd as raw bits
+    std::vector<int32_t> wordRate; // Word a quantized word advances by every snapshot, -1 for none
+};
+
+class SnapshotStreamEncoder
+{
+public:
+    explicit SnapshotStreamEncoder(const SnapshotCodec& codec);
+
+    // Writes snapshot id, baseline age and the encoded snapshot. Returns bytes written, 0 if out is too small.
+    size_t Encode(const void* snapshot, uint64_t nowMs, uint8_t* out, size_t outLen);
+    // Records that peerId has the snapshot ack is the low byte of, or needs a keyframe if ack is SNAPSHOT_NEEDS_KEYFRAME.
+    void Ack(int peerId, uint8_t ack, uint64_t nowMs);
+    void ForgetPeer(int peerId) { peers.erase(peerId); }
+    void Reset();
+
+    size_t MaxEncodedSize() const { return SNAPSHOT_STREAM_HEADER_SIZE + codec.MaxEncodedSize(); }
+
+private:
+    struct PeerAcks
+    {
+        uint16_t acked[SNAPSHOT_HISTORY_SIZE] = {};
+        uint64_t lastAckMs = 0;
+    };
+
+    int findBaseline(uint64_t nowMs);
+
+    const SnapshotCodec& codec;
+    uint16_t nextSnapshotId = 1;
+    std::vector<uint32_t> history;
+    uint16_t historyIds[SNAPSHOT_HISTORY_SIZE] = {};
+    std::vector<uint32_t> words;
+    std::vector<uint32_t> predicted;
+    std::unordered_map<int, PeerAcks> peers;
+};
+
+class SnapshotStreamDecoder
+{
+public:
+    enum class Result
+    {
+        OK,
+        MISSING_BASELINE,
+        CORRUPT,
+    };
+
+    explicit SnapshotStreamDecoder(const SnapshotCodec& codec);
+
+    // Decodes a snapshot written by SnapshotStreamEncoder. bytesConsumed is set on success.
+    Result Decode(const uint8_t* in, size_t inLen, void* snapshot, uint16_t* snapshotId, size_t* bytesConsumed = nullptr);
+    // Low byte of the newest snapshot id decoded, or SNAPSHOT_NEEDS_KEYFRAME if the last decode was missing its baseline.
+    uint8_t AckId() const { return static_cast<uint8_t>(ackId); }
+    void Reset();
+
+private:
+    const SnapshotCodec& codec;
+    std::vector<uint32_t> history;
+    uint16_t historyIds[SNAPSHOT_HISTORY_SIZE] = {};
+    std::vector<uint32_t> words;
+    std::vector<uint32_t> predicted;
+    uint16_t ackId = SNAPSHOT_NEEDS_KEYFRAME;
+};
+
+namespace SnapshotVarint
+{
+    size_t Write(uint32_t value, uint8_t* out, size_t outLen);
+    size_t Read(const uint8_t* in, size_t inLen, uint32_t* value);
+}
@@ -0,0 +1,269 @@
+// SnapshotInterpolator.cpp
+// Jitter buffer for a remote player's snapshot stream.
+
+#include "SnapshotInterpolator.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const double PI = 3.14159265358979323846;
+
+    void readFloats(const uint8_t* snapshot, uint32_t offset, float* values, size_t count)
+    {
+        memcpy(values, snapshot + offset, count * sizeof(float));
+    }
+
+    void writeFloats(uint8_t* snapshot, uint32_t offset, const float* values, size_t count)
+    {
+        memcpy(snapshot + offset, values, count * sizeof(float));
+    }
+
+    float lerpAngle(float from, float to, double t)
+    {
+        double delta = std::fmod((double)to - from, 2.0 * PI);
+        if (delta > PI)
+        {
+            delta -= 2.0 * PI;
+        }
+        else if (delta < -PI)
+        {
+            delta += 2.0 * PI;
+        }
+        return (float)(from + delta * t);
+    }
+}
+
+SnapshotInterpolator::SnapshotInterpolator(size_t snapshotSize, SnapshotKinematics kinematics)
+    : SnapshotInterpolator(snapshotSize, kinematics, Config())
+{
+}
+
+SnapshotInterpolator::SnapshotInterpolator(size_t snapshotSize, SnapshotKinematics kinematics, Config config)
+    : snapshotSize(snapshotSize), kinematics(kinematics), config(config)
+{
+    for (Entry& entry : entries)
+    {
+        entry.data.resize(snapshotSize);
+    }
+}
+
+void SnapshotInterpolator::Reset()
+{
+    head = 0;
+    count = 0;
+    hasClockOffset = false;
+    hasLastTime = false;
+    hasShownTime = false;
+    stats = Stats();
+}
+
+void SnapshotInterpolator::AddOneShotField(uint32_t offset, uint32_t size)
+{
+    oneShotFields.push_back({ offset, size });
+}
+
+uint32_t SnapshotInterpolator::UnwrapTime(uint16_t senderMs)
+{
+    if (!hasLastTime)
+    {
+        hasLastTime = true;
+        // Half the range up, so a reordered earlier snapshot counts down from it instead of wrapping below 0
+        unwrappedTime = senderMs + 0x8000u;
+    }
+    else
+    {
+        unwrappedTime += static_cast<int16_t>(senderMs - lastTime);
+    }
+    lastTime = senderMs;
+    return unwrappedTime;
+}
+
+void SnapshotInterpolator::Push(uint32_t senderMs, double arrivalMs, const void* snapshot)
+{
+    // The fastest arrival is the best guess of the one way delay, slower ones only move the offset up slowly
+    // so it can follow clock drift without every late packet dragging playback back.
+    const double offset = arrivalMs - senderMs;
+    if (!hasClockOffset || offset < clockOffsetMs)
+    {
+        clockOffsetMs = offset;
+        hasClockOffset = true;
+    }
+    else
+    {
+        clockOffsetMs += std::min(offset - clockOffsetMs, INTERPOLATION_CLOCK_RELAX_MS);
+    }
+
+    const double playbackMs = arrivalMs - clockOffsetMs - config.delayMs;
+    if (senderMs < playbackMs)
+    {
+        stats.lateSnapshots++;
+    }
+
+    // Reordered snapshots are slotted in as long as playback has not passed them
+    size_t index = count;
+    while (index > 0 && at(index - 1).senderMs > senderMs)
+    {
+        index--;
+    }
+    if ((index > 0 && at(index - 1).senderMs == senderMs) || (index == 0 && count > 0 && at(0).senderMs <= playbackMs))
+    {
+        stats.droppedSnapshots++;
+        return;
+    }
+
+    if (count == INTERPOLATION_BUFFER_SIZE)
+    {
+        if (index == 0)
+        {
+            stats.droppedSnapshots++;
+            return;
+        }
+        head = (head + 1) % INTERPOLATION_BUFFER_SIZE;
+        count--;
+        index--;
+    }
+
+    // Rotate the free slot down to the insert position, the snapshot buffers are swapped instead of copied
+    for (size_t i = count; i > index; i--)
+    {
+        Entry& dst = slot(i);
+        Entry& src = slot(i - 1);
+        dst.senderMs = src.senderMs;
+        dst.data.swap(src.data);
+    }
+    Entry& entry = slot(index);
+    entry.senderMs = senderMs;
+    memcpy(entry.data.data(), snapshot, snapshotSize);
+    count++;
+}
+
+bool SnapshotInterpolator::Sample(double nowMs, void* out, SampleInfo* info)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    const double playbackMs = nowMs - clockOffsetMs - config.delayMs;
+
+    // Keep exactly one snapshot at or before the playback time
+    while (count >= 2 && at(1).senderMs <= playbackMs)
+    {
+        head = (head + 1) % INTERPOLATION_BUFFER_SIZE;
+        count--;
+    }
+
+    const Entry& from = at(0);
+    stats.depth = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        stats.depth += at(i).senderMs > playbackMs ? 1 : 0;
+    }
+
+    uint8_t* outBytes = static_cast<uint8_t*>(out);
+    bool extrapolated = false;
+    if (playbackMs <= from.senderMs)
+    {
+        // Still filling the buffer
+        memcpy(outBytes, from.data.data(), snapshotSize);
+        stats.extrapolationMs = 0.0;
+    }
+    else if (count >= 2)
+    {
+        const Entry& to = at(1);
+        const double spanMs = (double)(to.senderMs - from.senderMs);
+        interpolate(from, to, (playbackMs - from.senderMs) / spanMs, spanMs, outBytes);
+        stats.extrapolationMs = 0.0;
+        stats.interpolatedSamples++;
+    }
+    else
+    {
+        const double aheadMs = playbackMs - from.senderMs;
+        if (aheadMs > config.maxExtrapolationMs)
+        {
+            stats.frozenSamples++;
+        }
+        extrapolate(from, std::min(aheadMs, config.maxExtrapolationMs), outBytes);
+        stats.extrapolationMs = aheadMs;
+        stats.extrapolatedSamples++;
+        extrapolated = true;
+    }
+
+    // A hit or a sound in the snapshot happened once, however many frames show that snapshot
+    if (hasShownTime && shownTime == from.senderMs)
+    {
+        for (const SnapshotOneShotField& field : oneShotFields)
+        {
+            memset(outBytes + field.offset, 0, field.size);
+        }
+    }
+    hasShownTime = true;
+    shownTime = from.senderMs;
+
+    if (info != nullptr)
+    {
+        info->baseTimeMs = from.senderMs;
+        info->extrapolated = extrapolated;
+    }
+    return true;
+}
+
+void SnapshotInterpolator::interpolate(const Entry& from, const Entry& to, double t, double spanMs, uint8_t* out) const
+{
+    memcpy(out, from.data.data(), snapshotSize);
+
+    float p0[3], p1[3], v0[3], v1[3];
+    readFloats(from.data.data(), kinematics.positionOffset, p0, 3);
+    readFloats(to.data.data(), kinematics.positionOffset, p1, 3);
+    readFloats(from.data.data(), kinematics.velocityOffset, v0, 3);
+    readFloats(to.data.data(), kinematics.velocityOffset, v1, 3);
+
+    const float dx = p1[0] - p0[0];
+    const float dy = p1[1] - p0[1];
+    const float dz = p1[2] - p0[2];
+    if (dx * dx + dy * dy + dz * dz > config.snapDistance * config.snapDistance)
+    {
+        return;
+    }
+
+    // Cubic Hermite basis, the tangents are the velocities scaled to the span between the snapshots
+    const double t2 = t * t;
+    const double t3 = t2 * t;
+    const double h00 = 2 * t3 - 3 * t2 + 1;
+    const double h10 = t3 - 2 * t2 + t;
+    const double h01 = -2 * t3 + 3 * t2;
+    const double h11 = t3 - t2;
+    const double tangentScale = spanMs / config.velocityTickMs;
+
+    float position[3], velocity[3];
+    for (int i = 0; i < 3; i++)
+    {
+        position[i] = (float)(h00 * p0[i] + h10 * v0[i] * tangentScale + h01 * p1[i] + h11 * v1[i] * tangentScale);
+        velocity[i] = (float)(v0[i] + (v1[i] - v0[i]) * t);
+    }
+    writeFloats(out, kinematics.positionOffset, position, 3);
+    writeFloats(out, kinematics.velocityOffset, velocity, 3);
+
+    float a0, a1;
+    readFloats(from.data.data(), kinematics.angleOffset, &a0, 1);
+    readFloats(to.data.data(), kinematics.angleOffset, &a1, 1);
+    float angle = lerpAngle(a0, a1, t);
+    writeFloats(out, kinematics.angleOffset, &angle, 1);
+}
+
+void SnapshotInterpolator::extrapolate(const Entry& from, double aheadMs, uint8_t* out) const
+{
+    memcpy(out, from.data.data(), snapshotSize);
+
+    float position[3], velocity[3];
+    readFloats(from.data.data(), kinematics.positionOffset, position, 3);
+    readFloats(from.data.data(), kinematics.velocityOffset, velocity, 3);
+    const double ticks = aheadMs / config.velocityTickMs;
+    for (int i = 0; i < 3; i++)
+    {
+        position[i] += (float)(velocity[i] * ticks);
+    }
+    writeFloats(out, kinematics.positionOffset, position, 3);
+}
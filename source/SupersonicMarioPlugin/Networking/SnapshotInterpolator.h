@@ -0,0 +1,115 @@
+#pragma once
+// SnapshotInterpolator.h
+// Jitter buffer for a remote player's snapshot stream.
+//
+// Snapshots are stored with the sender's timestamp and played back a fixed
+// delay behind the sender's clock, which is mapped to the local clock from
+// the fastest arrivals seen. Arrival jitter smaller than the delay is
+// absorbed completely. Between two snapshots the position follows a cubic
+// Hermite curve through both positions and velocities, and when the next
+// snapshot is late the last one is extrapolated along its velocity for at
+// most maxExtrapolationMs before it freezes.
+//
+// Snapshots are opaque fixed-size structs, the interpolated fields are found
+// through byte offsets like the fields of a SnapshotCodec. Everything that is
+// not interpolated is copied from the older of the two snapshots, except
+// one-shot fields like sounds or hits, which are zeroed in every sample after
+// the first one that shows their snapshot.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define INTERPOLATION_BUFFER_SIZE 32
+#define INTERPOLATION_DEFAULT_DELAY_MS 100.0
+#define INTERPOLATION_DEFAULT_MAX_EXTRAPOLATION_MS 100.0
+#define INTERPOLATION_CLOCK_RELAX_MS 0.05 // How fast the clock offset follows a stream that slowed down, per snapshot
+
+struct SnapshotKinematics
+{
+    uint32_t positionOffset; // float[3]
+    uint32_t velocityOffset; // float[3], in position units per velocityTickMs
+    uint32_t angleOffset;    // float, radians
+};
+
+struct SnapshotOneShotField
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+class SnapshotInterpolator
+{
+public:
+    struct Config
+    {
+        double velocityTickMs = 1000.0 / 30.0; // Time the velocity fields are relative to
+        double delayMs = INTERPOLATION_DEFAULT_DELAY_MS;
+        double maxExtrapolationMs = INTERPOLATION_DEFAULT_MAX_EXTRAPOLATION_MS;
+        float snapDistance = 2000.0f; // Snapshots further apart than this are not blended, e.g. after a respawn
+    };
+
+    struct Stats
+    {
+        size_t depth = 0;                // Snapshots buffered ahead of the playback time
+        double extrapolationMs = 0.0;    // How far past the newest snapshot the last sample was
+        uint64_t interpolatedSamples = 0;
+        uint64_t extrapolatedSamples = 0;
+        uint64_t frozenSamples = 0;      // Samples that hit maxExtrapolationMs
+        uint64_t lateSnapshots = 0;      // Snapshots that arrived after their playback time
+        uint64_t droppedSnapshots = 0;   // Duplicates and snapshots older than the playback position
+    };
+
+    struct SampleInfo
+    {
+        uint32_t baseTimeMs = 0; // Sender time of the snapshot the non interpolated fields came from
+        bool extrapolated = false;
+    };
+
+    SnapshotInterpolator(size_t snapshotSize, SnapshotKinematics kinematics);
+    SnapshotInterpolator(size_t snapshotSize, SnapshotKinematics kinematics, Config config);
+
+    // Adds a snapshot taken at senderMs on the sender's clock, received at arrivalMs on the local clock.
+    void Push(uint32_t senderMs, double arrivalMs, const void* snapshot);
+    // Marks size bytes at offset as belonging to a single snapshot, so they only come out of the first Sample that shows it
+    void AddOneShotField(uint32_t offset, uint32_t size);
+    // Writes the snapshot to show at nowMs into out. Returns false while nothing has been received.
+    bool Sample(double nowMs, void* out, SampleInfo* info = nullptr);
+    void Reset();
+
+    // Unwraps a 16-bit sender timestamp into one that keeps counting up, as long as snapshots are less than 32 s apart.
+    // Starts 32768 ms above the first timestamp, so snapshots sent before it still get an earlier time.
+    uint32_t UnwrapTime(uint16_t senderMs);
+
+    Config& GetConfig() { return config; }
+    const Stats& GetStats() const { return stats; }
+    size_t Buffered() const { return count; }
+
+private:
+    struct Entry
+    {
+        uint32_t senderMs;
+        std::vector<uint8_t> data;
+    };
+
+    const Entry& at(size_t index) const { return entries[(head + index) % INTERPOLATION_BUFFER_SIZE]; }
+    Entry& slot(size_t index) { return entries[(head + index) % INTERPOLATION_BUFFER_SIZE]; }
+    void interpolate(const Entry& from, const Entry& to, double t, double spanMs, uint8_t* out) const;
+    void extrapolate(const Entry& from, double aheadMs, uint8_t* out) const;
+
+    size_t snapshotSize;
+    SnapshotKinematics kinematics;
+    std::vector<SnapshotOneShotField> oneShotFields;
+    Config config;
+    Stats stats;
+    Entry entries[INTERPOLATION_BUFFER_SIZE];
+    size_t head = 0;
+    size_t count = 0;
+    bool hasClockOffset = false;
+    double clockOffsetMs = 0.0; // Local arrival time minus sender time of the fastest snapshots seen
+    bool hasLastTime = false;
+    uint16_t lastTime = 0;
+    uint32_t unwrappedTime = 0;
+    bool hasShownTime = false;
+    uint32_t shownTime = 0; // Sender time of the snapshot the last sample's one-shot fields came from
+};
@@ -66,21 +66,32 @@ void clientThread()
 
 	BM_LOG("Connected to server");
 	char buf[TCP_BUF_SIZE];
+	instance->frameReader.Reset();
+	UdpTransport::getInstance().ConnectToHost(instance->serverIp, instance->serverPort);
 
 	while (true)
 	{
-		ZeroMemory(buf, TCP_BUF_SIZE);
 		int bytesReceived = recv(instance->sock, buf, TCP_BUF_SIZE, 0);
-		if (bytesReceived <= sizeof(int))
+		if (bytesReceived <= 0)
 		{
 			break;
 		}
-		if (instance != nullptr && instance->msgReceivedClbk != nullptr)
+
+		// A single recv can hold a partial frame or several frames at once
+		bool validStream = instance->frameReader.Feed(buf, bytesReceived, [](const NetcodeFrame& frame) {
+			if (instance != nullptr && instance->msgReceivedClbk != nullptr)
+			{
+				instance->msgReceivedClbk(frame);
+			}
+		});
+		if (!validStream)
 		{
-			instance->msgReceivedClbk(buf, bytesReceived);
+			BM_LOG("Received a corrupt netcode frame from the server");
+			break;
 		}
 	}
 
+	UdpTransport::getInstance().Stop();
 	closesocket(instance->sock);
 	instance->sock = INVALID_SOCKET;
 	WSACleanup();
@@ -112,7 +123,7 @@ void TcpClient::DisconnectFromServer()
 	WSACleanup();
 }
 
-void TcpClient::RegisterMessageCallback(void (*clbk)(char* buf, int len))
+void TcpClient::RegisterMessageCallback(void (*clbk)(const NetcodeFrame& frame))
 {
 	msgReceivedClbk = clbk;
 }
@@ -123,5 +134,5 @@ void TcpClient::SendBytes(char* buf, int len)
 	{
 		return;
 	}
-	send(sock, buf, len, 0);
+	Networking::SendAll(sock, buf, len);
 }
\ No newline at end of file
@@ -10,186 +10,61 @@ TcpServer::TcpServer()
 	instance = this;
 }
 
-void serverThread()
+TcpServer::~TcpServer()
 {
-	if (instance == nullptr)
+	if (running)
 	{
-		return;
-	}
-
-	WSADATA wsData;
-	WORD ver = MAKEWORD(2, 2);
-
-	// Start winsock
-	int wsOk = WSAStartup(ver, &wsData);
-	if (wsOk != 0)
-	{
-		BM_LOG("Can't initialize winsock!");
-		return;
-	}
-
-	// Create listening socket
-	instance->listening = socket(AF_INET, SOCK_STREAM, 0);
-	if (instance->listening == INVALID_SOCKET)
-	{
-		BM_LOG("Can't create a socket!");
-		WSACleanup();
-		return;
-	}
-
-	sockaddr_in hint;
-	hint.sin_family = AF_INET;
-	hint.sin_port = htons(instance->port);
-	hint.sin_addr.S_un.S_addr = INADDR_ANY;
-
-	int bindResult = bind(instance->listening, (sockaddr*)&hint, sizeof(hint));
-	if(bindResult == SOCKET_ERROR)
-	{
-		std::stringstream errStrStream;
-		errStrStream << "After bind() Error#" << WSAGetLastError();
-		BM_LOG(errStrStream.str());
-	}
-
-	// Tell winsock the socket is for listening
-	int listenResult = listen(instance->listening, SOMAXCONN);
-
-	if (listenResult != 0)
-	{
-		std::stringstream errStrStream;
-		errStrStream << "Couldn't Start Listening Thread. Error#" << WSAGetLastError() << " listenResult: " << listenResult;
-		BM_LOG(errStrStream.str());
-	}
-
-	instance->masterSetSema.acquire();
-	FD_ZERO(&instance->master);
-	FD_SET(instance->listening, &instance->master);
-	instance->masterSetSema.release();
-
-	// Create a socket used solely to notify we should close the server
-	sockaddr_in closeHint;
-	closeHint.sin_family = AF_INET;
-	closeHint.sin_port = htons(instance->port);
-	std::string localAddress = "127.0.0.1";
-	inet_pton(AF_INET, localAddress.c_str(), &closeHint.sin_addr);
-	instance->stopServerSocket = socket(AF_INET, SOCK_STREAM, 0);
-	int connResult = connect(instance->stopServerSocket, (sockaddr*)&closeHint, sizeof(closeHint));
-	if (connResult == SOCKET_ERROR)
-	{
-		std::stringstream errStrStream;
-		errStrStream << "Can't connect close sock to server. Error#" << WSAGetLastError();
-		BM_LOG(errStrStream.str());
-		closesocket(instance->stopServerSocket);
-		instance->stopServerSocket = INVALID_SOCKET;
-		WSACleanup();
-	}
-
-	// Accept the exit socket
-	instance->serverExitSocket = accept(instance->listening, nullptr, nullptr);
-	if (instance->serverExitSocket == INVALID_SOCKET || instance->stopServerSocket == INVALID_SOCKET)
-	{
-		std::stringstream errStrStream;
-		errStrStream << "Can't accept close sock to server. Error#" << WSAGetLastError();
-		BM_LOG(errStrStream.str());
-		closesocket(instance->stopServerSocket);
-		instance->stopServerSocket = INVALID_SOCKET;
-		WSACleanup();
-		return;
+		StopServer();
 	}
-	instance->masterSetSema.acquire();
-	FD_SET(instance->serverExitSocket, &instance->master);
-	instance->masterSetSema.release();
+}
 
-	BM_LOG("Server started and listening");
+void logRelayError(const std::string& msg)
+{
+	BM_ERROR_LOG(msg);
+}
 
-	// Main server loop
-	char buf[TCP_BUF_SIZE];
-	while (true)
-	{
-		if (instance->stopServerSocket == INVALID_SOCKET)
+NetcodeRelay::Hooks makeRelayHooks()
+{
+	NetcodeRelay::Hooks hooks;
+	hooks.onFrame = [](relay_conn_t conn, const NetcodeFrame& frame) {
+		if (frame.Type() == NetcodeMessageType::MARIO_BODY_STATE)
 		{
-			break;
+			UdpTransport::getInstance().QueueRelay(frame.data, frame.Size());
 		}
 
-		fd_set setCopy = instance->master;
-		int socketCount = select(0, &setCopy, nullptr, nullptr, nullptr);
-
-		for (int i = 0; i < socketCount; i++)
+		// Handle the message ourselves too if a callback is set
+		if (instance->msgReceivedClbk != nullptr)
 		{
-			SOCKET sock = setCopy.fd_array[i];
-			if (sock == instance->listening)
-			{
-				// Accept a new connection
-				SOCKET client = accept(instance->listening, nullptr, nullptr);
-
-				if (client == INVALID_SOCKET)
-				{
-					instance->stopServerSocket = INVALID_SOCKET;
-					break;
-				}
-
-				// Add new connection to list of connected clients
-				int flags = 1;
-				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&flags, sizeof(flags));
-				instance->masterSetSema.acquire();
-				FD_SET(client, &instance->master);
-				instance->masterSetSema.release();
-			}
-			else if (sock == instance->serverExitSocket)
-			{
-				instance->stopServerSocket = INVALID_SOCKET;
-				break;
-			}
-			else
-			{
-				ZeroMemory(buf, TCP_BUF_SIZE);
-
-				// Receive message
-				int bytesIn = recv(sock, buf, TCP_BUF_SIZE, 0);
-				if (bytesIn <= 0)
-				{
-					// Drop the client
-					closesocket(sock);
-					instance->masterSetSema.acquire();
-					FD_CLR(sock, &instance->master);
-					instance->masterSetSema.release();
-				}
-				else
-				{
-					// Send message to other clients, and definitely NOT the listening socket
-					for (int k = 0; k < instance->master.fd_count; k++)
-					{
-						SOCKET outSock = instance->master.fd_array[k];
-						if (outSock != instance->listening && outSock != sock && outSock != instance->serverExitSocket)
-						{
-							send(outSock, buf, bytesIn, 0);
-						}
-					}
-
-					// Handle the message ourselves too if a callback is set
-					if (instance != nullptr && instance->msgReceivedClbk != nullptr)
-					{
-						instance->msgReceivedClbk(buf, bytesIn);
-					}
-
-
-				}
-
-			}
+			instance->msgReceivedClbk(frame);
 		}
-	}
-
-	// Close all open sockets
-	closesocket(instance->listening);
-	instance->stopServerSocket = INVALID_SOCKET;
+	};
+	hooks.onUdpOffer = [](relay_conn_t conn, uint32_t udpToken) {
+		UdpTransport::getInstance().OfferPeer(udpToken);
+	};
+	hooks.onUdpReady = [](relay_conn_t conn, uint32_t udpToken) {
+		UdpTransport::getInstance().ConfirmPeer(udpToken);
+	};
+	hooks.onDisconnect = [](relay_conn_t conn, uint32_t udpToken) {
+		if (udpToken != 0)
+		{
+			UdpTransport::getInstance().DropPeer(udpToken);
+		}
+	};
+	return hooks;
+}
 
-	// Cleanup winsock
-	WSACleanup();
-	BM_LOG("Server stopped");
+// Everything on the relay's sockets happens on this thread, other threads only post to it
+void serverThread(NetcodeRelay* relay)
+{
+	while (!instance->stopRequested)
+	{
+		relay->RunOnce();
+	}
 }
 
 void TcpServer::StartServer(int inPort)
 {
-	if (stopServerSocket != INVALID_SOCKET)
+	if (running)
 	{
 		StopServer();
 	}
@@ -197,13 +72,29 @@ void TcpServer::StartServer(int inPort)
 	playerIdMap.clear();
 	nextPlayerId = 1;
 	port = inPort;
-	std::thread servThread(serverThread);
-	servThread.detach();
+
+	auto newRelay = std::make_unique<NetcodeRelay>(RelayIoBackend::Create(logRelayError), makeRelayHooks());
+	if (!newRelay->Listen((uint16_t)port))
+	{
+		BM_LOG("Couldn't start listening thread");
+		return;
+	}
+
+	relaySema.acquire();
+	relay = std::move(newRelay);
+	relaySema.release();
+
+	stopRequested = false;
+	running = true;
+	relayThread = std::thread(serverThread, relay.get());
+
+	BM_LOG("Server started and listening");
+	UdpTransport::getInstance().StartHost(port);
 }
 
 void TcpServer::StopServer()
 {
-	if (stopServerSocket == INVALID_SOCKET)
+	if (!running)
 	{
 		BM_LOG("Tried to close server, but none are running!");
 		return;
@@ -211,32 +102,31 @@ void TcpServer::StopServer()
 
 	playerIdMap.clear();
 	nextPlayerId = 1;
-	std::string emptyStr = "";
-	int sendResult = send(stopServerSocket, emptyStr.c_str(), 1, 0);
+
+	stopRequested = true;
+	relay->Wake();
+	relayThread.join();
+	UdpTransport::getInstance().Stop();
+
+	// Closes all open sockets
+	relaySema.acquire();
+	relay.reset();
+	relaySema.release();
+	running = false;
+	BM_LOG("Server stopped");
 }
 
-void TcpServer::RegisterMessageCallback(void (*clbk)(char* buf, int len))
+void TcpServer::RegisterMessageCallback(void (*clbk)(const NetcodeFrame& frame))
 {
 	msgReceivedClbk = clbk;
 }
 
-void TcpServer::SendBytes(char* buf, int len)
+void TcpServer::SendBytes(const char* buf, int len)
 {
-	if (stopServerSocket == INVALID_SOCKET)
+	relaySema.acquire();
+	if (relay != nullptr)
 	{
-		return;
+		relay->Broadcast(buf, len);
 	}
-	masterSetSema.acquire();
-	fd_set setCopy = master;
-	masterSetSema.release();
-
-	for (int k = 0; k < instance->master.fd_count; k++)
-	{
-		SOCKET outSock = instance->master.fd_array[k];
-		if (outSock != listening && outSock != serverExitSocket)
-		{
-			send(outSock, buf, len, 0);
-		}
-	}
-
-}
\ No newline at end of file
+	relaySema.release();
+}
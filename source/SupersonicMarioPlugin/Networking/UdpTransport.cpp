@@ -0,0 +1,540 @@
+// UdpTransport.cpp
+// Unreliable, sequenced UDP channel for SM64 body state snapshots.
+
+#include "Networking.h"
+
+#define UDP_HELLO_INTERVAL_MS 250
+#define UDP_HELLO_ATTEMPTS 20
+#define UDP_IDLE_RECV_TIMEOUT_MS 100
+#define UDP_BUSY_RECV_TIMEOUT_MS 2
+// Offered peers that haven't confirmed by then are dropped, well past the time a client keeps sending hellos
+#define UDP_PEER_CONFIRM_TIMEOUT_MS (2 * UDP_HELLO_INTERVAL_MS * UDP_HELLO_ATTEMPTS)
+
+UdpTransport* udpInstance = &UdpTransport::getInstance();
+
+bool sameAddr(const sockaddr_in& a, const sockaddr_in& b)
+{
+	return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+void sendHandshakeFrame(NetcodeMessageType type, const sockaddr_in& addr, uint32_t token)
+{
+	char frameBuf[sizeof(NetcodeFrameHeader) + sizeof(uint32_t)];
+	size_t frameLen = NetcodeFraming::WriteFrame(frameBuf, sizeof(frameBuf), type, 0, (const char*)&token, sizeof(token));
+	udpInstance->sendTo(addr, frameBuf, (int)frameLen);
+}
+
+void handleHostDatagram(const NetcodeFrame& frame, const sockaddr_in& from)
+{
+	if (frame.Type() == NetcodeMessageType::UDP_HELLO)
+	{
+		if (frame.payloadLen != sizeof(uint32_t))
+		{
+			return;
+		}
+		uint32_t peerToken = *((uint32_t*)frame.payload);
+
+		// Only tokens a live TCP connection offered get an answer, so a spoofed sender can't make us stream to someone else.
+		// Once confirmed the address is fixed and a late hello can't redirect the stream.
+		udpInstance->peersSema.acquire();
+		auto peer = std::find_if(udpInstance->peers.begin(), udpInstance->peers.end(),
+			[peerToken](const UdpTransport::Peer& p) { return p.token == peerToken; });
+		bool offered = peer != udpInstance->peers.end() && (!peer->confirmed || sameAddr(peer->addr, from));
+		if (offered)
+		{
+			peer->addr = from;
+			peer->hasAddr = true;
+		}
+		udpInstance->peersSema.release();
+		if (!offered)
+		{
+			return;
+		}
+
+		sendHandshakeFrame(NetcodeMessageType::UDP_HELLO_ACK, from, peerToken);
+		return;
+	}
+
+	if (frame.Type() != NetcodeMessageType::MARIO_BODY_STATE && frame.Type() != NetcodeMessageType::MARIO_INPUT)
+	{
+		return;
+	}
+
+	udpInstance->peersSema.acquire();
+	auto peer = std::find_if(udpInstance->peers.begin(), udpInstance->peers.end(),
+		[&from](const UdpTransport::Peer& p) { return p.confirmed && sameAddr(p.addr, from); });
+	bool knownPeer = peer != udpInstance->peers.end();
+	uint32_t peerToken = knownPeer ? peer->token : 0;
+	udpInstance->peersSema.release();
+	if (!knownPeer)
+	{
+		return;
+	}
+
+	udpInstance->interestSema.acquire();
+	udpInstance->interest.Observe(peerToken, frame.data, frame.Size());
+	udpInstance->interestSema.release();
+
+	// Inputs are simulated here and go no further
+	if (frame.Type() == NetcodeMessageType::MARIO_INPUT)
+	{
+		if (udpInstance->msgReceivedClbk != nullptr)
+		{
+			udpInstance->msgReceivedClbk(frame);
+		}
+		return;
+	}
+
+	// Queue for the other UDP peers until the end of the tick window, the TCP relay batches it for clients still on TCP
+	udpInstance->relayBatchSema.acquire();
+	if (udpInstance->relayBatch.Empty())
+	{
+		udpInstance->relayBatchStart = std::chrono::steady_clock::now();
+	}
+	udpInstance->relayBatch.Add(peerToken, frame.data, frame.Size());
+	udpInstance->relayBatchSema.release();
+	TcpServer::getInstance().SendBytes(frame.data, frame.Size());
+
+	if (udpInstance->msgReceivedClbk != nullptr)
+	{
+		udpInstance->msgReceivedClbk(frame);
+	}
+}
+
+void handleClientDatagram(const NetcodeFrame& frame, const sockaddr_in& from)
+{
+	if (!sameAddr(from, udpInstance->hostAddr))
+	{
+		return;
+	}
+
+	if (frame.Type() == NetcodeMessageType::UDP_HELLO_ACK)
+	{
+		if (frame.payloadLen != sizeof(uint32_t) || *((uint32_t*)frame.payload) != udpInstance->token || udpInstance->handshakeDone)
+		{
+			return;
+		}
+
+		// Tell the host over TCP that it can stop sending us body state on the reliable stream
+		udpInstance->handshakeDone = true;
+		Networking::SendBytes(NetcodeMessageType::UDP_READY, (char*)&udpInstance->token, sizeof(uint32_t));
+		BM_LOG("UDP channel to server established");
+		return;
+	}
+
+	if (frame.Type() == NetcodeMessageType::MARIO_BODY_STATE && udpInstance->msgReceivedClbk != nullptr)
+	{
+		udpInstance->msgReceivedClbk(frame);
+	}
+}
+
+void udpThread(SOCKET threadSock)
+{
+	char buf[UDP_BUF_SIZE];
+	int helloAttempts = 0;
+	auto lastHello = std::chrono::steady_clock::time_point();
+	DWORD recvTimeout = 0;
+
+	while (udpInstance->sock == threadSock)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (!udpInstance->isHost && !udpInstance->handshakeDone &&
+			now - lastHello > std::chrono::milliseconds(UDP_HELLO_INTERVAL_MS))
+		{
+			if (helloAttempts++ == UDP_HELLO_ATTEMPTS)
+			{
+				BM_LOG("No UDP response from server, body state stays on TCP");
+			}
+			else if (helloAttempts < UDP_HELLO_ATTEMPTS)
+			{
+				sendHandshakeFrame(NetcodeMessageType::UDP_HELLO, udpInstance->hostAddr, udpInstance->token);
+				lastHello = now;
+			}
+		}
+
+		// Poll quickly while there are delayed datagrams or relayed frames to let out
+		udpInstance->relayBatchSema.acquire();
+		bool relayPending = !udpInstance->relayBatch.Empty();
+		udpInstance->relayBatchSema.release();
+		DWORD wantedTimeout = udpInstance->latencyMs > 0 || relayPending ? UDP_BUSY_RECV_TIMEOUT_MS : UDP_IDLE_RECV_TIMEOUT_MS;
+		if (wantedTimeout != recvTimeout)
+		{
+			recvTimeout = wantedTimeout;
+			setsockopt(threadSock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&recvTimeout, sizeof(recvTimeout));
+		}
+		udpInstance->flushDelayed();
+		udpInstance->flushRelayBatch();
+		if (udpInstance->isHost)
+		{
+			udpInstance->expireUnconfirmedPeers();
+		}
+
+		sockaddr_in from;
+		int fromLen = sizeof(from);
+		int bytesIn = recvfrom(threadSock, buf, UDP_BUF_SIZE, 0, (sockaddr*)&from, &fromLen);
+		if (bytesIn == SOCKET_ERROR)
+		{
+			int err = WSAGetLastError();
+			// WSAECONNRESET is an ICMP port unreachable from an earlier send, which is expected for UDP
+			if (err == WSAETIMEDOUT || err == WSAECONNRESET)
+			{
+				continue;
+			}
+			break;
+		}
+
+		// The host coalesces relayed frames, so a datagram can hold several
+		udpInstance->receivedCount++;
+		NetcodeFraming::ReadFrames(buf, bytesIn, [&from](const NetcodeFrame& frame) {
+			if (udpInstance->isHost)
+			{
+				handleHostDatagram(frame, from);
+			}
+			else
+			{
+				handleClientDatagram(frame, from);
+			}
+		});
+	}
+}
+
+void UdpTransport::StartHost(int inPort)
+{
+	Stop();
+
+	WSADATA wsData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsData) != 0)
+	{
+		BM_LOG("Can't initialize winsock for UDP!");
+		return;
+	}
+
+	// Same port number as the TCP listener, so a single forwarded or punched port carries both
+	SOCKET newSock = GetBoundSocket((u_short)inPort);
+	if (newSock == INVALID_SOCKET)
+	{
+		WSACleanup();
+		return;
+	}
+
+	isHost = true;
+	handshakeDone = false;
+	peersSema.acquire();
+	peers.clear();
+	peersSema.release();
+	sock = newSock;
+
+	std::thread udpThrd(udpThread, newSock);
+	udpThrd.detach();
+	BM_LOG("UDP body state channel listening");
+}
+
+void UdpTransport::ConnectToHost(const std::string& inIpAddress, int inPort)
+{
+	Stop();
+
+	WSADATA wsData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsData) != 0)
+	{
+		BM_LOG("Can't initialize winsock for UDP!");
+		return;
+	}
+
+	SOCKET newSock = GetBoundSocket(0);
+	if (newSock == INVALID_SOCKET)
+	{
+		WSACleanup();
+		return;
+	}
+
+	hostAddr = {};
+	hostAddr.sin_family = AF_INET;
+	hostAddr.sin_port = htons((u_short)inPort);
+	inet_pton(AF_INET, inIpAddress.c_str(), &hostAddr.sin_addr);
+
+	std::random_device rd;
+	token = rd();
+	isHost = false;
+	handshakeDone = false;
+	sock = newSock;
+
+	// The host only answers hellos carrying a token offered over our TCP connection
+	Networking::SendBytes(NetcodeMessageType::UDP_OFFER, (char*)&token, sizeof(uint32_t));
+
+	std::thread udpThrd(udpThread, newSock);
+	udpThrd.detach();
+}
+
+void UdpTransport::Stop()
+{
+	SOCKET oldSock = sock.exchange(INVALID_SOCKET);
+	if (oldSock == INVALID_SOCKET)
+	{
+		return;
+	}
+
+	handshakeDone = false;
+	closesocket(oldSock);
+
+	peersSema.acquire();
+	peers.clear();
+	peersSema.release();
+	delayedSema.acquire();
+	delayed.clear();
+	delayedSema.release();
+	relayBatchSema.acquire();
+	relayBatch.Clear();
+	relayBatchSema.release();
+	interestSema.acquire();
+	interest.Reset();
+	interestSema.release();
+
+	WSACleanup();
+}
+
+void UdpTransport::RegisterMessageCallback(void (*clbk)(const NetcodeFrame& frame))
+{
+	msgReceivedClbk = clbk;
+}
+
+void UdpTransport::SendBytes(const char* buf, int len)
+{
+	if (!IsConnected())
+	{
+		return;
+	}
+
+	if (!isHost)
+	{
+		sendTo(hostAddr, buf, len);
+		return;
+	}
+
+	RelayBytes(buf, len, nullptr);
+}
+
+void UdpTransport::RelayBytes(const char* buf, int len, const sockaddr_in* from)
+{
+	if (!isHost || sock == INVALID_SOCKET)
+	{
+		return;
+	}
+
+	peersSema.acquire();
+	std::vector<Peer> peersCopy = peers;
+	peersSema.release();
+
+	// Our own frames skip the relay batch, so they are thinned out for far away peers here
+	interestSema.acquire();
+	interest.Observe(UINT64_MAX, buf, len);
+	for (const Peer& peer : peersCopy)
+	{
+		if (peer.confirmed && (from == nullptr || !sameAddr(peer.addr, *from)) && interest.Relevant(peer.token, buf, len))
+		{
+			sendTo(peer.addr, buf, len);
+		}
+	}
+	interestSema.release();
+}
+
+void UdpTransport::QueueRelay(const char* buf, int len)
+{
+	if (!isHost || sock == INVALID_SOCKET)
+	{
+		return;
+	}
+
+	interestSema.acquire();
+	interest.Observe(UINT64_MAX, buf, len);
+	interestSema.release();
+
+	relayBatchSema.acquire();
+	if (relayBatch.Empty())
+	{
+		relayBatchStart = std::chrono::steady_clock::now();
+	}
+	// Not from any UDP peer, so every peer gets it
+	relayBatch.Add(UINT64_MAX, buf, len);
+	relayBatchSema.release();
+}
+
+void UdpTransport::flushRelayBatch()
+{
+	relayBatchSema.acquire();
+	if (relayBatch.Empty() ||
+		std::chrono::steady_clock::now() - relayBatchStart < std::chrono::milliseconds(RELAY_TICK_WINDOW_MS))
+	{
+		relayBatchSema.release();
+		return;
+	}
+
+	peersSema.acquire();
+	std::vector<Peer> peersCopy = peers;
+	peersSema.release();
+
+	// One datagram per peer per tick, split only when it would get past the MTU
+	std::vector<RelaySlice> slices;
+	std::vector<std::pair<size_t, size_t>> runs;
+	interestSema.acquire();
+	interest.Update();
+	for (const Peer& peer : peersCopy)
+	{
+		if (!peer.confirmed)
+		{
+			continue;
+		}
+		relayBatch.Gather(peer.token, slices, [this, &peer](const RelayBatch::Entry& entry) {
+			return interest.Relevant(peer.token, relayBatch.FrameData(entry), entry.len);
+		}, RELAY_DATAGRAM_MTU);
+		RelayBatch::SplitRuns(slices, RELAY_DATAGRAM_MTU, runs);
+		for (const auto& [first, count] : runs)
+		{
+			sendTo(peer.addr, slices.data() + first, count);
+			relayStats.sendCalls++;
+			for (size_t i = first; i < first + count; i++)
+			{
+				relayStats.bytesSent += slices[i].len;
+			}
+		}
+	}
+
+	interestSema.release();
+
+	relayStats.ticks++;
+	relayStats.framesRelayed += relayBatch.Frames();
+	relayBatch.Clear();
+	relayBatchSema.release();
+}
+
+void UdpTransport::OfferPeer(uint32_t peerToken)
+{
+	if (!isHost || sock == INVALID_SOCKET)
+	{
+		return;
+	}
+
+	peersSema.acquire();
+	std::erase_if(peers, [peerToken](const Peer& p) { return p.token == peerToken; });
+	peers.push_back({ {}, peerToken, false, false, std::chrono::steady_clock::now() });
+	peersSema.release();
+}
+
+void UdpTransport::ConfirmPeer(uint32_t peerToken)
+{
+	peersSema.acquire();
+	auto peer = std::find_if(peers.begin(), peers.end(), [peerToken](const Peer& p) { return p.token == peerToken; });
+	if (peer != peers.end() && peer->hasAddr)
+	{
+		peer->confirmed = true;
+	}
+	peersSema.release();
+}
+
+void UdpTransport::expireUnconfirmedPeers()
+{
+	auto deadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(UDP_PEER_CONFIRM_TIMEOUT_MS);
+	peersSema.acquire();
+	std::erase_if(peers, [deadline](const Peer& p) { return !p.confirmed && p.offeredAt < deadline; });
+	peersSema.release();
+}
+
+void UdpTransport::DropPeer(uint32_t peerToken)
+{
+	peersSema.acquire();
+	std::erase_if(peers, [peerToken](const Peer& p) { return p.token == peerToken; });
+	peersSema.release();
+	interestSema.acquire();
+	interest.Forget(peerToken);
+	interestSema.release();
+}
+
+void UdpTransport::SetImpairment(int inLossPercent, int inLatencyMs, int inJitterMs)
+{
+	lossPercent = std::clamp(inLossPercent, 0, 100);
+	latencyMs = std::max(inLatencyMs, 0);
+	jitterMs = std::max(inJitterMs, 0);
+}
+
+UdpTransport::Stats UdpTransport::GetStats() const
+{
+	return { sentCount, receivedCount, droppedCount, delayedCount };
+}
+
+void UdpTransport::sendTo(const sockaddr_in& addr, const char* buf, int len)
+{
+	int loss = lossPercent;
+	int latency = latencyMs;
+	if (loss > 0 || latency > 0)
+	{
+		thread_local std::mt19937 rng{ std::random_device{}() };
+		if (loss > 0 && (int)(rng() % 100) < loss)
+		{
+			droppedCount++;
+			return;
+		}
+
+		if (latency > 0)
+		{
+			// Jitter is applied per datagram, so it also reorders them
+			int jitter = jitterMs;
+			int delayMs = latency + (jitter > 0 ? (int)(rng() % (2 * jitter + 1)) - jitter : 0);
+			DelayedDatagram datagram{
+				std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(delayMs, 0)),
+				addr,
+				std::vector<char>(buf, buf + len)
+			};
+			delayedSema.acquire();
+			delayed.push_back(std::move(datagram));
+			delayedSema.release();
+			delayedCount++;
+			return;
+		}
+	}
+
+	sendto(sock, buf, len, 0, (const sockaddr*)&addr, sizeof(addr));
+	sentCount++;
+}
+
+void UdpTransport::sendTo(const sockaddr_in& addr, const RelaySlice* slices, size_t sliceCount)
+{
+	if (lossPercent > 0 || latencyMs > 0)
+	{
+		// Impairment works on whole datagrams, so assemble one
+		std::vector<char> datagram;
+		for (size_t i = 0; i < sliceCount; i++)
+		{
+			datagram.insert(datagram.end(), slices[i].data, slices[i].data + slices[i].len);
+		}
+		sendTo(addr, datagram.data(), (int)datagram.size());
+		return;
+	}
+
+	std::vector<WSABUF> buffers(sliceCount);
+	for (size_t i = 0; i < sliceCount; i++)
+	{
+		buffers[i].buf = const_cast<char*>(slices[i].data);
+		buffers[i].len = slices[i].len;
+	}
+	DWORD sent = 0;
+	WSASendTo(sock, buffers.data(), (DWORD)sliceCount, &sent, 0, (const sockaddr*)&addr, sizeof(addr), nullptr, nullptr);
+	sentCount++;
+}
+
+void UdpTransport::flushDelayed()
+{
+	auto now = std::chrono::steady_clock::now();
+	std::vector<DelayedDatagram> due;
+
+	delayedSema.acquire();
+	auto firstDue = std::partition(delayed.begin(), delayed.end(),
+		[now](const DelayedDatagram& d) { return d.sendAt > now; });
+	due.assign(std::make_move_iterator(firstDue), std::make_move_iterator(delayed.end()));
+	delayed.erase(firstDue, delayed.end());
+	delayedSema.release();
+
+	for (const DelayedDatagram& d : due)
+	{
+		sendto(sock, d.data.data(), (int)d.data.size(), 0, (const sockaddr*)&d.addr, sizeof(d.addr));
+		sentCount++;
+	}
+}
@@ -650,70 +650,6 @@ std::vector<std::string> SupersonicMarioPlugin::complete(const std::vector<std::
     return suggestions;
 }
 
-typedef struct supported_maps_type_t
-{
-    XXH128_hash_t hash;
-    std::string fbx;
-} supported_maps_type;
-
-const supported_maps_type supported_maps[] = {
-    { { 0x5073cdbb305dc3e5, 0x388fab8b69718b78 }, "LethSM64.fbx" },
-    //{ { 0xe9708ff5ad55b6e1, 0x7165ef3aff368c3 }, "LethBlockFort.fbx" },
-    //{ { 17947140482627331743, 11142468266187614088 }, "LethParkourEgypt.fbx" },
-    //{ { 0xfd9d4ae1ff8facd5, 0xb38fe29c8455095f }, "LethFallGuys.fbx" },
-};
-const uint32_t supported_maps_count = sizeof(supported_maps) / sizeof(supported_maps[0]);
-
-Model* SupersonicMarioPlugin::loadMapModel(const std::string& inArena)
-{
-    std::string arena = "";
-    if (file_exists(inArena))
-    {
-        arena = inArena;
-    }
-    else
-    {
-        std::filesystem::path mapPath(Utils::GetMapFolderPath());
-        mapPath.append(inArena + ".upk");
-        arena = mapPath.string();
-        if (!file_exists(arena))
-        {
-            BM_ERROR_LOG("Could not find map file for extraction.");
-            return nullptr;
-        }
-    }
-    std::filesystem::path arenaPath(arena);
-
-    std::string bakkesmodFolderPath = Utils::GetBakkesmodFolderPath();
-    std::string assetsPath = bakkesmodFolderPath + "data\\assets\\";
-
-    size_t fileLength;
-    uint8_t* mapData = Utils::readFileAlloc(arena, &fileLength);
-    const auto mapHash = XXH3_128bits(mapData, fileLength);
-    free(mapData);
-
-    int mapIndex = -1;
-    for (int i = 0; i < supported_maps_count; i++)
-    {
-        if (XXH128_isEqual(mapHash, supported_maps[i].hash))
-        {
-            mapIndex = i;
-            break;
-        }
-    }
-
-    if (mapIndex < 0)
-    {
-        return nullptr; // map not found
-    }
-
-    std::string fbxPath = assetsPath + supported_maps[mapIndex].fbx;
-    std::vector<std::string> fbxList;
-    fbxList.push_back(fbxPath);
-    return new Model(fbxList);
-}
-
-
 /*
  *  Host/Join Match
  */
@@ -811,8 +747,7 @@ void SupersonicMarioPlugin::HostGame(std::string arena)
         gameWrapper->ExecuteUnrealCommand(command);
     }, 0.1f);
 
-    Model* m = loadMapModel(arena);
-    sm64->LoadStaticSurfaces(m);
+    sm64->LoadMap(arena);
 
     TcpServer::getInstance().StartServer(*sm64HostPort);
     if (isPublicMatch) {
@@ -853,13 +788,7 @@ void SupersonicMarioPlugin::JoinGame(const char* pswd)
         }
     }
 
-    Model* m = nullptr;
-    if (joinCustomMap)
-    {
-        m = loadMapModel(currentJoinMap.string());
-    }
-
-    sm64->LoadStaticSurfaces(m);
+    sm64->LoadMap(joinCustomMap ? currentJoinMap.string() : "");
 
     TcpClient::getInstance().ConnectToServer(*joinIP, *sm64HostPort);
     gameWrapper->ExecuteUnrealCommand(fmt::format("start {:s}:{:d}/?Lan?Password={:s}", *joinIP, *joinPort, pswd));
@@ -1207,6 +1136,37 @@ void SupersonicMarioPlugin::registerNotifiers()
     RegisterNotifier("rp_broadcast_game", [this](const std::vector<std::string>&) {
         broadcastJoining();
     }, "Broadcasts a game invite to your party members.", PERMISSION_SOCCAR);
+
+    RegisterNotifier("rp_build_map_cache", [this](const std::vector<std::string>& arguments) {
+        std::vector<std::string> maps(arguments.begin() + 1, arguments.end());
+        if (maps.empty()) {
+            for (const auto& [joinableMap, _] : joinableMaps) {
+                maps.push_back(joinableMap.string());
+            }
+        }
+
+        for (const std::string& map : maps) {
+            const std::shared_ptr<MapSurfaces> surfaces = sm64->mapLoader.Load(map, false).get();
+            if (surfaces == nullptr) {
+                BM_LOG("Skipped {:s}, it is not a supported map", quote(map));
+                continue;
+            }
+            BM_LOG("Cached {:s}, {:d} surfaces", quote(map), surfaces->SurfaceCount());
+        }
+    }, "Rebuilds the collision cache of the given maps, or of every joinable map.", PERMISSION_ALL);
+
+    RegisterNotifier("rp_render_memory", [this](const std::vector<std::string>&) {
+        constexpr double megabyte = 1024.0 * 1024.0;
+        size_t cpuBytes = 0;
+        size_t gpuBytes = 0;
+        for (const ModelMemoryUsage& usage : Renderer::getInstance().GetMemoryUsage()) {
+            BM_LOG("{:s}: {:d} meshes, {:.2f} MB CPU, {:.2f} MB GPU", usage.name.empty() ? "Model" : usage.name,
+                usage.meshes, usage.cpuBytes / megabyte, usage.gpuBytes / megabyte);
+            cpuBytes += usage.cpuBytes;
+            gpuBytes += usage.gpuBytes;
+        }
+        BM_LOG("Total: {:.2f} MB CPU, {:.2f} MB GPU", cpuBytes / megabyte, gpuBytes / megabyte);
+    }, "Logs how much CPU and GPU memory every rendered model holds.", PERMISSION_ALL);
 }
 
 
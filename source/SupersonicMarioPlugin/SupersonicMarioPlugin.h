@@ -93,7 +93,6 @@ public:
     void ForceJoin();
 
 private:
-    Model* loadMapModel(const std::string& arena);
     std::string getGameTags() const;
     void savePreset(const std::string& presetName);
     void loadPreset(const std::filesystem::path& presetPath);
@@ -0,0 +1,376 @@
+// NetcodeFramingTest.cpp
+// Linux test for the netcode frame reader, over a real loopback TCP connection.
+//
+// Writes a stream of frames of mixed sizes, from empty to larger than a
+// loopback segment, and checks that a NetcodeFrameReader hands every frame
+// back whole, once and in order however the stream was cut up:
+// - in memory, in chunks from a single byte up to the whole stream,
+// - over loopback with small odd sized writes and reads, so headers and
+//   payloads arrive split over several recv calls,
+// - over loopback with whole frames written while the reader lags behind,
+//   so a single recv returns several frames at once.
+// A corrupt header must make the reader give up on the connection.
+// Exits with a non zero exit code if any check fails.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NetcodeFraming.h"
+
+#define FRAMING_TEST_LARGE_PAYLOAD 60000 // Every 32nd frame, more than a loopback segment
+
+struct FramingTestOptions
+{
+    int frames = 512;
+    int runs = 4;
+    unsigned seed = 1;
+};
+
+struct ReceiveResult
+{
+    int received = 0;
+    int corrupt = 0; // Frames with the wrong sequence, type, length or payload
+    bool streamOk = true;
+    size_t buffered = 0; // Left in the reader at the end, a partial frame
+    uint64_t reads = 0;
+    uint64_t splitReads = 0; // Reads that ended part way into a frame
+    int mostFramesPerRead = 0;
+};
+
+void printUsage()
+{
+    printf("usage: NetcodeFramingTest [--frames N] [--runs N] [--seed N]\n");
+}
+
+bool parseOptions(int argc, char** argv, FramingTestOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--frames")
+        {
+            options.frames = std::max(2, atoi(value.c_str()));
+        }
+        else if (arg == "--runs")
+        {
+            options.runs = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+char payloadByte(uint32_t sequence, size_t index)
+{
+    return (char)(sequence * 31 + index * 7);
+}
+
+size_t payloadSize(uint32_t sequence, std::mt19937& random)
+{
+    if (sequence % 32 == 31)
+    {
+        return FRAMING_TEST_LARGE_PAYLOAD;
+    }
+    // Empty payloads, ones shorter than a header and body state sized ones
+    return std::uniform_int_distribution<size_t>(0, 600)(random);
+}
+
+std::vector<char> buildStream(int frames, std::mt19937& random)
+{
+    std::vector<char> stream;
+    std::vector<char> payload;
+    for (uint32_t sequence = 0; sequence < (uint32_t)frames; sequence++)
+    {
+        payload.resize(payloadSize(sequence, random));
+        for (size_t i = 0; i < payload.size(); i++)
+        {
+            payload[i] = payloadByte(sequence, i);
+        }
+        const NetcodeMessageType type = sequence % 2 == 0 ? NetcodeMessageType::MARIO_BODY_STATE
+            : NetcodeMessageType::MARIO_INPUT;
+
+        const size_t offset = stream.size();
+        stream.resize(offset + sizeof(NetcodeFrameHeader) + payload.size());
+        NetcodeFraming::WriteFrame(stream.data() + offset, stream.size() - offset, type, sequence, payload.data(),
+            payload.size(), (uint8_t)(sequence & 0xFF));
+    }
+    return stream;
+}
+
+// Feeds a read into the reader and checks every frame it completes against the next one expected
+void feed(NetcodeFrameReader& reader, char* data, size_t len, ReceiveResult& result)
+{
+    int framesThisRead = 0;
+    result.streamOk &= reader.Feed(data, len, [&](const NetcodeFrame& frame) {
+        const uint32_t sequence = (uint32_t)result.received;
+        const NetcodeMessageType type = sequence % 2 == 0 ? NetcodeMessageType::MARIO_BODY_STATE
+            : NetcodeMessageType::MARIO_INPUT;
+        bool ok = frame.header.sequence == sequence && frame.Type() == type &&
+            frame.header.flags == (uint8_t)(sequence & 0xFF) && frame.payload == frame.data + sizeof(NetcodeFrameHeader);
+        for (int i = 0; ok && i < frame.payloadLen; i++)
+        {
+            ok = frame.payload[i] == payloadByte(sequence, i);
+        }
+        result.corrupt += ok ? 0 : 1;
+        result.received++;
+        framesThisRead++;
+    });
+    result.reads++;
+    result.splitReads += reader.Buffered() > 0 ? 1 : 0;
+    result.mostFramesPerRead = std::max(result.mostFramesPerRead, framesThisRead);
+}
+
+bool report(const std::string& name, const ReceiveResult& result, int frames)
+{
+    const bool passed = result.streamOk && result.received == frames && result.corrupt == 0 && result.buffered == 0;
+    printf("%-32s %s: %d/%d frames, %d corrupt, %zu bytes left over, %llu reads, %llu split, up to %d frames per read\n",
+        name.c_str(), passed ? "passed" : "FAILED", result.received, frames, result.corrupt, result.buffered,
+        (unsigned long long)result.reads, (unsigned long long)result.splitReads, result.mostFramesPerRead);
+    return passed;
+}
+
+bool testInMemory(std::vector<char>& stream, int frames)
+{
+    bool passed = true;
+    for (const size_t chunk : { (size_t)1, (size_t)3, sizeof(NetcodeFrameHeader) - 1, sizeof(NetcodeFrameHeader) + 1,
+        (size_t)1000, stream.size() })
+    {
+        NetcodeFrameReader reader;
+        ReceiveResult result;
+        for (size_t offset = 0; offset < stream.size(); offset += chunk)
+        {
+            feed(reader, stream.data() + offset, std::min(chunk, stream.size() - offset), result);
+        }
+        result.buffered = reader.Buffered();
+        passed &= report("in memory, " + std::to_string(chunk) + " byte chunks", result, frames);
+    }
+    return passed;
+}
+
+bool testCorruptHeader(const std::vector<char>& stream)
+{
+    bool passed = true;
+    // A bad magic in the first header, then one in a header that only shows up part way into a read
+    std::vector<char> corrupt = stream;
+    corrupt[0] ^= 0xFF;
+    NetcodeFrameReader reader;
+    passed &= !reader.Feed(corrupt.data(), corrupt.size(), [](const NetcodeFrame&) {});
+
+    corrupt = stream;
+    NetcodeFrameHeader header;
+    memcpy(&header, corrupt.data(), sizeof(header));
+    const size_t second = sizeof(NetcodeFrameHeader) + header.length;
+    header.length = NETCODE_MAX_PAYLOAD_SIZE + 1;
+    memcpy(corrupt.data() + second, &header, sizeof(header));
+    NetcodeFrameReader splitReader;
+    int received = 0;
+    bool rejected = false;
+    for (size_t offset = 0; offset < corrupt.size() && !rejected; offset += 5)
+    {
+        rejected = !splitReader.Feed(corrupt.data() + offset, std::min((size_t)5, corrupt.size() - offset),
+            [&](const NetcodeFrame&) { received++; });
+    }
+    passed &= rejected && received == 1;
+
+    printf("%-32s %s\n", "corrupt headers", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+bool sendAll(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        len -= (size_t)sent;
+    }
+    return true;
+}
+
+// Connects a client to a fresh 127.0.0.1 listener. Returns false if loopback isn't available.
+bool connectLoopback(int& clientFd, int& serverFd)
+{
+    clientFd = -1;
+    serverFd = -1;
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        getsockname(listener, (sockaddr*)&addr, &addrLen) < 0 || listen(listener, 1) < 0)
+    {
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        return false;
+    }
+
+    clientFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (clientFd >= 0 && connect(clientFd, (sockaddr*)&addr, sizeof(addr)) == 0)
+    {
+        serverFd = accept(listener, nullptr, nullptr);
+    }
+    close(listener);
+    if (serverFd < 0)
+    {
+        if (clientFd >= 0)
+        {
+            close(clientFd);
+        }
+        return false;
+    }
+    return true;
+}
+
+// The sender writes small odd sized chunks straight out and the receiver reads a few bytes at a time
+bool testLoopbackSplit(const std::vector<char>& stream, int frames, unsigned seed)
+{
+    int clientFd, serverFd;
+    if (!connectLoopback(clientFd, serverFd))
+    {
+        printf("%-32s FAILED: could not connect over loopback\n", "loopback, split");
+        return false;
+    }
+    int noDelay = 1;
+    setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    std::thread sender([&stream, clientFd, seed]() {
+        std::mt19937 random(seed);
+        std::uniform_int_distribution<size_t> chunks(1, 509);
+        for (size_t offset = 0; offset < stream.size();)
+        {
+            const size_t chunk = std::min(chunks(random), stream.size() - offset);
+            if (!sendAll(clientFd, stream.data() + offset, chunk))
+            {
+                break;
+            }
+            offset += chunk;
+        }
+        shutdown(clientFd, SHUT_WR);
+    });
+
+    std::mt19937 random(seed + 1);
+    std::uniform_int_distribution<size_t> readSizes(1, 2 * sizeof(NetcodeFrameHeader) + 3);
+    std::vector<char> buf(readSizes.max());
+    NetcodeFrameReader reader;
+    ReceiveResult result;
+    ssize_t bytesIn;
+    while ((bytesIn = recv(serverFd, buf.data(), readSizes(random), 0)) > 0)
+    {
+        feed(reader, buf.data(), (size_t)bytesIn, result);
+    }
+    result.buffered = reader.Buffered();
+    sender.join();
+    close(clientFd);
+    close(serverFd);
+
+    // Small reads that never cut a frame would not have tested anything
+    return report("loopback, split", result, frames) && result.splitReads > 0;
+}
+
+// The sender writes whole frames with Nagle on and the receiver only reads every few milliseconds, with a big buffer
+bool testLoopbackCoalesced(const std::vector<char>& stream, int frames)
+{
+    int clientFd, serverFd;
+    if (!connectLoopback(clientFd, serverFd))
+    {
+        printf("%-32s FAILED: could not connect over loopback\n", "loopback, coalesced");
+        return false;
+    }
+
+    std::thread sender([&stream, clientFd]() {
+        NetcodeFrameHeader header;
+        for (size_t offset = 0; offset + sizeof(header) <= stream.size();)
+        {
+            memcpy(&header, stream.data() + offset, sizeof(header));
+            const size_t frameLen = sizeof(header) + header.length;
+            if (!sendAll(clientFd, stream.data() + offset, frameLen))
+            {
+                break;
+            }
+            offset += frameLen;
+        }
+        shutdown(clientFd, SHUT_WR);
+    });
+
+    std::vector<char> buf(NETCODE_MAX_PAYLOAD_SIZE * 2);
+    NetcodeFrameReader reader;
+    ReceiveResult result;
+    ssize_t bytesIn;
+    do
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        bytesIn = recv(serverFd, buf.data(), buf.size(), 0);
+        if (bytesIn > 0)
+        {
+            feed(reader, buf.data(), (size_t)bytesIn, result);
+        }
+    } while (bytesIn > 0);
+    result.buffered = reader.Buffered();
+    sender.join();
+    close(clientFd);
+    close(serverFd);
+
+    // Reads that never held more than one frame would not have tested anything
+    return report("loopback, coalesced", result, frames) && result.mostFramesPerRead > 1;
+}
+
+int main(int argc, char** argv)
+{
+    FramingTestOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    int failed = 0;
+    for (int run = 0; run < options.runs; run++)
+    {
+        const unsigned seed = options.seed + run;
+        std::mt19937 random(seed);
+        std::vector<char> stream = buildStream(options.frames, random);
+        printf("run %d, seed %u, %d frames, %zu bytes\n", run + 1, seed, options.frames, stream.size());
+
+        failed += testInMemory(stream, options.frames) ? 0 : 1;
+        failed += testCorruptHeader(stream) ? 0 : 1;
+        failed += testLoopbackSplit(stream, options.frames, seed) ? 0 : 1;
+        failed += testLoopbackCoalesced(stream, options.frames) ? 0 : 1;
+    }
+
+    printf("%d checks failed\n", failed);
+    return failed == 0 ? 0 : 1;
+}
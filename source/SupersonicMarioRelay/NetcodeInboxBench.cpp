@@ -0,0 +1,277 @@
+// NetcodeInboxBench.cpp
+// Times the handoff of body states from network threads to the render thread, through a semaphore and lock-free.
+//
+// Network threads deliver the remote players' 30 Hz body state streams
+// while a render thread takes them once per 144 Hz frame and then works
+// for a while, ticking and drawing. Once the handoff goes through one
+// std::counting_semaphore that the render thread holds while it works,
+// like MarioMessageReceived used to, and once through the SpscRing and
+// MpscQueue inboxes from LockFreeQueues.h the plugin uses now. Reports
+// how long pushes and takes took on either side. Every body state pushed
+// has to be taken or counted as dropped, or it fails with a non zero exit
+// code.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LockFreeQueues.h"
+
+// Stand-ins about the size of the plugin's ReceivedBodyState and MarioControlMessage, which need libsm64
+#define BENCH_BODY_STATE_SIZE 176
+#define BENCH_CONTROL_MESSAGE_SIZE 320
+// Like MARIO_INBOX_SIZE, CONTROL_INBOX_SIZE and MAX_NUM_PLAYERS in GameModes/SM64.h
+#define BENCH_MARIO_INBOX_SIZE 64
+#define BENCH_CONTROL_INBOX_SIZE 256
+#define BENCH_MAX_PLAYERS 8
+#define BENCH_FRAME_MS (1000.0 / 144.0)
+#define BENCH_SNAPSHOT_MS (1000.0 / 30.0)
+
+struct BenchOptions
+{
+    int networkThreads = 2;
+    int players = BENCH_MAX_PLAYERS - 1;
+    double renderWorkMs = 2.0;
+    int seconds = 2;
+};
+
+struct BenchBodyState
+{
+    uint8_t bytes[BENCH_BODY_STATE_SIZE] = {};
+};
+
+struct BenchControlMessage
+{
+    uint8_t bytes[BENCH_CONTROL_MESSAGE_SIZE] = {};
+};
+
+struct Handoff
+{
+    std::function<void(int player, const BenchBodyState& received)> push;
+    std::function<size_t()> take; // Returns how many body states it took
+    std::function<void()> done;   // Called when the frame's work is finished
+    std::function<uint64_t()> dropped;
+};
+
+using Clock = std::chrono::steady_clock;
+
+void printUsage()
+{
+    printf("usage: NetcodeInboxBench [--network-threads N] [--players N] [--render-ms MS] [--seconds N]\n");
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--network-threads")
+        {
+            options.networkThreads = std::clamp(atoi(value.c_str()), 1, 8);
+        }
+        else if (arg == "--players")
+        {
+            options.players = std::clamp(atoi(value.c_str()), 1, BENCH_MAX_PLAYERS);
+        }
+        else if (arg == "--render-ms")
+        {
+            options.renderWorkMs = std::clamp(atof(value.c_str()), 0.0, BENCH_FRAME_MS);
+        }
+        else if (arg == "--seconds")
+        {
+            options.seconds = std::max(1, atoi(value.c_str()));
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    size_t index = std::min(sorted.size() - 1, (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5));
+    return sorted[index];
+}
+
+double elapsedUs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+Clock::duration fromMs(double ms)
+{
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+}
+
+// Returns whether every body state pushed was taken or dropped
+bool run(const std::string& name, const BenchOptions& options, const Handoff& handoff)
+{
+    const int networkThreads = options.networkThreads;
+    const int players = options.players;
+    std::atomic<bool> running = true;
+    std::vector<std::vector<double>> pushUs(networkThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < networkThreads; t++)
+    {
+        threads.emplace_back([&, t]() {
+            // Every network thread delivers its share of the players' 30 Hz streams, spread out evenly
+            const int streams = std::max(1, (players - t + networkThreads - 1) / networkThreads);
+            const Clock::duration interval = fromMs(BENCH_SNAPSHOT_MS / streams);
+            BenchBodyState received;
+            Clock::time_point next = Clock::now();
+            int player = t % players;
+            while (running)
+            {
+                next += interval;
+                std::this_thread::sleep_until(next);
+                const Clock::time_point start = Clock::now();
+                handoff.push(player, received);
+                pushUs[t].push_back(elapsedUs(start));
+                player = player + networkThreads < players ? player + networkThreads : t % players;
+            }
+        });
+    }
+
+    // The render thread spends renderWorkMs of every frame ticking and drawing with whatever it took
+    std::vector<double> takeUs;
+    size_t taken = 0;
+    const Clock::time_point end = Clock::now() + std::chrono::seconds(options.seconds);
+    Clock::time_point nextFrame = Clock::now();
+    while (Clock::now() < end)
+    {
+        const Clock::time_point start = Clock::now();
+        taken += handoff.take();
+        takeUs.push_back(elapsedUs(start));
+        const Clock::time_point workUntil = Clock::now() + fromMs(options.renderWorkMs);
+        while (Clock::now() < workUntil)
+        {
+        }
+        handoff.done();
+
+        nextFrame += fromMs(BENCH_FRAME_MS);
+        std::this_thread::sleep_until(nextFrame);
+    }
+    running = false;
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    taken += handoff.take();
+    handoff.done();
+
+    std::vector<double> allPushUs;
+    for (const std::vector<double>& us : pushUs)
+    {
+        allPushUs.insert(allPushUs.end(), us.begin(), us.end());
+    }
+    std::sort(allPushUs.begin(), allPushUs.end());
+    std::sort(takeUs.begin(), takeUs.end());
+    const uint64_t dropped = handoff.dropped();
+    const bool accounted = taken + dropped == allPushUs.size();
+    printf("%-10s network us p50 %.1f p99 %.1f max %.1f, render us p50 %.1f p99 %.1f max %.1f, %zu pushed, %zu taken, "
+        "%llu dropped%s\n", name.c_str(), percentile(allPushUs, 50), percentile(allPushUs, 99),
+        allPushUs.empty() ? 0.0 : allPushUs.back(), percentile(takeUs, 50), percentile(takeUs, 99),
+        takeUs.empty() ? 0.0 : takeUs.back(), allPushUs.size(), taken, (unsigned long long)dropped,
+        accounted ? "" : ", LOST");
+    return accounted;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    printf("%d network threads, %d remote players at 30 Hz, %.1f ms render work per 144 Hz frame, %d s each\n",
+        options.networkThreads, options.players, options.renderWorkMs, options.seconds);
+
+    // The render thread holds the semaphore while it works, which is what pushes wait for
+    std::counting_semaphore<1> sema{ 1 };
+    std::vector<std::deque<BenchBodyState>> queues(options.players);
+    bool passed = run("semaphore", options, {
+        [&](int player, const BenchBodyState& received) {
+            sema.acquire();
+            queues[player].push_back(received);
+            sema.release();
+        },
+        [&]() {
+            sema.acquire();
+            size_t taken = 0;
+            for (std::deque<BenchBodyState>& queue : queues)
+            {
+                taken += queue.size();
+                queue.clear();
+            }
+            return taken;
+        },
+        [&]() { sema.release(); },
+        []() { return (uint64_t)0; } });
+
+    // Network threads only wait for each other, the render thread takes what is there and works without a lock
+    std::counting_semaphore<1> receiveSema{ 1 };
+    std::vector<std::unique_ptr<SpscRing<BenchBodyState>>> inboxes;
+    for (int i = 0; i < options.players; i++)
+    {
+        inboxes.push_back(std::make_unique<SpscRing<BenchBodyState>>(BENCH_MARIO_INBOX_SIZE));
+    }
+    MpscQueue<BenchControlMessage> controlInbox(BENCH_CONTROL_INBOX_SIZE);
+    passed &= run("lock-free", options, {
+        [&](int player, const BenchBodyState& received) {
+            BenchControlMessage acks;
+            receiveSema.acquire();
+            inboxes[player]->TryPush(received);
+            receiveSema.release();
+            controlInbox.TryPush(acks);
+        },
+        [&]() {
+            BenchControlMessage message;
+            while (controlInbox.TryPop(message))
+            {
+            }
+            size_t taken = 0;
+            BenchBodyState received;
+            for (std::unique_ptr<SpscRing<BenchBodyState>>& inbox : inboxes)
+            {
+                while (inbox->TryPop(received))
+                {
+                    taken++;
+                }
+            }
+            return taken;
+        },
+        []() {},
+        [&]() {
+            uint64_t dropped = 0;
+            for (std::unique_ptr<SpscRing<BenchBodyState>>& inbox : inboxes)
+            {
+                dropped += inbox->Dropped();
+            }
+            return dropped;
+        } });
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// RelayInterestSim.cpp
+// Simulated lobbies for the relay's distance based send rates.
+//
+// Moves simulated players around a Rocket League sized field, half of them
+// chasing the ball, and runs their body state frames through the same
+// RelayBatch and RelayInterest the relays use. Reports the bandwidth the
+// relay sends with and without interest management for lobbies of 2 to 32
+// players, and the longest any receiver went without a frame from any other
+// player. No sockets are involved, so the numbers only depend on the seed.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "RelayBatch.h"
+#include "RelayInterest.h"
+
+#define SIM_FIELD_HALF_WIDTH 4096.0f
+#define SIM_FIELD_HALF_LENGTH 5120.0f
+#define SIM_PLAYER_SPEED 1400.0f // Units per second, about a car's top speed without boost
+#define SIM_BALL_SPEED 2000.0f
+#define SIM_BALL_CHASE_RADIUS 1500.0f
+
+struct SimOptions
+{
+    int seconds = 60;
+    int rateHz = 30;
+    int snapshotSize = 48; // Typical delta encoded body state, acks included
+    unsigned seed = 1;
+    std::vector<int> playerCounts = { 2, 4, 8, 12, 16, 24, 32 };
+};
+
+struct SimBody
+{
+    float position[3];
+    float target[3];
+};
+
+struct SimResult
+{
+    uint64_t fullBytes = 0;
+    uint64_t interestBytes = 0;
+    int longestGap = 0; // Frames, over every receiver and stream
+};
+
+void printUsage()
+{
+    printf("usage: RelayInterestSim [--seconds N] [--rate HZ] [--snapshot BYTES] [--seed N] [--players N,N,...]\n");
+}
+
+bool parseOptions(int argc, char** argv, SimOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--seconds")
+        {
+            options.seconds = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--rate")
+        {
+            options.rateHz = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--snapshot")
+        {
+            options.snapshotSize = std::max(0, atoi(value.c_str()));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--players")
+        {
+            options.playerCounts.clear();
+            size_t start = 0;
+            while (start < value.size())
+            {
+                size_t comma = value.find(',', start);
+                if (comma == std::string::npos)
+                {
+                    comma = value.size();
+                }
+                options.playerCounts.push_back(std::max(2, atoi(value.substr(start, comma - start).c_str())));
+                start = comma + 1;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return !options.playerCounts.empty();
+}
+
+void pickTarget(SimBody& body, const SimBody* ball, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    if (ball != nullptr)
+    {
+        body.target[0] = ball->position[0] + unit(rng) * SIM_BALL_CHASE_RADIUS;
+        body.target[1] = ball->position[1] + unit(rng) * SIM_BALL_CHASE_RADIUS;
+    }
+    else
+    {
+        body.target[0] = unit(rng) * SIM_FIELD_HALF_WIDTH;
+        body.target[1] = unit(rng) * SIM_FIELD_HALF_LENGTH;
+    }
+    body.target[0] = std::clamp(body.target[0], -SIM_FIELD_HALF_WIDTH, SIM_FIELD_HALF_WIDTH);
+    body.target[1] = std::clamp(body.target[1], -SIM_FIELD_HALF_LENGTH, SIM_FIELD_HALF_LENGTH);
+    body.target[2] = std::uniform_real_distribution<float>(0.0f, 600.0f)(rng);
+}
+
+// Moves towards the target and picks a new one once it is reached. Returns true when it did.
+bool moveBody(SimBody& body, float step)
+{
+    float delta[3];
+    float distance = 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        delta[i] = body.target[i] - body.position[i];
+        distance += delta[i] * delta[i];
+    }
+    distance = std::sqrt(distance);
+    if (distance <= step)
+    {
+        memcpy(body.position, body.target, sizeof(body.position));
+        return true;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        body.position[i] += delta[i] / distance * step;
+    }
+    return false;
+}
+
+SimResult simulate(const SimOptions& options, int players)
+{
+    std::mt19937 rng(options.seed + players);
+    SimBody ball = {};
+    pickTarget(ball, nullptr, rng);
+    std::vector<SimBody> bodies(players);
+    for (int i = 0; i < players; i++)
+    {
+        pickTarget(bodies[i], nullptr, rng);
+        memcpy(bodies[i].position, bodies[i].target, sizeof(bodies[i].position));
+        pickTarget(bodies[i], i % 2 == 0 ? &ball : nullptr, rng);
+    }
+
+    RelayInterest interest;
+    RelayBatch batch;
+    std::vector<RelaySlice> slices;
+    // The snapshot itself is never looked at, only its size matters
+    std::vector<char> payload(sizeof(NetcodeRelevance) + options.snapshotSize);
+    std::vector<char> frame(sizeof(NetcodeFrameHeader) + payload.size());
+    // Frames since each receiver last got each stream, receiver * players + stream
+    std::vector<int> gaps(players * players, 0);
+    SimResult result;
+
+    const int ticks = options.seconds * options.rateHz;
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        if (moveBody(ball, SIM_BALL_SPEED / options.rateHz))
+        {
+            pickTarget(ball, nullptr, rng);
+        }
+
+        // Sources are 1 based, 0 is the relay itself
+        for (int i = 0; i < players; i++)
+        {
+            if (moveBody(bodies[i], SIM_PLAYER_SPEED / options.rateHz))
+            {
+                pickTarget(bodies[i], i % 2 == 0 ? &ball : nullptr, rng);
+            }
+
+            NetcodeRelevance relevance;
+            relevance.playerId = i;
+            for (int k = 0; k < 3; k++)
+            {
+                relevance.position[k] = (int16_t)bodies[i].position[k];
+            }
+            memcpy(payload.data(), &relevance, sizeof(relevance));
+            size_t frameLen = NetcodeFraming::WriteFrame(frame.data(), frame.size(), NetcodeMessageType::MARIO_BODY_STATE,
+                tick, payload.data(), payload.size(), NETCODE_FLAG_RELEVANCE);
+
+            interest.Observe(i + 1, frame.data(), frameLen);
+            batch.Add(i + 1, frame.data(), frameLen);
+        }
+
+        interest.Update();
+        for (int receiver = 0; receiver < players; receiver++)
+        {
+            result.fullBytes += batch.Gather(receiver + 1, slices);
+            result.interestBytes += batch.Gather(receiver + 1, slices, [&](const RelayBatch::Entry& entry) {
+                int stream = (int)entry.source - 1;
+                int& gap = gaps[receiver * players + stream];
+                if (interest.Relevant(receiver + 1, batch.FrameData(entry), entry.len))
+                {
+                    gap = 0;
+                    return true;
+                }
+                result.longestGap = std::max(result.longestGap, ++gap);
+                return false;
+            });
+        }
+        batch.Clear();
+    }
+
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    SimOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    printf("relay interest sim: %d s at %d Hz, %d byte snapshots, full rate within %.0f units, floor %.3f, budget %.1f streams\n",
+        options.seconds, options.rateHz, options.snapshotSize, RELEVANCE_FULL_RATE_DISTANCE, RELEVANCE_MIN_RATE,
+        RELEVANCE_RECEIVER_BUDGET);
+    printf("%8s %14s %14s %8s %14s %9s %11s\n", "players", "full kB/s", "interest kB/s", "ratio", "kB/s/receiver", "exponent",
+        "max skipped");
+
+    double lastPlayers = 0.0;
+    double lastBytes = 0.0;
+    for (int players : options.playerCounts)
+    {
+        SimResult result = simulate(options, players);
+        const double fullKBps = result.fullBytes / 1024.0 / options.seconds;
+        const double interestKBps = result.interestBytes / 1024.0 / options.seconds;
+
+        // Growth of the total relay bandwidth since the previous lobby size, 2 is quadratic
+        std::string exponent = "-";
+        if (lastPlayers > 0.0 && players > lastPlayers)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.2f", std::log(interestKBps / lastBytes) / std::log(players / lastPlayers));
+            exponent = buf;
+        }
+        printf("%8d %14.1f %14.1f %7.2fx %14.2f %9s %11d\n", players, fullKBps, interestKBps, fullKBps / interestKBps,
+            interestKBps / players, exponent.c_str(), result.longestGap);
+        lastPlayers = players;
+        lastBytes = interestKBps;
+    }
+    return 0;
+}
@@ -0,0 +1,324 @@
+// RelayLoadTest.cpp
+// Linux load test for the netcode relay, measures relay latency percentiles.
+//
+// Opens a number of TCP clients that each send a timestamped body state frame
+// at a fixed rate, and measures how long every frame takes to reach each of
+// the other clients through the relay. By default the relay runs in this
+// process on the epoll backend, --connect points it at an external one.
+// A number of clients can be made to never read, to check that they only
+// hurt themselves.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NetcodeRelay.h"
+
+#define LOAD_TEST_DEFAULT_PORT 27778
+
+struct LoadTestOptions
+{
+    int clients = 32;
+    int slowClients = 0;
+    int seconds = 10;
+    int rateHz = 30;
+    int payloadSize = 64;
+    std::string host = "127.0.0.1";
+    uint16_t port = LOAD_TEST_DEFAULT_PORT;
+    bool inProcessRelay = true;
+};
+
+#pragma pack(push, 1)
+struct LoadTestPayloadHeader
+{
+    uint64_t sentNs;
+    uint32_t sender;
+};
+#pragma pack(pop)
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void logRelay(const std::string& msg)
+{
+    fprintf(stderr, "relay: %s\n", msg.c_str());
+}
+
+void printUsage()
+{
+    printf("usage: RelayLoadTest [--clients N] [--slow N] [--seconds N] [--rate HZ] [--payload BYTES] [--port PORT]\n"
+        "                     [--connect HOST:PORT]\n");
+}
+
+bool parseOptions(int argc, char** argv, LoadTestOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--clients")
+        {
+            options.clients = std::max(2, atoi(value.c_str()));
+        }
+        else if (arg == "--slow")
+        {
+            options.slowClients = std::max(0, atoi(value.c_str()));
+        }
+        else if (arg == "--seconds")
+        {
+            options.seconds = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--rate")
+        {
+            options.rateHz = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--payload")
+        {
+            options.payloadSize = std::max((int)sizeof(LoadTestPayloadHeader), atoi(value.c_str()));
+        }
+        else if (arg == "--port")
+        {
+            options.port = (uint16_t)atoi(value.c_str());
+        }
+        else if (arg == "--connect")
+        {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos)
+            {
+                return false;
+            }
+            options.host = value.substr(0, colon);
+            options.port = (uint16_t)atoi(value.substr(colon + 1).c_str());
+            options.inProcessRelay = false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options.slowClients < options.clients - 1;
+}
+
+int connectClient(const LoadTestOptions& options)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &result) != 0 || result == nullptr)
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) < 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd >= 0)
+    {
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return fd;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    size_t index = std::min(sorted.size() - 1, (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5));
+    return sorted[index];
+}
+
+int main(int argc, char** argv)
+{
+    LoadTestOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    // In process relay, driven by its own thread like the plugin's TcpServer
+    std::atomic<bool> stopRelay = false;
+    std::unique_ptr<NetcodeRelay> relay;
+    std::thread relayThread;
+    if (options.inProcessRelay)
+    {
+        relay = std::make_unique<NetcodeRelay>(RelayIoBackend::Create(logRelay), NetcodeRelay::Hooks());
+        if (!relay->Listen(options.port))
+        {
+            return 1;
+        }
+        relayThread = std::thread([&relay, &stopRelay]() {
+            while (!stopRelay)
+            {
+                relay->RunOnce();
+            }
+        });
+    }
+
+    std::vector<int> fds;
+    for (int i = 0; i < options.clients; i++)
+    {
+        int fd = connectClient(options);
+        if (fd < 0)
+        {
+            fprintf(stderr, "failed to connect client %d to %s:%u\n", i, options.host.c_str(), options.port);
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+    // Give the relay a moment to accept everyone, frames sent before that are not relayed to late clients
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // The last slowClients clients never read
+    const int readingClients = options.clients - options.slowClients;
+    int epollFd = epoll_create1(0);
+    for (int i = 0; i < readingClients; i++)
+    {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+
+    std::atomic<bool> sending = true;
+    uint64_t framesSent = 0;
+    uint64_t expectedDeliveries = 0;
+    std::vector<double> latenciesMs;
+    std::mutex latenciesMutex;
+    std::thread receiver([&]() {
+        std::vector<NetcodeFrameReader> readers(readingClients);
+        std::vector<char> buf(RELAY_RECV_BUF_SIZE);
+        std::vector<double> local;
+        epoll_event events[64];
+        // Keep draining for a bit after the senders stop so the last frames are counted
+        uint64_t drainUntil = 0;
+        while (true)
+        {
+            if (!sending && drainUntil == 0)
+            {
+                drainUntil = nowNs() + 500000000ull;
+            }
+            if (drainUntil != 0 && nowNs() > drainUntil)
+            {
+                break;
+            }
+
+            int count = epoll_wait(epollFd, events, 64, 50);
+            for (int i = 0; i < count; i++)
+            {
+                int client = (int)events[i].data.u32;
+                ssize_t bytesIn = recv(fds[client], buf.data(), buf.size(), MSG_DONTWAIT);
+                if (bytesIn <= 0)
+                {
+                    continue;
+                }
+
+                const uint64_t receivedNs = nowNs();
+                readers[client].Feed(buf.data(), (size_t)bytesIn, [&](const NetcodeFrame& frame) {
+                    if (frame.payloadLen < (int)sizeof(LoadTestPayloadHeader))
+                    {
+                        return;
+                    }
+                    LoadTestPayloadHeader header;
+                    memcpy(&header, frame.payload, sizeof(header));
+                    local.push_back((receivedNs - header.sentNs) / 1e6);
+                });
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(latenciesMutex);
+        latenciesMs.swap(local);
+    });
+
+    // Every client sends one frame per tick, spread evenly over the tick like real players would be
+    printf("relay load test: %d clients (%d not reading), %d Hz, %d byte payload, %d s, %s relay\n",
+        options.clients, options.slowClients, options.rateHz, options.payloadSize, options.seconds,
+        options.inProcessRelay ? "in process" : "external");
+    std::vector<char> payload(options.payloadSize);
+    std::vector<char> frameBuf(sizeof(NetcodeFrameHeader) + options.payloadSize);
+    const auto tick = std::chrono::nanoseconds(1000000000ll / options.rateHz);
+    const auto spacing = tick / options.clients;
+    const auto start = std::chrono::steady_clock::now();
+    const auto end = start + std::chrono::seconds(options.seconds);
+    uint32_t sequence = 0;
+    for (auto tickStart = start; tickStart < end; tickStart += tick)
+    {
+        for (int i = 0; i < options.clients; i++)
+        {
+            std::this_thread::sleep_until(tickStart + spacing * i);
+
+            LoadTestPayloadHeader header = { nowNs(), (uint32_t)i };
+            memcpy(payload.data(), &header, sizeof(header));
+            size_t frameLen = NetcodeFraming::WriteFrame(frameBuf.data(), frameBuf.size(),
+                NetcodeMessageType::MARIO_BODY_STATE, sequence++, payload.data(), payload.size());
+            if (send(fds[i], frameBuf.data(), frameLen, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)frameLen)
+            {
+                // Everyone that reads gets it, except the sender itself
+                framesSent++;
+                expectedDeliveries += i < readingClients ? readingClients - 1 : readingClients;
+            }
+        }
+    }
+    sending = false;
+    receiver.join();
+
+    std::sort(latenciesMs.begin(), latenciesMs.end());
+    printf("frames sent: %llu, deliveries: %zu of %llu expected\n",
+        (unsigned long long)framesSent, latenciesMs.size(), (unsigned long long)expectedDeliveries);
+    printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+        percentile(latenciesMs, 50), percentile(latenciesMs, 90), percentile(latenciesMs, 99),
+        percentile(latenciesMs, 99.9), latenciesMs.empty() ? 0.0 : latenciesMs.back());
+
+    if (relay != nullptr)
+    {
+        stopRelay = true;
+        relay->Wake();
+        relayThread.join();
+
+        const RelayStats& stats = relay->Stats();
+        const RelayBackendStats& backendStats = relay->BackendStats();
+        printf("relay: %llu ticks, %llu frames, %llu send calls, %llu bytes, %llu dropped sends, %llu slow clients closed\n",
+            (unsigned long long)stats.ticks.load(), (unsigned long long)stats.framesRelayed.load(),
+            (unsigned long long)backendStats.sendCalls.load(), (unsigned long long)backendStats.bytesSent.load(),
+            (unsigned long long)backendStats.droppedSends.load(), (unsigned long long)backendStats.slowClientsClosed.load());
+    }
+
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+    close(epollFd);
+    return 0;
+}
@@ -0,0 +1,305 @@
+// SnapshotCodecBench.cpp
+// Replays body state streams through the snapshot codec, reports bytes on the wire and encode/decode time.
+//
+// The streams come from a recording made in game with rp_netcode_record or
+// by MarioReplayHarness --trace, or are generated from a seed. Every stream
+// is encoded once per tick like the plugin sends it and decoded by every
+// other player of the lobby, which ack a few snapshots late. Every decoded
+// snapshot must match the quantized original, any mismatch fails the
+// benchmark with a non zero exit code.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BodyStateRecording.h"
+#include "NetcodeFraming.h"
+#include "SnapshotCodec.h"
+
+#define BENCH_STEP_MS 33 // One 30 Hz step
+// Synthetic body states, only roughly laid out like libsm64's
+#define SYNTHETIC_BODY_STATE_SIZE 160
+#define SYNTHETIC_ACTION_OFFSET 28
+#define SYNTHETIC_ANIM_FRAME_OFFSET 64
+#define SYNTHETIC_FIELD_HALF_WIDTH 3500.0f
+#define SYNTHETIC_FIELD_HALF_LENGTH 4500.0f
+
+struct BenchOptions
+{
+    std::string recordingPath;
+    int syntheticMarios = 8;
+    int steps = 1800;
+    int players = 8;
+    int ackDelay = 3; // Snapshots
+    unsigned seed = 1;
+};
+
+struct BodyStateStreams
+{
+    BodyStateLayout layout;
+    // Body states of every stream back to back, layout.size bytes each
+    std::map<int, std::vector<uint8_t>> streams;
+};
+
+void printUsage()
+{
+    printf("usage: SnapshotCodecBench [--recording FILE | --synthetic MARIOS [--steps N] [--seed N]] [--players N]\n"
+        "                          [--ack-delay SNAPSHOTS]\n");
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--recording")
+        {
+            options.recordingPath = value;
+        }
+        else if (arg == "--synthetic")
+        {
+            options.syntheticMarios = std::clamp(atoi(value.c_str()), 1, 64);
+        }
+        else if (arg == "--steps")
+        {
+            options.steps = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--players")
+        {
+            options.players = std::clamp(atoi(value.c_str()), 2, 64);
+        }
+        else if (arg == "--ack-delay")
+        {
+            options.ackDelay = std::clamp(atoi(value.c_str()), 0, SNAPSHOT_HISTORY_SIZE - 1);
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readRecording(const std::string& path, BodyStateStreams& recorded)
+{
+    std::ifstream recording(path, std::ios::binary);
+    BodyStateRecordingHeader header;
+    if (!recording.read((char*)&header, sizeof(header)) || header.magic != BODY_STATE_RECORDING_MAGIC ||
+        !BodyStateLayoutValid(header.layout))
+    {
+        return false;
+    }
+    recorded.layout = header.layout;
+
+    std::vector<uint8_t> bodyState(header.layout.size);
+    uint64_t timestamp;
+    int32_t playerId;
+    while (recording.read((char*)&timestamp, sizeof(timestamp)) &&
+        recording.read((char*)&playerId, sizeof(playerId)) &&
+        recording.read((char*)bodyState.data(), bodyState.size()))
+    {
+        std::vector<uint8_t>& stream = recorded.streams[playerId];
+        stream.insert(stream.end(), bodyState.begin(), bodyState.end());
+    }
+    return true;
+}
+
+// Marios that run around the field, turn, and jump or dive now and then
+void generateStreams(const BenchOptions& options, BodyStateStreams& generated)
+{
+    BodyStateLayout& layout = generated.layout;
+    layout.size = SYNTHETIC_BODY_STATE_SIZE;
+    layout.positionOffset = 0;
+    layout.velocityOffset = 12;
+    layout.faceAngleOffset = 24;
+
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<uint8_t> bodyState(layout.size);
+    for (int mario = 0; mario < options.syntheticMarios; mario++)
+    {
+        std::fill(bodyState.begin(), bodyState.end(), 0);
+        // Constant words, like health and the cap, are whatever the rest of a body state holds
+        for (size_t i = SYNTHETIC_ANIM_FRAME_OFFSET + 4; i < bodyState.size(); i++)
+        {
+            bodyState[i] = (uint8_t)random();
+        }
+
+        float position[3] = { unit(random) * SYNTHETIC_FIELD_HALF_WIDTH, 0.0f,
+            unit(random) * SYNTHETIC_FIELD_HALF_LENGTH };
+        float velocity[3] = {};
+        float faceAngle = unit(random) * 3.14159f;
+        uint32_t action = 0x0C400201; // Idle
+        uint32_t animFrame = 0;
+        std::vector<uint8_t>& stream = generated.streams[mario + 1];
+        for (int step = 0; step < options.steps; step++)
+        {
+            if (random() % 45 == 0)
+            {
+                faceAngle = std::remainder(faceAngle + unit(random) * 1.5f, 6.28318f);
+                action = random() % 4 == 0 ? 0x03000880 : 0x04000440; // Jump or walk
+                velocity[1] = action == 0x03000880 ? 42.0f : 0.0f;
+                animFrame = 0;
+            }
+            const float speed = 32.0f;
+            velocity[0] = std::sin(faceAngle) * speed;
+            velocity[2] = std::cos(faceAngle) * speed;
+            velocity[1] = position[1] > 0.0f || velocity[1] > 0.0f ? velocity[1] - 4.0f : 0.0f;
+            for (int k = 0; k < 3; k++)
+            {
+                position[k] += velocity[k];
+            }
+            position[1] = std::max(position[1], 0.0f);
+            position[0] = std::clamp(position[0], -SYNTHETIC_FIELD_HALF_WIDTH, SYNTHETIC_FIELD_HALF_WIDTH);
+            position[2] = std::clamp(position[2], -SYNTHETIC_FIELD_HALF_LENGTH, SYNTHETIC_FIELD_HALF_LENGTH);
+            animFrame++;
+
+            memcpy(bodyState.data() + layout.positionOffset, position, sizeof(position));
+            memcpy(bodyState.data() + layout.velocityOffset, velocity, sizeof(velocity));
+            memcpy(bodyState.data() + layout.faceAngleOffset, &faceAngle, sizeof(faceAngle));
+            memcpy(bodyState.data() + SYNTHETIC_ACTION_OFFSET, &action, sizeof(action));
+            memcpy(bodyState.data() + SYNTHETIC_ANIM_FRAME_OFFSET, &animFrame, sizeof(animFrame));
+            stream.insert(stream.end(), bodyState.begin(), bodyState.end());
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    BodyStateStreams input;
+    if (!options.recordingPath.empty())
+    {
+        if (!readRecording(options.recordingPath, input))
+        {
+            fprintf(stderr, "no usable recording at %s, record one with rp_netcode_record or MarioReplayHarness --trace\n",
+                options.recordingPath.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        generateStreams(options, input);
+    }
+
+    const BodyStateLayout& layout = input.layout;
+    const SnapshotCodec codec(layout.size, BodyStateQuantizedFields(layout));
+    std::vector<uint8_t> encoded(SnapshotStreamEncoder(codec).MaxEncodedSize());
+    std::vector<uint32_t> expectedWords(codec.WordCount());
+    std::vector<uint32_t> decodedWords(codec.WordCount());
+    std::vector<uint8_t> decoded(layout.size);
+    size_t snapshots = 0;
+    size_t encodedBytes = 0;
+    size_t inputSequenceBytes = 0;
+    size_t mismatches = 0;
+    std::chrono::nanoseconds encodeTime(0);
+    std::chrono::nanoseconds decodeTime(0);
+
+    // Every stream is sent to players - 1 receivers which ack a few snapshots late
+    const int receivers = options.players - 1;
+    for (const auto& [streamId, states] : input.streams)
+    {
+        SnapshotStreamEncoder encoder(codec);
+        std::vector<SnapshotStreamDecoder> decoders;
+        for (int i = 0; i < receivers; i++)
+        {
+            decoders.emplace_back(codec);
+        }
+        struct PendingAck
+        {
+            size_t tick;
+            int receiver;
+            uint8_t ack;
+        };
+        std::deque<PendingAck> pendingAcks;
+
+        const size_t ticks = states.size() / layout.size;
+        for (size_t tick = 0; tick < ticks; tick++)
+        {
+            const uint8_t* state = states.data() + tick * layout.size;
+            const uint64_t nowMs = tick * BENCH_STEP_MS;
+            auto start = std::chrono::steady_clock::now();
+            const size_t len = encoder.Encode(state, nowMs, encoded.data(), encoded.size());
+            encodeTime += std::chrono::steady_clock::now() - start;
+            encodedBytes += len;
+            snapshots++;
+            // The plugin sends the input sequence its mario ticked to, one per tick
+            uint8_t inputSequence[SNAPSHOT_VARINT_MAX_SIZE];
+            inputSequenceBytes += SnapshotVarint::Write((uint32_t)tick + 1, inputSequence, sizeof(inputSequence));
+
+            codec.Quantize(state, expectedWords.data());
+            for (int receiver = 0; receiver < receivers; receiver++)
+            {
+                uint16_t snapshotId;
+                start = std::chrono::steady_clock::now();
+                const auto result = decoders[receiver].Decode(encoded.data(), len, decoded.data(), &snapshotId);
+                decodeTime += std::chrono::steady_clock::now() - start;
+
+                codec.Quantize(decoded.data(), decodedWords.data());
+                if (result != SnapshotStreamDecoder::Result::OK || decodedWords != expectedWords)
+                {
+                    mismatches++;
+                }
+                pendingAcks.push_back({ tick + options.ackDelay, receiver, decoders[receiver].AckId() });
+            }
+
+            while (!pendingAcks.empty() && pendingAcks.front().tick <= tick)
+            {
+                encoder.Ack(pendingAcks.front().receiver, pendingAcks.front().ack, nowMs);
+                pendingAcks.pop_front();
+            }
+        }
+    }
+
+    if (snapshots == 0)
+    {
+        fprintf(stderr, "no snapshots to encode\n");
+        return 1;
+    }
+
+    // Per message overhead besides the snapshot: frame header, player id and position, sender time, input sequence,
+    // ack count and a varint player id and ack byte per other stream
+    const double overhead = sizeof(NetcodeFrameHeader) + sizeof(NetcodeRelevance) + sizeof(uint16_t) +
+        (double)inputSequenceBytes / snapshots + 1 + receivers * 2.0;
+    const double rawPerSnapshot = sizeof(NetcodeFrameHeader) + sizeof(int32_t) + layout.size;
+    const double payloadPerSnapshot = (double)encodedBytes / snapshots;
+    const double encodedPerSnapshot = overhead + payloadPerSnapshot;
+    printf("%zu snapshots of %u bytes from %zu %s streams, %d player lobby, %zu decode mismatches\n", snapshots,
+        layout.size, input.streams.size(), options.recordingPath.empty() ? "synthetic" : "recorded", options.players,
+        mismatches);
+    printf("bytes per snapshot: raw %.1f, encoded %.1f (%.1fx smaller)\n", rawPerSnapshot, encodedPerSnapshot,
+        rawPerSnapshot / encodedPerSnapshot);
+    printf("encoded bytes per snapshot: snapshot %.1f (%.1fx smaller than the %u byte body state), message overhead %.1f\n",
+        payloadPerSnapshot, layout.size / payloadPerSnapshot, layout.size, overhead);
+    printf("bytes per tick received per client: raw %.1f, encoded %.1f\n", rawPerSnapshot * receivers,
+        encodedPerSnapshot * receivers);
+    printf("encode %.0f ns, decode %.0f ns per snapshot\n", (double)encodeTime.count() / snapshots,
+        (double)decodeTime.count() / (snapshots * receivers));
+
+    return mismatches == 0 ? 0 : 1;
+}
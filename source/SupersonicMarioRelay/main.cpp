@@ -0,0 +1,476 @@
+// main.cpp
+// Headless SM64 netcode relay, runs without Rocket League or BakkesMod.
+//
+//   host    Listens for players and relays framed netcode between them,
+//           like the plugin's TcpServer does inside the host's game.
+//   client  Listens for nearby players and forwards everything to and from
+//           an upstream relay, so relays can be placed close to players.
+//   soak    Runs a relay with simulated players for a long time, checks that
+//           every frame arrives intact and in order while players come and go.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NetcodeRelay.h"
+
+#define RELAY_DEFAULT_PORT 7778
+#define RELAY_STATS_INTERVAL_S 10
+#define RELAY_RECONNECT_DELAY_MS 2000
+
+struct RelayOptions
+{
+    std::string role;
+    uint16_t port = RELAY_DEFAULT_PORT;
+    std::string upstreamHost;
+    uint16_t upstreamPort = 0;
+    int statsIntervalS = RELAY_STATS_INTERVAL_S;
+
+    // Soak only
+    int seconds = 600;
+    int clients = 16;
+    int rateHz = 30;
+    int payloadSize = 256;
+    int churnMs = 5000;
+};
+
+std::atomic<bool> stopRequested = false;
+
+void onSignal(int)
+{
+    stopRequested = true;
+}
+
+void logLine(const char* level, const std::string& msg)
+{
+    time_t now = time(nullptr);
+    char timeBuf[32];
+    strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    printf("%s [%s] %s\n", timeBuf, level, msg.c_str());
+    fflush(stdout);
+}
+
+void logRelayError(const std::string& msg)
+{
+    logLine("error", msg);
+}
+
+void printUsage()
+{
+    printf("usage: SupersonicMarioRelay host [--port PORT]\n"
+        "       SupersonicMarioRelay client --connect HOST:PORT [--port PORT]\n"
+        "       SupersonicMarioRelay soak [--seconds N] [--clients N] [--rate HZ] [--payload BYTES] [--churn-ms MS]\n"
+        "                                 [--port PORT] [--connect HOST:PORT]\n"
+        "options: --stats-interval SECONDS\n");
+}
+
+bool parseHostPort(const std::string& value, std::string& host, uint16_t& port)
+{
+    size_t colon = value.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        return false;
+    }
+    host = value.substr(0, colon);
+    port = (uint16_t)atoi(value.substr(colon + 1).c_str());
+    return port != 0;
+}
+
+bool parseOptions(int argc, char** argv, RelayOptions& options)
+{
+    if (argc < 2)
+    {
+        return false;
+    }
+
+    options.role = argv[1];
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--port")
+        {
+            options.port = (uint16_t)atoi(value.c_str());
+        }
+        else if (arg == "--connect")
+        {
+            if (!parseHostPort(value, options.upstreamHost, options.upstreamPort))
+            {
+                return false;
+            }
+        }
+        else if (arg == "--stats-interval")
+        {
+            options.statsIntervalS = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--seconds")
+        {
+            options.seconds = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--clients")
+        {
+            options.clients = std::max(2, atoi(value.c_str()));
+        }
+        else if (arg == "--rate")
+        {
+            options.rateHz = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--payload")
+        {
+            options.payloadSize = std::max(32, atoi(value.c_str()));
+        }
+        else if (arg == "--churn-ms")
+        {
+            options.churnMs = std::max(0, atoi(value.c_str()));
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (options.role == "client")
+    {
+        return !options.upstreamHost.empty();
+    }
+    return options.role == "host" || options.role == "soak";
+}
+
+void logRelayStats(NetcodeRelay& relay)
+{
+    RelayStats& stats = relay.Stats();
+    const RelayBackendStats& backendStats = relay.BackendStats();
+    const uint64_t ticks = stats.ticks;
+    logLine("info", "connections " + std::to_string(relay.Connections())
+        + ", ticks " + std::to_string(ticks)
+        + ", frames " + std::to_string(stats.framesRelayed.load())
+        + ", frames/tick " + (ticks > 0 ? std::to_string((double)stats.framesRelayed / ticks) : "0")
+        + ", send calls " + std::to_string(backendStats.sendCalls.load())
+        + ", bytes " + std::to_string(backendStats.bytesSent.load())
+        + ", dropped sends " + std::to_string(backendStats.droppedSends.load())
+        + ", slow clients closed " + std::to_string(backendStats.slowClientsClosed.load())
+        + ", body states held back " + std::to_string(relay.InterestStats().skipped.load()));
+}
+
+// Runs a relay until stopRequested is set. In the client role the upstream relay is just one more connection,
+// and it is reconnected whenever it drops.
+int runRelay(const RelayOptions& options)
+{
+    std::atomic<relay_conn_t> upstream = 0;
+    NetcodeRelay::Hooks hooks;
+    hooks.onDisconnect = [&upstream](relay_conn_t conn, uint32_t) {
+        if (conn == upstream)
+        {
+            logLine("warning", "lost connection to upstream relay");
+            upstream = 0;
+        }
+    };
+
+    NetcodeRelay relay(RelayIoBackend::Create(logRelayError), hooks);
+    if (!relay.Listen(options.port))
+    {
+        return 1;
+    }
+    logLine("info", "relay listening on port " + std::to_string(options.port) + " as " + options.role);
+
+    const bool hasUpstream = !options.upstreamHost.empty();
+    auto nextUpstreamAttempt = std::chrono::steady_clock::now();
+    auto nextStats = std::chrono::steady_clock::now() + std::chrono::seconds(options.statsIntervalS);
+    while (!stopRequested)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (hasUpstream && upstream == 0 && now >= nextUpstreamAttempt)
+        {
+            upstream = relay.Connect(options.upstreamHost, options.upstreamPort);
+            if (upstream != 0)
+            {
+                logLine("info", "connected to upstream relay " + options.upstreamHost + ":" + std::to_string(options.upstreamPort));
+            }
+            nextUpstreamAttempt = now + std::chrono::milliseconds(RELAY_RECONNECT_DELAY_MS);
+        }
+        if (now >= nextStats)
+        {
+            logRelayStats(relay);
+            nextStats = now + std::chrono::seconds(options.statsIntervalS);
+        }
+
+        relay.RunOnce();
+    }
+
+    logRelayStats(relay);
+    logLine("info", "relay stopped");
+    return 0;
+}
+
+#pragma pack(push, 1)
+struct SoakPayloadHeader
+{
+    uint32_t sender;
+    uint32_t generation;
+    uint32_t sequence;
+    uint64_t sentNs;
+};
+#pragma pack(pop)
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint8_t soakFillByte(uint32_t sequence, size_t index)
+{
+    return (uint8_t)(sequence * 31 + index * 7);
+}
+
+// One simulated player in the soak test
+struct SoakClient
+{
+    relay_conn_t conn = 0;
+    uint32_t generation = 0;
+    uint32_t nextSequence = 0;
+    NetcodeFrameReader reader;
+    // Last sequence seen from each sender generation, keyed by (sender << 32 | generation)
+    std::unordered_map<uint64_t, uint32_t> lastSeen;
+};
+
+struct SoakResults
+{
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    uint64_t corrupt = 0;
+    uint64_t outOfOrder = 0;
+    uint64_t reconnects = 0;
+    std::vector<double> latenciesMs;
+};
+
+double percentile(std::vector<double>& values, double p)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p / 100.0 * (values.size() - 1) + 0.5))];
+}
+
+void onSoakFrame(SoakClient& receiver, const NetcodeFrame& frame, size_t payloadSize, SoakResults& results)
+{
+    SoakPayloadHeader header;
+    if (frame.Type() != NetcodeMessageType::MARIO_BODY_STATE || (size_t)frame.payloadLen != payloadSize)
+    {
+        results.corrupt++;
+        return;
+    }
+    memcpy(&header, frame.payload, sizeof(header));
+    for (size_t i = sizeof(header); i < payloadSize; i++)
+    {
+        if ((uint8_t)frame.payload[i] != soakFillByte(header.sequence, i))
+        {
+            results.corrupt++;
+            return;
+        }
+    }
+
+    // TCP through the relay must neither reorder nor lose frames from a sender
+    const uint64_t key = ((uint64_t)header.sender << 32) | header.generation;
+    auto last = receiver.lastSeen.find(key);
+    if (last != receiver.lastSeen.end() && header.sequence != last->second + 1)
+    {
+        results.outOfOrder++;
+    }
+    receiver.lastSeen[key] = header.sequence;
+
+    results.delivered++;
+    results.latenciesMs.push_back((nowNs() - header.sentNs) / 1e6);
+}
+
+// Simulated players live on their own backend instance and talk to the relay over loopback like real clients would
+int runSoak(const RelayOptions& options)
+{
+    std::thread relayThread;
+    const bool external = !options.upstreamHost.empty();
+    const std::string relayHost = external ? options.upstreamHost : "127.0.0.1";
+    const uint16_t relayPort = external ? options.upstreamPort : options.port;
+    if (!external)
+    {
+        RelayOptions relayOptions = options;
+        relayOptions.role = "host";
+        relayOptions.statsIntervalS = options.statsIntervalS;
+        relayThread = std::thread([relayOptions]() {
+            runRelay(relayOptions);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    std::unique_ptr<RelayIoBackend> backend = RelayIoBackend::Create(logRelayError);
+    std::vector<SoakClient> clients(options.clients);
+    for (SoakClient& client : clients)
+    {
+        client.conn = backend->Connect(relayHost, relayPort);
+        if (client.conn == 0)
+        {
+            stopRequested = true;
+            if (relayThread.joinable())
+            {
+                relayThread.join();
+            }
+            return 1;
+        }
+    }
+
+    SoakResults total;
+    SoakResults interval;
+    const auto byConn = [&clients](relay_conn_t conn) -> SoakClient* {
+        for (SoakClient& client : clients)
+        {
+            if (client.conn == conn)
+            {
+                return &client;
+            }
+        }
+        return nullptr;
+    };
+
+    RelayIoBackend::Callbacks callbacks;
+    callbacks.onData = [&](relay_conn_t conn, char* data, size_t len) {
+        SoakClient* client = byConn(conn);
+        if (client != nullptr && !client->reader.Feed(data, len, [&](const NetcodeFrame& frame) {
+            onSoakFrame(*client, frame, options.payloadSize, interval);
+        }))
+        {
+            interval.corrupt++;
+        }
+    };
+    callbacks.onClose = [&](relay_conn_t conn) {
+        if (byConn(conn) != nullptr)
+        {
+            logLine("error", "relay closed a soak client");
+            interval.corrupt++;
+        }
+    };
+
+    logLine("info", "soak: " + std::to_string(options.clients) + " clients at " + std::to_string(options.rateHz) + " Hz, "
+        + std::to_string(options.payloadSize) + " byte frames for " + std::to_string(options.seconds) + " s");
+
+    std::mt19937 rng(1234);
+    std::vector<char> payload(options.payloadSize);
+    std::vector<char> frameBuf(sizeof(NetcodeFrameHeader) + options.payloadSize);
+    const auto tick = std::chrono::nanoseconds(1000000000ll / options.rateHz);
+    const auto start = std::chrono::steady_clock::now();
+    const auto end = start + std::chrono::seconds(options.seconds);
+    auto nextTick = start;
+    auto nextChurn = start + std::chrono::milliseconds(options.churnMs);
+    auto nextReport = start + std::chrono::seconds(options.statsIntervalS);
+    while (!stopRequested && std::chrono::steady_clock::now() < end)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= nextTick)
+        {
+            for (size_t i = 0; i < clients.size(); i++)
+            {
+                SoakClient& client = clients[i];
+                SoakPayloadHeader header = { (uint32_t)i, client.generation, client.nextSequence++, nowNs() };
+                memcpy(payload.data(), &header, sizeof(header));
+                for (size_t k = sizeof(header); k < payload.size(); k++)
+                {
+                    payload[k] = (char)soakFillByte(header.sequence, k);
+                }
+                size_t frameLen = NetcodeFraming::WriteFrame(frameBuf.data(), frameBuf.size(),
+                    NetcodeMessageType::MARIO_BODY_STATE, header.sequence, payload.data(), payload.size());
+                backend->Send(client.conn, RelaySendItem::Copy(frameBuf.data(), frameLen));
+                interval.sent++;
+            }
+            nextTick += tick;
+        }
+
+        // A player leaves and rejoins, everyone else must not notice
+        if (options.churnMs > 0 && now >= nextChurn)
+        {
+            SoakClient& client = clients[rng() % clients.size()];
+            backend->Close(client.conn);
+            client.conn = backend->Connect(relayHost, relayPort);
+            client.generation++;
+            client.nextSequence = 0;
+            client.reader.Reset();
+            client.lastSeen.clear();
+            interval.reconnects++;
+            if (client.conn == 0)
+            {
+                logLine("error", "soak client failed to reconnect");
+                break;
+            }
+            nextChurn = now + std::chrono::milliseconds(options.churnMs);
+        }
+
+        if (now >= nextReport)
+        {
+            logLine("info", "soak: sent " + std::to_string(interval.sent) + ", delivered " + std::to_string(interval.delivered)
+                + ", corrupt " + std::to_string(interval.corrupt) + ", out of order " + std::to_string(interval.outOfOrder)
+                + ", reconnects " + std::to_string(interval.reconnects)
+                + ", p50 " + std::to_string(percentile(interval.latenciesMs, 50))
+                + " ms, p99 " + std::to_string(percentile(interval.latenciesMs, 99)) + " ms");
+            total.sent += interval.sent;
+            total.delivered += interval.delivered;
+            total.corrupt += interval.corrupt;
+            total.outOfOrder += interval.outOfOrder;
+            total.reconnects += interval.reconnects;
+            interval = SoakResults();
+            nextReport = now + std::chrono::seconds(options.statsIntervalS);
+        }
+
+        auto untilTick = std::chrono::duration_cast<std::chrono::milliseconds>(nextTick - std::chrono::steady_clock::now()).count();
+        backend->Poll((int)std::clamp<long long>(untilTick, 0, RELAY_IDLE_POLL_MS), callbacks);
+    }
+
+    total.sent += interval.sent;
+    total.delivered += interval.delivered;
+    total.corrupt += interval.corrupt;
+    total.outOfOrder += interval.outOfOrder;
+    total.reconnects += interval.reconnects;
+
+    stopRequested = true;
+    if (relayThread.joinable())
+    {
+        relayThread.join();
+    }
+
+    const bool passed = total.corrupt == 0 && total.outOfOrder == 0 && total.delivered > 0;
+    logLine(passed ? "info" : "error", std::string("soak ") + (passed ? "passed" : "FAILED") + ": sent "
+        + std::to_string(total.sent) + ", delivered " + std::to_string(total.delivered) + ", corrupt "
+        + std::to_string(total.corrupt) + ", out of order " + std::to_string(total.outOfOrder) + ", reconnects "
+        + std::to_string(total.reconnects));
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    RelayOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    if (options.role == "soak")
+    {
+        return runSoak(options);
+    }
+    return runRelay(options);
+}